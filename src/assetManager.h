@@ -0,0 +1,613 @@
+#pragma once
+
+#include "fileIO.h"
+#include "traceRecorder.h"
+#include "jobSystem.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cwctype>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+template<typename T> class assetHandle;
+
+// Loads meshes, sprites, sounds, anything with a loader set for its type, and shares
+// them. Load() hands back a refcounted assetHandle straight away and the file is
+// read by a job on the engine's job system, so many assets load at once while the
+// caller gets on with something else. Waiting for an asset runs jobs meanwhile, so
+// loads finish even with no workers. A thread waiting on other jobs can pick up a
+// load too, so a big one asked for mid frame can hold that frame up.
+//
+// The same asset is only ever loaded once. A path already asked for gets the asset
+// it was loaded as, without touching the disk. A new path whose file is the same
+// size as one already loaded is hashed, along with that one, so a copy of a file
+// loaded under another name shares it instead of being loaded again. Files of a
+// size nothing else has are only read by their loader.
+//
+// An asset nothing holds a handle to stays loaded, in case it is wanted again, until
+// the total size of everything loaded goes over the budget. Then the assets that
+// have gone unused longest are freed until it fits again. Assets that are in use
+// are never freed, so the budget can be overrun while they are all wanted. Nor are
+// assets pinned by something that can't hold a handle, see assetHandle::Pin().
+//
+// Handles can be copied and dropped from any thread, but loaders are set up front
+// and every handle must be gone before the manager is. A loader mustn't wait for
+// another asset, the wait would be for its own job as well.
+class assetManager
+{
+public:
+	enum { LOADING, READY, FAILED };
+
+	struct sAsset
+	{
+		std::atomic<int> nRefs = 0;		// Handles, plus one for each asset forwarding here
+		std::atomic<int> nState = LOADING;
+		std::atomic<int> nPins = 0;		// Users without a handle, such as voices on the audio thread
+		sAsset* pShared = nullptr;		// Set when the file turned out to match this asset, which is then only a forward
+		void* pData = nullptr;
+		int nType = 0;
+		int nId = 0;
+		size_t nBytes = 0;
+		uint64_t nSize = 0;				// Of the file
+		uint64_t nHash = 0;				// Of the file, once another the same size has been asked for
+		bool bHashed = false;
+		uint64_t nLastUsed = 0;
+		std::wstring sFile;				// Read from here, the first path it was asked for by
+		std::vector<std::wstring> vecPaths;	// Every path that finds it, normalised
+	};
+
+	// The job system must outlive the manager
+	assetManager(jobSystem& jobs, size_t nBudgetBytes = (size_t)256 << 20) : m_jobs(jobs)
+	{
+		m_nBudget = nBudgetBytes;
+	}
+
+	~assetManager()
+	{
+		m_jobs.Wait(m_loads);
+
+		for (sAsset* pAsset : m_vecAssets)
+			Free(pAsset);
+	}
+
+	assetManager(const assetManager&) = delete;
+	assetManager& operator=(const assetManager&) = delete;
+
+	// fnLoad(const std::wstring& sFile, T& asset, size_t& nBytes) fills in a default
+	// constructed T from the file and how much memory it takes, false if it couldn't
+	template<typename T, typename F>
+	void SetLoader(F fnLoad)
+	{
+		int nType = AssetType<T>();
+		std::unique_lock<std::mutex> lm(m_mux);
+		if ((int)m_vecLoaders.size() <= nType)
+			m_vecLoaders.resize(nType + 1);
+		m_vecLoaders[nType].fnLoad = [fnLoad](const std::wstring& sFile, size_t& nBytes) -> void*
+		{
+			T* pAsset = new T();
+			if (fnLoad(sFile, *pAsset, nBytes))
+				return pAsset;
+			delete pAsset;
+			return nullptr;
+		};
+		m_vecLoaders[nType].pfnDelete = [](void* p) { delete (T*)p; };
+	}
+
+	// Starts loading sFile as a T if it isn't already. The handle fails if there is
+	// no loader for T
+	template<typename T>
+	assetHandle<T> Load(const std::wstring& sFile)
+	{
+		int nType = AssetType<T>();
+		std::wstring sKey = Normalise(sFile, nType);
+
+		std::unique_lock<std::mutex> lm(m_mux);
+		auto it = m_mapPaths.find(sKey);
+		if (it != m_mapPaths.end())
+		{
+			it->second->nRefs++;
+			return assetHandle<T>(this, it->second);
+		}
+
+		sAsset* pAsset = new sAsset();
+		pAsset->nType = nType;
+		pAsset->nId = ++m_nNextId;
+		pAsset->sFile = sFile;
+		pAsset->nRefs = 1;
+		m_vecAssets.push_back(pAsset);
+		if (nType >= (int)m_vecLoaders.size() || !m_vecLoaders[nType].fnLoad)
+		{
+			pAsset->nState = FAILED;
+			return assetHandle<T>(this, pAsset);
+		}
+
+		pAsset->vecPaths.push_back(sKey);
+		m_mapPaths[sKey] = pAsset;
+		m_queueLoads.push_back(pAsset);
+		m_nLoading++;
+		lm.unlock();
+		m_jobs.Submit(&assetManager::LoadJob, this, 0, 1, m_loads);
+		return assetHandle<T>(this, pAsset);
+	}
+
+	// Load() and wait for it
+	template<typename T>
+	assetHandle<T> LoadNow(const std::wstring& sFile)
+	{
+		assetHandle<T> handle = Load<T>(sFile);
+		handle.Wait();
+		return handle;
+	}
+
+	// Until every load asked for so far has finished
+	void WaitAll()
+	{
+		m_jobs.Wait(m_loads);
+	}
+
+	// Frees unused assets straight away if they are already over
+	void SetBudget(size_t nBytes)
+	{
+		std::unique_lock<std::mutex> lm(m_mux);
+		m_nBudget = nBytes;
+		Trim();
+	}
+
+	size_t Budget() { return m_nBudget; }
+	size_t BytesLoaded() { std::unique_lock<std::mutex> lm(m_mux); return m_nBytes; }
+	int AssetCount() { std::unique_lock<std::mutex> lm(m_mux); return (int)m_vecAssets.size(); }
+	int LoadingCount() { std::unique_lock<std::mutex> lm(m_mux); return m_nLoading; }
+	int SharedCount() { return m_nShared; }		// Loads that found a copy of a file already loaded
+	int EvictedCount() { return m_nEvicted; }
+
+	// Every load is recorded on this timeline while it is recording
+	void SetTrace(traceRecorder* pTrace)
+	{
+		m_pTrace = pTrace;
+	}
+
+private:
+	template<typename U> friend class assetHandle;
+
+	struct sLoader
+	{
+		std::function<void* (const std::wstring&, size_t&)> fnLoad;
+		void (*pfnDelete)(void*) = nullptr;
+	};
+
+	// Asset types are numbered the first time each is used, for every manager, from
+	// whichever thread uses them first
+	static std::atomic<int>& AssetTypeCount()
+	{
+		static std::atomic<int> nCount(0);
+		return nCount;
+	}
+
+	template<typename T>
+	static int AssetType()
+	{
+		static const int nType = AssetTypeCount()++;
+		return nType;
+	}
+
+	// Paths are compared without case or slash direction, and only against assets of the same type
+	static std::wstring Normalise(const std::wstring& sFile, int nType)
+	{
+		std::wstring sKey = std::to_wstring(nType) + L':';
+		for (wchar_t c : sFile)
+			sKey += c == L'/' ? L'\\' : (wchar_t)std::towlower(c);
+		return sKey;
+	}
+
+	// False if it can't be opened
+	static bool FileSize(const std::wstring& sFile, uint64_t& nSize)
+	{
+		std::FILE* f = fileIO::OpenFile(sFile, L"rb");
+		if (f == nullptr)
+			return false;
+
+#if defined(_WIN32)
+		bool bOk = _fseeki64(f, 0, SEEK_END) == 0;
+		int64_t nEnd = _ftelli64(f);
+#else
+		bool bOk = fseeko(f, 0, SEEK_END) == 0;
+		int64_t nEnd = (int64_t)ftello(f);
+#endif
+		std::fclose(f);
+		nSize = (uint64_t)nEnd;
+		return bOk && nEnd >= 0;
+	}
+
+	// 64-bit FNV-1a of the whole file, false if it can't be read
+	static bool HashFile(const std::wstring& sFile, uint64_t& nHash)
+	{
+		std::FILE* f = fileIO::OpenFile(sFile, L"rb");
+		if (f == nullptr)
+			return false;
+
+		nHash = 14695981039346656037ull;
+		uint8_t buffer[65536];
+		size_t nRead;
+		while ((nRead = std::fread(buffer, 1, sizeof(buffer), f)) > 0)
+			for (size_t i = 0; i < nRead; i++)
+				nHash = (nHash ^ buffer[i]) * 1099511628211ull;
+		std::fclose(f);
+		return true;
+	}
+
+	// Game or any thread, from the last handle going. Only ever under m_mux, so the
+	// count can't reach zero while Load() is finding the asset
+	void Release(sAsset* pAsset)
+	{
+		std::unique_lock<std::mutex> lm(m_mux);
+		ReleaseLocked(pAsset);
+		Trim();
+	}
+
+	void ReleaseLocked(sAsset* pAsset)
+	{
+		if (--pAsset->nRefs == 0)
+			Unused(pAsset);
+	}
+
+	// Nothing holds the asset any more. Forwards and failures have nothing worth
+	// keeping, anything else waits for Trim(). Under m_mux
+	void Unused(sAsset* pAsset)
+	{
+		pAsset->nLastUsed = ++m_nTick;
+		if (pAsset->nState == LOADING)
+			return;
+		if (pAsset->pShared != nullptr)
+		{
+			sAsset* pShared = pAsset->pShared;
+			Remove(pAsset);
+			ReleaseLocked(pShared);
+		}
+		else if (pAsset->nState == FAILED)
+			Remove(pAsset);
+	}
+
+	// Least recently used assets nothing holds go until everything fits in the budget
+	void Trim()
+	{
+		while (m_nBytes > m_nBudget)
+		{
+			sAsset* pOldest = nullptr;
+			for (sAsset* pAsset : m_vecAssets)
+				if (pAsset->nRefs == 0 && pAsset->nPins == 0 && pAsset->nState == READY && pAsset->pShared == nullptr && (pOldest == nullptr || pAsset->nLastUsed < pOldest->nLastUsed))
+					pOldest = pAsset;
+			if (pOldest == nullptr)
+				return;
+
+			Remove(pOldest);
+			m_nEvicted++;
+		}
+	}
+
+	// Out of every table and freed, under m_mux
+	void Remove(sAsset* pAsset)
+	{
+		for (const std::wstring& sKey : pAsset->vecPaths)
+			m_mapPaths.erase(sKey);
+		ForgetSize(pAsset);
+		m_nBytes -= pAsset->nBytes;
+
+		m_vecAssets.erase(std::find(m_vecAssets.begin(), m_vecAssets.end(), pAsset));
+		Free(pAsset);
+	}
+
+	void Free(sAsset* pAsset)
+	{
+		if (pAsset->pData != nullptr)
+			m_vecLoaders[pAsset->nType].pfnDelete(pAsset->pData);
+		delete pAsset;
+	}
+
+	// Assets of a type whose files are the same size, the only ones that can be copies of each other
+	static uint64_t SizeKey(sAsset* pAsset)
+	{
+		return pAsset->nSize ^ ((uint64_t)pAsset->nType * 0x9E3779B97F4A7C15ull);
+	}
+
+	// Under m_mux
+	void ForgetSize(sAsset* pAsset)
+	{
+		auto range = m_mapSizes.equal_range(SizeKey(pAsset));
+		for (auto it = range.first; it != range.second; ++it)
+		{
+			if (it->second == pAsset)
+			{
+				m_mapSizes.erase(it);
+				return;
+			}
+		}
+	}
+
+	// One per Load(), each takes whichever load has waited longest
+	static void LoadJob(void* pContext, int, int)
+	{
+		assetManager* pManager = (assetManager*)pContext;
+		sAsset* pAsset;
+		{
+			std::unique_lock<std::mutex> lm(pManager->m_mux);
+			pAsset = pManager->m_queueLoads.front();
+			pManager->m_queueLoads.pop_front();
+		}
+
+		// A load works to its own timing whichever thread runs it, so what it allocates
+		// isn't the frame's, see frameArena.h
+		bool bCounted = frameArenaHeapCheckThread();
+		frameArenaHeapCheckThread() = false;
+
+		traceRecorder* pTrace = pManager->m_pTrace;
+		int64_t nStart = pTrace != nullptr && pTrace->IsRecording() ? traceRecorder::Now() : 0;
+		pManager->LoadAsset(pAsset);
+		if (nStart != 0)
+			pTrace->Record("Load asset", nStart, traceRecorder::Now());
+		frameArenaHeapCheckThread() = bCounted;
+
+		std::unique_lock<std::mutex> lm(pManager->m_mux);
+		pManager->m_nLoading--;
+	}
+
+	// Already in the table with the same type, size and hash, or nullptr. Under m_mux
+	sAsset* FindCopy(sAsset* pAsset)
+	{
+		auto range = m_mapSizes.equal_range(SizeKey(pAsset));
+		for (auto it = range.first; it != range.second; ++it)
+		{
+			sAsset* pOther = it->second;
+			if (pOther->nType == pAsset->nType && pOther->nSize == pAsset->nSize && pOther->bHashed && pOther->nHash == pAsset->nHash)
+				return pOther;
+		}
+		return nullptr;
+	}
+
+	void LoadAsset(sAsset* pAsset)
+	{
+		uint64_t nSize = 0;
+		bool bReadable = FileSize(pAsset->sFile, nSize);
+
+		// Only load jobs set pShared or state, and each asset is loaded by one of them
+		std::unique_lock<std::mutex> lm(m_mux);
+		pAsset->nSize = nSize;
+		bool bAlone = true;
+		std::vector<std::wstring> vecUnhashed;
+		auto range = m_mapSizes.equal_range(SizeKey(pAsset));
+		for (auto it = range.first; it != range.second; ++it)
+		{
+			if (it->second->nType == pAsset->nType && it->second->nSize == nSize)
+			{
+				bAlone = false;
+				if (!it->second->bHashed)
+					vecUnhashed.push_back(it->second->sFile);
+			}
+		}
+
+		// Only worth reading the file for a hash when something else is the same size,
+		// and then the others that weren't hashed yet need one too
+		if (bReadable && !bAlone)
+		{
+			lm.unlock();
+			uint64_t nHash = 0;
+			bReadable = HashFile(pAsset->sFile, nHash);
+			std::vector<uint64_t> vecHashes(vecUnhashed.size(), 0);
+			std::vector<bool> vecHashed(vecUnhashed.size(), false);
+			for (size_t i = 0; i < vecUnhashed.size(); i++)
+				vecHashed[i] = HashFile(vecUnhashed[i], vecHashes[i]);
+			lm.lock();
+
+			// Any of the others that went meanwhile aren't in the table to be found
+			range = m_mapSizes.equal_range(SizeKey(pAsset));
+			for (auto it = range.first; it != range.second; ++it)
+			{
+				for (size_t i = 0; i < vecUnhashed.size() && !it->second->bHashed; i++)
+				{
+					if (vecHashed[i] && it->second->sFile == vecUnhashed[i])
+					{
+						it->second->nHash = vecHashes[i];
+						it->second->bHashed = true;
+					}
+				}
+			}
+			pAsset->nHash = nHash;
+			pAsset->bHashed = bReadable;
+		}
+
+		if (!bReadable)
+		{
+			Failed(pAsset);
+			return;
+		}
+
+		sAsset* pShared = bAlone ? nullptr : FindCopy(pAsset);
+		if (pShared != nullptr)
+		{
+			// A copy of something loaded or loading already, its paths find that from now on
+			pShared->nRefs++;
+			for (const std::wstring& sKey : pAsset->vecPaths)
+			{
+				m_mapPaths[sKey] = pShared;
+				pShared->vecPaths.push_back(sKey);
+			}
+			pAsset->vecPaths.clear();
+			pAsset->pShared = pShared;
+			pAsset->nState = READY;
+			m_nShared++;
+			if (pAsset->nRefs == 0)
+				Unused(pAsset);
+			return;
+		}
+		m_mapSizes.insert({ SizeKey(pAsset), pAsset });
+		lm.unlock();
+
+		size_t nBytes = 0;
+		void* pData = m_vecLoaders[pAsset->nType].fnLoad(pAsset->sFile, nBytes);
+
+		lm.lock();
+		if (pData == nullptr)
+		{
+			Failed(pAsset);
+			return;
+		}
+		pAsset->pData = pData;
+		pAsset->nBytes = nBytes;
+		pAsset->nLastUsed = ++m_nTick;
+		m_nBytes += nBytes;
+		pAsset->nState = READY;
+		Trim();
+	}
+
+	// Under m_mux. Another Load() of the path tries the file again, and if nothing
+	// holds this one it is gone
+	void Failed(sAsset* pAsset)
+	{
+		for (const std::wstring& sKey : pAsset->vecPaths)
+			m_mapPaths.erase(sKey);
+		pAsset->vecPaths.clear();
+		ForgetSize(pAsset);
+		pAsset->nState = FAILED;
+		if (pAsset->nRefs == 0)
+			Unused(pAsset);
+	}
+
+	// Following forwards, the asset holding the data
+	static sAsset* Resolve(sAsset* pAsset)
+	{
+		while (pAsset->nState.load(std::memory_order_acquire) != LOADING && pAsset->pShared != nullptr)
+			pAsset = pAsset->pShared;
+		return pAsset;
+	}
+
+	// Runs jobs, loads or otherwise, until the asset is done. The counter is every
+	// load's, so this can return later than it needs to but never early
+	void Wait(sAsset* pAsset)
+	{
+		while (Resolve(pAsset)->nState.load(std::memory_order_acquire) == LOADING)
+			m_jobs.Wait(m_loads);
+	}
+
+	jobSystem& m_jobs;
+	jobCounter m_loads;				// Load jobs not yet finished
+
+	std::mutex m_mux;
+
+	std::vector<sLoader> m_vecLoaders;
+	std::vector<sAsset*> m_vecAssets;	// Everything loaded, loading or failed and still held
+	std::unordered_map<std::wstring, sAsset*> m_mapPaths;
+	std::unordered_multimap<uint64_t, sAsset*> m_mapSizes;	// By SizeKey(), forwards and failures aren't in it
+	std::deque<sAsset*> m_queueLoads;
+	int m_nLoading = 0;
+	int m_nNextId = 0;
+	uint64_t m_nTick = 0;
+
+	size_t m_nBudget = 0;
+	size_t m_nBytes = 0;
+	std::atomic<int> m_nShared = 0;
+	std::atomic<int> m_nEvicted = 0;
+	std::atomic<traceRecorder*> m_pTrace = nullptr;
+};
+
+// A counted reference to an asset of an assetManager. The asset stays loaded while
+// any handle to it is alive; the handle may be taken before it has finished
+// loading, Get() is nullptr until IsReady() and for good if Failed()
+template<typename T>
+class assetHandle
+{
+public:
+	assetHandle()
+	{
+
+	}
+
+	assetHandle(const assetHandle& other) : m_pManager(other.m_pManager), m_pAsset(other.m_pAsset)
+	{
+		if (m_pAsset != nullptr)
+			m_pAsset->nRefs++;
+	}
+
+	assetHandle(assetHandle&& other) noexcept : m_pManager(other.m_pManager), m_pAsset(other.m_pAsset)
+	{
+		other.m_pManager = nullptr;
+		other.m_pAsset = nullptr;
+	}
+
+	assetHandle& operator=(assetHandle other)
+	{
+		std::swap(m_pManager, other.m_pManager);
+		std::swap(m_pAsset, other.m_pAsset);
+		return *this;
+	}
+
+	~assetHandle()
+	{
+		Reset();
+	}
+
+	void Reset()
+	{
+		if (m_pAsset != nullptr)
+			m_pManager->Release(m_pAsset);
+		m_pManager = nullptr;
+		m_pAsset = nullptr;
+	}
+
+	bool IsValid() const { return m_pAsset != nullptr; }
+	bool IsReady() const { return m_pAsset != nullptr && State() == assetManager::READY; }
+	bool Failed() const { return m_pAsset == nullptr || State() == assetManager::FAILED; }
+
+	// Blocks until the asset has loaded or failed to
+	void Wait() const
+	{
+		if (m_pAsset != nullptr)
+			m_pManager->Wait(m_pAsset);
+	}
+
+	T* Get() const
+	{
+		if (!IsReady())
+			return nullptr;
+		return (T*)assetManager::Resolve(m_pAsset)->pData;
+	}
+
+	T* operator->() const { return Get(); }
+	T& operator*() const { return *Get(); }
+
+	// Same for every handle to the same data, whichever path it was loaded by
+	int Id() const { return m_pAsset != nullptr ? assetManager::Resolve(m_pAsset)->nId : 0; }
+
+	// Keeps the data from being freed after every handle has gone, for a user that
+	// mustn't take the manager's lock to let go of it, such as the audio thread. It
+	// lets go by decrementing the count this returns. nullptr unless IsReady()
+	std::atomic<int>* Pin() const
+	{
+		if (!IsReady())
+			return nullptr;
+		std::atomic<int>* pPins = &assetManager::Resolve(m_pAsset)->nPins;
+		(*pPins)++;
+		return pPins;
+	}
+
+private:
+	friend class assetManager;
+
+	assetHandle(assetManager* pManager, assetManager::sAsset* pAsset) : m_pManager(pManager), m_pAsset(pAsset)
+	{
+
+	}
+
+	int State() const
+	{
+		return assetManager::Resolve(m_pAsset)->nState.load(std::memory_order_acquire);
+	}
+
+	assetManager* m_pManager = nullptr;
+	assetManager::sAsset* m_pAsset = nullptr;
+};
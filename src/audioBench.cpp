@@ -0,0 +1,233 @@
+/*
+Measures how fast the engine's audio path runs and how long a sound takes to be
+heard, without a sound card, so it can be run on any build machine.
+
+This is a separate program from the demo, build it on its own:
+
+	cl /O2 /EHsc /std:c++17 audioBench.cpp
+	g++ -O2 -std=c++17 audioBench.cpp -o audioBench -lpthread
+
+Usage:
+
+	audioBench [sample.wav] [voices] [blocks]
+
+The sample (default a generated 22050Hz tone) is resampled to 44100Hz like
+LoadAudioSample() does, then the given number of voices (default 64) play it on
+a loop while an audio thread mixes, clips and submits the given number of blocks
+(default 20000) to an unpaced nullAudioSink, as AudioThread() does. A .wav file
+is also played as a stream from disk alongside them. That gives the mix time per
+block and how many times faster than real time the audio thread is.
+
+Latency is then measured against a real time nullAudioSink with the engine's
+default 8 blocks of 512 samples: the time from Play() to the first submitted
+block that has the sound in it, plus the blocks already queued ahead of it in
+the device, which is what a sound card would add.
+*/
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define CGE_SSE2 1
+#endif
+
+#include "wavFile.h"
+#include "wavStream.h"
+#include "audioResampler.h"
+#include "audioMixer.h"
+#include "audioSink.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+using namespace std;
+
+static const unsigned int nSampleRate = 44100;
+static const unsigned int nChannels = 1;
+
+// The engine's audio thread, mixing into whatever sink it is given until it has
+// submitted nBlocks, or forever if nBlocks is 0 and bStop is set
+struct sAudioThread
+{
+	audioMixer mixer;
+	audioSink* pSink = nullptr;
+	unsigned int nBlockSamples = 512;
+	atomic<bool> bStop{ false };
+
+	double fMixSeconds = 0.0;
+	unsigned int nBlocksMixed = 0;
+
+	// Set when a block with anything but silence in it is submitted
+	atomic<bool> bHeard{ false };
+	chrono::steady_clock::time_point tpHeard;
+
+	void Run(unsigned int nBlocks)
+	{
+		vector<float> vecMix(nBlockSamples);
+		float fMaxSample = 32767.0f;
+
+		while (!bStop && (nBlocks == 0 || nBlocksMixed < nBlocks))
+		{
+			short* pBlock = pSink->AcquireBlock();
+			if (pBlock == nullptr)
+				break;
+
+			auto tpMixStart = chrono::steady_clock::now();
+			fill(vecMix.begin(), vecMix.end(), 0.0f);
+			mixer.MixBlock(vecMix.data(), nBlockSamples / nChannels, nChannels);
+
+			unsigned int n = 0;
+#if defined(CGE_SSE2)
+			__m128 vMax = _mm_set1_ps(1.0f), vMin = _mm_set1_ps(-1.0f), vScale = _mm_set1_ps(fMaxSample);
+			for (; n + 8 <= nBlockSamples; n += 8)
+			{
+				__m128 a = _mm_mul_ps(_mm_max_ps(_mm_min_ps(_mm_loadu_ps(&vecMix[n]), vMax), vMin), vScale);
+				__m128 b = _mm_mul_ps(_mm_max_ps(_mm_min_ps(_mm_loadu_ps(&vecMix[n + 4]), vMax), vMin), vScale);
+				_mm_storeu_si128((__m128i*)(pBlock + n), _mm_packs_epi32(_mm_cvttps_epi32(a), _mm_cvttps_epi32(b)));
+			}
+#endif
+			for (; n < nBlockSamples; n++)
+				pBlock[n] = (short)((std::max)(-1.0f, (std::min)(vecMix[n], 1.0f)) * fMaxSample);
+
+			fMixSeconds += chrono::duration<double>(chrono::steady_clock::now() - tpMixStart).count();
+			nBlocksMixed++;
+
+			if (!bHeard)
+			{
+				for (unsigned int i = 0; i < nBlockSamples; i++)
+				{
+					if (pBlock[i] != 0)
+					{
+						tpHeard = chrono::steady_clock::now();
+						bHeard = true;
+						break;
+					}
+				}
+			}
+
+			pSink->SubmitBlock();
+		}
+	}
+};
+
+int main(int argc, char* argv[])
+{
+	string sFile = argc > 1 ? argv[1] : "";
+	int nVoices = argc > 2 ? atoi(argv[2]) : 64;
+	unsigned int nBlocks = argc > 3 ? (unsigned int)atoi(argv[3]) : 20000;
+	wstring sWideFile(sFile.begin(), sFile.end());
+
+	// The sample, decoded from the file or a generated tone
+	vector<float> vecSource;
+	unsigned int nSourceRate = 22050;
+	int nSourceChannels = 1;
+	wavFile file;
+	if (!sFile.empty())
+	{
+		if (!file.Open(sWideFile))
+		{
+			cerr << "Can't read " << sFile << endl;
+			return 1;
+		}
+		nSourceRate = file.SampleRate();
+		nSourceChannels = file.Channels();
+		vecSource.resize((size_t)file.Frames() * nSourceChannels);
+		file.Decode(0, file.Frames(), vecSource.data());
+	}
+	else
+	{
+		vecSource.resize(nSourceRate);
+		for (size_t i = 0; i < vecSource.size(); i++)
+			vecSource[i] = 0.25f * (float)sin(2.0 * 3.14159265358979 * 440.0 * (double)i / (double)nSourceRate);
+	}
+	long nSourceFrames = (long)(vecSource.size() / nSourceChannels);
+
+	// Resample it to the output rate in one go, as LoadAudioSample() does
+	audioResampler resampler;
+	resampler.Setup(nSourceRate, nSampleRate, nSourceChannels);
+	vector<float> vecSample((size_t)resampler.OutputFrames(nSourceFrames) * nSourceChannels);
+	long nCursor = 0;
+	auto tpResampleStart = chrono::steady_clock::now();
+	int nSampleFrames = resampler.Process(vecSample.data(), (int)(vecSample.size() / nSourceChannels), [&](float* pDecoded, int nWanted)
+		{
+			int n = (int)(std::min)((long)nWanted, nSourceFrames - nCursor);
+			memcpy(pDecoded, &vecSource[(size_t)nCursor * nSourceChannels], sizeof(float) * n * nSourceChannels);
+			nCursor += n;
+			return n;
+		});
+	double fResampleSeconds = chrono::duration<double>(chrono::steady_clock::now() - tpResampleStart).count();
+	printf("Resample %ldHz -> %uHz: %ld frames in %.2f ms, %.0fx real time\n", (long)nSourceRate, nSampleRate, nSourceFrames,
+		fResampleSeconds * 1000.0, ((double)nSourceFrames / nSourceRate) / (std::max)(fResampleSeconds, 1e-9));
+
+	// Throughput, the sink never waits so the audio thread runs flat out
+	{
+		nullAudioSink sink(false);
+		sAudioThread audio;
+		audio.pSink = &sink;
+		sink.Open(nSampleRate, nChannels, 8, audio.nBlockSamples);
+
+		for (int i = 0; i < nVoices; i++)
+			audio.mixer.Play(i + 1, vecSample.data(), nSampleFrames, nSourceChannels, true);
+
+		wavStream stream;
+		bool bStream = !sFile.empty() && stream.Open(sWideFile, nSampleRate);
+		if (bStream)
+			audio.mixer.PlayStream(&stream, true);
+
+		auto tpStart = chrono::steady_clock::now();
+		thread t(&sAudioThread::Run, &audio, nBlocks);
+		t.join();
+		double fSeconds = chrono::duration<double>(chrono::steady_clock::now() - tpStart).count();
+		sink.Close();
+
+		double fBlockSeconds = (double)(audio.nBlockSamples / nChannels) / nSampleRate;
+		double fMixPerBlock = audio.fMixSeconds / (std::max)(audio.nBlocksMixed, 1u);
+		printf("Mix %d voices%s: %u blocks of %u samples, %.2f us per block, %.0fx real time (%.2f s wall)\n",
+			nVoices, bStream ? " and a stream" : "", audio.nBlocksMixed, audio.nBlockSamples,
+			fMixPerBlock * 1e6, fBlockSeconds / (std::max)(fMixPerBlock, 1e-12), fSeconds);
+		printf("Voices playing at the end: %d, dropped: %d\n", audio.mixer.ActiveVoices(), audio.mixer.DroppedVoices());
+	}
+
+	// Latency, a paced sink with the engine's default buffering
+	{
+		const unsigned int nDeviceBlocks = 8;
+		const int nTrials = 20;
+		double fMin = 1e9, fMax = 0.0, fTotal = 0.0;
+
+		for (int nTrial = 0; nTrial < nTrials; nTrial++)
+		{
+			nullAudioSink sink(true);
+			sAudioThread audio;
+			audio.pSink = &sink;
+			sink.Open(nSampleRate, nChannels, nDeviceBlocks, audio.nBlockSamples);
+			thread t(&sAudioThread::Run, &audio, 0);
+
+			// Land the Play() at a different point in the block each time
+			this_thread::sleep_for(chrono::microseconds(5000 + nTrial * 577));
+			auto tpPlay = chrono::steady_clock::now();
+			audio.mixer.Play(1, vecSample.data(), nSampleFrames, nSourceChannels, false);
+			while (!audio.bHeard)
+				this_thread::sleep_for(chrono::microseconds(100));
+
+			audio.bStop = true;
+			t.join();
+			sink.Close();
+
+			// A device plays the blocks queued ahead of this one first
+			double fBlockSeconds = (double)(audio.nBlockSamples / nChannels) / nSampleRate;
+			double fLatency = chrono::duration<double>(audio.tpHeard - tpPlay).count() + (nDeviceBlocks - 1) * fBlockSeconds;
+			fMin = (std::min)(fMin, fLatency);
+			fMax = (std::max)(fMax, fLatency);
+			fTotal += fLatency;
+		}
+
+		printf("Latency over %d plays, %u blocks of 512 samples: min %.1f ms, mean %.1f ms, max %.1f ms\n",
+			nTrials, nDeviceBlocks, fMin * 1000.0, fTotal / nTrials * 1000.0, fMax * 1000.0);
+	}
+
+	return 0;
+}
@@ -0,0 +1,334 @@
+#pragma once
+
+#include "spscQueue.h"
+
+#include <atomic>
+#include <cstring>
+#include <algorithm>
+
+#if defined(CGE_SSE2)
+#include <emmintrin.h>
+#endif
+
+// A sound that makes its frames as it plays instead of sitting in memory, such as a
+// long music track decoded straight from disk. Rewind() and Read() are only called
+// on the audio thread and must not block or allocate.
+class audioStreamSource
+{
+public:
+	virtual ~audioStreamSource()
+	{
+
+	}
+
+	virtual int Channels() = 0;
+	virtual void Rewind() = 0;
+
+	// Returns frames written, fewer than nFrames once the end is reached
+	virtual int Read(float* pFrames, int nFrames) = 0;
+};
+
+// Block based sample mixer. Playing sounds live in a fixed pool of voices, and each
+// block every active voice adds a contiguous run of its sample data straight into
+// the output, four floats at a time where SSE2 is available. Cost per block is one
+// pass over the block per voice, with no per-sample bookkeeping.
+//
+// The game thread never touches the voices. PlaySample()/StopSample() push commands
+// onto a lock-free queue that the audio thread drains at the start of each block,
+// so only the audio thread ever reads or writes the pool.
+class audioMixer
+{
+public:
+	static const int nMaxVoices = 256;
+	static const int nMaxStreamChannels = 8;
+
+	struct sCommand
+	{
+		enum { PLAY, STOP, STOP_ALL } nType = PLAY;
+		int nSampleID = 0;
+		audioStreamSource* pStream = nullptr;	// Streams are played and stopped by pointer, not ID
+		const float* pData = nullptr;	// Interleaved sample frames, owned by the caller
+		long nFrames = 0;
+		int nChannels = 0;
+		bool bLoop = false;
+		std::atomic<int>* pPin = nullptr;	// Decremented when the voice finishes, or if it never starts
+	};
+
+	audioMixer()
+	{
+		for (int i = 0; i < nMaxVoices; i++)
+			m_nActive[i] = i;
+	}
+
+	// Game thread ==========================================================================
+
+	// pData must stay valid for as long as the sound might be playing. If pPin is
+	// given it is decremented once the mixer is done with pData, however the voice ends
+	bool Play(int nSampleID, const float* pData, long nFrames, int nChannels, bool bLoop, std::atomic<int>* pPin = nullptr)
+	{
+		sCommand cmd;
+		cmd.nType = sCommand::PLAY;
+		cmd.nSampleID = nSampleID;
+		cmd.pData = pData;
+		cmd.nFrames = nFrames;
+		cmd.nChannels = nChannels;
+		cmd.bLoop = bLoop;
+		cmd.pPin = pPin;
+		if (m_queueCommands.Push(cmd))
+			return true;
+		Unpin(pPin);
+		return false;
+	}
+
+	// A stream can only play once at a time, playing it again restarts it.
+	// pStream must outlive the mixer
+	bool PlayStream(audioStreamSource* pStream, bool bLoop)
+	{
+		sCommand cmd;
+		cmd.nType = sCommand::PLAY;
+		cmd.pStream = pStream;
+		cmd.nChannels = pStream->Channels();
+		cmd.bLoop = bLoop;
+		return m_queueCommands.Push(cmd);
+	}
+
+	bool StopStream(audioStreamSource* pStream)
+	{
+		sCommand cmd;
+		cmd.nType = sCommand::STOP;
+		cmd.pStream = pStream;
+		return m_queueCommands.Push(cmd);
+	}
+
+	// Stops every voice playing nSampleID
+	bool Stop(int nSampleID)
+	{
+		sCommand cmd;
+		cmd.nType = sCommand::STOP;
+		cmd.nSampleID = nSampleID;
+		return m_queueCommands.Push(cmd);
+	}
+
+	bool StopAll()
+	{
+		sCommand cmd;
+		cmd.nType = sCommand::STOP_ALL;
+		return m_queueCommands.Push(cmd);
+	}
+
+	// Audio thread =========================================================================
+
+	// Overwrites pOut with nFrames interleaved frames of nOutChannels. A source with
+	// fewer channels than the output repeats its last channel into the rest
+	void MixBlock(float* pOut, int nFrames, int nOutChannels)
+	{
+		ProcessCommands();
+		memset(pOut, 0, sizeof(float) * nFrames * nOutChannels);
+
+		int v = 0;
+		while (v < m_nActiveVoices)
+		{
+			sVoice& voice = m_voices[m_nActive[v]];
+			if (voice.pStream != nullptr)
+			{
+				if (MixStream(voice, pOut, nFrames, nOutChannels))
+					v++;
+				else
+					Release(v);
+				continue;
+			}
+
+			int nDone = 0;
+			while (nDone < nFrames)
+			{
+				long nRun = (std::min)((long)(nFrames - nDone), voice.nFrames - voice.nPosition);
+				const float* pSrc = voice.pData + voice.nPosition * voice.nChannels;
+				float* pDst = pOut + nDone * nOutChannels;
+
+				if (voice.nChannels == nOutChannels)
+					Accumulate(pDst, pSrc, (int)nRun * nOutChannels);
+				else
+					AccumulateRemapped(pDst, nOutChannels, pSrc, voice.nChannels, (int)nRun);
+
+				nDone += (int)nRun;
+				voice.nPosition += nRun;
+				if (voice.nPosition < voice.nFrames)
+					continue;
+
+				if (!voice.bLoop)
+					break;
+				voice.nPosition = 0;
+			}
+
+			if (voice.nPosition >= voice.nFrames && !voice.bLoop)
+				Release(v);
+			else
+				v++;
+		}
+	}
+
+	int ActiveVoices() { return m_nActiveVoices; }
+
+	// Play commands that arrived while every voice was busy
+	int DroppedVoices() { return m_nDropped; }
+
+private:
+	struct sVoice
+	{
+		int nSampleID = 0;
+		audioStreamSource* pStream = nullptr;
+		const float* pData = nullptr;
+		long nFrames = 0;
+		long nPosition = 0;
+		int nChannels = 0;
+		bool bLoop = false;
+		std::atomic<int>* pPin = nullptr;
+	};
+
+	void ProcessCommands()
+	{
+		sCommand cmd;
+		while (m_queueCommands.Pop(cmd))
+		{
+			switch (cmd.nType)
+			{
+			case sCommand::PLAY:
+			{
+				if (m_nActiveVoices == nMaxVoices)
+				{
+					m_nDropped++;
+					Unpin(cmd.pPin);
+					break;
+				}
+				if (cmd.pStream != nullptr)
+				{
+					if (cmd.nChannels <= 0 || cmd.nChannels > nMaxStreamChannels)
+						break;
+					StopMatching(cmd.pStream, 0);
+					cmd.pStream->Rewind();
+				}
+				else if (cmd.pData == nullptr || cmd.nFrames <= 0 || cmd.nChannels <= 0)
+				{
+					Unpin(cmd.pPin);
+					break;
+				}
+
+				// Free voices are the slots past the end of the active list
+				sVoice& voice = m_voices[m_nActive[m_nActiveVoices++]];
+				voice.nSampleID = cmd.nSampleID;
+				voice.pStream = cmd.pStream;
+				voice.pData = cmd.pData;
+				voice.nFrames = cmd.nFrames;
+				voice.nChannels = cmd.nChannels;
+				voice.nPosition = 0;
+				voice.bLoop = cmd.bLoop;
+				voice.pPin = cmd.pPin;
+				break;
+			}
+
+			case sCommand::STOP:
+				StopMatching(cmd.pStream, cmd.nSampleID);
+				break;
+
+			case sCommand::STOP_ALL:
+				while (m_nActiveVoices > 0)
+					Release(m_nActiveVoices - 1);
+				break;
+			}
+		}
+	}
+
+	// A stream if pStream is set, otherwise every in-memory voice of nSampleID
+	void StopMatching(audioStreamSource* pStream, int nSampleID)
+	{
+		int v = 0;
+		while (v < m_nActiveVoices)
+		{
+			sVoice& voice = m_voices[m_nActive[v]];
+			if (pStream != nullptr ? voice.pStream == pStream : (voice.pStream == nullptr && voice.nSampleID == nSampleID))
+				Release(v);
+			else
+				v++;
+		}
+	}
+
+	// Streams are read a chunk at a time into scratch memory, then mixed like any
+	// other voice. Returns false once a non-looping stream has finished
+	bool MixStream(sVoice& voice, float* pOut, int nFrames, int nOutChannels)
+	{
+		int nDone = 0;
+		bool bRewound = false;
+		while (nDone < nFrames)
+		{
+			int nWant = (std::min)(nFrames - nDone, (int)nScratchFrames);
+			int nGot = voice.pStream->Read(m_fScratch, nWant);
+			float* pDst = pOut + nDone * nOutChannels;
+
+			if (voice.nChannels == nOutChannels)
+				Accumulate(pDst, m_fScratch, nGot * nOutChannels);
+			else
+				AccumulateRemapped(pDst, nOutChannels, m_fScratch, voice.nChannels, nGot);
+			nDone += nGot;
+
+			if (nGot < nWant)
+			{
+				// An empty stream would rewind forever
+				if (!voice.bLoop || (nGot == 0 && bRewound))
+					return false;
+				voice.pStream->Rewind();
+				bRewound = true;
+			}
+			else
+				bRewound = false;
+		}
+		return true;
+	}
+
+	// Swap the voice at position v of the active list with the last active one
+	void Release(int v)
+	{
+		int nSlot = m_nActive[v];
+		Unpin(m_voices[nSlot].pPin);
+		m_voices[nSlot].pPin = nullptr;
+		m_nActiveVoices--;
+		m_nActive[v] = m_nActive[m_nActiveVoices];
+		m_nActive[m_nActiveVoices] = nSlot;
+	}
+
+	static void Unpin(std::atomic<int>* pPin)
+	{
+		if (pPin != nullptr)
+			pPin->fetch_sub(1, std::memory_order_release);
+	}
+
+	static void Accumulate(float* pDst, const float* pSrc, int n)
+	{
+		int i = 0;
+#if defined(CGE_SSE2)
+		for (; i + 8 <= n; i += 8)
+		{
+			_mm_storeu_ps(pDst + i, _mm_add_ps(_mm_loadu_ps(pDst + i), _mm_loadu_ps(pSrc + i)));
+			_mm_storeu_ps(pDst + i + 4, _mm_add_ps(_mm_loadu_ps(pDst + i + 4), _mm_loadu_ps(pSrc + i + 4)));
+		}
+#endif
+		for (; i < n; i++)
+			pDst[i] += pSrc[i];
+	}
+
+	static void AccumulateRemapped(float* pDst, int nDstChannels, const float* pSrc, int nSrcChannels, int nFrames)
+	{
+		for (int f = 0; f < nFrames; f++)
+			for (int c = 0; c < nDstChannels; c++)
+				pDst[f * nDstChannels + c] += pSrc[f * nSrcChannels + (std::min)(c, nSrcChannels - 1)];
+	}
+
+	sVoice m_voices[nMaxVoices];
+	int m_nActive[nMaxVoices] = { 0 };	// Voice slots, the first m_nActiveVoices are playing
+	int m_nActiveVoices = 0;
+	int m_nDropped = 0;
+
+	static const int nScratchFrames = 256;
+	float m_fScratch[nScratchFrames * nMaxStreamChannels];
+
+	spscQueue<sCommand, 1024> m_queueCommands;
+};
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+// Streaming sample rate converter using a Kaiser windowed sinc filter. The filter is
+// precomputed for nPhases fractional positions between two input frames, and the
+// two nearest phases are blended for positions in between. When converting down the
+// cutoff moves below the output Nyquist frequency so nothing folds back as aliasing.
+//
+// Input is pulled on demand from a source function, so the same converter works on
+// a sample that is already in memory and on a file being decoded as it plays:
+//
+//		int fnRead(float* pFrames, int nFrames) // returns frames written, 0 at the end
+//
+// All memory is allocated by Setup(), Process() and Reset() never allocate.
+class audioResampler
+{
+public:
+	static const int nHalfTaps = 16;	// Input frames used either side of each output frame
+	static const int nPhases = 256;
+
+	audioResampler()
+	{
+
+	}
+
+	void Setup(unsigned int nInRate, unsigned int nOutRate, int nChannels, int nChunkFrames = 1024)
+	{
+		m_nChannels = nChannels;
+		m_fStep = (double)nInRate / (double)nOutRate;
+		m_bPassThrough = nInRate == nOutRate;
+		m_nChunkFrames = nChunkFrames;
+		m_vecBuffer.assign((size_t)(nChunkFrames + nHalfTaps * 2) * nChannels, 0.0f);
+
+		if (!m_bPassThrough)
+			BuildTable((std::min)(1.0, 1.0 / m_fStep) * 0.97);
+		Reset();
+	}
+
+	// Back to the start of a new input stream
+	void Reset()
+	{
+		// Half a filter of silence in front of the first frame, so that frame can be centred
+		std::fill(m_vecBuffer.begin(), m_vecBuffer.end(), 0.0f);
+		m_nBuffered = nHalfTaps - 1;
+		m_fPosition = (double)(nHalfTaps - 1);
+		m_nEnd = -1;
+	}
+
+	// Frames of output for nInFrames of input
+	long OutputFrames(long nInFrames)
+	{
+		return (long)ceil((double)nInFrames / m_fStep);
+	}
+
+	// Writes up to nFrames output frames, fewer only once the source has run dry
+	template<typename FSource>
+	int Process(float* pOut, int nFrames, FSource&& fnRead)
+	{
+		if (m_bPassThrough)
+		{
+			int nDone = 0;
+			while (nDone < nFrames)
+			{
+				int n = fnRead(pOut + nDone * m_nChannels, nFrames - nDone);
+				if (n <= 0)
+					break;
+				nDone += n;
+			}
+			return nDone;
+		}
+
+		const int nTaps = nHalfTaps * 2;
+		for (int f = 0; f < nFrames; f++)
+		{
+			long nCentre = (long)m_fPosition;
+
+			// Source exhausted and every real frame has been passed
+			if (m_nEnd >= 0 && nCentre >= m_nEnd)
+				return f;
+
+			// Make sure the whole filter window is in the buffer
+			if (nCentre + nHalfTaps >= m_nBuffered)
+			{
+				Refill(nCentre - nHalfTaps + 1, fnRead);
+				nCentre = (long)m_fPosition;
+				if (m_nEnd >= 0 && nCentre >= m_nEnd)
+					return f;
+			}
+
+			float fPhase = (float)(m_fPosition - (double)nCentre) * (float)nPhases;
+			int nPhase = (int)fPhase;
+			float fBlend = fPhase - (float)nPhase;
+			const float* k0 = &m_vecTable[(size_t)nPhase * nTaps];
+			const float* k1 = k0 + nTaps;
+			const float* pIn = &m_vecBuffer[(size_t)(nCentre - nHalfTaps + 1) * m_nChannels];
+
+			for (int c = 0; c < m_nChannels; c++)
+			{
+				float fSum0 = 0.0f, fSum1 = 0.0f;
+				for (int k = 0; k < nTaps; k++)
+				{
+					float s = pIn[k * m_nChannels + c];
+					fSum0 += s * k0[k];
+					fSum1 += s * k1[k];
+				}
+				pOut[f * m_nChannels + c] = fSum0 + (fSum1 - fSum0) * fBlend;
+			}
+
+			m_fPosition += m_fStep;
+		}
+		return nFrames;
+	}
+
+private:
+	// Discards everything before nKeepFrom and tops the buffer up from the source
+	template<typename FSource>
+	void Refill(long nKeepFrom, FSource&& fnRead)
+	{
+		long nKeep = m_nBuffered - nKeepFrom;
+		std::copy(m_vecBuffer.begin() + nKeepFrom * m_nChannels, m_vecBuffer.begin() + m_nBuffered * m_nChannels, m_vecBuffer.begin());
+		m_nBuffered = nKeep;
+		m_fPosition -= (double)nKeepFrom;
+		if (m_nEnd >= 0)
+			m_nEnd -= nKeepFrom;
+
+		long nCapacity = (long)(m_vecBuffer.size() / m_nChannels);
+		while (m_nEnd < 0 && m_nBuffered < nCapacity)
+		{
+			int n = fnRead(&m_vecBuffer[(size_t)m_nBuffered * m_nChannels], (int)(nCapacity - m_nBuffered));
+			if (n <= 0)
+				m_nEnd = m_nBuffered;
+			else
+				m_nBuffered += n;
+		}
+
+		// Past the end the filter just sees silence
+		if (m_nEnd >= 0)
+		{
+			std::fill(m_vecBuffer.begin() + m_nBuffered * m_nChannels, m_vecBuffer.end(), 0.0f);
+			m_nBuffered = nCapacity;
+		}
+	}
+
+	static double BesselI0(double x)
+	{
+		double fSum = 1.0, fTerm = 1.0;
+		for (int k = 1; k < 32; k++)
+		{
+			fTerm *= (x * 0.5 / k) * (x * 0.5 / k);
+			fSum += fTerm;
+		}
+		return fSum;
+	}
+
+	// fCutoff is a fraction of the input Nyquist frequency
+	void BuildTable(double fCutoff)
+	{
+		const int nTaps = nHalfTaps * 2;
+		const double fBeta = 8.0;
+		const double fPi = 3.14159265358979323846;
+		m_vecTable.assign((size_t)(nPhases + 1) * nTaps, 0.0f);
+
+		for (int p = 0; p <= nPhases; p++)
+		{
+			double fFrac = (double)p / (double)nPhases;
+			double fTotal = 0.0;
+			for (int k = 0; k < nTaps; k++)
+			{
+				// Distance from the output position to input frame k of the window
+				double x = (double)(k - (nHalfTaps - 1)) - fFrac;
+				double fSinc = x == 0.0 ? 1.0 : sin(fPi * fCutoff * x) / (fPi * fCutoff * x);
+				double r = x / (double)nHalfTaps;
+				double fWindow = fabs(r) >= 1.0 ? 0.0 : BesselI0(fBeta * sqrt(1.0 - r * r)) / BesselI0(fBeta);
+				double h = fSinc * fWindow;
+				m_vecTable[(size_t)p * nTaps + k] = (float)h;
+				fTotal += h;
+			}
+
+			// Unity gain at DC for every phase
+			for (int k = 0; k < nTaps; k++)
+				m_vecTable[(size_t)p * nTaps + k] = (float)(m_vecTable[(size_t)p * nTaps + k] / fTotal);
+		}
+	}
+
+	int m_nChannels = 1;
+	int m_nChunkFrames = 0;
+	double m_fStep = 1.0;
+	bool m_bPassThrough = true;
+
+	std::vector<float> m_vecTable;
+	std::vector<float> m_vecBuffer;	// Input frames, the filter window slides along this
+	long m_nBuffered = 0;
+	long m_nEnd = -1;				// Buffer index one past the last real frame, once the source is done
+	double m_fPosition = 0.0;		// Input position of the next output frame, relative to the buffer
+};
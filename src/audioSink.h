@@ -0,0 +1,174 @@
+#pragma once
+
+#include "fileIO.h"
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+
+// Where the audio thread sends mixed blocks of 16-bit samples. The engine asks the
+// sink for somewhere to write the next block, mixes straight into it, then hands
+// it back. A sound card sink blocks in AcquireBlock() until the device has a free
+// buffer; the sinks here don't need Windows, so the mixer's throughput and latency
+// can be measured without a sound card, or on a build machine.
+class audioSink
+{
+public:
+	virtual ~audioSink()
+	{
+
+	}
+
+	// nBlockSamples counts every channel, like the engine's m_nBlockSamples
+	virtual bool Open(unsigned int nSampleRate, unsigned int nChannels, unsigned int nBlocks, unsigned int nBlockSamples) = 0;
+
+	// Somewhere to mix the next block, or nullptr if Cancel() was called while waiting
+	virtual short* AcquireBlock() = 0;
+
+	// The block from the last AcquireBlock() is complete
+	virtual void SubmitBlock() = 0;
+
+	// Called from another thread to wake the audio thread out of AcquireBlock()
+	virtual void Cancel()
+	{
+
+	}
+
+	// Called once the audio thread has finished
+	virtual void Close() = 0;
+
+	unsigned int BlocksSubmitted() { return m_nBlocksSubmitted; }
+
+protected:
+	unsigned int m_nBlocksSubmitted = 0;
+};
+
+// Throws every block away. Unpaced it runs the audio thread flat out, which
+// measures how fast the mixer is; paced it waits out the real duration of each
+// block like a sound card would, for measuring latency.
+class nullAudioSink : public audioSink
+{
+public:
+	nullAudioSink(bool bRealTime = false)
+	{
+		m_bRealTime = bRealTime;
+	}
+
+	bool Open(unsigned int nSampleRate, unsigned int nChannels, unsigned int /*nBlocks*/, unsigned int nBlockSamples) override
+	{
+		m_vecBlock.assign(nBlockSamples, 0);
+		m_durBlock = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>((double)(nBlockSamples / nChannels) / (double)nSampleRate));
+		m_tpNextBlock = std::chrono::steady_clock::now();
+		m_nBlocksSubmitted = 0;
+		return true;
+	}
+
+	short* AcquireBlock() override
+	{
+		if (m_bRealTime)
+		{
+			std::this_thread::sleep_until(m_tpNextBlock);
+			m_tpNextBlock += m_durBlock;
+		}
+		return m_vecBlock.data();
+	}
+
+	void SubmitBlock() override
+	{
+		m_nBlocksSubmitted++;
+	}
+
+	void Close() override
+	{
+
+	}
+
+private:
+	bool m_bRealTime = false;
+	std::vector<short> m_vecBlock;
+	std::chrono::steady_clock::duration m_durBlock;
+	std::chrono::steady_clock::time_point m_tpNextBlock;
+};
+
+// Writes everything the engine plays to a 16-bit PCM .wav file, unpaced. The RIFF
+// sizes are filled in by Close(), so the file is only valid after that.
+class wavFileAudioSink : public audioSink
+{
+public:
+	wavFileAudioSink(const std::wstring& sFile)
+	{
+		m_sFile = sFile;
+	}
+
+	~wavFileAudioSink()
+	{
+		Close();
+	}
+
+	bool Open(unsigned int nSampleRate, unsigned int nChannels, unsigned int /*nBlocks*/, unsigned int nBlockSamples) override
+	{
+		Close();
+		m_pFile = fileIO::OpenFile(m_sFile, L"wb");
+		if (m_pFile == nullptr)
+			return false;
+
+		m_vecBlock.assign(nBlockSamples, 0);
+		m_nDataBytes = 0;
+		m_nBlocksSubmitted = 0;
+
+		// Header with placeholder sizes
+		uint16_t nBlockAlign = (uint16_t)(nChannels * sizeof(short));
+		uint32_t nByteRate = nSampleRate * nBlockAlign;
+		uint16_t nFormat = 1, nChannels16 = (uint16_t)nChannels, nBits = 16;
+		uint32_t nFmtSize = 16, nZero = 0;
+		std::fwrite("RIFF", 1, 4, m_pFile);
+		std::fwrite(&nZero, 4, 1, m_pFile);
+		std::fwrite("WAVEfmt ", 1, 8, m_pFile);
+		std::fwrite(&nFmtSize, 4, 1, m_pFile);
+		std::fwrite(&nFormat, 2, 1, m_pFile);
+		std::fwrite(&nChannels16, 2, 1, m_pFile);
+		std::fwrite(&nSampleRate, 4, 1, m_pFile);
+		std::fwrite(&nByteRate, 4, 1, m_pFile);
+		std::fwrite(&nBlockAlign, 2, 1, m_pFile);
+		std::fwrite(&nBits, 2, 1, m_pFile);
+		std::fwrite("data", 1, 4, m_pFile);
+		std::fwrite(&nZero, 4, 1, m_pFile);
+		return true;
+	}
+
+	short* AcquireBlock() override
+	{
+		return m_vecBlock.data();
+	}
+
+	void SubmitBlock() override
+	{
+		std::fwrite(m_vecBlock.data(), sizeof(short), m_vecBlock.size(), m_pFile);
+		m_nDataBytes += (uint32_t)(m_vecBlock.size() * sizeof(short));
+		m_nBlocksSubmitted++;
+	}
+
+	void Close() override
+	{
+		if (m_pFile == nullptr)
+			return;
+
+		uint32_t nRiffSize = 36 + m_nDataBytes;
+		std::fseek(m_pFile, 4, SEEK_SET);
+		std::fwrite(&nRiffSize, 4, 1, m_pFile);
+		std::fseek(m_pFile, 40, SEEK_SET);
+		std::fwrite(&m_nDataBytes, 4, 1, m_pFile);
+		std::fclose(m_pFile);
+		m_pFile = nullptr;
+	}
+
+private:
+	std::wstring m_sFile;
+	std::FILE* m_pFile = nullptr;
+	std::vector<short> m_vecBlock;
+	uint32_t m_nDataBytes = 0;
+};
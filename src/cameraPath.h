@@ -0,0 +1,133 @@
+#pragma once
+
+#include "fileIO.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// A camera flythrough for offline renders: keys of position and yaw at frame
+// numbers, read from a text file with one key per line
+//
+//		frame x y z yaw
+//
+// Blank lines and lines starting with # are skipped, and keys must be in frame
+// order. Between keys the camera follows a Catmull-Rom spline, so it passes
+// through every key without stopping at it, with tangents scaled by the spacing
+// of the keys so uneven gaps don't jolt the speed. Before the first key and after
+// the last it holds still.
+//
+// Any frame can be sampled on its own, in any order, which is what lets a render
+// be split up between workers by frame range.
+class cameraPath
+{
+public:
+	struct sKey
+	{
+		float fFrame;
+		float vPosition[3];
+		float fYaw;
+	};
+
+	// False if the file can't be read, a line doesn't parse or the keys are out of order
+	bool Load(const std::wstring& sFile)
+	{
+		m_vecKeys.clear();
+		std::FILE* f = fileIO::OpenFile(sFile, L"r");
+		if (f == nullptr)
+			return false;
+
+		bool bOk = true;
+		char sLine[256];
+		while (bOk && std::fgets(sLine, sizeof(sLine), f) != nullptr)
+		{
+			const char* c = sLine;
+			while (*c == ' ' || *c == '\t')
+				c++;
+			if (*c == '#' || *c == '\r' || *c == '\n' || *c == 0)
+				continue;
+
+			sKey key;
+			bOk = std::sscanf(c, "%f %f %f %f %f", &key.fFrame, &key.vPosition[0], &key.vPosition[1], &key.vPosition[2], &key.fYaw) == 5 && AddKey(key);
+		}
+		std::fclose(f);
+
+		if (!bOk)
+			m_vecKeys.clear();
+		return bOk && !m_vecKeys.empty();
+	}
+
+	// False if the key is before the last one
+	bool AddKey(const sKey& key)
+	{
+		if (!m_vecKeys.empty() && key.fFrame < m_vecKeys.back().fFrame)
+			return false;
+		m_vecKeys.push_back(key);
+		return true;
+	}
+
+	int KeyCount() const { return (int)m_vecKeys.size(); }
+	float FirstFrame() const { return m_vecKeys.empty() ? 0.0f : m_vecKeys.front().fFrame; }
+	float LastFrame() const { return m_vecKeys.empty() ? 0.0f : m_vecKeys.back().fFrame; }
+
+	void Sample(float fFrame, float* pPosition, float& fYaw) const
+	{
+		if (m_vecKeys.empty())
+		{
+			pPosition[0] = pPosition[1] = pPosition[2] = 0.0f;
+			fYaw = 0.0f;
+			return;
+		}
+
+		// Last key at or before the frame
+		int n = (int)m_vecKeys.size();
+		int k = 0;
+		while (k + 1 < n && m_vecKeys[k + 1].fFrame <= fFrame)
+			k++;
+
+		const sKey& k1 = m_vecKeys[k];
+		if (fFrame <= k1.fFrame || k + 1 == n)
+		{
+			Copy(k1, pPosition, fYaw);
+			return;
+		}
+
+		// Ends of the path repeat their key for the missing neighbour
+		const sKey& k0 = m_vecKeys[k > 0 ? k - 1 : k];
+		const sKey& k2 = m_vecKeys[k + 1];
+		const sKey& k3 = m_vecKeys[k + 2 < n ? k + 2 : k + 1];
+
+		float fSpan = k2.fFrame - k1.fFrame;
+		float t = (fFrame - k1.fFrame) / fSpan;
+		float t2 = t * t, t3 = t2 * t;
+		float h00 = 2.0f * t3 - 3.0f * t2 + 1.0f;
+		float h10 = t3 - 2.0f * t2 + t;
+		float h01 = -2.0f * t3 + 3.0f * t2;
+		float h11 = t3 - t2;
+
+		// Tangents in units per segment, from the keys either side
+		float fScale1 = k2.fFrame > k0.fFrame ? fSpan / (k2.fFrame - k0.fFrame) : 0.0f;
+		float fScale2 = k3.fFrame > k1.fFrame ? fSpan / (k3.fFrame - k1.fFrame) : 0.0f;
+		auto Spline = [&](float p0, float p1, float p2, float p3)
+		{
+			float m1 = (p2 - p0) * fScale1;
+			float m2 = (p3 - p1) * fScale2;
+			return h00 * p1 + h10 * m1 + h01 * p2 + h11 * m2;
+		};
+
+		for (int i = 0; i < 3; i++)
+			pPosition[i] = Spline(k0.vPosition[i], k1.vPosition[i], k2.vPosition[i], k3.vPosition[i]);
+		fYaw = Spline(k0.fYaw, k1.fYaw, k2.fYaw, k3.fYaw);
+	}
+
+private:
+	static void Copy(const sKey& key, float* pPosition, float& fYaw)
+	{
+		pPosition[0] = key.vPosition[0];
+		pPosition[1] = key.vPosition[1];
+		pPosition[2] = key.vPosition[2];
+		fYaw = key.fYaw;
+	}
+
+	std::vector<sKey> m_vecKeys;
+};
@@ -0,0 +1,195 @@
+/*
+Converts a capture recorded by the engine, see StartFrameCapture() and
+frameCapture.h, into a numbered sequence of 24-bit .bmp images, ready to be
+stepped through or turned into a video.
+
+This is a separate program from the demo, build it on its own:
+
+	cl /O2 /EHsc /std:c++17 captureToImages.cpp
+
+Usage:
+
+	captureToImages <capture.cgef> <output prefix> [cell size] [every nth frame]
+
+Each console cell becomes a square of cell size pixels (default 1, the demo runs
+with 1x1 pixel fonts). Cells are drawn in the standard console palette, and the
+shade glyphs the engine draws with are drawn as dithered mixes of foreground and
+background in proportion to how much of the cell they cover. Any other glyph is
+drawn as a block of foreground in the middle of its cell, so text shows up where
+it was but can't be read.
+*/
+
+#include "frameCapture.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+using namespace std;
+
+// Default console colours, indexed by the low or high nibble of the attribute
+static const uint8_t nPalette[16][3] =
+{
+	{ 0, 0, 0 }, { 0, 0, 128 }, { 0, 128, 0 }, { 0, 128, 128 },
+	{ 128, 0, 0 }, { 128, 0, 128 }, { 128, 128, 0 }, { 192, 192, 192 },
+	{ 128, 128, 128 }, { 0, 0, 255 }, { 0, 255, 0 }, { 0, 255, 255 },
+	{ 255, 0, 0 }, { 255, 0, 255 }, { 255, 255, 0 }, { 255, 255, 255 },
+};
+
+// 4x4 ordered dither thresholds
+static const int nBayer[4][4] =
+{
+	{ 0, 8, 2, 10 }, { 12, 4, 14, 6 }, { 3, 11, 1, 9 }, { 15, 7, 13, 5 },
+};
+
+// How much of the cell a glyph covers in sixteenths, or -1 for anything that
+// isn't a block or shade
+static int GlyphCoverage(uint16_t nGlyph)
+{
+	switch (nGlyph)
+	{
+	case 0:
+	case L' ':		return 0;
+	case 0x2591:	return 4;	// PIXEL_QUARTER
+	case 0x2592:	return 8;	// PIXEL_HALF
+	case 0x2593:	return 12;	// PIXEL_THREEQUARTERS
+	case 0x2588:	return 16;	// PIXEL_SOLID
+	default:		return -1;
+	}
+}
+
+static bool WriteBitmap(const string& sFile, int nWidth, int nHeight, const vector<uint8_t>& vecRGB)
+{
+	FILE* f = nullptr;
+#if defined(_WIN32)
+	fopen_s(&f, sFile.c_str(), "wb");
+#else
+	f = fopen(sFile.c_str(), "wb");
+#endif
+	if (f == nullptr)
+		return false;
+
+	uint32_t nRowBytes = (uint32_t)(nWidth * 3 + 3) & ~3u;
+	uint32_t nImageBytes = nRowBytes * nHeight;
+	uint32_t nFileBytes = 54 + nImageBytes;
+
+	uint8_t header[54] = { 'B', 'M' };
+	auto Put32 = [&](int nOffset, uint32_t n) { for (int b = 0; b < 4; b++) header[nOffset + b] = (uint8_t)(n >> (b * 8)); };
+	Put32(2, nFileBytes);
+	Put32(10, 54);
+	Put32(14, 40);
+	Put32(18, (uint32_t)nWidth);
+	Put32(22, (uint32_t)nHeight);
+	header[26] = 1;
+	header[28] = 24;
+	Put32(34, nImageBytes);
+	fwrite(header, 1, 54, f);
+
+	// Bottom row first, pixels in BGR order
+	vector<uint8_t> vecRow(nRowBytes, 0);
+	for (int y = nHeight - 1; y >= 0; y--)
+	{
+		for (int x = 0; x < nWidth; x++)
+		{
+			const uint8_t* p = &vecRGB[((size_t)y * nWidth + x) * 3];
+			vecRow[x * 3 + 0] = p[2];
+			vecRow[x * 3 + 1] = p[1];
+			vecRow[x * 3 + 2] = p[0];
+		}
+		fwrite(vecRow.data(), 1, nRowBytes, f);
+	}
+	return fclose(f) == 0;
+}
+
+static void RenderFrame(const vector<uint32_t>& vecCells, int nCellsX, int nCellsY, int nCellSize, vector<uint8_t>& vecRGB)
+{
+	int nImageWidth = nCellsX * nCellSize;
+	for (int cy = 0; cy < nCellsY; cy++)
+	{
+		for (int cx = 0; cx < nCellsX; cx++)
+		{
+			uint32_t nCell = vecCells[(size_t)cy * nCellsX + cx];
+			uint16_t nGlyph = (uint16_t)(nCell & 0xffff);
+			uint16_t nColour = (uint16_t)(nCell >> 16);
+			const uint8_t* fg = nPalette[nColour & 0x0f];
+			const uint8_t* bg = nPalette[(nColour >> 4) & 0x0f];
+			int nCoverage = GlyphCoverage(nGlyph);
+
+			for (int py = 0; py < nCellSize; py++)
+			{
+				for (int px = 0; px < nCellSize; px++)
+				{
+					uint8_t* pOut = &vecRGB[((size_t)(cy * nCellSize + py) * nImageWidth + cx * nCellSize + px) * 3];
+					if (nCellSize == 1)
+					{
+						// One pixel per cell, blend by coverage, unknown glyphs count as a third
+						int nMix = nCoverage < 0 ? 5 : nCoverage;
+						for (int c = 0; c < 3; c++)
+							pOut[c] = (uint8_t)((fg[c] * nMix + bg[c] * (16 - nMix)) / 16);
+						continue;
+					}
+
+					bool bForeground;
+					if (nCoverage < 0)
+						bForeground = px >= nCellSize / 4 && px < nCellSize - nCellSize / 4 && py >= nCellSize / 4 && py < nCellSize - nCellSize / 4;
+					else
+						bForeground = nCoverage > nBayer[py & 3][px & 3];
+
+					const uint8_t* pColour = bForeground ? fg : bg;
+					pOut[0] = pColour[0];
+					pOut[1] = pColour[1];
+					pOut[2] = pColour[2];
+				}
+			}
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3)
+	{
+		cout << "Usage: captureToImages <capture.cgef> <output prefix> [cell size] [every nth frame]" << endl;
+		return 1;
+	}
+
+	string sCapture = argv[1];
+	string sPrefix = argv[2];
+	int nCellSize = argc > 3 ? max(1, atoi(argv[3])) : 1;
+	int nEvery = argc > 4 ? max(1, atoi(argv[4])) : 1;
+
+	frameCaptureReader capture;
+	if (!capture.Open(wstring(sCapture.begin(), sCapture.end())))
+	{
+		cout << "Can't read capture " << sCapture << endl;
+		return 1;
+	}
+
+	int nCellsX = capture.Width(), nCellsY = capture.Height();
+	vector<uint32_t> vecCells((size_t)nCellsX * nCellsY);
+	vector<uint8_t> vecRGB((size_t)nCellsX * nCellSize * nCellsY * nCellSize * 3);
+
+	int nFrame = 0, nWritten = 0;
+	float fElapsedTime = 0.0f, fTime = 0.0f;
+	while (capture.ReadFrame(vecCells.data(), fElapsedTime))
+	{
+		fTime += fElapsedTime;
+		if (nFrame++ % nEvery != 0)
+			continue;
+
+		RenderFrame(vecCells, nCellsX, nCellsY, nCellSize, vecRGB);
+
+		char sNumber[16];
+		snprintf(sNumber, sizeof(sNumber), "%05d", nWritten);
+		if (!WriteBitmap(sPrefix + sNumber + ".bmp", nCellsX * nCellSize, nCellsY * nCellSize, vecRGB))
+		{
+			cout << "Can't write " << sPrefix + sNumber + ".bmp" << endl;
+			return 1;
+		}
+		nWritten++;
+	}
+
+	cout << nFrame << " frames, " << fTime << "s, wrote " << nWritten << " images" << endl;
+	return 0;
+}
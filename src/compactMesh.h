@@ -0,0 +1,345 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+
+// Unit vector <--> two 16 bit values. The sphere is folded onto an octahedron and
+// the octahedron flattened onto a square, so directions are spread evenly over the
+// codes and the error stays under a twentieth of a degree. A zero vector gets a
+// code of its own, which a unit vector never produces.
+namespace octahedralNormal
+{
+	const int16_t nNone = INT16_MIN;
+
+	inline void Encode(float x, float y, float z, int16_t& nOutX, int16_t& nOutY)
+	{
+		float l1 = fabsf(x) + fabsf(y) + fabsf(z);
+		if (l1 <= 0.0f)
+		{
+			nOutX = nOutY = nNone;
+			return;
+		}
+		float ox = x / l1, oy = y / l1;
+		if (z < 0.0f)
+		{
+			float fx = (1.0f - fabsf(oy)) * (ox >= 0.0f ? 1.0f : -1.0f);
+			float fy = (1.0f - fabsf(ox)) * (oy >= 0.0f ? 1.0f : -1.0f);
+			ox = fx;
+			oy = fy;
+		}
+		nOutX = (int16_t)lroundf((std::max)(-1.0f, (std::min)(ox, 1.0f)) * 32767.0f);
+		nOutY = (int16_t)lroundf((std::max)(-1.0f, (std::min)(oy, 1.0f)) * 32767.0f);
+	}
+
+	// False for the zero vector, x/y/z are then left alone
+	inline bool Decode(int16_t nX, int16_t nY, float& x, float& y, float& z)
+	{
+		if (nX == nNone)
+			return false;
+		x = (float)nX / 32767.0f;
+		y = (float)nY / 32767.0f;
+		z = 1.0f - fabsf(x) - fabsf(y);
+		float t = (std::max)(-z, 0.0f);
+		x += x >= 0.0f ? -t : t;
+		y += y >= 0.0f ? -t : t;
+		float l = sqrtf(x * x + y * y + z * z);
+		x /= l; y /= l; z /= l;
+		return true;
+	}
+}
+
+// A triangle mesh packed small enough to hold millions of triangles. Corners that
+// share a position (and texture coordinate) are welded into one vertex, positions
+// are 16 bit fractions of the mesh bounds, texture coordinates 16 bit fractions of
+// their own range, and triangles are three 16 bit indices when there are few
+// enough vertices, 32 bit otherwise. Each triangle keeps its face normal,
+// octahedral encoded, so the transform stage doesn't have to rebuild it with a
+// cross product and square root. Triangle i is triangle i of the list it was built
+// from, so anything indexed by triangle (clusters, BVH hits) still lines up.
+class compactMesh
+{
+public:
+	compactMesh()
+	{
+
+	}
+
+	// Works on anything with a _point[3] of x/y/z and a _tex[3] of u/v, i.e. triPoly
+	template<typename TRI>
+	void Build(const std::vector<TRI>& vecTris, bool bTexCoords)
+	{
+		Clear();
+		m_nTriangles = (int)vecTris.size();
+		if (m_nTriangles == 0)
+			return;
+
+		// Bounds of everything, which the 16 bit values are fractions of
+		float fMin[5], fMax[5];
+		for (int a = 0; a < 5; a++)
+		{
+			fMin[a] = FLT_MAX;
+			fMax[a] = -FLT_MAX;
+		}
+		for (auto& t : vecTris)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				float f[5] = { t._point[k].x, t._point[k].y, t._point[k].z, t._tex[k].u, t._tex[k].v };
+				for (int a = 0; a < 5; a++)
+				{
+					fMin[a] = (std::min)(fMin[a], f[a]);
+					fMax[a] = (std::max)(fMax[a], f[a]);
+				}
+			}
+		}
+		for (int a = 0; a < 5; a++)
+		{
+			m_fOffset[a] = fMin[a];
+			m_fStep[a] = (fMax[a] - fMin[a]) / 65535.0f;
+		}
+
+		// Weld corners that quantize to the same values, numbering vertices in the
+		// order they are first used so neighbouring triangles stay near in memory
+		std::unordered_map<uint64_t, uint32_t> mapPosition;
+		std::unordered_map<uint64_t, std::vector<std::pair<uint32_t, uint32_t>>> mapTexCoord;
+		std::vector<uint32_t> vecIndices(m_nTriangles * 3);
+		mapPosition.reserve(m_nTriangles);
+		for (int i = 0; i < m_nTriangles; i++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				const TRI& t = vecTris[i];
+				uint16_t q[5] =
+				{
+					Quantize(t._point[k].x, 0), Quantize(t._point[k].y, 1), Quantize(t._point[k].z, 2),
+					bTexCoords ? Quantize(t._tex[k].u, 3) : (uint16_t)0, bTexCoords ? Quantize(t._tex[k].v, 4) : (uint16_t)0
+				};
+				uint64_t nKey = ((uint64_t)q[0] << 32) | ((uint64_t)q[1] << 16) | q[2];
+				uint32_t nTexKey = ((uint32_t)q[3] << 16) | q[4];
+
+				uint32_t nVertex = UINT32_MAX;
+				if (!bTexCoords)
+				{
+					auto it = mapPosition.find(nKey);
+					if (it != mapPosition.end())
+						nVertex = it->second;
+				}
+				else
+				{
+					// Seams give one position several texture coordinates
+					for (auto& entry : mapTexCoord[nKey])
+						if (entry.first == nTexKey)
+							nVertex = entry.second;
+				}
+
+				if (nVertex == UINT32_MAX)
+				{
+					nVertex = (uint32_t)(m_vecPositions.size() / 3);
+					m_vecPositions.insert(m_vecPositions.end(), { q[0], q[1], q[2] });
+					if (bTexCoords)
+					{
+						m_vecTexCoords.insert(m_vecTexCoords.end(), { q[3], q[4] });
+						mapTexCoord[nKey].push_back({ nTexKey, nVertex });
+					}
+					else
+						mapPosition[nKey] = nVertex;
+				}
+				vecIndices[i * 3 + k] = nVertex;
+			}
+		}
+		m_vecPositions.shrink_to_fit();
+		m_vecTexCoords.shrink_to_fit();
+
+		if (VertexCount() <= 65536)
+			m_vecIndex16.assign(vecIndices.begin(), vecIndices.end());
+		else
+			m_vecIndex32.swap(vecIndices);
+
+		// Face normals from the original positions, before quantizing moved them
+		m_vecNormals.resize(m_nTriangles * 2);
+		for (int i = 0; i < m_nTriangles; i++)
+		{
+			const TRI& t = vecTris[i];
+			float e1[3] = { t._point[1].x - t._point[0].x, t._point[1].y - t._point[0].y, t._point[1].z - t._point[0].z };
+			float e2[3] = { t._point[2].x - t._point[0].x, t._point[2].y - t._point[0].y, t._point[2].z - t._point[0].z };
+			float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			octahedralNormal::Encode(n[0], n[1], n[2], m_vecNormals[i * 2], m_vecNormals[i * 2 + 1]);
+		}
+	}
+
+	int TriangleCount() const { return m_nTriangles; }
+	int VertexCount() const { return (int)(m_vecPositions.size() / 3); }
+	bool HasTexCoords() const { return !m_vecTexCoords.empty(); }
+
+	// Vertex index of corner k of triangle i
+	uint32_t Index(int i, int k) const
+	{
+		return m_vecIndex32.empty() ? m_vecIndex16[i * 3 + k] : m_vecIndex32[i * 3 + k];
+	}
+
+	// Sets x/y/z of the three corners of triangle i, anything else in POINT is untouched
+	template<typename POINT>
+	void DecodePositions(int i, POINT* pOut) const
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			const uint16_t* q = &m_vecPositions[Index(i, k) * 3];
+			pOut[k].x = m_fOffset[0] + (float)q[0] * m_fStep[0];
+			pOut[k].y = m_fOffset[1] + (float)q[1] * m_fStep[1];
+			pOut[k].z = m_fOffset[2] + (float)q[2] * m_fStep[2];
+		}
+	}
+
+	// Sets x/y/z of vertex v, numbered as Index() gives them
+	template<typename POINT>
+	void DecodeVertex(int v, POINT& out) const
+	{
+		const uint16_t* q = &m_vecPositions[(size_t)v * 3];
+		out.x = m_fOffset[0] + (float)q[0] * m_fStep[0];
+		out.y = m_fOffset[1] + (float)q[1] * m_fStep[1];
+		out.z = m_fOffset[2] + (float)q[2] * m_fStep[2];
+	}
+
+	// Sets u/v of the three corners of triangle i, left alone if the mesh has none
+	template<typename TEX>
+	void DecodeTexCoords(int i, TEX* pOut) const
+	{
+		if (m_vecTexCoords.empty())
+			return;
+		for (int k = 0; k < 3; k++)
+		{
+			const uint16_t* q = &m_vecTexCoords[Index(i, k) * 2];
+			pOut[k].u = m_fOffset[3] + (float)q[0] * m_fStep[3];
+			pOut[k].v = m_fOffset[4] + (float)q[1] * m_fStep[4];
+		}
+	}
+
+	// Unit face normal, winding 0 --> 1 --> 2 as given to Build(). False if the
+	// triangle had no area, so no normal, to begin with
+	bool DecodeNormal(int i, float& x, float& y, float& z) const
+	{
+		return octahedralNormal::Decode(m_vecNormals[i * 2], m_vecNormals[i * 2 + 1], x, y, z);
+	}
+
+	// Bytes held for the mesh data
+	size_t MemoryBytes() const
+	{
+		return m_vecPositions.capacity() * sizeof(uint16_t) + m_vecTexCoords.capacity() * sizeof(uint16_t) +
+			m_vecIndex16.capacity() * sizeof(uint16_t) + m_vecIndex32.capacity() * sizeof(uint32_t) +
+			m_vecNormals.capacity() * sizeof(int16_t);
+	}
+
+	// Empties the mesh but keeps what it had allocated
+	void Clear()
+	{
+		m_nTriangles = 0;
+		m_vecPositions.clear();
+		m_vecTexCoords.clear();
+		m_vecIndex16.clear();
+		m_vecIndex32.clear();
+		m_vecNormals.clear();
+	}
+
+	// Room for a mesh of this size, so Read() of anything up to it doesn't allocate
+	void Reserve(int nTriangles, int nVertices, bool bTexCoords)
+	{
+		m_vecPositions.reserve((size_t)nVertices * 3);
+		if (bTexCoords)
+			m_vecTexCoords.reserve((size_t)nVertices * 2);
+		if (nVertices <= 65536)
+			m_vecIndex16.reserve((size_t)nTriangles * 3);
+		else
+			m_vecIndex32.reserve((size_t)nTriangles * 3);
+		m_vecNormals.reserve((size_t)nTriangles * 2);
+	}
+
+	// Stores the mesh as it is held in memory, Read() takes it back
+	bool Write(std::FILE* f)
+	{
+		uint32_t nCounts[3] = { (uint32_t)m_nTriangles, (uint32_t)VertexCount(), HasTexCoords() ? 1u : 0u };
+		bool bOk = std::fwrite(nCounts, sizeof(uint32_t), 3, f) == 3;
+		bOk &= std::fwrite(m_fOffset, sizeof(float), 5, f) == 5;
+		bOk &= std::fwrite(m_fStep, sizeof(float), 5, f) == 5;
+		bOk &= WriteVector(f, m_vecPositions);
+		bOk &= WriteVector(f, m_vecTexCoords);
+		bOk &= WriteVector(f, m_vecIndex16);
+		bOk &= WriteVector(f, m_vecIndex32);
+		bOk &= WriteVector(f, m_vecNormals);
+		return bOk;
+	}
+
+	// Replaces the mesh with one written by Write(), which takes up no more than
+	// nMaxBytes of the file. Reuses what is already allocated, so after Reserve() for
+	// the largest mesh it will read, this never allocates
+	bool Read(std::FILE* f, uint64_t nMaxBytes)
+	{
+		m_nTriangles = 0;
+		uint32_t nCounts[3] = { 0 };
+		if (std::fread(nCounts, sizeof(uint32_t), 3, f) != 3 ||
+			std::fread(m_fOffset, sizeof(float), 5, f) != 5 ||
+			std::fread(m_fStep, sizeof(float), 5, f) != 5)
+			return false;
+
+		// The counts come from the file, they have to describe a mesh that fits in it
+		uint64_t nTris = nCounts[0], nVerts = nCounts[1];
+		bool bIndex16 = nVerts <= 65536;
+		uint64_t nBytes = sizeof(nCounts) + sizeof(m_fOffset) + sizeof(m_fStep)
+			+ sizeof(uint16_t) * nVerts * (nCounts[2] ? 5 : 3)
+			+ (bIndex16 ? sizeof(uint16_t) : sizeof(uint32_t)) * nTris * 3
+			+ sizeof(int16_t) * nTris * 2;
+		if (nCounts[2] > 1 || nTris > INT32_MAX || nBytes > nMaxBytes)
+			return false;
+
+		bool bOk = ReadVector(f, m_vecPositions, (size_t)nVerts * 3);
+		bOk = bOk && ReadVector(f, m_vecTexCoords, nCounts[2] ? (size_t)nVerts * 2 : 0);
+		bOk = bOk && ReadVector(f, m_vecIndex16, bIndex16 ? (size_t)nTris * 3 : 0);
+		bOk = bOk && ReadVector(f, m_vecIndex32, bIndex16 ? 0 : (size_t)nTris * 3);
+		bOk = bOk && ReadVector(f, m_vecNormals, (size_t)nTris * 2);
+
+		// And every corner has to be one of the vertices
+		for (uint16_t i : m_vecIndex16)
+			bOk = bOk && i < nVerts;
+		for (uint32_t i : m_vecIndex32)
+			bOk = bOk && i < nVerts;
+
+		m_nTriangles = bOk ? (int)nTris : 0;
+		return bOk;
+	}
+
+private:
+	template<typename T>
+	static bool WriteVector(std::FILE* f, const std::vector<T>& vec)
+	{
+		return vec.empty() || std::fwrite(vec.data(), sizeof(T), vec.size(), f) == vec.size();
+	}
+
+	template<typename T>
+	static bool ReadVector(std::FILE* f, std::vector<T>& vec, size_t nCount)
+	{
+		vec.resize(nCount);
+		return nCount == 0 || std::fread(vec.data(), sizeof(T), nCount, f) == nCount;
+	}
+
+	uint16_t Quantize(float f, int nAxis)
+	{
+		if (m_fStep[nAxis] <= 0.0f)
+			return 0;
+		long n = lroundf((f - m_fOffset[nAxis]) / m_fStep[nAxis]);
+		return (uint16_t)(std::max)(0L, (std::min)(n, 65535L));
+	}
+
+	int m_nTriangles = 0;
+	float m_fOffset[5] = { 0 };	// x, y, z, u, v at quantized 0
+	float m_fStep[5] = { 0 };	// Size of one quantized step on each
+
+	std::vector<uint16_t> m_vecPositions;	// x, y, z per vertex
+	std::vector<uint16_t> m_vecTexCoords;	// u, v per vertex, empty without texture coordinates
+	std::vector<uint16_t> m_vecIndex16;		// 3 per triangle, used when there are at most 65536 vertices
+	std::vector<uint32_t> m_vecIndex32;		// Otherwise this
+	std::vector<int16_t> m_vecNormals;		// Octahedral face normal, 2 per triangle
+};
@@ -15,6 +15,26 @@ Character Set -> Use Unicode. Thanks! - Javidx9
 #include <thread>
 #include <atomic>
 #include <condition_variable>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <cstdarg>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define CGE_SSE2 1
+#endif
+
+#include "frameArena.h"
+#include "audioMixer.h"
+#include "audioSink.h"
+#include "wavStream.h"
+#include "inputEvents.h"
+#include "jobSystem.h"
+#include "traceRecorder.h"
+#include "frameCapture.h"
+#include "assetManager.h"
 
 enum COLOUR
 {
@@ -79,6 +99,15 @@ public:
 			Create(8, 8);
 	}
 
+	~olcSprite()
+	{
+		delete[] m_Glyphs;
+		delete[] m_Colours;
+	}
+
+	olcSprite(const olcSprite&) = delete;
+	olcSprite& operator=(const olcSprite&) = delete;
+
 	int nWidth = 0;
 	int nHeight = 0;
 
@@ -173,6 +202,8 @@ public:
 	{
 		delete[] m_Glyphs;
 		delete[] m_Colours;
+		m_Glyphs = nullptr;
+		m_Colours = nullptr;
 		nWidth = 0;
 		nHeight = 0;
 
@@ -192,12 +223,358 @@ public:
 		std::fclose(f);
 		return true;
 	}
+
+	// Raw rows for the engine's blitters, y must be in range
+	const short* GlyphRow(int y) { return m_Glyphs + y * nWidth; }
+	const short* ColourRow(int y) { return m_Colours + y * nWidth; }
+};
+
+// Many sprites packed into one file that is memory mapped rather than read in.
+// Each cell is stored exactly as the console wants it, glyph in the low 16 bits and
+// colour in the high 16, so drawing a sprite is a masked copy of whole rows.
+//
+// File layout (little endian):
+//	sHeader
+//	sSprite[nSprites]			Where each sprite sits in the atlas image
+//	uint32_t[nWidth * nHeight]	Atlas image, starts at nDataOffset (16 byte aligned)
+class olcSpriteAtlas
+{
+public:
+	struct sHeader
+	{
+		char sMagic[4];			// "CGEA"
+		uint32_t nVersion;
+		uint32_t nSprites;
+		uint32_t nWidth;
+		uint32_t nHeight;
+		uint32_t nDataOffset;
+	};
+
+	struct sSprite
+	{
+		uint16_t x, y;
+		uint16_t w, h;
+	};
+
+	olcSpriteAtlas()
+	{
+
+	}
+
+	olcSpriteAtlas(std::wstring sFile)
+	{
+		Load(sFile);
+	}
+
+	~olcSpriteAtlas()
+	{
+		Unload();
+	}
+
+	olcSpriteAtlas(const olcSpriteAtlas&) = delete;
+	olcSpriteAtlas& operator=(const olcSpriteAtlas&) = delete;
+
+	bool Load(std::wstring sFile)
+	{
+		Unload();
+
+		m_hFile = CreateFileW(sFile.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (m_hFile == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER nSize;
+		if (!GetFileSizeEx(m_hFile, &nSize) || nSize.QuadPart < (LONGLONG)sizeof(sHeader))
+		{
+			Unload();
+			return false;
+		}
+
+		m_hMapping = CreateFileMappingW(m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (m_hMapping == nullptr)
+		{
+			Unload();
+			return false;
+		}
+
+		m_pView = (const uint8_t*)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+		if (m_pView == nullptr)
+		{
+			Unload();
+			return false;
+		}
+
+		// Validate everything up front so drawing never has to
+		m_pHeader = (const sHeader*)m_pView;
+		uint64_t nTableEnd = sizeof(sHeader) + (uint64_t)m_pHeader->nSprites * sizeof(sSprite);
+		uint64_t nDataEnd = (uint64_t)m_pHeader->nDataOffset + (uint64_t)m_pHeader->nWidth * m_pHeader->nHeight * sizeof(uint32_t);
+		if (std::memcmp(m_pHeader->sMagic, "CGEA", 4) != 0 || m_pHeader->nVersion != 1 ||
+			nTableEnd > m_pHeader->nDataOffset || nDataEnd > (uint64_t)nSize.QuadPart)
+		{
+			Unload();
+			return false;
+		}
+
+		m_pSprites = (const sSprite*)(m_pView + sizeof(sHeader));
+		m_pCells = (const uint32_t*)(m_pView + m_pHeader->nDataOffset);
+		for (uint32_t i = 0; i < m_pHeader->nSprites; i++)
+		{
+			if (m_pSprites[i].x + m_pSprites[i].w > m_pHeader->nWidth || m_pSprites[i].y + m_pSprites[i].h > m_pHeader->nHeight)
+			{
+				Unload();
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void Unload()
+	{
+		if (m_pView != nullptr)
+			UnmapViewOfFile(m_pView);
+		if (m_hMapping != nullptr)
+			CloseHandle(m_hMapping);
+		if (m_hFile != INVALID_HANDLE_VALUE)
+			CloseHandle(m_hFile);
+		m_pView = nullptr;
+		m_hMapping = nullptr;
+		m_hFile = INVALID_HANDLE_VALUE;
+		m_pHeader = nullptr;
+		m_pSprites = nullptr;
+		m_pCells = nullptr;
+	}
+
+	bool IsLoaded() { return m_pHeader != nullptr; }
+	int SpriteCount() { return m_pHeader ? (int)m_pHeader->nSprites : 0; }
+	int Pitch() { return (int)m_pHeader->nWidth; }
+	const sSprite& GetSprite(int id) { return m_pSprites[id]; }
+
+	// First cell of a sprite, rows are Pitch() cells apart
+	const uint32_t* SpriteCells(int id)
+	{
+		return m_pCells + m_pSprites[id].y * m_pHeader->nWidth + m_pSprites[id].x;
+	}
+
+	// Packs sprites onto shelves and writes an atlas file, sprite ids follow vecSprites order
+	static bool Build(std::wstring sFile, std::vector<olcSprite*>& vecSprites, int nAtlasWidth = 256)
+	{
+		// Tallest first gives tighter shelves
+		std::vector<int> vecOrder(vecSprites.size());
+		for (size_t i = 0; i < vecOrder.size(); i++)
+			vecOrder[i] = (int)i;
+		std::sort(vecOrder.begin(), vecOrder.end(), [&](int a, int b) { return vecSprites[a]->nHeight > vecSprites[b]->nHeight; });
+
+		std::vector<sSprite> vecTable(vecSprites.size());
+		int nShelfX = 0, nShelfY = 0, nShelfHeight = 0;
+		for (int i : vecOrder)
+		{
+			olcSprite* spr = vecSprites[i];
+			if (spr->nWidth > nAtlasWidth || spr->nWidth > 0xFFFF || spr->nHeight > 0xFFFF)
+				return false;
+			if (nShelfX + spr->nWidth > nAtlasWidth)
+			{
+				nShelfY += nShelfHeight;
+				nShelfX = 0;
+				nShelfHeight = 0;
+			}
+			vecTable[i] = { (uint16_t)nShelfX, (uint16_t)nShelfY, (uint16_t)spr->nWidth, (uint16_t)spr->nHeight };
+			nShelfX += spr->nWidth;
+			nShelfHeight = (std::max)(nShelfHeight, spr->nHeight);
+		}
+		int nAtlasHeight = nShelfY + nShelfHeight;
+		if (nAtlasHeight > 0xFFFF)
+			return false;
+
+		// Unused space is transparent
+		std::vector<uint32_t> vecCells(nAtlasWidth * nAtlasHeight, (uint32_t)L' ');
+		for (size_t i = 0; i < vecSprites.size(); i++)
+		{
+			olcSprite* spr = vecSprites[i];
+			for (int y = 0; y < spr->nHeight; y++)
+				for (int x = 0; x < spr->nWidth; x++)
+					vecCells[(vecTable[i].y + y) * nAtlasWidth + vecTable[i].x + x] =
+						(uint16_t)spr->GetGlyph(x, y) | ((uint32_t)(uint16_t)spr->GetColour(x, y) << 16);
+		}
+
+		sHeader header;
+		std::memcpy(header.sMagic, "CGEA", 4);
+		header.nVersion = 1;
+		header.nSprites = (uint32_t)vecSprites.size();
+		header.nWidth = nAtlasWidth;
+		header.nHeight = nAtlasHeight;
+		header.nDataOffset = (uint32_t)((sizeof(sHeader) + vecTable.size() * sizeof(sSprite) + 15) & ~(size_t)15);
+
+		FILE* f = nullptr;
+		_wfopen_s(&f, sFile.c_str(), L"wb");
+		if (f == nullptr)
+			return false;
+
+		char pad[16] = { 0 };
+		size_t nPad = header.nDataOffset - sizeof(sHeader) - vecTable.size() * sizeof(sSprite);
+		bool bOk = std::fwrite(&header, sizeof(sHeader), 1, f) == 1;
+		bOk &= std::fwrite(vecTable.data(), sizeof(sSprite), vecTable.size(), f) == vecTable.size();
+		bOk &= std::fwrite(pad, 1, nPad, f) == nPad;
+		bOk &= std::fwrite(vecCells.data(), sizeof(uint32_t), vecCells.size(), f) == vecCells.size();
+		bOk &= std::fclose(f) == 0;
+
+		// A partly written atlas would only be turned away by the next Load()
+		if (!bOk)
+			DeleteFileW(sFile.c_str());
+		return bOk;
+	}
+
+private:
+	HANDLE m_hFile = INVALID_HANDLE_VALUE;
+	HANDLE m_hMapping = nullptr;
+	const uint8_t* m_pView = nullptr;
+	const sHeader* m_pHeader = nullptr;
+	const sSprite* m_pSprites = nullptr;
+	const uint32_t* m_pCells = nullptr;
+};
+
+// The sound card, through the Win32 waveOut API. A ring of nBlocks buffers is
+// queued on the device, and AcquireBlock() sleeps until the device hands one back.
+class waveOutAudioSink : public audioSink
+{
+public:
+	waveOutAudioSink()
+	{
+
+	}
+
+	bool Open(unsigned int nSampleRate, unsigned int nChannels, unsigned int nBlocks, unsigned int nBlockSamples) override
+	{
+		m_nBlockCount = nBlocks;
+		m_nBlockSamples = nBlockSamples;
+		m_nBlockFree = m_nBlockCount;
+		m_nBlockCurrent = 0;
+		m_bCancelled = false;
+		m_nBlocksSubmitted = 0;
+
+		// Device is available
+		WAVEFORMATEX waveFormat;
+		waveFormat.wFormatTag = WAVE_FORMAT_PCM;
+		waveFormat.nSamplesPerSec = nSampleRate;
+		waveFormat.wBitsPerSample = sizeof(short) * 8;
+		waveFormat.nChannels = nChannels;
+		waveFormat.nBlockAlign = (waveFormat.wBitsPerSample / 8) * waveFormat.nChannels;
+		waveFormat.nAvgBytesPerSec = waveFormat.nSamplesPerSec * waveFormat.nBlockAlign;
+		waveFormat.cbSize = 0;
+
+		// Open Device if valid
+		if (waveOutOpen(&m_hwDevice, WAVE_MAPPER, &waveFormat, (DWORD_PTR)waveOutProcWrap, (DWORD_PTR)this, CALLBACK_FUNCTION) != S_OK)
+		{
+			m_hwDevice = nullptr;
+			return false;
+		}
+
+		// Allocate Wave|Block Memory
+		m_pBlockMemory = new short[m_nBlockCount * m_nBlockSamples];
+		ZeroMemory(m_pBlockMemory, sizeof(short) * m_nBlockCount * m_nBlockSamples);
+
+		m_pWaveHeaders = new WAVEHDR[m_nBlockCount];
+		ZeroMemory(m_pWaveHeaders, sizeof(WAVEHDR) * m_nBlockCount);
+
+		// Link headers to block memory
+		for (unsigned int n = 0; n < m_nBlockCount; n++)
+		{
+			m_pWaveHeaders[n].dwBufferLength = m_nBlockSamples * sizeof(short);
+			m_pWaveHeaders[n].lpData = (LPSTR)(m_pBlockMemory + (n * m_nBlockSamples));
+		}
+		return true;
+	}
+
+	short* AcquireBlock() override
+	{
+		// Wait for block to become available
+		if (m_nBlockFree == 0)
+		{
+			std::unique_lock<std::mutex> lm(m_muxBlockNotZero);
+			while (m_nBlockFree == 0 && !m_bCancelled) // sometimes, Windows signals incorrectly
+				m_cvBlockNotZero.wait(lm);
+		}
+		if (m_bCancelled)
+			return nullptr;
+
+		// Block is here, so use it
+		m_nBlockFree--;
+
+		// Prepare block for processing
+		if (m_pWaveHeaders[m_nBlockCurrent].dwFlags & WHDR_PREPARED)
+			waveOutUnprepareHeader(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
+
+		return m_pBlockMemory + m_nBlockCurrent * m_nBlockSamples;
+	}
+
+	void SubmitBlock() override
+	{
+		waveOutPrepareHeader(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
+		waveOutWrite(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
+		m_nBlockCurrent++;
+		m_nBlockCurrent %= m_nBlockCount;
+		m_nBlocksSubmitted++;
+	}
+
+	void Cancel() override
+	{
+		std::unique_lock<std::mutex> lm(m_muxBlockNotZero);
+		m_bCancelled = true;
+		m_cvBlockNotZero.notify_one();
+	}
+
+	void Close() override
+	{
+		if (m_hwDevice != nullptr)
+		{
+			// Hand back every queued block before the memory goes
+			waveOutReset(m_hwDevice);
+			for (unsigned int n = 0; n < m_nBlockCount; n++)
+				if (m_pWaveHeaders[n].dwFlags & WHDR_PREPARED)
+					waveOutUnprepareHeader(m_hwDevice, &m_pWaveHeaders[n], sizeof(WAVEHDR));
+			waveOutClose(m_hwDevice);
+			m_hwDevice = nullptr;
+		}
+
+		delete[] m_pWaveHeaders;
+		delete[] m_pBlockMemory;
+		m_pWaveHeaders = nullptr;
+		m_pBlockMemory = nullptr;
+	}
+
+private:
+	// Handler for soundcard request for more data
+	void waveOutProc(HWAVEOUT hWaveOut, UINT uMsg, DWORD dwParam1, DWORD dwParam2)
+	{
+		if (uMsg != WOM_DONE) return;
+		m_nBlockFree++;
+		std::unique_lock<std::mutex> lm(m_muxBlockNotZero);
+		m_cvBlockNotZero.notify_one();
+	}
+
+	// Static wrapper for sound card handler
+	static void CALLBACK waveOutProcWrap(HWAVEOUT hWaveOut, UINT uMsg, DWORD dwInstance, DWORD dwParam1, DWORD dwParam2)
+	{
+		((waveOutAudioSink*)dwInstance)->waveOutProc(hWaveOut, uMsg, dwParam1, dwParam2);
+	}
+
+	unsigned int m_nBlockCount = 0;
+	unsigned int m_nBlockSamples = 0;
+	unsigned int m_nBlockCurrent = 0;
+
+	short* m_pBlockMemory = nullptr;
+	WAVEHDR* m_pWaveHeaders = nullptr;
+	HWAVEOUT m_hwDevice = nullptr;
+
+	std::atomic<unsigned int> m_nBlockFree = 0;
+	std::atomic<bool> m_bCancelled = false;
+	std::condition_variable m_cvBlockNotZero;
+	std::mutex m_muxBlockNotZero;
 };
 
 class consoleWindowEngine
 {
 public:
-	consoleWindowEngine()
+	// nJobWorkers sizes Jobs(), by default one worker for every core beyond the first
+	consoleWindowEngine(int nJobWorkers = -1) : m_jobs(nJobWorkers), m_assets(m_jobs)
 	{
 		m_nScreenWidth = 80;
 		m_nScreenHeight = 30;
@@ -205,15 +582,35 @@ public:
 		m_hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
 		m_hConsoleIn = GetStdHandle(STD_INPUT_HANDLE);
 
-		std::memset(m_keyNewState, 0, 256 * sizeof(short));
-		std::memset(m_keyOldState, 0, 256 * sizeof(short));
 		std::memset(m_keys, 0, 256 * sizeof(sKeyState));
+		std::memset(m_mouse, 0, 5 * sizeof(sKeyState));
 		m_mousePosX = 0;
 		m_mousePosY = 0;
 
 		m_bEnableSound = false;
 
 		m_sAppName = L"Default";
+
+		m_jobs.SetTrace(&m_trace);
+		m_frameCapture.SetTrace(&m_trace);
+		m_assets.SetTrace(&m_trace);
+
+		// Sprites and sounds can be loaded through Assets(), anything else needs its own loader
+		m_assets.SetLoader<olcSprite>([](const std::wstring& sFile, olcSprite& sprite, size_t& nBytes)
+			{
+				if (!sprite.Load(sFile))
+					return false;
+				nBytes = (size_t)sprite.nWidth * sprite.nHeight * 2 * sizeof(short);
+				return true;
+			});
+		m_assets.SetLoader<olcAudioSample>([this](const std::wstring& sFile, olcAudioSample& sample, size_t& nBytes)
+			{
+				if (!m_bEnableSound)
+					return false;
+				sample = olcAudioSample(sFile, m_nSampleRate);
+				nBytes = (size_t)sample.nSamples * sample.nChannels * sizeof(float);
+				return sample.bSampleValid;
+			});
 	}
 
 	void EnableSound()
@@ -307,41 +704,79 @@ public:
 
 	virtual void Draw(int x, int y, short c = 0x2588, short col = 0x000F)
 	{
-		if (x >= 0 && x < m_nScreenWidth && y >= 0 && y < m_nScreenHeight)
-		{
-			m_bufScreen[y * m_nScreenWidth + x].Char.UnicodeChar = c;
-			m_bufScreen[y * m_nScreenWidth + x].Attributes = col;
-		}
+		PlotCell<true>(x, y, c, col);
+	}
+
+	// Span-level framebuffer writes. Each clips once against the current target and then
+	// stores whole rows, the built-in primitives below are written on top of these rather
+	// than a virtual Draw() and bounds check per cell
+
+	void Clear(short c = 0x2588, short col = 0x000F)
+	{
+		int nCells = m_nScreenWidth * m_nScreenHeight;
+		FillCellRow(m_bufScreen, c, col, nCells);
+		if (m_pOverdrawCounts)
+			CountCellRow(m_pOverdrawCounts, nCells);
+	}
+
+	// Cells x1..x2 inclusive on row y
+	void FillSpan(int x1, int x2, int y, short c = 0x2588, short col = 0x000F)
+	{
+		if (y < 0 || y >= m_nScreenHeight)
+			return;
+		if (x1 < 0) x1 = 0;
+		if (x2 >= m_nScreenWidth) x2 = m_nScreenWidth - 1;
+		if (x2 < x1)
+			return;
+
+		int i = y * m_nScreenWidth + x1;
+		FillCellRow(m_bufScreen + i, c, col, x2 - x1 + 1);
+		if (m_pOverdrawCounts)
+			CountCellRow(m_pOverdrawCounts + i, x2 - x1 + 1);
+	}
+
+	// Opaque copy of n cells to (x, y), spaces included
+	void BlitRow(int x, int y, const CHAR_INFO* pSrc, int n)
+	{
+		if (y < 0 || y >= m_nScreenHeight)
+			return;
+		if (x < 0) { pSrc -= x; n += x; x = 0; }
+		n = (std::min)(n, m_nScreenWidth - x);
+		if (n <= 0)
+			return;
+
+		int i = y * m_nScreenWidth + x;
+		memcpy(m_bufScreen + i, pSrc, sizeof(CHAR_INFO) * n);
+		if (m_pOverdrawCounts)
+			CountCellRow(m_pOverdrawCounts + i, n);
 	}
 
+	// Rectangle from (x1, y1) up to but not including (x2, y2)
 	void Fill(int x1, int y1, int x2, int y2, short c = 0x2588, short col = 0x000F)
 	{
 		Clip(x1, y1);
 		Clip(x2, y2);
-		for (int x = x1; x < x2; x++)
-			for (int y = y1; y < y2; y++)
-				Draw(x, y, c, col);
+		for (int y = y1; y < y2; y++)
+			FillSpan(x1, x2 - 1, y, c, col);
 	}
 
-	void DrawString(int x, int y, std::wstring c, short col = 0x000F)
+	void DrawString(int x, int y, const std::wstring& c, short col = 0x000F)
 	{
-		for (size_t i = 0; i < c.size(); i++)
-		{
-			m_bufScreen[y * m_nScreenWidth + x + i].Char.UnicodeChar = c[i];
-			m_bufScreen[y * m_nScreenWidth + x + i].Attributes = col;
-		}
+		int nFrom, nTo;
+		if (!ClipString(x, y, (int)c.size(), nFrom, nTo))
+			return;
+		for (int i = nFrom; i < nTo; i++)
+			PutCell(x + i, y, c[i], col);
 	}
 
-	void DrawStringAlpha(int x, int y, std::wstring c, short col = 0x000F)
+	void DrawStringAlpha(int x, int y, const std::wstring& c, short col = 0x000F)
 	{
-		for (size_t i = 0; i < c.size(); i++)
-		{
+		int nFrom, nTo;
+		if (!ClipString(x, y, (int)c.size(), nFrom, nTo))
+			return;
+		for (int i = nFrom; i < nTo; i++)
 			if (c[i] != L' ')
-			{
-				m_bufScreen[y * m_nScreenWidth + x + i].Char.UnicodeChar = c[i];
-				m_bufScreen[y * m_nScreenWidth + x + i].Attributes = col;
-			}
-		}
+				PutCell(x + i, y, c[i], col);
 	}
 
 	void Clip(int& x, int& y)
@@ -354,63 +789,29 @@ public:
 
 	void DrawLine(int x1, int y1, int x2, int y2, short c = 0x2588, short col = 0x000F)
 	{
-		int x, y, dx, dy, dx1, dy1, px, py, xe, ye, i;
-		dx = x2 - x1; dy = y2 - y1;
-		dx1 = abs(dx); dy1 = abs(dy);
-		px = 2 * dy1 - dx1;	py = 2 * dx1 - dy1;
-		if (dy1 <= dx1)
+		// Axis aligned lines are single spans
+		if (y1 == y2)
 		{
-			if (dx >= 0)
-			{
-				x = x1; y = y1; xe = x2;
-			}
-			else
-			{
-				x = x2; y = y2; xe = x1;
-			}
-
-			Draw(x, y, c, col);
-
-			for (i = 0; x < xe; i++)
-			{
-				x = x + 1;
-				if (px < 0)
-					px = px + 2 * dy1;
-				else
-				{
-					if ((dx < 0 && dy < 0) || (dx > 0 && dy > 0)) y = y + 1; else y = y - 1;
-					px = px + 2 * (dy1 - dx1);
-				}
-				Draw(x, y, c, col);
-			}
+			FillSpan((std::min)(x1, x2), (std::max)(x1, x2), y1, c, col);
+			return;
 		}
-		else
+		if (x1 == x2)
 		{
-			if (dy >= 0)
-			{
-				x = x1; y = y1; ye = y2;
-			}
-			else
-			{
-				x = x2; y = y2; ye = y1;
-			}
+			if (x1 < 0 || x1 >= m_nScreenWidth)
+				return;
+			int ys = (std::max)((std::min)(y1, y2), 0);
+			int ye = (std::min)((std::max)(y1, y2), m_nScreenHeight - 1);
+			for (int y = ys; y <= ye; y++)
+				PutCell(x1, y, c, col);
+			return;
+		}
 
-			Draw(x, y, c, col);
-
-			for (i = 0; y < ye; i++)
-			{
-				y = y + 1;
-				if (py <= 0)
-					py = py + 2 * dx1;
-				else
-				{
-					if ((dx < 0 && dy < 0) || (dx > 0 && dy > 0)) x = x + 1; else x = x - 1;
-					py = py + 2 * (dx1 - dy1);
-				}
-				Draw(x, y, c, col);
-			}
-		}
-	}
+		// Only lines leaving the screen need testing cell by cell
+		if (InsideScreen((std::min)(x1, x2), (std::min)(y1, y2), (std::max)(x1, x2), (std::max)(y1, y2)))
+			LineCells<false>(x1, y1, x2, y2, c, col);
+		else
+			LineCells<true>(x1, y1, x2, y2, c, col);
+	}
 
 	void DrawTriangle(int x1, int y1, int x2, int y2, int x3, int y3, short c = 0x2588, short col = 0x000F)
 	{
@@ -423,7 +824,7 @@ public:
 	void FillTriangle(int x1, int y1, int x2, int y2, int x3, int y3, short c = 0x2588, short col = 0x000F)
 	{
 		auto SWAP = [](int& x, int& y) { int t = x; x = y; y = t; };
-		auto drawline = [&](int sx, int ex, int ny) { for (int i = sx; i <= ex; i++) Draw(i, ny, c, col); };
+		auto drawline = [&](int sx, int ex, int ny) { FillSpan(sx, ex, ny, c, col); };
 
 		int t1x, t2x, y, minx, maxx, t1xp, t2xp;
 		bool changed1 = false;
@@ -559,24 +960,11 @@ public:
 
 	void DrawCircle(int xc, int yc, int r, short c = 0x2588, short col = 0x000F)
 	{
-		int x = 0;
-		int y = r;
-		int p = 3 - 2 * r;
 		if (!r) return;
-
-		while (y >= x) // only formulate 1/8 of circle
-		{
-			Draw(xc - x, yc - y, c, col);//upper left left
-			Draw(xc - y, yc - x, c, col);//upper upper left
-			Draw(xc + y, yc - x, c, col);//upper upper right
-			Draw(xc + x, yc - y, c, col);//upper right right
-			Draw(xc - x, yc + y, c, col);//lower left left
-			Draw(xc - y, yc + x, c, col);//lower lower left
-			Draw(xc + y, yc + x, c, col);//lower lower right
-			Draw(xc + x, yc + y, c, col);//lower right right
-			if (p < 0) p += 4 * x++ + 6;
-			else p += 4 * (x++ - y--) + 10;
-		}
+		if (InsideScreen(xc - r, yc - r, xc + r, yc + r))
+			CircleCells<false>(xc, yc, r, c, col);
+		else
+			CircleCells<true>(xc, yc, r, c, col);
 	}
 
 	void FillCircle(int xc, int yc, int r, short c = 0x2588, short col = 0x000F)
@@ -587,19 +975,13 @@ public:
 		int p = 3 - 2 * r;
 		if (!r) return;
 
-		auto drawline = [&](int sx, int ex, int ny)
-		{
-			for (int i = sx; i <= ex; i++)
-				Draw(i, ny, c, col);
-		};
-
 		while (y >= x)
 		{
 			// Modified to draw scan-lines instead of edges
-			drawline(xc - x, xc + x, yc - y);
-			drawline(xc - y, xc + y, yc - x);
-			drawline(xc - x, xc + x, yc + y);
-			drawline(xc - y, xc + y, yc + x);
+			FillSpan(xc - x, xc + x, yc - y, c, col);
+			FillSpan(xc - y, xc + y, yc - x, c, col);
+			FillSpan(xc - x, xc + x, yc + y, c, col);
+			FillSpan(xc - y, xc + y, yc + x, c, col);
 			if (p < 0) p += 4 * x++ + 6;
 			else p += 4 * (x++ - y--) + 10;
 		}
@@ -610,14 +992,7 @@ public:
 		if (sprite == nullptr)
 			return;
 
-		for (int i = 0; i < sprite->nWidth; i++)
-		{
-			for (int j = 0; j < sprite->nHeight; j++)
-			{
-				if (sprite->GetGlyph(i, j) != L' ')
-					Draw(x + i, y + j, sprite->GetGlyph(i, j), sprite->GetColour(i, j));
-			}
-		}
+		DrawPartialSprite(x, y, sprite, 0, 0, sprite->nWidth, sprite->nHeight);
 	}
 
 	void DrawPartialSprite(int x, int y, olcSprite* sprite, int ox, int oy, int w, int h)
@@ -625,56 +1000,289 @@ public:
 		if (sprite == nullptr)
 			return;
 
-		for (int i = 0; i < w; i++)
-		{
-			for (int j = 0; j < h; j++)
-			{
-				if (sprite->GetGlyph(i + ox, j + oy) != L' ')
-					Draw(x + i, y + j, sprite->GetGlyph(i + ox, j + oy), sprite->GetColour(i + ox, j + oy));
-			}
-		}
+		// Outside the sprite reads as transparent, so trim the source first
+		if (!ClipBlit(x, y, ox, oy, w, h, sprite->nWidth, sprite->nHeight))
+			return;
+
+		for (int j = 0; j < h; j++)
+			BlitGlyphColourRow(&m_bufScreen[(y + j) * m_nScreenWidth + x], sprite->GlyphRow(oy + j) + ox, sprite->ColourRow(oy + j) + ox, w);
+	}
+
+	void DrawAtlasSprite(int x, int y, olcSpriteAtlas* atlas, int id)
+	{
+		if (atlas == nullptr || id < 0 || id >= atlas->SpriteCount())
+			return;
+
+		DrawPartialAtlasSprite(x, y, atlas, id, 0, 0, atlas->GetSprite(id).w, atlas->GetSprite(id).h);
+	}
+
+	void DrawPartialAtlasSprite(int x, int y, olcSpriteAtlas* atlas, int id, int ox, int oy, int w, int h)
+	{
+		if (atlas == nullptr || id < 0 || id >= atlas->SpriteCount())
+			return;
+
+		if (!ClipBlit(x, y, ox, oy, w, h, atlas->GetSprite(id).w, atlas->GetSprite(id).h))
+			return;
+
+		const uint32_t* pSrc = atlas->SpriteCells(id) + oy * atlas->Pitch() + ox;
+		for (int j = 0; j < h; j++)
+			BlitCellRow(&m_bufScreen[(y + j) * m_nScreenWidth + x], pSrc + j * atlas->Pitch(), w);
 	}
 
 	void DrawWireFrameModel(const std::vector<std::pair<float, float>>& vecModelCoordinates, float x, float y, float r = 0.0f, float s = 1.0f, short col = FG_WHITE, short c = PIXEL_SOLID)
 	{
 		// pair.first = x coordinate
 		// pair.second = y coordinate
+		int verts = (int)vecModelCoordinates.size();
+		if (verts == 0)
+			return;
+
+		// Rotate, scale and translate each vertex as its edge is drawn, carrying the
+		// previous one along instead of building a transformed copy of the model
+		float fCos = cosf(r), fSin = sinf(r);
+		auto transform = [&](int i, int& tx, int& ty)
+		{
+			const std::pair<float, float>& v = vecModelCoordinates[i];
+			tx = (int)((v.first * fCos - v.second * fSin) * s + x);
+			ty = (int)((v.first * fSin + v.second * fCos) * s + y);
+		};
+
+		// Draw Closed Polygon
+		int x1, y1, x2, y2;
+		transform(0, x1, y1);
+		for (int i = 0; i < verts + 1; i++)
+		{
+			transform((i + 1) % verts, x2, y2);
+			DrawLine(x1, y1, x2, y2, c, col);
+			x1 = x2; y1 = y2;
+		}
+	}
+
+private:
+	// Writes one cell of the current target with no bounds check, the caller has
+	// already clipped the primitive it belongs to
+	void PutCell(int x, int y, short c, short col)
+	{
+		int i = y * m_nScreenWidth + x;
+		m_bufScreen[i].Char.UnicodeChar = c;
+		m_bufScreen[i].Attributes = col;
+		if (m_pOverdrawCounts)
+			m_pOverdrawCounts[i]++;
+	}
+
+	template<bool bClip>
+	void PlotCell(int x, int y, short c, short col)
+	{
+		if (!bClip || (x >= 0 && x < m_nScreenWidth && y >= 0 && y < m_nScreenHeight))
+			PutCell(x, y, c, col);
+	}
+
+	bool InsideScreen(int x1, int y1, int x2, int y2) const
+	{
+		return x1 >= 0 && y1 >= 0 && x2 < m_nScreenWidth && y2 < m_nScreenHeight;
+	}
+
+	// Range [nFrom, nTo) of an n character string at (x, y) that lands on screen
+	bool ClipString(int x, int y, int n, int& nFrom, int& nTo) const
+	{
+		if (y < 0 || y >= m_nScreenHeight)
+			return false;
+		nFrom = (std::max)(0, -x);
+		nTo = (std::min)(n, m_nScreenWidth - x);
+		return nFrom < nTo;
+	}
+
+	template<bool bClip>
+	void LineCells(int x1, int y1, int x2, int y2, short c, short col)
+	{
+		int x, y, dx, dy, dx1, dy1, px, py, xe, ye, i;
+		dx = x2 - x1; dy = y2 - y1;
+		dx1 = abs(dx); dy1 = abs(dy);
+		px = 2 * dy1 - dx1;	py = 2 * dx1 - dy1;
+		if (dy1 <= dx1)
+		{
+			if (dx >= 0)
+			{
+				x = x1; y = y1; xe = x2;
+			}
+			else
+			{
+				x = x2; y = y2; xe = x1;
+			}
+
+			PlotCell<bClip>(x, y, c, col);
+
+			for (i = 0; x < xe; i++)
+			{
+				x = x + 1;
+				if (px < 0)
+					px = px + 2 * dy1;
+				else
+				{
+					if ((dx < 0 && dy < 0) || (dx > 0 && dy > 0)) y = y + 1; else y = y - 1;
+					px = px + 2 * (dy1 - dx1);
+				}
+				PlotCell<bClip>(x, y, c, col);
+			}
+		}
+		else
+		{
+			if (dy >= 0)
+			{
+				x = x1; y = y1; ye = y2;
+			}
+			else
+			{
+				x = x2; y = y2; ye = y1;
+			}
+
+			PlotCell<bClip>(x, y, c, col);
+
+			for (i = 0; y < ye; i++)
+			{
+				y = y + 1;
+				if (py <= 0)
+					py = py + 2 * dx1;
+				else
+				{
+					if ((dx < 0 && dy < 0) || (dx > 0 && dy > 0)) x = x + 1; else x = x - 1;
+					py = py + 2 * (dx1 - dy1);
+				}
+				PlotCell<bClip>(x, y, c, col);
+			}
+		}
+	}
 
-		// Create translated model vector of coordinate pairs
-		std::vector<std::pair<float, float>> vecTransformedCoordinates;
-		int verts = vecModelCoordinates.size();
-		vecTransformedCoordinates.resize(verts);
+	template<bool bClip>
+	void CircleCells(int xc, int yc, int r, short c, short col)
+	{
+		int x = 0;
+		int y = r;
+		int p = 3 - 2 * r;
 
-		// Rotate
-		for (int i = 0; i < verts; i++)
+		while (y >= x) // only formulate 1/8 of circle
 		{
-			vecTransformedCoordinates[i].first = vecModelCoordinates[i].first * cosf(r) - vecModelCoordinates[i].second * sinf(r);
-			vecTransformedCoordinates[i].second = vecModelCoordinates[i].first * sinf(r) + vecModelCoordinates[i].second * cosf(r);
+			PlotCell<bClip>(xc - x, yc - y, c, col);//upper left left
+			PlotCell<bClip>(xc - y, yc - x, c, col);//upper upper left
+			PlotCell<bClip>(xc + y, yc - x, c, col);//upper upper right
+			PlotCell<bClip>(xc + x, yc - y, c, col);//upper right right
+			PlotCell<bClip>(xc - x, yc + y, c, col);//lower left left
+			PlotCell<bClip>(xc - y, yc + x, c, col);//lower lower left
+			PlotCell<bClip>(xc + y, yc + x, c, col);//lower lower right
+			PlotCell<bClip>(xc + x, yc + y, c, col);//lower right right
+			if (p < 0) p += 4 * x++ + 6;
+			else p += 4 * (x++ - y--) + 10;
 		}
+	}
 
-		// Scale
-		for (int i = 0; i < verts; i++)
+	// n cells set to the same packed glyph|colour, four per store where SSE2 is available
+	static void FillCellRow(CHAR_INFO* pDst, short c, short col, int n)
+	{
+		static_assert(sizeof(CHAR_INFO) == sizeof(uint32_t), "CHAR_INFO expected to be glyph|colour");
+		const uint32_t nCell = (uint32_t)(uint16_t)c | ((uint32_t)(uint16_t)col << 16);
+		uint32_t* d = (uint32_t*)pDst;
+		int i = 0;
+#ifdef CGE_SSE2
+		const __m128i vCell = _mm_set1_epi32((int)nCell);
+		for (; i + 8 <= n; i += 8)
 		{
-			vecTransformedCoordinates[i].first = vecTransformedCoordinates[i].first * s;
-			vecTransformedCoordinates[i].second = vecTransformedCoordinates[i].second * s;
+			_mm_storeu_si128((__m128i*)(d + i), vCell);
+			_mm_storeu_si128((__m128i*)(d + i + 4), vCell);
 		}
+		for (; i + 4 <= n; i += 4)
+			_mm_storeu_si128((__m128i*)(d + i), vCell);
+#endif
+		for (; i < n; i++)
+			d[i] = nCell;
+	}
+
+	// Adds one write to n overdraw counters
+	static void CountCellRow(uint16_t* pCounts, int n)
+	{
+		int i = 0;
+#ifdef CGE_SSE2
+		const __m128i vOne = _mm_set1_epi16(1);
+		for (; i + 8 <= n; i += 8)
+			_mm_storeu_si128((__m128i*)(pCounts + i), _mm_add_epi16(_mm_loadu_si128((const __m128i*)(pCounts + i)), vOne));
+#endif
+		for (; i < n; i++)
+			pCounts[i]++;
+	}
+
+	// Clips a w*h blit of source region (ox, oy) to position (x, y) against both the
+	// source size and the screen, once per sprite rather than once per cell.
+	// Returns false if nothing is left to draw
+	bool ClipBlit(int& x, int& y, int& ox, int& oy, int& w, int& h, int nSrcWidth, int nSrcHeight)
+	{
+		if (ox < 0) { x -= ox; w += ox; ox = 0; }
+		if (oy < 0) { y -= oy; h += oy; oy = 0; }
+		w = (std::min)(w, nSrcWidth - ox);
+		h = (std::min)(h, nSrcHeight - oy);
+
+		if (x < 0) { ox -= x; w += x; x = 0; }
+		if (y < 0) { oy -= y; h += y; y = 0; }
+		w = (std::min)(w, m_nScreenWidth - x);
+		h = (std::min)(h, m_nScreenHeight - y);
+		return w > 0 && h > 0;
+	}
 
-		// Translate
-		for (int i = 0; i < verts; i++)
+	// Copies a row of packed glyph|colour cells, skipping transparent (space) glyphs
+	static void BlitCellRow(CHAR_INFO* pDst, const uint32_t* pSrc, int n)
+	{
+		static_assert(sizeof(CHAR_INFO) == sizeof(uint32_t), "CHAR_INFO expected to be glyph|colour");
+		uint32_t* d = (uint32_t*)pDst;
+		int i = 0;
+#ifdef CGE_SSE2
+		const __m128i vSpace = _mm_set1_epi32(L' ');
+		const __m128i vGlyphMask = _mm_set1_epi32(0xFFFF);
+		for (; i + 4 <= n; i += 4)
 		{
-			vecTransformedCoordinates[i].first = vecTransformedCoordinates[i].first + x;
-			vecTransformedCoordinates[i].second = vecTransformedCoordinates[i].second + y;
+			__m128i vSrc = _mm_loadu_si128((const __m128i*)(pSrc + i));
+			__m128i vDst = _mm_loadu_si128((const __m128i*)(d + i));
+			__m128i vKeep = _mm_cmpeq_epi32(_mm_and_si128(vSrc, vGlyphMask), vSpace);
+			_mm_storeu_si128((__m128i*)(d + i), _mm_or_si128(_mm_and_si128(vKeep, vDst), _mm_andnot_si128(vKeep, vSrc)));
 		}
+#endif
+		for (; i < n; i++)
+			if ((pSrc[i] & 0xFFFF) != L' ')
+				d[i] = pSrc[i];
+	}
 
-		// Draw Closed Polygon
-		for (int i = 0; i < verts + 1; i++)
+	// Same for olcSprite's separate glyph and colour planes, interleaving as it goes
+	static void BlitGlyphColourRow(CHAR_INFO* pDst, const short* pGlyphs, const short* pColours, int n)
+	{
+		int i = 0;
+#ifdef CGE_SSE2
+		uint32_t* d = (uint32_t*)pDst;
+		const __m128i vSpace = _mm_set1_epi16(L' ');
+		for (; i + 8 <= n; i += 8)
 		{
-			int j = (i + 1);
-			DrawLine((int)vecTransformedCoordinates[i % verts].first, (int)vecTransformedCoordinates[i % verts].second,
-				(int)vecTransformedCoordinates[j % verts].first, (int)vecTransformedCoordinates[j % verts].second, c, col);
+			__m128i vGlyph = _mm_loadu_si128((const __m128i*)(pGlyphs + i));
+			__m128i vColour = _mm_loadu_si128((const __m128i*)(pColours + i));
+			__m128i vKeep = _mm_cmpeq_epi16(vGlyph, vSpace);
+
+			__m128i vSrcLo = _mm_unpacklo_epi16(vGlyph, vColour);
+			__m128i vSrcHi = _mm_unpackhi_epi16(vGlyph, vColour);
+			__m128i vKeepLo = _mm_unpacklo_epi16(vKeep, vKeep);
+			__m128i vKeepHi = _mm_unpackhi_epi16(vKeep, vKeep);
+			__m128i vDstLo = _mm_loadu_si128((const __m128i*)(d + i));
+			__m128i vDstHi = _mm_loadu_si128((const __m128i*)(d + i + 4));
+
+			_mm_storeu_si128((__m128i*)(d + i), _mm_or_si128(_mm_and_si128(vKeepLo, vDstLo), _mm_andnot_si128(vKeepLo, vSrcLo)));
+			_mm_storeu_si128((__m128i*)(d + i + 4), _mm_or_si128(_mm_and_si128(vKeepHi, vDstHi), _mm_andnot_si128(vKeepHi, vSrcHi)));
+		}
+#endif
+		for (; i < n; i++)
+		{
+			if (pGlyphs[i] != L' ')
+			{
+				pDst[i].Char.UnicodeChar = pGlyphs[i];
+				pDst[i].Attributes = pColours[i];
+			}
 		}
 	}
 
+public:
 	~consoleWindowEngine()
 	{
 		SetConsoleActiveScreenBuffer(m_hOriginalConsole);
@@ -686,10 +1294,83 @@ public:
 	{
 		// Start the thread
 		m_bAtomActive = true;
+		m_bInputThreadActive = true;
+		std::thread tInput = std::thread(&consoleWindowEngine::InputThread, this);
 		std::thread t = std::thread(&consoleWindowEngine::GameThread, this);
 
 		// Wait for thread to be exited
 		t.join();
+		m_bInputThreadActive = false;
+		tInput.join();
+	}
+
+	// Runs without a console window for batch jobs, in place of ConstructConsole() and
+	// Start(). OnWindowCreate() is called, then OnWindowUpdate() nFrames times, each
+	// given fFrameTime as its elapsed time, and every frame is recorded to sCaptureFile.
+	// Nothing is read from the keyboard or mouse, and the capture waits for its writer
+	// rather than dropping frames. False if the user's create or update returned false,
+	// or the capture couldn't be opened or written
+	bool RenderOffline(int width, int height, const std::wstring& sCaptureFile, int nFrames, float fFrameTime)
+	{
+		m_nScreenWidth = width;
+		m_nScreenHeight = height;
+		m_bufScreen = new CHAR_INFO[m_nScreenWidth * m_nScreenHeight];
+		memset(m_bufScreen, 0, sizeof(CHAR_INFO) * m_nScreenWidth * m_nScreenHeight);
+
+		{
+			traceScope scope(m_trace, "OnWindowCreate");
+			if (!OnWindowCreate())
+				return false;
+		}
+
+		if (!m_frameCapture.Start(sCaptureFile, m_nScreenWidth, m_nScreenHeight))
+			return false;
+
+		bool bOk = true;
+		for (int f = 0; f < nFrames && bOk; f++)
+		{
+			traceScope scopeFrame(m_trace, "Frame");
+			m_frameArena.Reset();
+			m_bFrameUnchanged = false;
+			{
+				traceScope scope(m_trace, "OnWindowUpdate");
+				bOk = OnWindowUpdate(fFrameTime);
+			}
+			m_nFrameCount++;
+
+			// An unchanged frame left the one before in the buffer, which is still right
+			if (bOk)
+				m_frameCapture.SubmitWait(m_bufScreen, fFrameTime);
+
+			// No point rendering the rest of a capture that can't be written
+			bOk = bOk && !m_frameCapture.WriteFailed();
+		}
+
+		m_frameCapture.Stop();
+		bOk = bOk && !m_frameCapture.WriteFailed();
+		StopTrace();
+		OnUserDestroy();
+		return bOk;
+	}
+
+	// Saves every frame's input and elapsed time to a file. Call before Start()
+	// or from the game thread
+	bool StartInputRecording(std::wstring sFile)
+	{
+		return m_inputTimeline.StartRecording(sFile);
+	}
+
+	// Plays a recording back in place of live input, frame for frame, with the
+	// recorded elapsed times. Call before Start() to replay from the first frame
+	bool StartInputReplay(std::wstring sFile, bool bExitAtEnd = true)
+	{
+		m_bExitAtReplayEnd = bExitAtEnd;
+		return m_inputTimeline.StartReplay(sFile);
+	}
+
+	void StopInputTimeline()
+	{
+		m_inputTimeline.Stop();
 	}
 
 	int ScreenWidth()
@@ -702,12 +1383,146 @@ public:
 		return m_nScreenHeight;
 	}
 
+	// Sends all drawing, and ScreenWidth()/ScreenHeight(), to another grid of cells
+	// until EndRenderTarget(), e.g. to draw part of a frame at a lower resolution
+	void BeginRenderTarget(CHAR_INFO* pTarget, int nWidth, int nHeight)
+	{
+		m_bufScreenSaved = m_bufScreen;
+		m_nScreenWidthSaved = m_nScreenWidth;
+		m_nScreenHeightSaved = m_nScreenHeight;
+		m_bufScreen = pTarget;
+		m_nScreenWidth = nWidth;
+		m_nScreenHeight = nHeight;
+	}
+
+	void EndRenderTarget()
+	{
+		if (m_bufScreenSaved == nullptr)
+			return;
+		m_bufScreen = m_bufScreenSaved;
+		m_nScreenWidth = m_nScreenWidthSaved;
+		m_nScreenHeight = m_nScreenHeightSaved;
+		m_bufScreenSaved = nullptr;
+	}
+
+	// Counts every write Draw() makes into pCounts, one counter per cell of the current
+	// render target, until EndOverdrawCount(). Anything else drawing straight into the
+	// cells can add itself through OverdrawCounts()
+	void BeginOverdrawCount(uint16_t* pCounts)
+	{
+		m_pOverdrawCounts = pCounts;
+	}
+
+	void EndOverdrawCount()
+	{
+		m_pOverdrawCounts = nullptr;
+	}
+
+	// nullptr while nothing is being counted
+	uint16_t* OverdrawCounts()
+	{
+		return m_pOverdrawCounts;
+	}
+
+	// Call from OnWindowUpdate() when the screen and the frame stats are exactly as the
+	// last frame left them. Nothing is presented, and instead of going straight on to
+	// the next frame the game thread naps for nIdleSleepMs, so a still scene costs next
+	// to nothing. Input keeps being queued while it sleeps
+	void SetFrameUnchanged()
+	{
+		m_bFrameUnchanged = true;
+	}
+
+	void SetIdleSleep(int nMilliseconds)
+	{
+		m_nIdleSleepMs = nMilliseconds;
+	}
+
+	// Adds to the stats shown in the title after the FPS, cut short once they fill
+	// the buffer rather than overrunning it. Call from OnWindowUpdate()
+	void AppendFrameStats(const wchar_t* sFormat, ...)
+	{
+		size_t nStats = wcslen(m_sFrameStats);
+		va_list args;
+		va_start(args, sFormat);
+		_vsnwprintf_s(m_sFrameStats + nStats, nFrameStatsLength - nStats, _TRUNCATE, sFormat, args);
+		va_end(args);
+	}
+
+	// Shared worker threads, for anything that can be split up and run in parallel
+	jobSystem& Jobs()
+	{
+		return m_jobs;
+	}
+
+	// Loads and shares sprites, sounds and whatever else the application gives a
+	// loader, on the job system, see assetManager.h
+	assetManager& Assets()
+	{
+		return m_assets;
+	}
+
+	// Timeline of what every engine thread was doing, add events with traceScope
+	traceRecorder& Trace()
+	{
+		return m_trace;
+	}
+
+	// Records a timeline until StopTrace(), or until the engine shuts down, then
+	// writes it to sFile as Chrome trace JSON. Call before Start() to include loading
+	void StartTrace(std::wstring sFile, int nEventsPerThread = 16384)
+	{
+		m_sTraceFile = sFile;
+		m_trace.Start(nEventsPerThread);
+	}
+
+	bool StopTrace()
+	{
+		if (!m_trace.IsRecording())
+			return false;
+		m_trace.Stop();
+		return m_trace.Write(m_sTraceFile);
+	}
+
+	// Streams every presented frame to a capture file, compressed and written on a
+	// background thread, see frameCapture.h. Safe to call from OnWindowUpdate(), the
+	// capture starts or stops between frames, so the file name is copied rather than
+	// held in a string and the frame never touches the heap
+	void StartFrameCapture(const wchar_t* sFile, int nRingFrames = 8)
+	{
+		wcsncpy_s(m_sCaptureFile, 260, sFile, _TRUNCATE);
+		m_nCaptureRingFrames = nRingFrames;
+		m_nCaptureRequest = CAPTURE_START;
+	}
+
+	void StopFrameCapture()
+	{
+		m_nCaptureRequest = CAPTURE_STOP;
+	}
+
+	bool IsCapturingFrames() { return m_frameCapture.IsRecording(); }
+	unsigned int CaptureFramesWritten() { return m_frameCapture.FramesWritten(); }
+	unsigned int CaptureFramesDropped() { return m_frameCapture.FramesDropped(); }
+
+	// Allocator for data that only needs to live until the end of the current frame
+	template<typename T>
+	frameArenaAllocator<T> FrameAllocator()
+	{
+		return frameArenaAllocator<T>(&m_frameArena);
+	}
+
 private:
 	void GameThread()
 	{
+		traceRecorder::SetThreadName("Game");
+		frameArenaHeapCheckThread() = true;
+
 		// Create user resources as part of this thread
-		if (!OnWindowCreate())
-			m_bAtomActive = false;
+		{
+			traceScope scope(m_trace, "OnWindowCreate");
+			if (!OnWindowCreate())
+				m_bAtomActive = false;
+		}
 
 		// Check if sound system should be enabled
 		if (m_bEnableSound)
@@ -732,121 +1547,70 @@ private:
 				std::chrono::duration<float> elapsedTime = tp2 - tp1;
 				tp1 = tp2;
 				float fElapsedTime = elapsedTime.count();
+				traceScope scopeFrame(m_trace, "Frame");
 
-				// Handle Keyboard Input
-				for (int i = 0; i < 256; i++)
+				// Handle Keyboard and Mouse Input
 				{
-					m_keyNewState[i] = GetAsyncKeyState(i);
+					traceScope scope(m_trace, "Input");
+					UpdateInput(fElapsedTime);
+				}
 
-					m_keys[i].bPressed = false;
-					m_keys[i].bReleased = false;
+				// Transient render data from last frame is no longer needed
+				m_frameArena.Reset();
 
-					if (m_keyNewState[i] != m_keyOldState[i])
-					{
-						if (m_keyNewState[i] & 0x8000)
-						{
-							m_keys[i].bPressed = !m_keys[i].bHeld;
-							m_keys[i].bHeld = true;
-						}
-						else
-						{
-							m_keys[i].bReleased = true;
-							m_keys[i].bHeld = false;
-						}
-					}
+#if FRAME_ARENA_HEAP_CHECK
+				size_t nHeapAllocsBefore = frameArenaHeapAllocCount();
+				size_t nArenaAllocsBefore = m_frameArena.HeapAllocCount();
+#endif
 
-					m_keyOldState[i] = m_keyNewState[i];
+				// Handle Frame Update
+				m_bFrameUnchanged = false;
+				{
+					traceScope scope(m_trace, "OnWindowUpdate");
+					if (!OnWindowUpdate(fElapsedTime))
+						m_bAtomActive = false;
 				}
 
-				// Handle Mouse Input - Check for window events
-				INPUT_RECORD inBuf[32];
-				DWORD events = 0;
-				GetNumberOfConsoleInputEvents(m_hConsoleIn, &events);
-				if (events > 0)
-					ReadConsoleInput(m_hConsoleIn, inBuf, events, &events);
+#if FRAME_ARENA_HEAP_CHECK
+				// Once warmed up, the only heap traffic a frame may cause is the
+				// arena growing itself, everything else must come from the arena
+				size_t nFrameHeapAllocs = frameArenaHeapAllocCount() - nHeapAllocsBefore;
+				size_t nFrameArenaAllocs = m_frameArena.HeapAllocCount() - nArenaAllocsBefore;
+				if (m_nFrameCount >= m_nFrameArenaWarmupFrames)
+					assert(nFrameHeapAllocs == nFrameArenaAllocs && "Steady-state frame allocated from the global heap");
+#endif
+				m_nFrameCount++;
 
-				// Handle events - we only care about mouse clicks and movement
-				// for now
-				for (DWORD i = 0; i < events; i++)
+				// Update Title & Present Screen Buffer, the console already shows an unchanged frame
+				if (!m_bFrameUnchanged)
 				{
-					switch (inBuf[i].EventType)
-					{
-					case FOCUS_EVENT:
-					{
-						m_bConsoleInFocus = inBuf[i].Event.FocusEvent.bSetFocus;
-					}
-					break;
-
-					case MOUSE_EVENT:
-					{
-						switch (inBuf[i].Event.MouseEvent.dwEventFlags)
-						{
-						case MOUSE_MOVED:
-						{
-							m_mousePosX = inBuf[i].Event.MouseEvent.dwMousePosition.X;
-							m_mousePosY = inBuf[i].Event.MouseEvent.dwMousePosition.Y;
-						}
-						break;
-
-						case 0:
-						{
-							for (int m = 0; m < 5; m++)
-								m_mouseNewState[m] = (inBuf[i].Event.MouseEvent.dwButtonState & (1 << m)) > 0;
-
-						}
-						break;
-
-						default:
-							break;
-						}
-					}
-					break;
-
-					default:
-						break;
-						// We don't care just at the moment
-					}
+					traceScope scopePresent(m_trace, "Present");
+					wchar_t s[nFrameStatsLength + 128];
+					swprintf_s(s, nFrameStatsLength + 128, L"OneLoneCoder.com - Console Game Engine - %s - FPS: %3.2f %s", m_sAppName.c_str(), 1.0f / fElapsedTime, m_sFrameStats);
+					SetConsoleTitle(s);
+					WriteConsoleOutput(m_hConsole, m_bufScreen, { (short)m_nScreenWidth, (short)m_nScreenHeight }, { 0,0 }, &m_rectWindow);
 				}
 
-				for (int m = 0; m < 5; m++)
-				{
-					m_mouse[m].bPressed = false;
-					m_mouse[m].bReleased = false;
-
-					if (m_mouseNewState[m] != m_mouseOldState[m])
-					{
-						if (m_mouseNewState[m])
-						{
-							m_mouse[m].bPressed = true;
-							m_mouse[m].bHeld = true;
-						}
-						else
-						{
-							m_mouse[m].bReleased = true;
-							m_mouse[m].bHeld = false;
-						}
-					}
+				UpdateFrameCapture(fElapsedTime);
 
-					m_mouseOldState[m] = m_mouseNewState[m];
+				if (m_bFrameUnchanged)
+				{
+					traceScope scopeIdle(m_trace, "Idle");
+					std::this_thread::sleep_for(std::chrono::milliseconds(m_nIdleSleepMs));
 				}
-
-
-				// Handle Frame Update
-				if (!OnWindowUpdate(fElapsedTime))
-					m_bAtomActive = false;
-
-				// Update Title & Present Screen Buffer
-				wchar_t s[256];
-				swprintf_s(s, 256, L"OneLoneCoder.com - Console Game Engine - %s - FPS: %3.2f", m_sAppName.c_str(), 1.0f / fElapsedTime);
-				SetConsoleTitle(s);
-				WriteConsoleOutput(m_hConsole, m_bufScreen, { (short)m_nScreenWidth, (short)m_nScreenHeight }, { 0,0 }, &m_rectWindow);
 			}
 
 			if (m_bEnableSound)
 			{
 				// Close and Clean up audio system
+				DestroyAudio();
 			}
 
+			// Finish off any input recording, capture and timeline so the files are complete
+			m_inputTimeline.Stop();
+			m_frameCapture.Stop();
+			StopTrace();
+
 			// Allow the user to free resources if they have overrided the destroy function
 			if (OnUserDestroy())
 			{
@@ -883,73 +1647,71 @@ protected: // Audio Engine =====================================================
 
 		}
 
-		olcAudioSample(std::wstring sWavFile)
+		// Decodes the whole file at once and converts it to nSampleRate, long
+		// tracks are better played as a stream, see LoadAudioStream()
+		olcAudioSample(std::wstring sWavFile, unsigned int nSampleRate = 44100)
 		{
-			// Load Wav file and convert to float format
-			FILE* f = nullptr;
-			_wfopen_s(&f, sWavFile.c_str(), L"rb");
-			if (f == nullptr)
+			wavFile file;
+			if (!file.Open(sWavFile))
 				return;
 
-			char dump[4];
-			std::fread(&dump, sizeof(char), 4, f); // Read "RIFF"
-			if (strncmp(dump, "RIFF", 4) != 0) return;
-			std::fread(&dump, sizeof(char), 4, f); // Not Interested
-			std::fread(&dump, sizeof(char), 4, f); // Read "WAVE"
-			if (strncmp(dump, "WAVE", 4) != 0) return;
-
-			// Read Wave description chunk
-			std::fread(&dump, sizeof(char), 4, f); // Read "fmt "
-			std::fread(&dump, sizeof(char), 4, f); // Not Interested
-			std::fread(&wavHeader, sizeof(WAVEFORMATEX) - 2, 1, f); // Read Wave Format Structure chunk
-			// Note the -2, because the structure has 2 bytes to indicate its own size
-			// which are not in the wav file
-
-// Just check if wave format is compatible with olcCGE
-			if (wavHeader.wBitsPerSample != 16 || wavHeader.nSamplesPerSec != 44100)
-			{
-				std::fclose(f);
-				return;
-			}
+			nChannels = file.Channels();
+			std::vector<float> vecDecoded((size_t)file.Frames() * nChannels);
+			file.Decode(0, file.Frames(), vecDecoded.data());
 
-			// Search for audio data chunk
-			long nChunksize = 0;
-			std::fread(&dump, sizeof(char), 4, f); // Read chunk header
-			std::fread(&nChunksize, sizeof(long), 1, f); // Read chunk size
-			while (strncmp(dump, "data", 4) != 0)
-			{
-				// Not audio data, so just skip it
-				std::fseek(f, nChunksize, SEEK_CUR);
-				std::fread(&dump, sizeof(char), 4, f);
-				std::fread(&nChunksize, sizeof(long), 1, f);
-			}
-
-			// Finally got to data, so read it all in and convert to float samples
-			nSamples = nChunksize / (wavHeader.nChannels * (wavHeader.wBitsPerSample >> 3));
-			nChannels = wavHeader.nChannels;
-
-			// Create floating point buffer to hold audio sample
-			fSample = new float[nSamples * nChannels];
-			float* pSample = fSample;
+			// Create floating point buffer to hold audio sample, at the engine's rate
+			audioResampler resampler;
+			resampler.Setup(file.SampleRate(), nSampleRate, nChannels);
+			long nCapacity = resampler.OutputFrames(file.Frames()) + 1;
+			fSample = new float[(size_t)nCapacity * nChannels];
 
-			// Read in audio data and normalise
-			for (long i = 0; i < nSamples; i++)
-			{
-				for (int c = 0; c < nChannels; c++)
+			long nRead = 0;
+			nSamples = resampler.Process(fSample, nCapacity, [&](float* pFrames, int nWanted)
 				{
-					short s = 0;
-					std::fread(&s, sizeof(short), 1, f);
-					*pSample = (float)s / (float)(MAXSHORT);
-					pSample++;
-				}
-			}
+					long n = (std::min)((long)nWanted, file.Frames() - nRead);
+					std::memcpy(pFrames, vecDecoded.data() + (size_t)nRead * nChannels, sizeof(float) * n * nChannels);
+					nRead += n;
+					return (int)n;
+				});
+
+			// Describes fSample, rather than the file
+			wavHeader.wFormatTag = WAVE_FORMAT_PCM;
+			wavHeader.nChannels = (WORD)nChannels;
+			wavHeader.nSamplesPerSec = nSampleRate;
+			wavHeader.wBitsPerSample = (WORD)file.BitsPerSample();
+			wavHeader.nBlockAlign = (WORD)(nChannels * file.BitsPerSample() / 8);
+			wavHeader.nAvgBytesPerSec = wavHeader.nSamplesPerSec * wavHeader.nBlockAlign;
+			wavHeader.cbSize = 0;
 
 			// All done, flag sound as valid
-			std::fclose(f);
-			bSampleValid = true;
+			bSampleValid = nSamples > 0;
 		}
 
-		WAVEFORMATEX wavHeader;
+		~olcAudioSample()
+		{
+			delete[] fSample;
+		}
+
+		// The mixer plays straight from fSample, so it moves with the sample rather than being copied
+		olcAudioSample(olcAudioSample&& other) noexcept
+		{
+			*this = std::move(other);
+		}
+
+		olcAudioSample& operator=(olcAudioSample&& other) noexcept
+		{
+			std::swap(wavHeader, other.wavHeader);
+			std::swap(fSample, other.fSample);
+			std::swap(nSamples, other.nSamples);
+			std::swap(nChannels, other.nChannels);
+			std::swap(bSampleValid, other.bSampleValid);
+			return *this;
+		}
+
+		olcAudioSample(const olcAudioSample&) = delete;
+		olcAudioSample& operator=(const olcAudioSample&) = delete;
+
+		WAVEFORMATEX wavHeader = {};
 		float* fSample = nullptr;
 		long nSamples = 0;
 		int nChannels = 0;
@@ -959,51 +1721,113 @@ protected: // Audio Engine =====================================================
 	// This vector holds all loaded sound samples in memory
 	std::vector<olcAudioSample> vecAudioSamples;
 
-	// This structure represents a sound that is currently playing. It only
-	// holds the sound ID and where this instance of it is up to for its
-	// current playback
-	struct sCurrentlyPlayingSample
-	{
-		int nAudioSampleID = 0;
-		long nSamplePosition = 0;
-		bool bFinished = false;
-		bool bLoop = false;
-	};
-	std::list<sCurrentlyPlayingSample> listActiveSamples;
+	// Long sounds played from disk as they go, the mixer keeps pointers to these
+	std::vector<std::unique_ptr<wavStream>> vecAudioStreams;
 
-	// Load a 16-bit WAVE file @ 44100Hz ONLY into memory. A sample ID
-	// number is returned if successful, otherwise -1
+	// Currently playing sounds. The voices belong to the audio thread, the game
+	// thread only sends it play and stop commands
+	audioMixer m_mixer;
+
+	// Load a PCM or float WAVE file of any rate into memory, converted to the
+	// engine's rate. A sample ID number is returned if successful, otherwise -1
 	unsigned int LoadAudioSample(std::wstring sWavFile)
 	{
 		if (!m_bEnableSound)
 			return -1;
 
-		olcAudioSample a(sWavFile);
+		traceScope scope(m_trace, "LoadAudioSample");
+
+		olcAudioSample a(sWavFile, m_nSampleRate);
 		if (a.bSampleValid)
 		{
-			vecAudioSamples.push_back(a);
+			vecAudioSamples.push_back(std::move(a));
 			return vecAudioSamples.size();
 		}
 		else
 			return -1;
 	}
 
-	// Add sample 'id' to the mixers sounds to play list
+	// Add sample 'id' to the mixers sounds to play list. Play and stop must only
+	// be called from the game thread, they are the producer end of the mixer's queue
 	void PlaySample(int id, bool bLoop = false)
 	{
-		sCurrentlyPlayingSample a;
-		a.nAudioSampleID = id;
-		a.nSamplePosition = 0;
-		a.bFinished = false;
-		a.bLoop = bLoop;
-		listActiveSamples.push_back(a);
+		if (id < 1 || id > (int)vecAudioSamples.size())
+			return;
+
+		olcAudioSample& a = vecAudioSamples[id - 1];
+		m_mixer.Play(id, a.fSample, a.nSamples, a.nChannels, bLoop);
 	}
 
+	// Stops every playing instance of sample 'id'
 	void StopSample(int id)
 	{
+		m_mixer.Stop(id);
+	}
 
+	// Same for a sample from Assets(), nothing plays until it has loaded. The voice
+	// pins the sample, so it stays loaded until it finishes even if the handle goes
+	void PlaySample(const assetHandle<olcAudioSample>& sample, bool bLoop = false)
+	{
+		olcAudioSample* a = sample.Get();
+		if (a == nullptr)
+			return;
+
+		// Negative ids keep them apart from LoadAudioSample()'s
+		m_mixer.Play(-sample.Id(), a->fSample, a->nSamples, a->nChannels, bLoop, sample.Pin());
 	}
 
+	void StopSample(const assetHandle<olcAudioSample>& sample)
+	{
+		if (sample.IsValid())
+			m_mixer.Stop(-sample.Id());
+	}
+
+	// Open a WAVE file to be streamed from disk when played, for music and other
+	// long sounds. A stream ID number is returned if successful, otherwise -1
+	unsigned int LoadAudioStream(std::wstring sWavFile)
+	{
+		if (!m_bEnableSound)
+			return -1;
+
+		traceScope scope(m_trace, "LoadAudioStream");
+
+		std::unique_ptr<wavStream> stream(new wavStream());
+		if (!stream->Open(sWavFile, m_nSampleRate))
+			return -1;
+
+		vecAudioStreams.push_back(std::move(stream));
+		return vecAudioStreams.size();
+	}
+
+	// A stream only plays once at a time, playing it again restarts it
+	void PlayStream(int id, bool bLoop = false)
+	{
+		if (id < 1 || id > (int)vecAudioStreams.size())
+			return;
+		m_mixer.PlayStream(vecAudioStreams[id - 1].get(), bLoop);
+	}
+
+	void StopStream(int id)
+	{
+		if (id < 1 || id > (int)vecAudioStreams.size())
+			return;
+		m_mixer.StopStream(vecAudioStreams[id - 1].get());
+	}
+
+public:
+	// Send audio somewhere other than the sound card, e.g. a nullAudioSink or
+	// wavFileAudioSink. Call before Start(), the sink must outlive the engine
+	void SetAudioSink(audioSink* pSink)
+	{
+		m_pAudioSink = pSink;
+	}
+
+	// Blocks the audio thread has mixed, and the average time it spent mixing each
+	unsigned int AudioBlocksMixed() { return m_nAudioBlocksMixed; }
+	float AudioMixTimePerBlock() { return m_nAudioBlocksMixed > 0 ? m_fAudioMixTime / (float)m_nAudioBlocksMixed : 0.0f; }
+
+protected:
+
 	// The audio system uses by default a specific wave format
 	bool CreateAudio(unsigned int nSampleRate = 44100, unsigned int nChannels = 1,
 		unsigned int nBlocks = 8, unsigned int nBlockSamples = 512)
@@ -1014,49 +1838,19 @@ protected: // Audio Engine =====================================================
 		m_nChannels = nChannels;
 		m_nBlockCount = nBlocks;
 		m_nBlockSamples = nBlockSamples;
-		m_nBlockFree = m_nBlockCount;
-		m_nBlockCurrent = 0;
-		m_pBlockMemory = nullptr;
-		m_pWaveHeaders = nullptr;
+		m_nAudioBlocksMixed = 0;
+		m_fAudioMixTime = 0.0f;
 
-		// Device is available
-		WAVEFORMATEX waveFormat;
-		waveFormat.wFormatTag = WAVE_FORMAT_PCM;
-		waveFormat.nSamplesPerSec = m_nSampleRate;
-		waveFormat.wBitsPerSample = sizeof(short) * 8;
-		waveFormat.nChannels = m_nChannels;
-		waveFormat.nBlockAlign = (waveFormat.wBitsPerSample / 8) * waveFormat.nChannels;
-		waveFormat.nAvgBytesPerSec = waveFormat.nSamplesPerSec * waveFormat.nBlockAlign;
-		waveFormat.cbSize = 0;
-
-		// Open Device if valid
-		if (waveOutOpen(&m_hwDevice, WAVE_MAPPER, &waveFormat, (DWORD_PTR)waveOutProcWrap, (DWORD_PTR)this, CALLBACK_FUNCTION) != S_OK)
+		// The sound card, unless the user asked for somewhere else
+		m_pAudioSinkActive = m_pAudioSink != nullptr ? m_pAudioSink : &m_waveOutSink;
+		if (!m_pAudioSinkActive->Open(m_nSampleRate, m_nChannels, m_nBlockCount, m_nBlockSamples))
 			return DestroyAudio();
 
-		// Allocate Wave|Block Memory
-		m_pBlockMemory = new short[m_nBlockCount * m_nBlockSamples];
-		if (m_pBlockMemory == nullptr)
-			return DestroyAudio();
-		ZeroMemory(m_pBlockMemory, sizeof(short) * m_nBlockCount * m_nBlockSamples);
-
-		m_pWaveHeaders = new WAVEHDR[m_nBlockCount];
-		if (m_pWaveHeaders == nullptr)
-			return DestroyAudio();
-		ZeroMemory(m_pWaveHeaders, sizeof(WAVEHDR) * m_nBlockCount);
-
-		// Link headers to block memory
-		for (unsigned int n = 0; n < m_nBlockCount; n++)
-		{
-			m_pWaveHeaders[n].dwBufferLength = m_nBlockSamples * sizeof(short);
-			m_pWaveHeaders[n].lpData = (LPSTR)(m_pBlockMemory + (n * m_nBlockSamples));
-		}
+		// One block of floats for the mixer to render into
+		m_pMixBlock = new float[m_nBlockSamples];
 
 		m_bAudioThreadActive = true;
 		m_AudioThread = std::thread(&consoleWindowEngine::AudioThread, this);
-
-		// Start the ball rolling with the sound delivery thread
-		std::unique_lock<std::mutex> lm(m_muxBlockNotZero);
-		m_cvBlockNotZero.notify_one();
 		return true;
 	}
 
@@ -1064,84 +1858,70 @@ protected: // Audio Engine =====================================================
 	bool DestroyAudio()
 	{
 		m_bAudioThreadActive = false;
-		return false;
-	}
+		if (m_pAudioSinkActive != nullptr)
+			m_pAudioSinkActive->Cancel();
+		if (m_AudioThread.joinable())
+			m_AudioThread.join();
 
-	// Handler for soundcard request for more data
-	void waveOutProc(HWAVEOUT hWaveOut, UINT uMsg, DWORD dwParam1, DWORD dwParam2)
-	{
-		if (uMsg != WOM_DONE) return;
-		m_nBlockFree++;
-		std::unique_lock<std::mutex> lm(m_muxBlockNotZero);
-		m_cvBlockNotZero.notify_one();
-	}
+		if (m_pAudioSinkActive != nullptr)
+			m_pAudioSinkActive->Close();
+		m_pAudioSinkActive = nullptr;
 
-	// Static wrapper for sound card handler
-	static void CALLBACK waveOutProcWrap(HWAVEOUT hWaveOut, UINT uMsg, DWORD dwInstance, DWORD dwParam1, DWORD dwParam2)
-	{
-		((consoleWindowEngine*)dwInstance)->waveOutProc(hWaveOut, uMsg, dwParam1, dwParam2);
+		delete[] m_pMixBlock;
+		m_pMixBlock = nullptr;
+		return false;
 	}
 
-	// Audio thread. This loop responds to requests from the soundcard to fill 'blocks'
+	// Audio thread. This loop responds to requests from the sink to fill 'blocks'
 	// with audio data. If no requests are available it goes dormant until the sound
 	// card is ready for more data. The block is fille by the "user" in some manner
-	// and then issued to the soundcard.
+	// and then issued to the sink.
 	void AudioThread()
 	{
+		traceRecorder::SetThreadName("Audio");
 		m_fGlobalTime = 0.0f;
 		float fTimeStep = 1.0f / (float)m_nSampleRate;
 
 		// Goofy hack to get maximum integer for a type at run-time
 		short nMaxSample = (short)pow(2, (sizeof(short) * 8) - 1) - 1;
 		float fMaxSample = (float)nMaxSample;
-		short nPreviousSample = 0;
 
 		while (m_bAudioThreadActive)
 		{
 			// Wait for block to become available
-			if (m_nBlockFree == 0)
+			int64_t nWaitStart = m_trace.IsRecording() ? traceRecorder::Now() : 0;
+			short* pBlock = m_pAudioSinkActive->AcquireBlock();
+			if (nWaitStart != 0)
+				m_trace.Record("Wait for device", nWaitStart, traceRecorder::Now());
+			if (pBlock == nullptr)
+				continue;
+
+			traceScope scope(m_trace, "Mix block");
+			auto tpMixStart = std::chrono::steady_clock::now();
+
+			// User Process, the whole block is mixed at once
+			GetMixerBlock(m_pMixBlock, m_nBlockSamples / m_nChannels, fTimeStep);
+
+			// Clip and convert to the device format
+			unsigned int n = 0;
+#if defined(CGE_SSE2)
+			__m128 vMax = _mm_set1_ps(1.0f), vMin = _mm_set1_ps(-1.0f), vScale = _mm_set1_ps(fMaxSample);
+			for (; n + 8 <= m_nBlockSamples; n += 8)
 			{
-				std::unique_lock<std::mutex> lm(m_muxBlockNotZero);
-				while (m_nBlockFree == 0) // sometimes, Windows signals incorrectly
-					m_cvBlockNotZero.wait(lm);
+				__m128 a = _mm_mul_ps(_mm_max_ps(_mm_min_ps(_mm_loadu_ps(m_pMixBlock + n), vMax), vMin), vScale);
+				__m128 b = _mm_mul_ps(_mm_max_ps(_mm_min_ps(_mm_loadu_ps(m_pMixBlock + n + 4), vMax), vMin), vScale);
+				_mm_storeu_si128((__m128i*)(pBlock + n), _mm_packs_epi32(_mm_cvttps_epi32(a), _mm_cvttps_epi32(b)));
 			}
+#endif
+			for (; n < m_nBlockSamples; n++)
+				pBlock[n] = (short)((std::max)(-1.0f, (std::min)(m_pMixBlock[n], 1.0f)) * fMaxSample);
 
-			// Block is here, so use it
-			m_nBlockFree--;
-
-			// Prepare block for processing
-			if (m_pWaveHeaders[m_nBlockCurrent].dwFlags & WHDR_PREPARED)
-				waveOutUnprepareHeader(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
-
-			short nNewSample = 0;
-			int nCurrentBlock = m_nBlockCurrent * m_nBlockSamples;
-
-			auto clip = [](float fSample, float fMax)
-			{
-				if (fSample >= 0.0)
-					return fmin(fSample, fMax);
-				else
-					return fmax(fSample, -fMax);
-			};
-
-			for (unsigned int n = 0; n < m_nBlockSamples; n += m_nChannels)
-			{
-				// User Process
-				for (unsigned int c = 0; c < m_nChannels; c++)
-				{
-					nNewSample = (short)(clip(GetMixerOutput(c, m_fGlobalTime, fTimeStep), 1.0) * fMaxSample);
-					m_pBlockMemory[nCurrentBlock + n + c] = nNewSample;
-					nPreviousSample = nNewSample;
-				}
-
-				m_fGlobalTime = m_fGlobalTime + fTimeStep;
-			}
+			std::chrono::duration<float> durMix = std::chrono::steady_clock::now() - tpMixStart;
+			m_fAudioMixTime = m_fAudioMixTime + durMix.count();
+			m_nAudioBlocksMixed++;
 
 			// Send block to sound device
-			waveOutPrepareHeader(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
-			waveOutWrite(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
-			m_nBlockCurrent++;
-			m_nBlockCurrent %= m_nBlockCount;
+			m_pAudioSinkActive->SubmitBlock();
 		}
 	}
 
@@ -1159,12 +1939,11 @@ protected: // Audio Engine =====================================================
 
 	// The Sound Mixer - If the user wants to play many sounds simultaneously, and
 	// perhaps the same sound overlapping itself, then you need a mixer, which
-	// takes input from all sound sources for that audio frame. This mixer maintains
-	// a list of sound locations for all concurrently playing audio samples. Instead
-	// of duplicating audio data, we simply store the fact that a sound sample is in
-	// use and an offset into its sample data. As time progresses we update this offset
-	// until it is beyound the length of the sound sample it is attached to. At this
-	// point we remove the playing souind from the list.
+	// takes input from all sound sources for that audio frame. The mixer keeps a
+	// pool of voices, each just a pointer into a loaded sample and how far through
+	// it this instance is. Instead of duplicating audio data, every block each voice
+	// adds the next run of its sample straight into the block, and voices that reach
+	// the end of a non-looping sample go back to the pool.
 	//
 	// Additionally, the users application may want to generate sound instead of just
 	// playing audio clips (think a synthesizer for example) in whcih case we also
@@ -1174,49 +1953,46 @@ protected: // Audio Engine =====================================================
 	// Finally, before the sound is issued to the operating system for performing, the
 	// user gets one final chance to "filter" the sound, perhaps changing the volume
 	// or adding funky effects
-	float GetMixerOutput(int nChannel, float fGlobalTime, float fTimeStep)
+	//
+	// pBlock receives nFrames interleaved frames of m_nChannels samples
+	void GetMixerBlock(float* pBlock, unsigned int nFrames, float fTimeStep)
 	{
-		// Accumulate sample for this channel
-		float fMixerSample = 0.0f;
+		m_mixer.MixBlock(pBlock, (int)nFrames, (int)m_nChannels);
 
-		for (auto& s : listActiveSamples)
+		float fGlobalTime = m_fGlobalTime;
+		for (unsigned int f = 0; f < nFrames; f++)
 		{
-			// Calculate sample position
-			s.nSamplePosition += (long)((float)vecAudioSamples[s.nAudioSampleID - 1].wavHeader.nSamplesPerSec * fTimeStep);
-
-			// If sample position is valid add to the mix
-			if (s.nSamplePosition < vecAudioSamples[s.nAudioSampleID - 1].nSamples)
-				fMixerSample += vecAudioSamples[s.nAudioSampleID - 1].fSample[(s.nSamplePosition * vecAudioSamples[s.nAudioSampleID - 1].nChannels) + nChannel];
-			else
-				s.bFinished = true; // Else sound has completed
-		}
-
-		// If sounds have completed then remove them
-		listActiveSamples.remove_if([](const sCurrentlyPlayingSample& s) {return s.bFinished; });
+			for (unsigned int c = 0; c < m_nChannels; c++)
+			{
+				float& fMixerSample = pBlock[f * m_nChannels + c];
 
-		// The users application might be generating sound, so grab that if it exists
-		fMixerSample += onUserSoundSample(nChannel, fGlobalTime, fTimeStep);
+				// The users application might be generating sound, so grab that if it exists
+				fMixerSample += onUserSoundSample(c, fGlobalTime, fTimeStep);
 
-		// Return the sample via an optional user override to filter the sound
-		return onUserSoundFilter(nChannel, fGlobalTime, fMixerSample);
+				// Pass the sample through an optional user override to filter the sound
+				fMixerSample = onUserSoundFilter(c, fGlobalTime, fMixerSample);
+			}
+			fGlobalTime += fTimeStep;
+		}
+		m_fGlobalTime = fGlobalTime;
 	}
 
-	unsigned int m_nSampleRate;
-	unsigned int m_nChannels;
-	unsigned int m_nBlockCount;
-	unsigned int m_nBlockSamples;
-	unsigned int m_nBlockCurrent;
+	unsigned int m_nSampleRate = 44100;	// Samples loaded before CreateAudio() are converted to this
+	unsigned int m_nChannels = 1;
+	unsigned int m_nBlockCount = 0;
+	unsigned int m_nBlockSamples = 0;
 
-	short* m_pBlockMemory = nullptr;
-	WAVEHDR* m_pWaveHeaders = nullptr;
-	HWAVEOUT m_hwDevice = nullptr;
+	float* m_pMixBlock = nullptr;
+
+	waveOutAudioSink m_waveOutSink;
+	audioSink* m_pAudioSink = nullptr;			// Set by the user, nullptr for the sound card
+	audioSink* m_pAudioSinkActive = nullptr;	// The one the audio thread is using
 
 	std::thread m_AudioThread;
 	std::atomic<bool> m_bAudioThreadActive = false;
-	std::atomic<unsigned int> m_nBlockFree = 0;
-	std::condition_variable m_cvBlockNotZero;
-	std::mutex m_muxBlockNotZero;
 	std::atomic<float> m_fGlobalTime = 0.0f;
+	std::atomic<unsigned int> m_nAudioBlocksMixed = 0;
+	std::atomic<float> m_fAudioMixTime = 0.0f;		// Seconds, total over every block mixed
 
 
 
@@ -1233,6 +2009,197 @@ protected:
 	int m_mousePosX;
 	int m_mousePosY;
 
+private:
+	// Input thread. Sleeps until the console has input, translates it to
+	// inputEvents and queues them for the game thread
+	void InputThread()
+	{
+		traceRecorder::SetThreadName("Input");
+		INPUT_RECORD inBuf[32];
+		while (m_bInputThreadActive)
+		{
+			// Wake up now and then to see if we should stop
+			if (WaitForSingleObject(m_hConsoleIn, 50) != WAIT_OBJECT_0)
+				continue;
+
+			DWORD events = 0;
+			GetNumberOfConsoleInputEvents(m_hConsoleIn, &events);
+			if (events == 0)
+				continue;
+			ReadConsoleInput(m_hConsoleIn, inBuf, 32, &events);
+
+			for (DWORD i = 0; i < events; i++)
+			{
+				inputEvent e;
+				switch (inBuf[i].EventType)
+				{
+				case KEY_EVENT:
+					e.nType = inBuf[i].Event.KeyEvent.bKeyDown ? inputEvent::KEY_DOWN : inputEvent::KEY_UP;
+					e.nCode = (uint8_t)inBuf[i].Event.KeyEvent.wVirtualKeyCode;
+					break;
+
+				case FOCUS_EVENT:
+					e.nType = inputEvent::FOCUS;
+					e.nCode = inBuf[i].Event.FocusEvent.bSetFocus ? 1 : 0;
+					break;
+
+				case MOUSE_EVENT:
+					// We only care about mouse clicks and movement for now
+					if (inBuf[i].Event.MouseEvent.dwEventFlags == MOUSE_MOVED)
+					{
+						e.nType = inputEvent::MOUSE_MOVE;
+						e.x = inBuf[i].Event.MouseEvent.dwMousePosition.X;
+						e.y = inBuf[i].Event.MouseEvent.dwMousePosition.Y;
+					}
+					else if (inBuf[i].Event.MouseEvent.dwEventFlags == 0)
+					{
+						e.nType = inputEvent::MOUSE_BUTTONS;
+						e.nCode = (uint8_t)(inBuf[i].Event.MouseEvent.dwButtonState & 0x1F);
+					}
+					else
+						continue;
+					break;
+
+				default:
+					continue;
+				}
+
+				// A full queue means the game has stalled, newer events are dropped
+				m_queueInput.Push(e);
+			}
+		}
+	}
+
+	// Game thread, after the frame is presented. Starting or stopping a capture
+	// allocates and waits for the writer thread, so it happens here, outside the
+	// frame, rather than where it was asked for
+	void UpdateFrameCapture(float fElapsedTime)
+	{
+		if (m_nCaptureRequest == CAPTURE_START)
+			m_frameCapture.Start(m_sCaptureFile, m_nScreenWidth, m_nScreenHeight, m_nCaptureRingFrames);
+		else if (m_nCaptureRequest == CAPTURE_STOP)
+			m_frameCapture.Stop();
+		m_nCaptureRequest = CAPTURE_NONE;
+
+		static_assert(sizeof(CHAR_INFO) == 4, "Captures store CHAR_INFO as 4 byte cells");
+		if (m_frameCapture.IsRecording())
+			m_frameCapture.Submit(m_bufScreen, fElapsedTime);
+	}
+
+	// Game thread, once per frame. Takes this frame's events, either live from the
+	// input thread or from a recording, and applies them in order to the key and
+	// mouse states. A replayed frame also gets its recorded elapsed time
+	void UpdateInput(float& fElapsedTime)
+	{
+		int nEvents = 0;
+		if (m_inputTimeline.IsReplaying())
+		{
+			// Live input is ignored while replaying
+			inputEvent e;
+			while (m_queueInput.Pop(e)) {}
+
+			if (!m_inputTimeline.ReadFrame(fElapsedTime, m_frameInput, nEvents))
+			{
+				nEvents = 0;
+				if (m_bExitAtReplayEnd)
+					m_bAtomActive = false;
+			}
+		}
+		else
+		{
+			while (nEvents < inputTimeline::nMaxEventsPerFrame && m_queueInput.Pop(m_frameInput[nEvents]))
+				nEvents++;
+
+			if (m_inputTimeline.IsRecording())
+				m_inputTimeline.WriteFrame(fElapsedTime, m_frameInput, nEvents);
+		}
+
+		// Pressed and Released only last one frame, and only keys that changed last
+		// frame can have them set
+		for (int i = 0; i < m_nEdgeKeys; i++)
+		{
+			m_keys[m_nEdgeKeyList[i]].bPressed = false;
+			m_keys[m_nEdgeKeyList[i]].bReleased = false;
+		}
+		m_nEdgeKeys = 0;
+
+		for (int m = 0; m < 5; m++)
+		{
+			m_mouse[m].bPressed = false;
+			m_mouse[m].bReleased = false;
+		}
+
+		for (int i = 0; i < nEvents; i++)
+		{
+			inputEvent& e = m_frameInput[i];
+			switch (e.nType)
+			{
+			case inputEvent::KEY_DOWN:
+			case inputEvent::KEY_UP:
+				SetKeyState(e.nCode, e.nType == inputEvent::KEY_DOWN);
+				break;
+
+			case inputEvent::MOUSE_MOVE:
+				m_mousePosX = e.x;
+				m_mousePosY = e.y;
+				break;
+
+			case inputEvent::MOUSE_BUTTONS:
+			{
+				for (int m = 0; m < 5; m++)
+					SetButtonState(m_mouse[m], (e.nCode & (1 << m)) != 0);
+
+				// The buttons also show up as keys, like GetAsyncKeyState reports them
+				SetKeyState(VK_LBUTTON, (e.nCode & FROM_LEFT_1ST_BUTTON_PRESSED) != 0);
+				SetKeyState(VK_RBUTTON, (e.nCode & RIGHTMOST_BUTTON_PRESSED) != 0);
+				SetKeyState(VK_MBUTTON, (e.nCode & FROM_LEFT_2ND_BUTTON_PRESSED) != 0);
+			}
+			break;
+
+			case inputEvent::FOCUS:
+			{
+				m_bConsoleInFocus = e.nCode != 0;
+
+				// Key ups that happen in another window never reach us
+				if (!m_bConsoleInFocus)
+					for (int k = 0; k < 256; k++)
+						if (m_keys[k].bHeld)
+							SetKeyState(k, false);
+			}
+			break;
+			}
+		}
+	}
+
+	void SetButtonState(sKeyState& s, bool bDown)
+	{
+		if (bDown == s.bHeld)
+			return;
+		if (bDown)
+			s.bPressed = true;
+		else
+			s.bReleased = true;
+		s.bHeld = bDown;
+	}
+
+	void SetKeyState(int nKey, bool bDown)
+	{
+		sKeyState& s = m_keys[nKey];
+		if (bDown == s.bHeld)
+			return;
+		if (!s.bPressed && !s.bReleased)
+			m_nEdgeKeyList[m_nEdgeKeys++] = (uint8_t)nKey;
+		SetButtonState(s, bDown);
+	}
+
+	inputEventQueue m_queueInput;
+	std::atomic<bool> m_bInputThreadActive = false;
+	inputEvent m_frameInput[inputTimeline::nMaxEventsPerFrame];
+	uint8_t m_nEdgeKeyList[256];	// Keys with bPressed or bReleased set this frame
+	int m_nEdgeKeys = 0;
+	inputTimeline m_inputTimeline;
+	bool m_bExitAtReplayEnd = true;
+
 public:
 	sKeyState GetKey(int nKeyID) { return m_keys[nKeyID]; }
 	int GetMouseX() { return m_mousePosX; }
@@ -1270,20 +2237,51 @@ protected:
 protected:
 	int m_nScreenWidth;
 	int m_nScreenHeight;
-	CHAR_INFO* m_bufScreen;
+	CHAR_INFO* m_bufScreen = nullptr;
+	CHAR_INFO* m_bufScreenSaved = nullptr;
+	int m_nScreenWidthSaved = 0;
+	int m_nScreenHeightSaved = 0;
+	uint16_t* m_pOverdrawCounts = nullptr;
 	std::wstring m_sAppName;
 	HANDLE m_hOriginalConsole;
 	CONSOLE_SCREEN_BUFFER_INFO m_OriginalConsoleInfo;
 	HANDLE m_hConsole;
 	HANDLE m_hConsoleIn;
 	SMALL_RECT m_rectWindow;
-	short m_keyOldState[256] = { 0 };
-	short m_keyNewState[256] = { 0 };
-	bool m_mouseOldState[5] = { 0 };
-	bool m_mouseNewState[5] = { 0 };
 	bool m_bConsoleInFocus = true;
 	bool m_bEnableSound = false;
 
+	// Extra text the application wants shown in the title bar, fixed size so
+	// filling it in every frame never touches the heap
+	static const int nFrameStatsLength = 256;
+	wchar_t m_sFrameStats[nFrameStatsLength] = { 0 };
+
+	// Per-frame linear allocator, reset at the start of every frame
+	frameArena m_frameArena;
+
+	// Frame capture, started and stopped between frames by UpdateFrameCapture()
+	enum { CAPTURE_NONE, CAPTURE_START, CAPTURE_STOP };
+	frameCaptureWriter m_frameCapture;
+	wchar_t m_sCaptureFile[260] = { 0 };
+	int m_nCaptureRingFrames = 8;
+	int m_nCaptureRequest = CAPTURE_NONE;
+
+	// Timeline recording, declared before the job system so the workers are gone first
+	traceRecorder m_trace;
+	std::wstring m_sTraceFile;
+
+	// One worker per extra core, shared by everything in the engine and the application
+	jobSystem m_jobs;
+
+	// After the job system it loads on, which outlives it
+	assetManager m_assets;
+	unsigned int m_nFrameCount = 0;
+	unsigned int m_nFrameArenaWarmupFrames = 8;
+
+	// Set by SetFrameUnchanged() during a frame, that frame isn't presented
+	bool m_bFrameUnchanged = false;
+	int m_nIdleSleepMs = 10;
+
 	// These need to be static because of the OnDestroy call the OS may make. The OS
 	// spawns a special thread just for that
 	static std::atomic<bool> m_bAtomActive;
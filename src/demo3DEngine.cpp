@@ -1,4 +1,18 @@
+// The one translation unit that defines the debug heap counting, see frameArena.h
+#define FRAME_ARENA_HEAP_HOOKS
 #include "consoleWindowEngine.h"
+#include "hierarchicalZ.h"
+#include "meshBVH.h"
+#include "triSpatialHash.h"
+#include "mipTexture.h"
+#include "compactMesh.h"
+#include "meshPager.h"
+#include "resolutionScaler.h"
+#include "shadowMap.h"
+#include "skinnedMesh.h"
+#include "particleSystem.h"
+#include "entityStore.h"
+#include "cameraPath.h"
 #include <fstream>
 #include <strstream>
 #include <algorithm>
@@ -6,6 +20,7 @@ using namespace std;
 
 bool DEBUG_MODE_STATUS;
 bool GLOBAL_SPIN_MODE_STATUS;
+bool STREAM_MODE_STATUS;
 string MODEL_NAME;
 
 
@@ -17,16 +32,39 @@ struct point3D
 	float w = 1; // 4th element to help perform matrix vector multiplication
 };
 
+// Texture coordinate, w carries 1/z once the triangle has been projected so
+// u and v can be interpolated with perspective correction
+struct point2D
+{
+	float u = 0;
+	float v = 0;
+	float w = 1;
+};
+
 struct triPoly
 {
 	point3D _point[3];
+	point2D _tex[3];
 	wchar_t _symbol;
 	short _color;
 };
 
+// A spatially compact run of triangles in triPolyMeshCollection::triPolyList,
+// with an object space bounding box so the whole run can be culled at once
+struct triPolyCluster
+{
+	int nStart = 0;
+	int nCount = 0;
+	point3D vMin;
+	point3D vMax;
+};
+
 struct triPolyMeshCollection
 {
-	vector<triPoly> triPolyList;
+	vector<triPoly> triPolyList;	// Only while loading, see ReleaseTriangles()
+	vector<triPolyCluster> clusterList;
+	compactMesh compact;			// What is drawn from, triangles in the same order as triPolyList
+	bool bHasTexCoords = false;	// Every face referenced a "vt" texture coordinate
 
 	bool LoadFromObjectFile(string sFilename)
 	{
@@ -35,8 +73,10 @@ struct triPolyMeshCollection
 		if (!f.is_open())
 			return false;
 
-		/* Local vector to store vertices */
+		/* Local vectors to store vertices and texture coordinates */
 		vector<point3D> verts;
+		vector<point2D> texs;
+		bool bAllFacesTextured = true;
 
 		while (!f.eof())
 		{
@@ -48,7 +88,14 @@ struct triPolyMeshCollection
 
 			char junk;
 
-			if (line[0] == 'v')
+			if (line[0] == 'v' && line[1] == 't')
+			{
+				point2D t;
+				s >> junk >> junk >> t.u >> t.v;
+				t.v = 1.0f - t.v; // .obj has v going up, sprites have y going down
+				texs.push_back(t);
+			}
+			else if (line[0] == 'v' && line[1] == ' ')
 			{
 				point3D v;
 				s >> junk >> v.x >> v.y >> v.z;
@@ -57,13 +104,156 @@ struct triPolyMeshCollection
 
 			if (line[0] == 'f')
 			{
-				int f[3];
-				s >> junk >> f[0] >> f[1] >> f[2];
-				triPolyList.push_back({ verts[f[0] - 1], verts[f[1] - 1], verts[f[2] - 1] });
+				// Each corner is "v", "v/vt" or "v/vt/vn", normals are ignored
+				string sCorner[3];
+				s >> junk >> sCorner[0] >> sCorner[1] >> sCorner[2];
+
+				triPoly tri;
+				for (int k = 0; k < 3; k++)
+				{
+					char* pEnd = nullptr;
+					long nVert = strtol(sCorner[k].c_str(), &pEnd, 10);
+					long nTex = 0;
+					if (*pEnd == '/')
+						nTex = strtol(pEnd + 1, nullptr, 10);
+
+					tri._point[k] = verts[nVert - 1];
+					if (nTex > 0 && nTex <= (long)texs.size())
+						tri._tex[k] = texs[nTex - 1];
+					else
+						bAllFacesTextured = false;
+				}
+				triPolyList.push_back(tri);
 			}
 		}
+
+		bHasTexCoords = bAllFacesTextured && !triPolyList.empty();
+		BuildClusters();
+		compact.Build(triPolyList, bHasTexCoords);
 		return true;
 	}
+
+	// Frees the full size triangles once everything built from them is done,
+	// from then on the mesh is only in compact
+	void ReleaseTriangles()
+	{
+		vector<triPoly>().swap(triPolyList);
+	}
+
+	// Bytes held for the mesh, and what the same triangles take as triPolys
+	size_t MemoryBytes()
+	{
+		return compact.MemoryBytes() + clusterList.capacity() * sizeof(triPolyCluster) + triPolyList.capacity() * sizeof(triPoly);
+	}
+
+	size_t UncompressedBytes()
+	{
+		return (size_t)compact.TriangleCount() * sizeof(triPoly) + clusterList.capacity() * sizeof(triPolyCluster);
+	}
+
+	// Buckets triangles into a uniform grid by centroid and reorders triPolyList
+	// so every non-empty cell becomes one contiguous cluster of roughly
+	// nTargetClusterSize triangles
+	void BuildClusters(int nTargetClusterSize = 128)
+	{
+		clusterList.clear();
+		int nTris = (int)triPolyList.size();
+		if (nTris == 0)
+			return;
+
+		auto centroid = [](triPoly& t, int a)
+		{
+			float* p0 = &t._point[0].x; float* p1 = &t._point[1].x; float* p2 = &t._point[2].x;
+			return (p0[a] + p1[a] + p2[a]) / 3.0f;
+		};
+
+		float fMin[3], fMax[3];
+		for (int a = 0; a < 3; a++)
+		{
+			fMin[a] = fMax[a] = centroid(triPolyList[0], a);
+			for (auto& t : triPolyList)
+			{
+				float c = centroid(t, a);
+				fMin[a] = min(fMin[a], c);
+				fMax[a] = max(fMax[a], c);
+			}
+		}
+
+		// Choose a cell size that gives about the right number of cells over the
+		// axes that actually have some extent (terrain is nearly flat in y)
+		int nCells = max(1, nTris / nTargetClusterSize);
+		float fVolume = 1.0f;
+		int nAxes = 0;
+		for (int a = 0; a < 3; a++)
+		{
+			if (fMax[a] - fMin[a] > 1e-4f)
+			{
+				fVolume *= fMax[a] - fMin[a];
+				nAxes++;
+			}
+		}
+
+		int nDiv[3] = { 1, 1, 1 };
+		if (nAxes > 0)
+		{
+			float fCellSize = powf(fVolume / (float)nCells, 1.0f / (float)nAxes);
+			for (int a = 0; a < 3; a++)
+				if (fMax[a] - fMin[a] > 1e-4f)
+					nDiv[a] = min(64, max(1, (int)ceilf((fMax[a] - fMin[a]) / fCellSize)));
+		}
+
+		// Counting sort of triangles by cell
+		auto cellOf = [&](triPoly& t)
+		{
+			int idx[3];
+			for (int a = 0; a < 3; a++)
+			{
+				float fExtent = fMax[a] - fMin[a];
+				int i = fExtent > 1e-4f ? (int)((centroid(t, a) - fMin[a]) / fExtent * (float)nDiv[a]) : 0;
+				idx[a] = min(nDiv[a] - 1, max(0, i));
+			}
+			return (idx[2] * nDiv[1] + idx[1]) * nDiv[0] + idx[0];
+		};
+
+		int nTotalCells = nDiv[0] * nDiv[1] * nDiv[2];
+		vector<int> vecCellStart(nTotalCells + 1, 0);
+		vector<int> vecTriCell(nTris);
+		for (int i = 0; i < nTris; i++)
+		{
+			vecTriCell[i] = cellOf(triPolyList[i]);
+			vecCellStart[vecTriCell[i] + 1]++;
+		}
+		for (int c = 0; c < nTotalCells; c++)
+			vecCellStart[c + 1] += vecCellStart[c];
+
+		vector<triPoly> vecSorted(nTris);
+		vector<int> vecCursor(vecCellStart.begin(), vecCellStart.end() - 1);
+		for (int i = 0; i < nTris; i++)
+			vecSorted[vecCursor[vecTriCell[i]]++] = triPolyList[i];
+		triPolyList.swap(vecSorted);
+
+		for (int c = 0; c < nTotalCells; c++)
+		{
+			if (vecCellStart[c + 1] == vecCellStart[c])
+				continue;
+
+			triPolyCluster cluster;
+			cluster.nStart = vecCellStart[c];
+			cluster.nCount = vecCellStart[c + 1] - vecCellStart[c];
+			cluster.vMin = cluster.vMax = triPolyList[cluster.nStart]._point[0];
+			for (int i = cluster.nStart; i < cluster.nStart + cluster.nCount; i++)
+			{
+				for (int v = 0; v < 3; v++)
+				{
+					point3D& p = triPolyList[i]._point[v];
+					cluster.vMin.x = min(cluster.vMin.x, p.x); cluster.vMax.x = max(cluster.vMax.x, p.x);
+					cluster.vMin.y = min(cluster.vMin.y, p.y); cluster.vMax.y = max(cluster.vMax.y, p.y);
+					cluster.vMin.z = min(cluster.vMin.z, p.z); cluster.vMax.z = max(cluster.vMax.z, p.z);
+				}
+			}
+			clusterList.push_back(cluster);
+		}
+	}
 };
 
 struct quadMatrix
@@ -71,22 +261,230 @@ struct quadMatrix
 	float _matrix[4][4] = { 0 };
 };
 
+// A model as loaded through Assets(), with the structures built over it. Those
+// read their triangles from the mesh, so a model is never copied
+struct sModelAsset
+{
+	triPolyMeshCollection mesh;
+	meshBVH bvh;	// Object space ray acceleration structure over the mesh
+	triSpatialHash collision;	// Object space grid over the mesh for collision queries
+
+	sModelAsset() {}
+	sModelAsset(const sModelAsset&) = delete;
+	sModelAsset& operator=(const sModelAsset&) = delete;
+
+	// Everything the model holds, the mesh and what is built over it
+	size_t MemoryBytes()
+	{
+		return mesh.MemoryBytes() + bvh.MemoryBytes() + collision.MemoryBytes();
+	}
+};
+
 class consoleEngine3D : public consoleWindowEngine
 {
 public:
-	consoleEngine3D()
+	consoleEngine3D(int nJobWorkers = -1) : consoleWindowEngine(nJobWorkers)
 	{
 		m_sAppName = L"3D Demo";
+
+		Assets().SetLoader<sModelAsset>([](const wstring& sFile, sModelAsset& model, size_t& nBytes)
+			{
+				if (!model.mesh.LoadFromObjectFile(string(sFile.begin(), sFile.end())))
+					return false;
+				model.mesh.ReleaseTriangles();
+				model.bvh.Build(model.mesh.compact);
+				model.collision.Build(model.mesh.compact);
+				nBytes = model.MemoryBytes();
+				return true;
+			});
+	}
+
+	// Batch renders fly the camera along a path instead of taking input, frame
+	// nFirstFrame of it first, see RunBatchWorker()
+	void SetCameraPath(const cameraPath* pPath, int nFirstFrame)
+	{
+		pCameraPath = pPath;
+		nCameraPathFrame = nFirstFrame;
+		bCameraCollision = false;	// Only resolves from where the camera was last frame
 	}
 
 
 private:
-	triPolyMeshCollection meshObj;
+	assetHandle<sModelAsset> model;	// Held for as long as the demo runs
+	sModelAsset noModel;				// Stands in while streaming, or if the model didn't load
+	sModelAsset* pModel = &noModel;
 	quadMatrix matProj;	// Projetion Matrix for conversion from view space to screen space
+	quadMatrix matWorld;	// Object space --> world space for this frame
+	quadMatrix matCamera;	// Camera placement in world space, inverse of matView
+	quadMatrix matView;	// World space --> view space for this frame
 	point3D vCamera;	// To store location of camera in world space
 	point3D vLookDir;	// Vector to store where the camera is pointint
-	float fYaw;		// Camera rotation in XZ plane (For FPS)
-	float fTheta;	// Spins World transform
+	float fYaw = 0.0f;	// Camera rotation in XZ plane (For FPS)
+	float fTheta = 0.0f;	// Spins World transform
+
+	hierarchicalZBuffer hiZ;			// Depth pyramid of the nearest occluders
+	bool bOcclusionCulling = true;		// Toggled with 'O'
+	int nOccluderTriangleBudget = 1024;	// How many of the nearest triangles are rasterized as occluders
+
+	bool bCameraCollision = true;	// Toggled with 'C'
+	float fCameraRadius = 0.5f;
+	point3D vCameraLocalPrev;		// Camera in object space after last frame's collision
+	bool bCameraLocalPrevValid = false;
+	int nCollisionTrisTested = 0;
+
+	mipTexture texture;		// Loaded from the .spr next to the model, if it has one
+	bool bTexturing = false;	// Toggled with 'T', only when the mesh has texture coordinates
+
+	bool bShowMeshMemory = false;	// Toggled with 'M'
+
+	// Shown with 'H' in place of the scene, how many times the rasterizer wrote to each
+	// cell. Totals are summed over every view drawn this frame
+	bool bOverdraw = false;		// Toggled with 'H'
+	int nOverdrawWrites = 0;
+	int nOverdrawCovered = 0;	// Cells written at least once
+	int nOverdrawCells = 0;
+	int nOverdrawMax = 0;
+
+	// Illumination TODO: Make light dynamic
+	point3D vToLight = { 0.0f, 1.0f, -1.0f };	// Normalised in OnWindowCreate()
+
+	// Directional light shadows from two maps, a detailed one around where the camera
+	// is looking and a coarse one over the whole model for everything further out.
+	// They are only redrawn when something they depend on has changed
+	shadowMap shadowCascades[2];
+	bool bShadows = true;				// Toggled with 'L'
+	int nShadowMapSize = 512;
+	float fShadowNearRadius = 16.0f;	// World units covered around the camera by the detailed map
+	point3D vModelCentre;				// Object space sphere around the whole model
+	float fModelRadius = 1.0f;
+	quadMatrix matShadowWorld;			// matWorld when the maps were drawn
+	int nShadowMapsDrawn = 0;
+
+	// Stream mode draws from pages of the model on disk instead of loading it
+	meshPager pager;
+	int nPageCacheSlots = 64;			// Most pages ever held in memory at once
+	float fPrefetchSeconds = 0.5f;		// How far ahead camera motion is followed for prefetching
+	point3D vCameraLast;
+	float fYawLast = 0.0f;
+
+	// A triangle after the camera independent part of the work, in world space, lit
+	// and with its texture coordinates unpacked. Every viewport starts from these
+	struct sWorldTri
+	{
+		triPoly tri;
+		point3D normal;
+	};
+
+	// A run of triangles to draw this frame, and where their world space versions are
+	struct sDrawRange
+	{
+		compactMesh* pMesh;
+		int nStart;
+		int nCount;
+		sWorldTri* pWorld;
+	};
+
+	// A camera and the rectangle of the screen it draws into
+	struct sViewport
+	{
+		int x, y, w, h;
+		point3D vCamera;
+		quadMatrix matView;
+		quadMatrix matProj;
+	};
+	sViewport viewports[4];
+	int nViewports = 1;
+	int nViewportLayout = 0;	// Cycled with 'P': single view, mirror and map, four way split
+
+	// World space triangles of the loaded mesh, kept from frame to frame. A cluster's
+	// are only worked out again once nWorldVersion has moved on from when they were
+	// made, which happens when the model moves or the shadows change, but not when
+	// only the camera does. Streamed pages come and go, so they are redone every frame
+	vector<sWorldTri> vecWorldCache;
+	vector<unsigned int> vecClusterWorldVersion;
+	unsigned int nWorldVersion = 1;
+	quadMatrix matCacheWorld;			// matWorld the cache was made with
+	bool bCacheShadows = false;
+
+	// Animated copies of the model in a row behind it, shown with 'K'. The mesh is
+	// rigged as a chain of bones along its length that ripples, while it swells
+	// between its rest pose and a larger vertex keyframe. They don't cast shadows,
+	// the shadow maps would have to be redrawn every frame
+	skinnedMesh skinned;
+	bool bAnimating = false;			// Toggled with 'K'
+	float fAnimationTime = 0.0f;
+
+	// Everything in the scene besides the loaded model and the camera is an entity
+	// made of some of these components, and is moved and drawn by queries over them
+	struct sTransform			// Placed in the world, turned about x then about y
+	{
+		point3D vPosition;
+		float fYaw = 0.0f;
+		float fPitch = 0.0f;
+	};
+	struct sVelocity			// World units and radians per second
+	{
+		point3D vLinear;
+		float fYawRate = 0.0f;
+		float fPitchRate = 0.0f;
+	};
+	struct sOrbit				// Pulled towards the model's centre, harder the further away
+	{
+		float fPull = 0.0f;
+	};
+	struct sMeshRef				// Drawn with a mesh of its own
+	{
+		compactMesh* pMesh = nullptr;
+	};
+	struct sSkinnedInstance		// Drawn with skinned, its sTransform applied after matWorld
+	{
+		float fTimeOffset = 0.0f;
+	};
+	entityStore entities;
+
+	// A belt of rocks orbiting the model, shown with 'N'
+	compactMesh debrisMesh;
+	vector<entityStore::sEntity> vecDebris;
+	bool bDebris = false;				// Toggled with 'N'
+	int nDebrisCount = 4000;
+
+	// Sparks from the top of the model, exhaust from the back of the spaceship or dust
+	// blowing around the camera over the terrain, shown with 'E'. They live in world
+	// space, are moved once a frame and drawn into every view, hidden by whatever
+	// part of the scene is in front of them
+	particleSystem particles;
+	particleSystem::sEmitter emitter;
+	bool bParticles = false;			// Toggled with 'E'
+	int nParticleCapacity = 131072;
+	point3D vEmitterLocal;				// Object space, follows the model as it spins
+	point3D vEmitterDirectionLocal;
+	bool bEmitterFollowsCamera = false;
+
+	// The work of a frame up to drawing, rebuilt every frame in OnWindowUpdate()
+	jobGraph frameGraph;
+
+	// Everything the picture and the frame stats depend on. A frame whose key matches
+	// the last one drawn would come out the same, so it isn't drawn at all
+	struct sFrameKey
+	{
+		float vCamera[3];
+		float fYaw;
+		float fTheta;
+		float fAnimationTime;
+		int nToggles;
+		int nViewportLayout;
+		int nMouseX, nMouseY;
+		int nPagesLoaded;
+	};
+	sFrameKey lastFrameKey;
+	bool bLastFrameKeyValid = false;
+
+	const cameraPath* pCameraPath = nullptr;	// Set for batch renders
+	int nCameraPathFrame = 0;					// Frame of the path drawn next
+
+	resolutionScaler resolution;		// Picks the scene resolution that keeps to the frame time budget
+	bool bDynamicResolution = false;	// Toggled with 'V'
+	vector<CHAR_INFO> vecSceneBuffer;	// The scene is drawn here at the scaled size, then stretched to the screen
 
 	point3D Matrix_MultiplyVector(quadMatrix& m, point3D& i)
 	{
@@ -262,12 +660,19 @@ private:
 	}
 
 	point3D Vector_IntersectPlane(point3D& plane_p, point3D& plane_n, point3D& lineStart, point3D& lineEnd)
+	{
+		float t;
+		return Vector_IntersectPlane(plane_p, plane_n, lineStart, lineEnd, t);
+	}
+
+	// Also returns how far along the line the intersection is, for interpolating texture coordinates
+	point3D Vector_IntersectPlane(point3D& plane_p, point3D& plane_n, point3D& lineStart, point3D& lineEnd, float& t)
 	{
 		plane_n = Vector_Normalise(plane_n);
 		float plane_d = -Vector_DotProduct(plane_n, plane_p);
 		float ad = Vector_DotProduct(lineStart, plane_n);
 		float bd = Vector_DotProduct(lineEnd, plane_n);
-		float t = (-plane_d - ad) / (bd - ad);
+		t = (-plane_d - ad) / (bd - ad);
 		point3D lineStartToEnd = Vector_Sub(lineEnd, lineStart);
 		point3D lineToIntersect = Vector_Mul(lineStartToEnd, t);
 		return Vector_Add(lineStart, lineToIntersect);
@@ -289,18 +694,31 @@ private:
 			If distance sign is positive, point lies on "inside" of plane */
 		point3D* inside_points[3];  int nInsidePointCount = 0;
 		point3D* outside_points[3]; int nOutsidePointCount = 0;
+		point2D* inside_tex[3]; int nInsideTexCount = 0;
+		point2D* outside_tex[3]; int nOutsideTexCount = 0;
 
 		// Getting distance of each point in triPoly to plane
 		float d0 = dist(in_tri._point[0]);
 		float d1 = dist(in_tri._point[1]);
 		float d2 = dist(in_tri._point[2]);
 
-		if (d0 >= 0) { inside_points[nInsidePointCount++] = &in_tri._point[0]; }
-		else { outside_points[nOutsidePointCount++] = &in_tri._point[0]; }
-		if (d1 >= 0) { inside_points[nInsidePointCount++] = &in_tri._point[1]; }
-		else { outside_points[nOutsidePointCount++] = &in_tri._point[1]; }
-		if (d2 >= 0) { inside_points[nInsidePointCount++] = &in_tri._point[2]; }
-		else { outside_points[nOutsidePointCount++] = &in_tri._point[2]; }
+		if (d0 >= 0) { inside_points[nInsidePointCount++] = &in_tri._point[0]; inside_tex[nInsideTexCount++] = &in_tri._tex[0]; }
+		else { outside_points[nOutsidePointCount++] = &in_tri._point[0]; outside_tex[nOutsideTexCount++] = &in_tri._tex[0]; }
+		if (d1 >= 0) { inside_points[nInsidePointCount++] = &in_tri._point[1]; inside_tex[nInsideTexCount++] = &in_tri._tex[1]; }
+		else { outside_points[nOutsidePointCount++] = &in_tri._point[1]; outside_tex[nOutsideTexCount++] = &in_tri._tex[1]; }
+		if (d2 >= 0) { inside_points[nInsidePointCount++] = &in_tri._point[2]; inside_tex[nInsideTexCount++] = &in_tri._tex[2]; }
+		else { outside_points[nOutsidePointCount++] = &in_tri._point[2]; outside_tex[nOutsideTexCount++] = &in_tri._tex[2]; }
+
+		// Texture coordinate a fraction t of the way from a to b
+		auto lerpTex = [](point2D& a, point2D& b, float t)
+		{
+			point2D r;
+			r.u = a.u + t * (b.u - a.u);
+			r.v = a.v + t * (b.v - a.v);
+			r.w = a.w + t * (b.w - a.w);
+			return r;
+		};
+		float t;
 
 		/* Now classify triPoly points, and break the input triPoly into
 			smaller output triangles if required. There are four possible
@@ -325,9 +743,12 @@ private:
 				out_tri1._color = in_tri._color;
 			out_tri1._symbol = in_tri._symbol;
 			out_tri1._point[0] = *inside_points[0];
+			out_tri1._tex[0] = *inside_tex[0];
 
-			out_tri1._point[1] = Vector_IntersectPlane(plane_p, plane_n, *inside_points[0], *outside_points[0]);
-			out_tri1._point[2] = Vector_IntersectPlane(plane_p, plane_n, *inside_points[0], *outside_points[1]);
+			out_tri1._point[1] = Vector_IntersectPlane(plane_p, plane_n, *inside_points[0], *outside_points[0], t);
+			out_tri1._tex[1] = lerpTex(*inside_tex[0], *outside_tex[0], t);
+			out_tri1._point[2] = Vector_IntersectPlane(plane_p, plane_n, *inside_points[0], *outside_points[1], t);
+			out_tri1._tex[2] = lerpTex(*inside_tex[0], *outside_tex[1], t);
 
 			return 1;
 		}
@@ -350,171 +771,244 @@ private:
 			out_tri2._symbol = in_tri._symbol;
 
 			out_tri1._point[0] = *inside_points[0];
+			out_tri1._tex[0] = *inside_tex[0];
 			out_tri1._point[1] = *inside_points[1];
-			out_tri1._point[2] = Vector_IntersectPlane(plane_p, plane_n, *inside_points[0], *outside_points[0]);
+			out_tri1._tex[1] = *inside_tex[1];
+			out_tri1._point[2] = Vector_IntersectPlane(plane_p, plane_n, *inside_points[0], *outside_points[0], t);
+			out_tri1._tex[2] = lerpTex(*inside_tex[0], *outside_tex[0], t);
 
 			out_tri2._point[0] = *inside_points[1];
+			out_tri2._tex[0] = *inside_tex[1];
 			out_tri2._point[1] = out_tri1._point[2];
-			out_tri2._point[2] = Vector_IntersectPlane(plane_p, plane_n, *inside_points[1], *outside_points[0]);
+			out_tri2._tex[1] = out_tri1._tex[2];
+			out_tri2._point[2] = Vector_IntersectPlane(plane_p, plane_n, *inside_points[1], *outside_points[0], t);
+			out_tri2._tex[2] = lerpTex(*inside_tex[1], *outside_tex[0], t);
 
 			return 2; // Two newly formed tripolys returned
 		}
 	}
 
-	// Outside resource, apologies
-	CHAR_INFO GetColour(float lum)
-	{
-		short bg_col, fg_col;
-		wchar_t sym;
-		int pixel_bw = (int)(13.0f * lum);
-		switch (pixel_bw)
-		{
-		case 0: bg_col = BG_BLACK; fg_col = FG_BLACK; sym = PIXEL_SOLID; break;
-
-		case 1: bg_col = BG_BLACK; fg_col = FG_DARK_GREY; sym = PIXEL_QUARTER; break;
-		case 2: bg_col = BG_BLACK; fg_col = FG_DARK_GREY; sym = PIXEL_HALF; break;
-		case 3: bg_col = BG_BLACK; fg_col = FG_DARK_GREY; sym = PIXEL_THREEQUARTERS; break;
-		case 4: bg_col = BG_BLACK; fg_col = FG_DARK_GREY; sym = PIXEL_SOLID; break;
-
-		case 5: bg_col = BG_DARK_GREY; fg_col = FG_GREY; sym = PIXEL_QUARTER; break;
-		case 6: bg_col = BG_DARK_GREY; fg_col = FG_GREY; sym = PIXEL_HALF; break;
-		case 7: bg_col = BG_DARK_GREY; fg_col = FG_GREY; sym = PIXEL_THREEQUARTERS; break;
-		case 8: bg_col = BG_DARK_GREY; fg_col = FG_GREY; sym = PIXEL_SOLID; break;
-
-		case 9:  bg_col = BG_GREY; fg_col = FG_WHITE; sym = PIXEL_QUARTER; break;
-		case 10: bg_col = BG_GREY; fg_col = FG_WHITE; sym = PIXEL_HALF; break;
-		case 11: bg_col = BG_GREY; fg_col = FG_WHITE; sym = PIXEL_THREEQUARTERS; break;
-		case 12: bg_col = BG_GREY; fg_col = FG_WHITE; sym = PIXEL_SOLID; break;
-		default:
-			bg_col = BG_BLACK; fg_col = FG_BLACK; sym = PIXEL_SOLID;
-		}
-
-		CHAR_INFO c;
-		c.Attributes = bg_col | fg_col;
-		c.Char.UnicodeChar = sym;
-		return c;
-	}
-
-public:
-	bool OnWindowCreate() override
+	// View space --> screen space, the same steps the triangle pipeline takes
+	point3D ProjectToScreen(point3D& vViewed)
 	{
-		// Load object file
-		meshObj.LoadFromObjectFile(MODEL_NAME);
-
-		// Projection Matrix
-		matProj = Matrix_MakeProjection(90.0f, (float)ScreenHeight() / (float)ScreenWidth(), 0.1f, 1000.0f);
-		return true;
+		point3D p = Matrix_MultiplyVector(matProj, vViewed);
+		p = Vector_Div(p, p.w);
+		p.x = (1.0f - p.x) * 0.5f * (float)ScreenWidth();
+		p.y = (1.0f - p.y) * 0.5f * (float)ScreenHeight();
+		return p;
 	}
 
-	bool OnWindowUpdate(float fElapsedTime) override
+	// Rasterizes the nearest clusters into the depth pyramid as occluders, then tests
+	// every other cluster's bounding box against it. Clusters that cannot be seen are
+	// flagged in vecClusterVisible, returns how many triangles that removed
+	int CullOccludedClusters(frameVector<char>& vecClusterVisible)
 	{
-		if (GetKey(VK_ESCAPE).bPressed)
-			return false;
+		struct sClusterBounds
+		{
+			float fMinX, fMinY, fMaxX, fMaxY;
+			float fNearZ;
+			bool bInFront;
+		};
 
-		if (GetKey(VK_UP).bHeld)
-			vCamera.y += 8.0f * fElapsedTime;	// Travel Upwards
+		size_t nClusters = pModel->mesh.clusterList.size();
+		frameVector<sClusterBounds> vecBounds(nClusters, sClusterBounds(), FrameAllocator<sClusterBounds>());
+		frameVector<int> vecByDistance(FrameAllocator<int>());
+		vecByDistance.reserve(nClusters);
 
-		if (GetKey(VK_DOWN).bHeld)
-			vCamera.y -= 8.0f * fElapsedTime;	// Travel Downwards
+		quadMatrix matWorldView = Matrix_MultiplyMatrix(matWorld, matView);
 
+		// Screen rectangle and nearest depth of every cluster box
+		for (size_t c = 0; c < nClusters; c++)
+		{
+			triPolyCluster& cluster = pModel->mesh.clusterList[c];
+			sClusterBounds& b = vecBounds[c];
+			b.fMinX = b.fMinY = FLT_MAX;
+			b.fMaxX = b.fMaxY = -FLT_MAX;
+			b.fNearZ = FLT_MAX;
+			b.bInFront = true;
+
+			for (int k = 0; k < 8; k++)
+			{
+				point3D vCorner = { (k & 1) ? cluster.vMax.x : cluster.vMin.x,
+									(k & 2) ? cluster.vMax.y : cluster.vMin.y,
+									(k & 4) ? cluster.vMax.z : cluster.vMin.z };
+				point3D vViewed = Matrix_MultiplyVector(matWorldView, vCorner);
+				b.fNearZ = min(b.fNearZ, vViewed.z);
+				if (vViewed.z < 0.1f)
+				{
+					// Box reaches behind the near plane, can't bound it on screen
+					b.bInFront = false;
+					break;
+				}
 
-		// TODO change to move left and right as strafe instead of in world space
-		if (GetKey(VK_LEFT).bHeld)
-			vCamera.x -= 8.0f * fElapsedTime;
+				point3D vScreen = ProjectToScreen(vViewed);
+				b.fMinX = min(b.fMinX, vScreen.x); b.fMaxX = max(b.fMaxX, vScreen.x);
+				b.fMinY = min(b.fMinY, vScreen.y); b.fMaxY = max(b.fMaxY, vScreen.y);
+			}
 
-		if (GetKey(VK_RIGHT).bHeld)
-			vCamera.x += 8.0f * fElapsedTime;
+			if (b.bInFront)
+				vecByDistance.push_back((int)c);
+		}
 
+		sort(vecByDistance.begin(), vecByDistance.end(), [&](int a, int b)
+			{
+				return vecBounds[a].fNearZ < vecBounds[b].fNearZ;
+			});
 
-		point3D vForward = Vector_Mul(vLookDir, 8.0f * fElapsedTime);
+		// Nearest clusters become the occluders, only front facing triangles
+		// fully in front of the near plane are used
+		hiZ.Resize(ScreenWidth(), ScreenHeight());
+		hiZ.Clear();
 
-		if (GetKey(L'W').bHeld)
-			vCamera = Vector_Add(vCamera, vForward);
+		frameVector<char> vecIsOccluder(nClusters, 0, FrameAllocator<char>());
+		int nOccluderTris = 0;
+		for (int c : vecByDistance)
+		{
+			if (nOccluderTris >= nOccluderTriangleBudget)
+				break;
 
-		if (GetKey(L'S').bHeld)
-			vCamera = Vector_Sub(vCamera, vForward);
+			triPolyCluster& cluster = pModel->mesh.clusterList[c];
+			vecIsOccluder[c] = 1;
+			nOccluderTris += cluster.nCount;
 
-		if (GetKey(L'A').bHeld)
-			fYaw -= 2.0f * fElapsedTime;
+			for (int i = cluster.nStart; i < cluster.nStart + cluster.nCount; i++)
+			{
+				point3D p[3];
+				pModel->mesh.compact.DecodePositions(i, p);
+				for (int v = 0; v < 3; v++)
+					p[v] = Matrix_MultiplyVector(matWorld, p[v]);
+
+				point3D line1 = Vector_Sub(p[1], p[0]);
+				point3D line2 = Vector_Sub(p[2], p[0]);
+				point3D normal = Vector_CrossProduct(line1, line2);
+				point3D vCameraRay = Vector_Sub(p[0], vCamera);
+				if (Vector_DotProduct(normal, vCameraRay) >= 0.0f)
+					continue;
+
+				float fFarZ = 0.0f;
+				bool bInFront = true;
+				for (int v = 0; v < 3; v++)
+				{
+					p[v] = Matrix_MultiplyVector(matView, p[v]);
+					bInFront &= p[v].z >= 0.1f;
+					fFarZ = max(fFarZ, p[v].z);
+				}
+				if (!bInFront)
+					continue;
 
-		if (GetKey(L'D').bHeld)
-			fYaw += 2.0f * fElapsedTime;
+				for (int v = 0; v < 3; v++)
+					p[v] = ProjectToScreen(p[v]);
+				hiZ.RasterizeOccluder(p[0].x, p[0].y, p[1].x, p[1].y, p[2].x, p[2].y, fFarZ);
+			}
+		}
 
+		hiZ.BuildPyramid();
 
-		quadMatrix matRotZ, matRotX;
-		if(GLOBAL_SPIN_MODE_STATUS)
-			fTheta += 1.0f * fElapsedTime; // Spin to debug without moving
-		matRotZ = Matrix_MakeRotationZ(fTheta * 0.5f);
-		matRotX = Matrix_MakeRotationX(fTheta);
+		// Everything else is tested against the pyramid
+		int nCulledTris = 0;
+		for (int c : vecByDistance)
+		{
+			if (vecIsOccluder[c])
+				continue;
 
-		quadMatrix matTrans;
-		matTrans = Matrix_MakeTranslation(0.0f, 0.0f, 5.0f);
+			sClusterBounds& b = vecBounds[c];
+			if (hiZ.IsRectOccluded(b.fMinX, b.fMinY, b.fMaxX, b.fMaxY, b.fNearZ))
+			{
+				vecClusterVisible[c] = 0;
+				nCulledTris += pModel->mesh.clusterList[c].nCount;
+			}
+		}
+		return nCulledTris;
+	}
 
-		quadMatrix matWorld;
-		matWorld = Matrix_MakeIdentity();	// World Matrix
-		matWorld = Matrix_MultiplyMatrix(matRotZ, matRotX); // Transform by rotation
-		matWorld = Matrix_MultiplyMatrix(matWorld, matTrans); // Transform by translation
+	// Transform, light and unpack triangles nStart..nEnd-1 of a mesh into world space,
+	// the part of the work that doesn't depend on the camera, one to pOut for each.
+	// matObject places the mesh in the world, and may only rotate and translate.
+	// Only reads shared state, so separate ranges can run on separate threads
+	void WorldTriangles(compactMesh& mesh, quadMatrix& matObject, int nStart, int nEnd, sWorldTri* pOut)
+	{
+		for (int i = nStart; i < nEnd; i++)
+		{
+			sWorldTri& world = pOut[i - nStart];
+			triPoly& triTransformed = world.tri;
+
+			// Unpack the triangle from the compact mesh
+			point3D p[3];
+			mesh.DecodePositions(i, p);
+			triTransformed._point[0] = Matrix_MultiplyVector(matObject, p[0]);
+			triTransformed._point[1] = Matrix_MultiplyVector(matObject, p[1]);
+			triTransformed._point[2] = Matrix_MultiplyVector(matObject, p[2]);
+			mesh.DecodeTexCoords(i, triTransformed._tex);
+
+			// Stored face normal, matObject is only rotation and translation so turning
+			// it as a direction (w = 0) keeps it unit length
+			point3D& normal = world.normal;
+			if (mesh.DecodeNormal(i, normal.x, normal.y, normal.z))
+			{
+				normal.w = 0.0f;
+				normal = Matrix_MultiplyVector(matObject, normal);
+			}
+			else
+			{
+				// Zero area in object space, whatever rounding leaves in world space decides it
+				point3D line1 = Vector_Sub(triTransformed._point[1], triTransformed._point[0]);
+				point3D line2 = Vector_Sub(triTransformed._point[2], triTransformed._point[0]);
+				normal = Vector_CrossProduct(line1, line2);
+				normal = Vector_Normalise(normal);
+			}
 
-		// "Point At" Matrix for camera
-		point3D vUp = { 0,1,0 };
-		point3D vTarget = { 0,0,1 };
-		quadMatrix matCameraRot = Matrix_MakeRotationY(fYaw);
-		vLookDir = Matrix_MultiplyVector(matCameraRot, vTarget);
-		vTarget = Vector_Add(vCamera, vLookDir);
-		quadMatrix matCamera = Matrix_PointAt(vCamera, vTarget, vUp);
+			ShadeWorldTriangle(world);
+		}
+	}
 
-		// view matrix from camera
-		quadMatrix matView = Matrix_QuickInverse(matCamera);
+	// Colour of a world space triangle from its normal, the light and the shadow maps
+	void ShadeWorldTriangle(sWorldTri& world)
+	{
+		triPoly& tri = world.tri;
 
-		// Triangles for rastering later
-		vector<triPoly> vecTrianglesToRaster;
+		// How "aligned" are light direction and triPoly surface normal?
+		float dp = max(0.1f, Vector_DotProduct(vToLight, world.normal));
 
-		// Drawing Triangles
-		for (auto tri : meshObj.triPolyList)
+		// Faces the light, but something may be in the way, then only the ambient is left
+		if (bShadows && dp > 0.1f)
 		{
-			triPoly triProjected, triTransformed, triViewed;
-
-			triTransformed._point[0] = Matrix_MultiplyVector(matWorld, tri._point[0]);
-			triTransformed._point[1] = Matrix_MultiplyVector(matWorld, tri._point[1]);
-			triTransformed._point[2] = Matrix_MultiplyVector(matWorld, tri._point[2]);
-
-			// Calculate triPoly Normal
-			point3D normal, line1, line2;
-
-			// Get lines either side of triPoly
-			line1 = Vector_Sub(triTransformed._point[1], triTransformed._point[0]);
-			line2 = Vector_Sub(triTransformed._point[2], triTransformed._point[0]);
+			point3D vCentre = Vector_Add(tri._point[0], tri._point[1]);
+			vCentre = Vector_Add(vCentre, tri._point[2]);
+			vCentre = Vector_Div(vCentre, 3.0f);
+			dp = 0.1f + (dp - 0.1f) * ShadowLookup(vCentre, world.normal);
+		}
 
-			// Take cross product of lines to get normal to triPoly surface
-			normal = Vector_CrossProduct(line1, line2);
+		// Choosing console colours as required (much easier with RGB)
+		CHAR_INFO c = GetColour(dp);
+		tri._color = c.Attributes;
+		tri._symbol = c.Char.UnicodeChar;
+	}
 
-			// You normally need to normalise a normal!
-			normal = Vector_Normalise(normal);
+	// Backface cull, view, near clip and project world space triangles for one
+	// viewport, mapping them onto the current render target. Like WorldTriangles it
+	// can run on separate threads, vecOut needs room for 2 per triangle
+	void ViewTriangles(sViewport& view, sWorldTri* pTris, int nCount, frameVector<triPoly>& vecOut)
+	{
+		for (int i = 0; i < nCount; i++)
+		{
+			triPoly& triTransformed = pTris[i].tri;
+			triPoly triProjected, triViewed;
 
 			// Get Ray from triPoly to camera
-			point3D vCameraRay = Vector_Sub(triTransformed._point[0], vCamera);
+			point3D vCameraRay = Vector_Sub(triTransformed._point[0], view.vCamera);
 
 			// If ray is aligned with normal, then triPoly is visible
-			if (Vector_DotProduct(normal, vCameraRay) < 0.0f)
+			if (Vector_DotProduct(pTris[i].normal, vCameraRay) < 0.0f)
 			{
-				// Illumination TODO: Make light dynamic
-				point3D light_direction = { 0.0f, 1.0f, -1.0f };
-				light_direction = Vector_Normalise(light_direction);
-
-				// How "aligned" are light direction and triPoly surface normal?
-				float dp = max(0.1f, Vector_DotProduct(light_direction, normal));
-
-				// Choosing console colours as required (much easier with RGB)
-				CHAR_INFO c = GetColour(dp);
-				triTransformed._color = c.Attributes;
-				triTransformed._symbol = c.Char.UnicodeChar;
-
 				// Convert World Space --> View Space
-				triViewed._point[0] = Matrix_MultiplyVector(matView, triTransformed._point[0]);
-				triViewed._point[1] = Matrix_MultiplyVector(matView, triTransformed._point[1]);
-				triViewed._point[2] = Matrix_MultiplyVector(matView, triTransformed._point[2]);
+				triViewed._point[0] = Matrix_MultiplyVector(view.matView, triTransformed._point[0]);
+				triViewed._point[1] = Matrix_MultiplyVector(view.matView, triTransformed._point[1]);
+				triViewed._point[2] = Matrix_MultiplyVector(view.matView, triTransformed._point[2]);
 				triViewed._symbol = triTransformed._symbol;
 				triViewed._color = triTransformed._color;
+				triViewed._tex[0] = triTransformed._tex[0];
+				triViewed._tex[1] = triTransformed._tex[1];
+				triViewed._tex[2] = triTransformed._tex[2];
 
 				// Clipping Viewed Triangle against near plane, this could form two additional
 				// additional triangles. 
@@ -525,12 +1019,21 @@ public:
 				for (int n = 0; n < nClippedTriangles; n++)
 				{
 					// Project triangles from 3D --> 2D
-					triProjected._point[0] = Matrix_MultiplyVector(matProj, clipped[n]._point[0]);
-					triProjected._point[1] = Matrix_MultiplyVector(matProj, clipped[n]._point[1]);
-					triProjected._point[2] = Matrix_MultiplyVector(matProj, clipped[n]._point[2]);
+					triProjected._point[0] = Matrix_MultiplyVector(view.matProj, clipped[n]._point[0]);
+					triProjected._point[1] = Matrix_MultiplyVector(view.matProj, clipped[n]._point[1]);
+					triProjected._point[2] = Matrix_MultiplyVector(view.matProj, clipped[n]._point[2]);
 					triProjected._color = clipped[n]._color;
 					triProjected._symbol = clipped[n]._symbol;
 
+					// Texture coordinates divided by depth are linear in screen space,
+					// the rasterizer divides by the interpolated 1/w to get them back
+					for (int v = 0; v < 3; v++)
+					{
+						triProjected._tex[v].u = clipped[n]._tex[v].u / triProjected._point[v].w;
+						triProjected._tex[v].v = clipped[n]._tex[v].v / triProjected._point[v].w;
+						triProjected._tex[v].w = 1.0f / triProjected._point[v].w;
+					}
+
 					triProjected._point[0] = Vector_Div(triProjected._point[0], triProjected._point[0].w);
 					triProjected._point[1] = Vector_Div(triProjected._point[1], triProjected._point[1].w);
 					triProjected._point[2] = Vector_Div(triProjected._point[2], triProjected._point[2].w);
@@ -556,21 +1059,123 @@ public:
 					triProjected._point[2].y *= 0.5f * (float)ScreenHeight();
 
 					// Store triPoly for sorting
-					vecTrianglesToRaster.push_back(triProjected);
+					vecOut.push_back(triProjected);
 				}
 			}
 		}
+	}
+
+	// Place the cameras and screen rectangles for the current layout. The first view
+	// is always the player's camera, the others look from around it
+	void SetupViewports()
+	{
+		int W = ScreenWidth(), H = ScreenHeight();
+		point3D vUp = { 0,1,0 };
+
+		sViewport& front = viewports[0];
+		front = { 0, 0, W, H, vCamera, matView, matProj };
+		nViewports = 1;
+		if (nViewportLayout == 0)
+			return;
+
+		// Cameras for the other views
+		point3D vRearTarget = Vector_Sub(vCamera, vLookDir);
+		quadMatrix matRearCamera = Matrix_PointAt(vCamera, vRearTarget, vUp);
+		point3D vAbove = { vCamera.x, vCamera.y + 30.0f, vCamera.z };
+		quadMatrix matMapCamera = Matrix_PointAt(vAbove, vCamera, vLookDir);
+		point3D vSide = { vCamera.x - 15.0f, vCamera.y + 5.0f, vCamera.z };
+		quadMatrix matSideCamera = Matrix_PointAt(vSide, vCamera, vUp);
+
+		if (nViewportLayout == 1)
+		{
+			// Full screen view with a rear view mirror along the top and a map in the corner
+			int nMirrorW = max(1, W / 3), nMirrorH = max(1, H / 5);
+			int nMap = max(1, min(W, H) / 3);
+			viewports[1] = { (W - nMirrorW) / 2, 0, nMirrorW, nMirrorH, vCamera, Matrix_QuickInverse(matRearCamera) };
+			viewports[2] = { W - nMap, 0, nMap, nMap, vAbove, Matrix_QuickInverse(matMapCamera) };
+			nViewports = 3;
+		}
+		else
+		{
+			// Four way split, front, rear, map and side
+			int nHalfW = W / 2, nHalfH = H / 2;
+			front = { 0, 0, nHalfW, nHalfH, vCamera, matView };
+			viewports[1] = { nHalfW, 0, W - nHalfW, nHalfH, vCamera, Matrix_QuickInverse(matRearCamera) };
+			viewports[2] = { 0, nHalfH, nHalfW, H - nHalfH, vAbove, Matrix_QuickInverse(matMapCamera) };
+			viewports[3] = { nHalfW, nHalfH, W - nHalfW, H - nHalfH, vSide, Matrix_QuickInverse(matSideCamera) };
+			nViewports = 4;
+		}
+
+		for (int v = 0; v < nViewports; v++)
+			if (nViewportLayout == 2 || v > 0)
+				viewports[v].matProj = Matrix_MakeProjection(90.0f, (float)viewports[v].h / (float)viewports[v].w, 0.1f, 1000.0f);
+	}
+
+	// Draw the world space triangles of the visible ranges as seen from one viewport
+	// into the current render target, which fills the whole target. Pieces of the range
+	// list are viewed on their own threads and joined in order, so the result matches a
+	// single threaded pass
+	void RenderView(sViewport& view, frameVector<sDrawRange>& vecVisible)
+	{
+		traceScope scopeTransform(Trace(), "View transform");
+
+		// Triangles for rastering later, near plane clipping can at most double the count
+		int nVisibleTris = 0;
+		for (auto& range : vecVisible)
+			nVisibleTris += range.nCount;
+		frameVector<triPoly> vecTrianglesToRaster(FrameAllocator<triPoly>());
+		vecTrianglesToRaster.reserve(nVisibleTris * 2);
+
+		int nPieces = min((int)vecVisible.size(), Jobs().ThreadCount() * 4);
+		frameVector<frameVector<triPoly>> vecPieces(FrameAllocator<frameVector<triPoly>>());
+		vecPieces.reserve(nPieces);
+		for (int p = 0; p < nPieces; p++)
+		{
+			int nTris = 0;
+			for (int v = p * (int)vecVisible.size() / nPieces; v < (p + 1) * (int)vecVisible.size() / nPieces; v++)
+				nTris += vecVisible[v].nCount;
+			vecPieces.emplace_back(FrameAllocator<triPoly>());
+			vecPieces.back().reserve(nTris * 2);
+		}
+
+		Jobs().ParallelFor(0, nPieces, 1, [&](int nFrom, int nTo)
+			{
+				for (int p = nFrom; p < nTo; p++)
+					for (int v = p * (int)vecVisible.size() / nPieces; v < (p + 1) * (int)vecVisible.size() / nPieces; v++)
+						ViewTriangles(view, vecVisible[v].pWorld, vecVisible[v].nCount, vecPieces[p]);
+			});
+
+		for (auto& piece : vecPieces)
+			vecTrianglesToRaster.insert(vecTrianglesToRaster.end(), piece.begin(), piece.end());
+		scopeTransform.End();
 
 		// Sort triangles from back to front
+		traceScope scopeSort(Trace(), "Sort");
 		sort(vecTrianglesToRaster.begin(), vecTrianglesToRaster.end(), [](triPoly& t1, triPoly& t2)
 			{
 				float z1 = (t1._point[0].z + t1._point[1].z + t1._point[2].z) / 3.0f;
 				float z2 = (t2._point[0].z + t2._point[1].z + t2._point[2].z) / 3.0f;
 				return z1 > z2;
 			});
+		scopeSort.End();
 
 		// Clear Screen
-		Fill(0, 0, ScreenWidth(), ScreenHeight(), PIXEL_SOLID, FG_BLACK);
+		traceScope scopeRaster(Trace(), "Raster");
+		Clear(PIXEL_SOLID, FG_BLACK);
+
+		// Clearing isn't counted, only what the triangles draw over it
+		frameVector<uint16_t> vecOverdraw(FrameAllocator<uint16_t>());
+		if (bOverdraw)
+		{
+			vecOverdraw.assign(ScreenWidth() * ScreenHeight(), 0);
+			BeginOverdrawCount(vecOverdraw.data());
+		}
+
+		// Queue used while clipping against the screen edges, shared by every triangle.
+		// Each edge can at most double the count, so 1 + 2 + 4 + 8 + 16 entries are
+		// the most that can ever be pushed for one triangle
+		frameVector<triPoly> listTriangles(FrameAllocator<triPoly>());
+		listTriangles.reserve(32);
 
 		// Loop through all transformed, viewed, projected, and sorted triangles
 		for (auto& triToRaster : vecTrianglesToRaster)
@@ -579,7 +1184,11 @@ public:
 			// a bunch of triangles, so create a queue that we traverse to 
 			//  ensure we only test new triangles generated against planes
 			triPoly clipped[2];
-			list<triPoly> listTriangles;
+			listTriangles.clear();
+
+			// One mip level for the whole triangle, picked before the screen edges cut it up
+			int nMipLevel = bTexturing ? SelectMipLevel(triToRaster) : 0;
+			size_t nFront = 0;
 
 			// Add initial triPoly
 			listTriangles.push_back(triToRaster);
@@ -591,8 +1200,7 @@ public:
 				while (nNewTriangles > 0)
 				{
 					// Take triPoly from front of queue
-					triPoly test = listTriangles.front();
-					listTriangles.pop_front();
+					triPoly test = listTriangles[nFront++];
 					nNewTriangles--;
 
 					// Clipping it against a plane
@@ -608,51 +1216,1538 @@ public:
 					for (int w = 0; w < nTrisToAdd; w++)
 						listTriangles.push_back(clipped[w]);
 				}
-				nNewTriangles = listTriangles.size();
+				nNewTriangles = (int)(listTriangles.size() - nFront);
 			}
 
 
 			// Draw the transformed, viewed, clipped, projected, sorted, clipped triangles
-			for (auto& t : listTriangles)
+			for (size_t i = nFront; i < listTriangles.size(); i++)
 			{
-				FillTriangle(t._point[0].x, t._point[0].y, t._point[1].x, t._point[1].y, t._point[2].x, t._point[2].y, t._symbol, t._color);
+				triPoly& t = listTriangles[i];
+				if (bTexturing)
+					TexturedTriangle(t, nMipLevel);
+				else
+					FillTriangle(t._point[0].x, t._point[0].y, t._point[1].x, t._point[1].y, t._point[2].x, t._point[2].y, t._symbol, t._color);
 				if (DEBUG_MODE_STATUS)
 				{
 					DrawTriangle(t._point[0].x, t._point[0].y, t._point[1].x, t._point[1].y, t._point[2].x, t._point[2].y, PIXEL_SOLID, FG_BLACK);
 				}
 			}
 		}
+		EndOverdrawCount();
+		scopeRaster.End();
 
+		if (bParticles)
+			DrawParticles(view, vecTrianglesToRaster);
 
-		return true;
+		if (bOverdraw)
+			DrawOverdraw(vecOverdraw);
 	}
 
-};
-
-
-
-
-int main()
-{
-	int __consoleWidth = 140, __consoleHeight = 80, tmp;
-	char debugTmp = 'N';
-	cout << "Input Console Width (Min: 140 please): ";
-	cin >> tmp;
-	if (tmp >= 140)
+	// Heatmap colour for a number of writes to a cell, black for none through blue,
+	// green, yellow and red to white for 8 or more
+	short OverdrawColour(int nWrites)
 	{
-		__consoleWidth = tmp;
+		static const short nRamp[9] = { FG_BLACK, FG_DARK_BLUE, FG_BLUE, FG_DARK_GREEN, FG_GREEN, FG_YELLOW, FG_RED, FG_MAGENTA, FG_WHITE };
+		return nRamp[min(nWrites, 8)];
 	}
-	cout << "Input Console Height (Min: 80 please): ";
-	cin >> tmp;
-	if (tmp >= 80)
+
+	// Replace the view with the heatmap of its write counts, and add them to the totals
+	void DrawOverdraw(frameVector<uint16_t>& vecCounts)
 	{
-		__consoleHeight = tmp;
+		traceScope scope(Trace(), "Overdraw");
+		int nCells = ScreenWidth() * ScreenHeight();
+		for (int i = 0; i < nCells; i++)
+		{
+			int nWrites = vecCounts[i];
+			m_bufScreen[i].Char.UnicodeChar = PIXEL_SOLID;
+			m_bufScreen[i].Attributes = OverdrawColour(nWrites);
+			nOverdrawWrites += nWrites;
+			nOverdrawCovered += nWrites > 0 ? 1 : 0;
+			nOverdrawMax = max(nOverdrawMax, nWrites);
+		}
+		nOverdrawCells += nCells;
 	}
-	cout << "Turn debug mode ON? (Y/N)" << endl;
-	cin >> debugTmp;
-	if (debugTmp == 'Y')
+
+	// True if this frame would draw the same as the last one. Streaming that is still
+	// bringing pages in never counts as unchanged, the next frame may have more to draw
+	bool IsFrameUnchanged()
 	{
-		DEBUG_MODE_STATUS = true;
+		sFrameKey key;
+		memset(&key, 0, sizeof(key));
+		key.vCamera[0] = vCamera.x;
+		key.vCamera[1] = vCamera.y;
+		key.vCamera[2] = vCamera.z;
+		key.fYaw = fYaw;
+		key.fTheta = fTheta;
+		key.fAnimationTime = fAnimationTime;
+		key.nToggles = (bOcclusionCulling ? 1 : 0) | (bCameraCollision ? 2 : 0) | (bTexturing ? 4 : 0) | (bShowMeshMemory ? 8 : 0) |
+			(bDynamicResolution ? 16 : 0) | (bShadows ? 32 : 0) | (IsCapturingFrames() ? 64 : 0) | (bAnimating ? 128 : 0) |
+			(bParticles ? 256 : 0) | (bOverdraw ? 512 : 0);
+		key.nViewportLayout = nViewportLayout;
+		key.nMouseX = GetMouse(0).bHeld ? GetMouseX() : -1;
+		key.nMouseY = GetMouse(0).bHeld ? GetMouseY() : -1;
+		key.nPagesLoaded = STREAM_MODE_STATUS ? pager.PagesLoaded() : 0;
+
+		// Particles and entities with a velocity move every frame
+		bool bStreaming = STREAM_MODE_STATUS && (pager.LoadingPages() > 0 || pager.MissingPages() > 0);
+		bool bMoving = bParticles || bDebris != !vecDebris.empty() || entities.CountWith<sVelocity>() > 0;
+		bool bUnchanged = bLastFrameKeyValid && !bStreaming && !bMoving && memcmp(&key, &lastFrameKey, sizeof(key)) == 0;
+		lastFrameKey = key;
+		bLastFrameKeyValid = true;
+		return bUnchanged;
+	}
+
+	// Animation ===========================================================================
+
+	// Rig the loaded mesh and make up a clip for it, a ripple down the bone chain over
+	// two seconds and a swell out to 15% larger and back
+	void BuildAnimation()
+	{
+		compactMesh& mesh = pModel->mesh.compact;
+		int nVertices = mesh.VertexCount();
+		skinned.Create(nVertices);
+		for (int v = 0; v < nVertices; v++)
+		{
+			point3D p;
+			mesh.DecodeVertex(v, p);
+			skinned.KeyframeX(0)[v] = p.x;
+			skinned.KeyframeY(0)[v] = p.y;
+			skinned.KeyframeZ(0)[v] = p.z;
+		}
+
+		const int nBones = 6;
+		skinned.RigAsChain(nBones);
+
+		int nSwollen = skinned.AddVertexKeyframe();
+		for (int v = 0; v < nVertices; v++)
+		{
+			skinned.KeyframeX(nSwollen)[v] = vModelCentre.x + (skinned.KeyframeX(0)[v] - vModelCentre.x) * 1.15f;
+			skinned.KeyframeY(nSwollen)[v] = vModelCentre.y + (skinned.KeyframeY(0)[v] - vModelCentre.y) * 1.15f;
+			skinned.KeyframeZ(nSwollen)[v] = vModelCentre.z + (skinned.KeyframeZ(0)[v] - vModelCentre.z) * 1.15f;
+		}
+
+		const int nKeys = 8;
+		for (int k = 0; k <= nKeys; k++)
+		{
+			float fAngles[nBones];
+			for (int b = 0; b < nBones; b++)
+				fAngles[b] = (b == 0 ? 0.0f : 0.2f) * sinf(2.0f * 3.14159f * (float)k / (float)nKeys - (float)b * 0.9f);
+			skinned.AddBoneKey(2.0f * (float)k / (float)nKeys, fAngles);
+		}
+		skinned.AddVertexKey(0.0f, 0);
+		skinned.AddVertexKey(1.0f, nSwollen);
+		skinned.AddVertexKey(2.0f, 0);
+
+		// Four copies in a row behind the model, each a little out of step
+		const int nInstances = 4;
+		for (int n = 0; n < nInstances; n++)
+		{
+			sTransform transform;
+			transform.vPosition = { ((float)n - (float)(nInstances - 1) * 0.5f) * fModelRadius * 2.2f, 0.0f, fModelRadius * 2.5f };
+			sSkinnedInstance instance;
+			instance.fTimeOffset = (float)n * 0.37f;
+			entities.Create(transform, instance);
+		}
+	}
+
+	// Skin every instance and turn them into world space triangles in vecOut, adding
+	// ranges of them to vecVisible. Both stages are split into batches of instance
+	// and vertex (or triangle) range, so all the instances share the workers at once
+	void AnimateInstances(frameVector<sDrawRange>& vecVisible, frameVector<sWorldTri>& vecOut)
+	{
+		traceScope scope(Trace(), "Animate");
+		compactMesh& mesh = pModel->mesh.compact;
+		int nInstances = entities.CountWith<sTransform, sSkinnedInstance>();
+		int nVertices = skinned.VertexCount(), nTris = mesh.TriangleCount(), nBones = skinned.BoneCount();
+
+		frameVector<float> vecBones((size_t)nInstances * nBones * 12, 0.0f, FrameAllocator<float>());
+		frameVector<skinnedMesh::sVertexBlend> vecBlends(nInstances, skinnedMesh::sVertexBlend(), FrameAllocator<skinnedMesh::sVertexBlend>());
+		frameVector<quadMatrix> vecInstanceWorld(nInstances, quadMatrix(), FrameAllocator<quadMatrix>());
+		int n = 0;
+		entities.Each<sTransform, sSkinnedInstance>([&](sTransform& transform, sSkinnedInstance& instance)
+			{
+				skinned.Evaluate(fAnimationTime + instance.fTimeOffset, &vecBones[(size_t)n * nBones * 12], vecBlends[n]);
+				quadMatrix matOffset = EntityMatrix(transform);
+				vecInstanceWorld[n] = Matrix_MultiplyMatrix(matWorld, matOffset);
+				n++;
+			});
+
+		// Skinned positions, all the x of an instance, then its y, then its z
+		const int nVertexBatch = 1024;
+		int nVertexBatches = (nVertices + nVertexBatch - 1) / nVertexBatch;
+		frameVector<float> vecSkinned((size_t)nInstances * nVertices * 3, 0.0f, FrameAllocator<float>());
+		Jobs().ParallelFor(0, nInstances * nVertexBatches, 1, [&](int nFrom, int nTo)
+			{
+				for (int j = nFrom; j < nTo; j++)
+				{
+					int n = j / nVertexBatches, nStart = (j % nVertexBatches) * nVertexBatch;
+					float* pOut = &vecSkinned[(size_t)n * nVertices * 3];
+					skinned.Skin(&vecBones[(size_t)n * nBones * 12], vecBlends[n], nStart, min(nStart + nVertexBatch, nVertices),
+						pOut, pOut + nVertices, pOut + nVertices * 2);
+				}
+			});
+
+		const int nTriBatch = 512;
+		int nTriBatches = (nTris + nTriBatch - 1) / nTriBatch;
+		vecOut.resize((size_t)nInstances * nTris);
+		Jobs().ParallelFor(0, nInstances * nTriBatches, 1, [&](int nFrom, int nTo)
+			{
+				for (int j = nFrom; j < nTo; j++)
+				{
+					int n = j / nTriBatches, nStart = (j % nTriBatches) * nTriBatch;
+					const float* pX = &vecSkinned[(size_t)n * nVertices * 3];
+					const float* pY = pX + nVertices;
+					const float* pZ = pY + nVertices;
+					for (int i = nStart; i < min(nStart + nTriBatch, nTris); i++)
+					{
+						sWorldTri& world = vecOut[(size_t)n * nTris + i];
+						for (int k = 0; k < 3; k++)
+						{
+							uint32_t v = mesh.Index(i, k);
+							point3D p = { pX[v], pY[v], pZ[v] };
+							world.tri._point[k] = Matrix_MultiplyVector(vecInstanceWorld[n], p);
+						}
+						mesh.DecodeTexCoords(i, world.tri._tex);
+
+						// The stored normal is for the rest pose, a bent one needs working out
+						point3D line1 = Vector_Sub(world.tri._point[1], world.tri._point[0]);
+						point3D line2 = Vector_Sub(world.tri._point[2], world.tri._point[0]);
+						world.normal = Vector_CrossProduct(line1, line2);
+						world.normal = Vector_Normalise(world.normal);
+						ShadeWorldTriangle(world);
+					}
+				}
+			});
+
+		vecVisible.reserve(vecVisible.size() + (size_t)nInstances * nTriBatches);
+		for (int j = 0; j < nInstances * nTriBatches; j++)
+		{
+			int n = j / nTriBatches, nStart = (j % nTriBatches) * nTriBatch;
+			vecVisible.push_back({ &mesh, nStart, min(nTriBatch, nTris - nStart), &vecOut[(size_t)n * nTris + nStart] });
+		}
+	}
+
+	// Entities ============================================================================
+
+	quadMatrix EntityMatrix(sTransform& transform)
+	{
+		quadMatrix matPitch = Matrix_MakeRotationX(transform.fPitch);
+		quadMatrix matYaw = Matrix_MakeRotationY(transform.fYaw);
+		quadMatrix matTranslate = Matrix_MakeTranslation(transform.vPosition.x, transform.vPosition.y, transform.vPosition.z);
+		quadMatrix matObject = Matrix_MultiplyMatrix(matPitch, matYaw);
+		return Matrix_MultiplyMatrix(matObject, matTranslate);
+	}
+
+	// An octahedron to draw each rock with, sized to the model, and room for the belt so
+	// turning it on and off doesn't allocate
+	void BuildDebris()
+	{
+		float fSize = fModelRadius * 0.03f;
+		vector<triPoly> vecTris;
+		for (int f = 0; f < 8; f++)
+		{
+			float sx = (f & 1) ? -fSize : fSize, sy = (f & 2) ? -fSize : fSize, sz = (f & 4) ? -fSize : fSize;
+			triPoly t;
+			t._point[0] = { sx, 0.0f, 0.0f };
+			t._point[1] = { 0.0f, sy, 0.0f };
+			t._point[2] = { 0.0f, 0.0f, sz };
+
+			// Corners go anticlockwise seen from outside
+			if (sx * sy * sz < 0.0f)
+				swap(t._point[1], t._point[2]);
+			vecTris.push_back(t);
+		}
+		debrisMesh.Build(vecTris, false);
+		entities.Reserve<sTransform, sVelocity, sOrbit, sMeshRef>(nDebrisCount);
+		vecDebris.reserve(nDebrisCount);
+	}
+
+	// Rocks on circular orbits in a band around the model, spread out along it by the
+	// golden angle so no two start close together
+	void SpawnDebris()
+	{
+		point3D vCentre = Matrix_MultiplyVector(matWorld, vModelCentre);
+		sOrbit orbit;
+		orbit.fPull = 0.1f;
+		sMeshRef mesh;
+		mesh.pMesh = &debrisMesh;
+		for (int i = 0; i < nDebrisCount; i++)
+		{
+			float fAngle = (float)i * 2.39996f;
+			float fRadius = fModelRadius * (1.6f + fmodf((float)i * 0.618034f, 1.0f));
+			sTransform transform;
+			transform.vPosition = { vCentre.x + cosf(fAngle) * fRadius, vCentre.y + fModelRadius * 0.15f * sinf((float)i * 1.7f), vCentre.z + sinf(fAngle) * fRadius };
+
+			// Fast enough that the pull keeps it going round
+			float fSpeed = sqrtf(orbit.fPull) * fRadius;
+			sVelocity velocity;
+			velocity.vLinear = { -sinf(fAngle) * fSpeed, 0.0f, cosf(fAngle) * fSpeed };
+			velocity.fYawRate = 1.0f + (float)(i % 5) * 0.4f;
+			velocity.fPitchRate = 0.7f + (float)(i % 3) * 0.5f;
+			vecDebris.push_back(entities.Create(transform, velocity, orbit, mesh));
+		}
+	}
+
+	void DestroyDebris()
+	{
+		for (auto& e : vecDebris)
+			entities.Destroy(e);
+		vecDebris.clear();
+	}
+
+	// Systems that move entities, each a parallel pass over the tables it reads
+	void UpdateEntities(float fElapsedTime)
+	{
+		traceScope scope(Trace(), "Entities");
+		point3D vCentre = Matrix_MultiplyVector(matWorld, vModelCentre);
+		entities.ParallelEach<sTransform, sVelocity, sOrbit>(Jobs(), 1024, [&](sTransform& transform, sVelocity& velocity, sOrbit& orbit)
+			{
+				float fPull = orbit.fPull * fElapsedTime;
+				velocity.vLinear.x -= (transform.vPosition.x - vCentre.x) * fPull;
+				velocity.vLinear.y -= (transform.vPosition.y - vCentre.y) * fPull;
+				velocity.vLinear.z -= (transform.vPosition.z - vCentre.z) * fPull;
+			});
+		entities.ParallelEach<sTransform, sVelocity>(Jobs(), 1024, [&](sTransform& transform, sVelocity& velocity)
+			{
+				transform.vPosition.x += velocity.vLinear.x * fElapsedTime;
+				transform.vPosition.y += velocity.vLinear.y * fElapsedTime;
+				transform.vPosition.z += velocity.vLinear.z * fElapsedTime;
+				transform.fYaw += velocity.fYawRate * fElapsedTime;
+				transform.fPitch += velocity.fPitchRate * fElapsedTime;
+			});
+	}
+
+	// World space triangles of every entity with a mesh into vecOut, added to vecVisible
+	// as a range of each entity's mesh, split into pieces the size of a cluster
+	void WorldEntities(frameVector<sDrawRange>& vecVisible, frameVector<sWorldTri>& vecOut)
+	{
+		int nEntities = entities.CountWith<sTransform, sMeshRef>();
+		if (nEntities == 0)
+			return;
+		traceScope scope(Trace(), "Entity transform");
+
+		// Where each entity's triangles start, in query order
+		frameVector<int> vecFirst(FrameAllocator<int>());
+		vecFirst.reserve(nEntities + 1);
+		int nTris = 0;
+		entities.Each<sTransform, sMeshRef>([&](sTransform&, sMeshRef& mesh)
+			{
+				vecFirst.push_back(nTris);
+				nTris += mesh.pMesh->TriangleCount();
+			});
+		vecFirst.push_back(nTris);
+		vecOut.resize(nTris);
+
+		const int nRangeTris = 512;
+		vecVisible.reserve(vecVisible.size() + nEntities + nTris / nRangeTris);
+
+		int nBase = 0;
+		entities.EachRun<sTransform, sMeshRef>([&](int nCount, sTransform* pTransforms, sMeshRef* pMeshes)
+			{
+				Jobs().ParallelFor(0, nCount, 256, [&](int nFrom, int nTo)
+					{
+						for (int e = nFrom; e < nTo; e++)
+						{
+							quadMatrix matObject = EntityMatrix(pTransforms[e]);
+							compactMesh& mesh = *pMeshes[e].pMesh;
+							WorldTriangles(mesh, matObject, 0, mesh.TriangleCount(), &vecOut[vecFirst[nBase + e]]);
+						}
+					});
+
+				for (int e = 0; e < nCount; e++)
+				{
+					compactMesh* pMesh = pMeshes[e].pMesh;
+					sWorldTri* pWorld = &vecOut[vecFirst[nBase + e]];
+					for (int nStart = 0; nStart < pMesh->TriangleCount(); nStart += nRangeTris)
+						vecVisible.push_back({ pMesh, nStart, min(nRangeTris, pMesh->TriangleCount() - nStart), pWorld + nStart });
+				}
+				nBase += nCount;
+			});
+	}
+
+	// Particles ===========================================================================
+
+	// Pick what the emitter makes from the model, given its object space bounds. Each
+	// keeps somewhere between 8k and 40k particles alive
+	void SetupParticles(point3D& vMin, point3D& vMax)
+	{
+		particles.Create(nParticleCapacity);
+		point3D vCentre = Vector_Add(vMin, vMax);
+		vCentre = Vector_Mul(vCentre, 0.5f);
+
+		if (MODEL_NAME == "terrain.obj")
+		{
+			// Dust drifting on a breeze, always around wherever the camera is
+			uint16_t nGlyphs[particleSystem::nRampSteps] = { L'.', L'.', L'.', L'.' };
+			uint16_t nColours[particleSystem::nRampSteps] = { FG_DARK_GREY, FG_GREY, FG_GREY, FG_DARK_GREY };
+			particles.SetAppearance(nGlyphs, nColours, 0.05f);
+			particles.SetForces(0.4f, -0.05f, 0.0f, 0.5f);
+			bEmitterFollowsCamera = true;
+			vEmitterDirectionLocal = { 0.0f, 1.0f, 0.0f };
+			emitter.fRadius = 12.0f;
+			emitter.fSpread = 2.0f;
+			emitter.fSpeedMin = 0.1f; emitter.fSpeedMax = 0.4f;
+			emitter.fLifeMin = 3.0f; emitter.fLifeMax = 6.0f;
+			emitter.fRate = 2000.0f;
+		}
+		else if (MODEL_NAME == "spaceship.obj")
+		{
+			// Engine exhaust out of the back, white hot to smoke
+			uint16_t nGlyphs[particleSystem::nRampSteps] = { PIXEL_SOLID, PIXEL_THREEQUARTERS, PIXEL_HALF, PIXEL_QUARTER };
+			uint16_t nColours[particleSystem::nRampSteps] = { FG_WHITE, FG_YELLOW, FG_RED, FG_DARK_GREY };
+			particles.SetAppearance(nGlyphs, nColours, 0.15f);
+			particles.SetForces(0.0f, 0.0f, 0.0f, 3.0f);
+			vEmitterLocal = { vCentre.x, vCentre.y, vMin.z };
+			vEmitterDirectionLocal = { 0.0f, 0.0f, -1.0f };
+			emitter.fRadius = 0.3f;
+			emitter.fSpread = 0.15f;
+			emitter.fSpeedMin = 2.0f; emitter.fSpeedMax = 3.0f;
+			emitter.fLifeMin = 0.3f; emitter.fLifeMax = 0.6f;
+			emitter.fRate = 40000.0f;
+		}
+		else
+		{
+			// A fountain of sparks off the top that falls and bounces on the floor under
+			// the model, scaled to its size
+			float fScale = (vMax.y - vMin.y) / 3.0f;
+			uint16_t nGlyphs[particleSystem::nRampSteps] = { L'*', L'+', L'.', L'.' };
+			uint16_t nColours[particleSystem::nRampSteps] = { FG_WHITE, FG_YELLOW, FG_RED, FG_DARK_RED };
+			particles.SetAppearance(nGlyphs, nColours, 0.05f * fScale);
+			particles.SetForces(0.0f, -9.8f * fScale, 0.0f, 0.2f);
+			particles.SetFloor(vMin.y, 0.4f);
+			vEmitterLocal = { vCentre.x, vMax.y, vCentre.z };
+			vEmitterDirectionLocal = { 0.0f, 1.0f, 0.0f };
+			emitter.fRadius = 0.05f * fScale;
+			emitter.fSpread = 0.35f;
+			emitter.fSpeedMin = 2.5f * fScale; emitter.fSpeedMax = 4.0f * fScale;
+			emitter.fLifeMin = 1.5f; emitter.fLifeMax = 2.5f;
+			emitter.fRate = 20000.0f;
+		}
+	}
+
+	// Move the emitter with the model (or the camera), add this frame's new particles
+	// and move everything on
+	void UpdateParticles(float fElapsedTime)
+	{
+		traceScope scope(Trace(), "Particles");
+		point3D vPosition = bEmitterFollowsCamera ? vCamera : Matrix_MultiplyVector(matWorld, vEmitterLocal);
+		point3D vDirection = vEmitterDirectionLocal;
+		vDirection.w = 0.0f;
+		if (!bEmitterFollowsCamera)
+			vDirection = Matrix_MultiplyVector(matWorld, vDirection);
+		emitter.vPosition[0] = vPosition.x; emitter.vPosition[1] = vPosition.y; emitter.vPosition[2] = vPosition.z;
+		emitter.vDirection[0] = vDirection.x; emitter.vDirection[1] = vDirection.y; emitter.vDirection[2] = vDirection.z;
+
+		particles.Emit(emitter, fElapsedTime);
+		particles.Update(fElapsedTime);
+	}
+
+	// 1/w of the nearest projected triangle in each cell of rows nRowMin..nRowMax-1,
+	// 0 where there is none. The triangles haven't been cut to the screen edges yet, so
+	// they are clamped to it here
+	void SceneDepth(frameVector<triPoly>& vecTris, float* pDepth, int nRowMin, int nRowMax)
+	{
+		int nWidth = ScreenWidth();
+		for (auto& t : vecTris)
+		{
+			const point3D* a = &t._point[0];
+			const point3D* b = &t._point[1];
+			const point3D* c = &t._point[2];
+			float wa = t._tex[0].w, wb = t._tex[1].w, wc = t._tex[2].w;
+
+			float fArea = (b->x - a->x) * (c->y - a->y) - (b->y - a->y) * (c->x - a->x);
+			if (fArea == 0.0f)
+				continue;
+			if (fArea < 0.0f)
+			{
+				swap(b, c);
+				swap(wb, wc);
+				fArea = -fArea;
+			}
+			float fInvArea = 1.0f / fArea;
+
+			int minx = max(0, (int)floorf(min(a->x, min(b->x, c->x))));
+			int maxx = min(nWidth - 1, (int)ceilf(max(a->x, max(b->x, c->x))));
+			int miny = max(nRowMin, (int)floorf(min(a->y, min(b->y, c->y))));
+			int maxy = min(nRowMax - 1, (int)ceilf(max(a->y, max(b->y, c->y))));
+
+			for (int y = miny; y <= maxy; y++)
+			{
+				float py = (float)y + 0.5f;
+				float* pRow = pDepth + y * nWidth;
+				for (int x = minx; x <= maxx; x++)
+				{
+					float px = (float)x + 0.5f;
+					float e1 = (c->x - b->x) * (py - b->y) - (c->y - b->y) * (px - b->x);
+					float e2 = (a->x - c->x) * (py - c->y) - (a->y - c->y) * (px - c->x);
+					float e3 = (b->x - a->x) * (py - a->y) - (b->y - a->y) * (px - a->x);
+					if (e1 >= 0.0f && e2 >= 0.0f && e3 >= 0.0f)
+					{
+						// 1/w is linear across the screen, edge functions weight the corners
+						float fInvW = (e1 * wa + e2 * wb + e3 * wc) * fInvArea;
+						if (fInvW > pRow[x])
+							pRow[x] = fInvW;
+					}
+				}
+			}
+		}
+	}
+
+	// Particles over the rasterized view. Projection is split over ranges of particles,
+	// then each band of rows gets the scene's depth and the particles drawn into it
+	void DrawParticles(sViewport& view, frameVector<triPoly>& vecTris)
+	{
+		traceScope scope(Trace(), "Draw particles");
+		int nWidth = ScreenWidth(), nHeight = ScreenHeight();
+		quadMatrix matViewProj = Matrix_MultiplyMatrix(view.matView, view.matProj);
+		Jobs().ParallelFor(0, particles.AliveCount(), 8192, [&](int nFrom, int nTo)
+			{
+				particles.Project(&matViewProj._matrix[0][0], nWidth, nHeight, 0.1f, nFrom, nTo);
+			});
+
+		frameVector<float> vecDepth(nWidth * nHeight, 0.0f, FrameAllocator<float>());
+		int nBands = min(nHeight, Jobs().ThreadCount() * 2);
+		float fCellsPerUnit = 0.5f * (float)nWidth * view.matProj._matrix[0][0];
+		uint16_t* pCells = reinterpret_cast<uint16_t*>(m_bufScreen);
+		Jobs().ParallelFor(0, nBands, 1, [&](int nFrom, int nTo)
+			{
+				for (int b = nFrom; b < nTo; b++)
+				{
+					int nRowMin = b * nHeight / nBands, nRowMax = (b + 1) * nHeight / nBands;
+					SceneDepth(vecTris, vecDepth.data(), nRowMin, nRowMax);
+					particles.Draw(pCells, nWidth, nHeight, nWidth, vecDepth.data(), fCellsPerUnit, nRowMin, nRowMax);
+				}
+			});
+	}
+
+	// Shadows =============================================================================
+
+	// How much light reaches a world space point, from the detailed map if it covers
+	// the point, otherwise the one over the whole model
+	float ShadowLookup(point3D& p, point3D& normal)
+	{
+		for (auto& cascade : shadowCascades)
+		{
+			float fLit = cascade.Lookup(p.x, p.y, p.z, normal.x, normal.y, normal.z);
+			if (fLit >= 0.0f)
+				return fLit;
+		}
+		return 1.0f;
+	}
+
+	// Fit both maps to this frame and redraw whichever of them no longer match, true
+	// if any were redrawn
+	bool UpdateShadows()
+	{
+		// Geometry that moved takes its shadows with it
+		if (memcmp(&matWorld, &matShadowWorld, sizeof(quadMatrix)) != 0)
+		{
+			matShadowWorld = matWorld;
+			for (auto& cascade : shadowCascades)
+				cascade.Invalidate();
+		}
+
+		point3D vFocus = Vector_Mul(vLookDir, fShadowNearRadius);
+		vFocus = Vector_Add(vCamera, vFocus);
+		point3D vCentre = Matrix_MultiplyVector(matWorld, vModelCentre);
+
+		shadowCascades[0].SetLightDirection(vToLight.x, vToLight.y, vToLight.z);
+		shadowCascades[0].Fit(vFocus.x, vFocus.y, vFocus.z, fShadowNearRadius);
+		shadowCascades[1].SetLightDirection(vToLight.x, vToLight.y, vToLight.z);
+		shadowCascades[1].Fit(vCentre.x, vCentre.y, vCentre.z, fModelRadius);
+
+		if (!shadowCascades[0].NeedsRender() && !shadowCascades[1].NeedsRender())
+			return false;
+
+		// World space corners of every triangle, shared by both maps
+		traceScope scope(Trace(), "Shadow maps");
+		int nTris = pModel->mesh.compact.TriangleCount();
+		frameVector<point3D> vecWorld((size_t)nTris * 3, point3D(), FrameAllocator<point3D>());
+		Jobs().ParallelFor(0, nTris, 256, [&](int nFrom, int nTo)
+			{
+				for (int i = nFrom; i < nTo; i++)
+				{
+					point3D* p = &vecWorld[(size_t)i * 3];
+					pModel->mesh.compact.DecodePositions(i, p);
+					for (int v = 0; v < 3; v++)
+						p[v] = Matrix_MultiplyVector(matWorld, p[v]);
+				}
+			});
+
+		frameVector<float> vecLight((size_t)nTris * 9, 0.0f, FrameAllocator<float>());
+		for (auto& cascade : shadowCascades)
+		{
+			if (!cascade.NeedsRender())
+				continue;
+
+			Jobs().ParallelFor(0, nTris, 256, [&](int nFrom, int nTo)
+				{
+					for (int i = nFrom; i < nTo; i++)
+						for (int v = 0; v < 3; v++)
+						{
+							point3D& p = vecWorld[(size_t)i * 3 + v];
+							float vWorld[3] = { p.x, p.y, p.z };
+							cascade.ToLightSpace(vWorld, &vecLight[((size_t)i * 3 + v) * 3]);
+						}
+				});
+
+			// Each band of rows goes to its own thread, every triangle is offered to every band
+			cascade.BeginRender();
+			int nSize = cascade.Size();
+			int nBands = min(nSize, Jobs().ThreadCount() * 2);
+			Jobs().ParallelFor(0, nBands, 1, [&](int nFrom, int nTo)
+				{
+					for (int b = nFrom; b < nTo; b++)
+					{
+						int nRowMin = b * nSize / nBands, nRowMax = (b + 1) * nSize / nBands;
+						for (int i = 0; i < nTris; i++)
+						{
+							const float* t = &vecLight[(size_t)i * 9];
+							cascade.RasterizeTriangle(t, t + 3, t + 6, nRowMin, nRowMax);
+						}
+					}
+				});
+			cascade.EndRender();
+			nShadowMapsDrawn++;
+		}
+		return true;
+	}
+
+	// Streaming ============================================================================
+
+	// Nearest view space depth of an object space box that could be on screen, or -1 if
+	// none of it can be. Boxes reaching behind the near plane can't be bounded on screen,
+	// so they are kept, as nearest of all
+	float BoxScreenDepth(quadMatrix& matWorldView, const float* vMin, const float* vMax)
+	{
+		float fMinX = FLT_MAX, fMinY = FLT_MAX, fMaxX = -FLT_MAX, fMaxY = -FLT_MAX, fNearZ = FLT_MAX;
+		int nBehind = 0;
+		for (int k = 0; k < 8; k++)
+		{
+			point3D vCorner = { (k & 1) ? vMax[0] : vMin[0], (k & 2) ? vMax[1] : vMin[1], (k & 4) ? vMax[2] : vMin[2] };
+			point3D vViewed = Matrix_MultiplyVector(matWorldView, vCorner);
+			fNearZ = min(fNearZ, vViewed.z);
+			if (vViewed.z < 0.1f)
+			{
+				nBehind++;
+				continue;
+			}
+			point3D vScreen = ProjectToScreen(vViewed);
+			fMinX = min(fMinX, vScreen.x); fMaxX = max(fMaxX, vScreen.x);
+			fMinY = min(fMinY, vScreen.y); fMaxY = max(fMaxY, vScreen.y);
+		}
+
+		if (nBehind == 8)
+			return -1.0f;
+		if (nBehind > 0)
+			return 0.0f;
+		if (fMaxX < 0.0f || fMinX >= (float)ScreenWidth() || fMaxY < 0.0f || fMinY >= (float)ScreenHeight())
+			return -1.0f;
+		return fNearZ;
+	}
+
+	// Asks the pager for every page on screen, nearest first, then prefetches the pages
+	// that will be on screen in fPrefetchSeconds if the camera keeps moving and turning
+	// as it did last frame. vecVisible gets the pages on screen now
+	void StreamPages(float fElapsedTime, frameVector<int>& vecVisible)
+	{
+		quadMatrix matWorldView = Matrix_MultiplyMatrix(matWorld, matView);
+		for (int p = 0; p < pager.PageCount(); p++)
+		{
+			const meshPageFile::sPage& page = pager.Page(p);
+			float fDepth = BoxScreenDepth(matWorldView, page.vMin, page.vMax);
+			if (fDepth < 0.0f)
+				continue;
+			pager.Request(p, fDepth);
+			vecVisible.push_back(p);
+		}
+
+		point3D vMoved = Vector_Sub(vCamera, vCameraLast);
+		float fTurned = fYaw - fYawLast;
+		if (fElapsedTime > 0.0f && (Vector_DotProduct(vMoved, vMoved) > 0.0f || fTurned != 0.0f))
+		{
+			float fFramesAhead = fPrefetchSeconds / fElapsedTime;
+			point3D vAheadMove = Vector_Mul(vMoved, fFramesAhead);
+			point3D vAhead = Vector_Add(vCamera, vAheadMove);
+			point3D vUp = { 0,1,0 };
+			point3D vTarget = { 0,0,1 };
+			quadMatrix matAheadRot = Matrix_MakeRotationY(fYaw + fTurned * fFramesAhead);
+			point3D vAheadLook = Matrix_MultiplyVector(matAheadRot, vTarget);
+			vTarget = Vector_Add(vAhead, vAheadLook);
+			quadMatrix matAheadCamera = Matrix_PointAt(vAhead, vTarget, vUp);
+			quadMatrix matAheadView = Matrix_QuickInverse(matAheadCamera);
+			quadMatrix matAheadWorldView = Matrix_MultiplyMatrix(matWorld, matAheadView);
+			for (int p = 0; p < pager.PageCount(); p++)
+			{
+				const meshPageFile::sPage& page = pager.Page(p);
+				float fDepth = BoxScreenDepth(matAheadWorldView, page.vMin, page.vMax);
+				if (fDepth >= 0.0f)
+					pager.Request(p, fDepth, true);
+			}
+		}
+		vCameraLast = vCamera;
+		fYawLast = fYaw;
+
+		pager.Update();
+	}
+
+	// Ray queries ==========================================================================
+	// All positions and directions are in world space, for the frame most recently
+	// drawn. Rays are taken into object space so the BVH never has to be rebuilt when
+	// the world spins; matWorld is rotation and translation only, so distances along
+	// the ray come out the same in both spaces.
+
+	rayQuery MakeObjectSpaceRay(point3D& vOrigin, point3D& vDir, float fMaxDist)
+	{
+		quadMatrix matInvWorld = Matrix_QuickInverse(matWorld);
+		point3D vDirection = vDir;
+		vDirection.w = 0.0f;
+		point3D o = Matrix_MultiplyVector(matInvWorld, vOrigin);
+		point3D d = Matrix_MultiplyVector(matInvWorld, vDirection);
+
+		rayQuery ray;
+		ray.ox = o.x; ray.oy = o.y; ray.oz = o.z;
+		ray.dx = d.x; ray.dy = d.y; ray.dz = d.z;
+		ray.tMax = fMaxDist;
+		return ray;
+	}
+
+	// Pushes the camera sphere out of the mesh, then stops it dropping through the
+	// ground it was above last frame, however far it moved. Done in object space like
+	// the ray queries, so the grid never needs rebuilding when the world spins
+	void ResolveCameraCollision()
+	{
+		quadMatrix matInvWorld = Matrix_QuickInverse(matWorld);
+		point3D vLocal = Matrix_MultiplyVector(matInvWorld, vCamera);
+		if (!bCameraLocalPrevValid)
+			vCameraLocalPrev = vLocal;
+
+		pModel->collision.ResolveSphere(&vLocal.x, fCameraRadius);
+		nCollisionTrisTested = pModel->collision.LastTrianglesTested();
+
+		float fGround;
+		if (pModel->collision.GroundHeight(vLocal.x, vLocal.z, fGround, vCameraLocalPrev.y) && vLocal.y < fGround + fCameraRadius)
+			vLocal.y = fGround + fCameraRadius;
+		nCollisionTrisTested += pModel->collision.LastTrianglesTested();
+
+		vCameraLocalPrev = vLocal;
+		bCameraLocalPrevValid = true;
+		vCamera = Matrix_MultiplyVector(matWorld, vLocal);
+	}
+
+	// Texturing ============================================================================
+
+	// Mip level for a projected triangle, from how many texels land on each screen cell
+	int SelectMipLevel(triPoly& t)
+	{
+		float u[3], v[3];
+		for (int k = 0; k < 3; k++)
+		{
+			u[k] = t._tex[k].u / t._tex[k].w;
+			v[k] = t._tex[k].v / t._tex[k].w;
+		}
+		float fUVArea = 0.5f * fabsf((u[1] - u[0]) * (v[2] - v[0]) - (v[1] - v[0]) * (u[2] - u[0]));
+		float fScreenArea = 0.5f * fabsf((t._point[1].x - t._point[0].x) * (t._point[2].y - t._point[0].y) -
+			(t._point[1].y - t._point[0].y) * (t._point[2].x - t._point[0].x));
+		return texture.SelectLevel(fUVArea, fScreenArea);
+	}
+
+	// Scanline fill of a projected, screen clipped triangle, sampling the texture at
+	// every cell centre. u/w, v/w and 1/w are interpolated linearly across the screen
+	// and divided back out per cell, so the texture doesn't swim with depth
+	void TexturedTriangle(triPoly& t, int nMipLevel)
+	{
+		// Sort corners top to bottom
+		int i0 = 0, i1 = 1, i2 = 2;
+		if (t._point[i1].y < t._point[i0].y) swap(i0, i1);
+		if (t._point[i2].y < t._point[i0].y) swap(i0, i2);
+		if (t._point[i2].y < t._point[i1].y) swap(i1, i2);
+
+		point3D& p0 = t._point[i0]; point3D& p1 = t._point[i1]; point3D& p2 = t._point[i2];
+		point2D& t0 = t._tex[i0]; point2D& t1 = t._tex[i1]; point2D& t2 = t._tex[i2];
+		if (p2.y - p0.y <= 0.0f)
+			return;
+
+		// Position along an edge a --> b at height fY
+		struct sEdgePoint { float x, u, v, w; };
+		auto edgeAt = [](point3D& a, point2D& ta, point3D& b, point2D& tb, float fY)
+		{
+			float s = b.y - a.y > 0.0f ? (fY - a.y) / (b.y - a.y) : 0.0f;
+			s = (std::max)(0.0f, (std::min)(1.0f, s));
+			return sEdgePoint{ a.x + s * (b.x - a.x), ta.u + s * (tb.u - ta.u), ta.v + s * (tb.v - ta.v), ta.w + s * (tb.w - ta.w) };
+		};
+
+		int nYStart = max(0, (int)ceilf(p0.y - 0.5f));
+		int nYEnd = min(ScreenHeight() - 1, (int)ceilf(p2.y - 0.5f) - 1);
+		for (int y = nYStart; y <= nYEnd; y++)
+		{
+			float fY = (float)y + 0.5f;
+			sEdgePoint a = edgeAt(p0, t0, p2, t2, fY);
+			sEdgePoint b = fY < p1.y ? edgeAt(p0, t0, p1, t1, fY) : edgeAt(p1, t1, p2, t2, fY);
+			if (b.x < a.x)
+				swap(a, b);
+
+			int nXStart = max(0, (int)ceilf(a.x - 0.5f));
+			int nXEnd = min(ScreenWidth() - 1, (int)ceilf(b.x - 0.5f) - 1);
+			if (nXEnd < nXStart)
+				continue;
+
+			float fSpan = b.x - a.x;
+			float fInvSpan = fSpan > 0.0f ? 1.0f / fSpan : 0.0f;
+			float du = (b.u - a.u) * fInvSpan, dv = (b.v - a.v) * fInvSpan, dw = (b.w - a.w) * fInvSpan;
+			float fOffset = (float)nXStart + 0.5f - a.x;
+			float u = a.u + du * fOffset, v = a.v + dv * fOffset, w = a.w + dw * fOffset;
+
+			CHAR_INFO* pCell = m_bufScreen + y * ScreenWidth() + nXStart;
+			for (int x = nXStart; x <= nXEnd; x++)
+			{
+				float fInvW = 1.0f / w;
+				uint32_t nTexel = texture.Sample(u * fInvW, v * fInvW, nMipLevel);
+				pCell->Char.UnicodeChar = (wchar_t)(nTexel & 0xFFFF);
+				pCell->Attributes = (WORD)(nTexel >> 16);
+				pCell++;
+				u += du; v += dv; w += dw;
+			}
+
+			// Written straight to the cells rather than through Draw(), so counted here
+			if (uint16_t* pCounts = OverdrawCounts())
+				for (int x = nXStart; x <= nXEnd; x++)
+					pCounts[y * ScreenWidth() + x]++;
+		}
+	}
+
+public:
+	// Closest triangle of the mesh along a ray, hit.nTriangle indexes pModel->mesh.compact
+	bool CastRay(point3D& vOrigin, point3D& vDir, rayHit& hit, float fMaxDist = FLT_MAX)
+	{
+		return pModel->bvh.Intersect(MakeObjectSpaceRay(vOrigin, vDir, fMaxDist), hit);
+	}
+
+	// Many rays at once, avoids recomputing the inverse world matrix per ray
+	void CastRays(point3D* pOrigins, point3D* pDirs, rayHit* pHits, int nRays, float fMaxDist = FLT_MAX)
+	{
+		for (int i = 0; i < nRays; i++)
+			pHits[i] = rayHit();
+
+		quadMatrix matInvWorld = Matrix_QuickInverse(matWorld);
+		const int nBatch = 64;
+		rayQuery rays[nBatch];
+		for (int i = 0; i < nRays; i += nBatch)
+		{
+			int n = min(nBatch, nRays - i);
+			for (int k = 0; k < n; k++)
+			{
+				point3D vDirection = pDirs[i + k];
+				vDirection.w = 0.0f;
+				point3D o = Matrix_MultiplyVector(matInvWorld, pOrigins[i + k]);
+				point3D d = Matrix_MultiplyVector(matInvWorld, vDirection);
+				rays[k].ox = o.x; rays[k].oy = o.y; rays[k].oz = o.z;
+				rays[k].dx = d.x; rays[k].dy = d.y; rays[k].dz = d.z;
+				rays[k].tMax = fMaxDist;
+			}
+			pModel->bvh.IntersectBatch(rays, pHits + i, n);
+		}
+	}
+
+	// True if nothing in the mesh lies on the segment between the two points
+	bool HasLineOfSight(point3D& vFrom, point3D& vTo)
+	{
+		point3D vDir = Vector_Sub(vTo, vFrom);
+		return !pModel->bvh.Occluded(MakeObjectSpaceRay(vFrom, vDir, 1.0f));
+	}
+
+	// Triangle under a console cell, e.g. the mouse position
+	bool PickTriangle(int nScreenX, int nScreenY, rayHit& hit)
+	{
+		// Undo the projection and screen offset to get a view space direction
+		float fNdcX = 1.0f - 2.0f * ((float)nScreenX + 0.5f) / (float)ScreenWidth();
+		float fNdcY = 1.0f - 2.0f * ((float)nScreenY + 0.5f) / (float)ScreenHeight();
+		point3D vViewDir = { fNdcX / matProj._matrix[0][0], fNdcY / matProj._matrix[1][1], 1.0f, 0.0f };
+		point3D vWorldDir = Matrix_MultiplyVector(matCamera, vViewDir);
+		return CastRay(vCamera, vWorldDir, hit);
+	}
+
+private:
+	// Outside resource, apologies
+	CHAR_INFO GetColour(float lum)
+	{
+		short bg_col, fg_col;
+		wchar_t sym;
+		int pixel_bw = (int)(13.0f * lum);
+		switch (pixel_bw)
+		{
+		case 0: bg_col = BG_BLACK; fg_col = FG_BLACK; sym = PIXEL_SOLID; break;
+
+		case 1: bg_col = BG_BLACK; fg_col = FG_DARK_GREY; sym = PIXEL_QUARTER; break;
+		case 2: bg_col = BG_BLACK; fg_col = FG_DARK_GREY; sym = PIXEL_HALF; break;
+		case 3: bg_col = BG_BLACK; fg_col = FG_DARK_GREY; sym = PIXEL_THREEQUARTERS; break;
+		case 4: bg_col = BG_BLACK; fg_col = FG_DARK_GREY; sym = PIXEL_SOLID; break;
+
+		case 5: bg_col = BG_DARK_GREY; fg_col = FG_GREY; sym = PIXEL_QUARTER; break;
+		case 6: bg_col = BG_DARK_GREY; fg_col = FG_GREY; sym = PIXEL_HALF; break;
+		case 7: bg_col = BG_DARK_GREY; fg_col = FG_GREY; sym = PIXEL_THREEQUARTERS; break;
+		case 8: bg_col = BG_DARK_GREY; fg_col = FG_GREY; sym = PIXEL_SOLID; break;
+
+		case 9:  bg_col = BG_GREY; fg_col = FG_WHITE; sym = PIXEL_QUARTER; break;
+		case 10: bg_col = BG_GREY; fg_col = FG_WHITE; sym = PIXEL_HALF; break;
+		case 11: bg_col = BG_GREY; fg_col = FG_WHITE; sym = PIXEL_THREEQUARTERS; break;
+		case 12: bg_col = BG_GREY; fg_col = FG_WHITE; sym = PIXEL_SOLID; break;
+		default:
+			bg_col = BG_BLACK; fg_col = FG_BLACK; sym = PIXEL_SOLID;
+		}
+
+		CHAR_INFO c;
+		c.Attributes = bg_col | fg_col;
+		c.Char.UnicodeChar = sym;
+		return c;
+	}
+
+public:
+	bool OnWindowCreate() override
+	{
+		// Load object file. Its texture, if there is one, is the .spr next to it
+		traceScope scopeLoad(Trace(), "Load model");
+		wstring sModelFile(MODEL_NAME.begin(), MODEL_NAME.end());
+		wstring sTextureFile = sModelFile.substr(0, sModelFile.rfind(L'.')) + L".spr";
+		assetHandle<olcSprite> sprTexture;
+		if (STREAM_MODE_STATUS)
+		{
+			// Pages are built next to the model the first time it is streamed, and
+			// again whenever the model has changed since. There is no whole mesh in
+			// memory to cull, collide or pick against
+			wstring sPageFile = sModelFile.substr(0, sModelFile.rfind(L'.')) + L".cgem";
+			if (!pager.Open(sPageFile, nPageCacheSlots) || !pager.IsBuiltFrom(MODEL_NAME))
+			{
+				pager.Close();
+				if (!meshPageFile::Build(MODEL_NAME, sPageFile) || !pager.Open(sPageFile, nPageCacheSlots))
+					return false;
+			}
+			pager.SetTrace(&Trace());
+			pModel->mesh.bHasTexCoords = pager.HasTexCoords();
+			bOcclusionCulling = false;
+			bCameraCollision = false;
+		}
+		else
+		{
+			// Whether the model wants the texture isn't known until it has loaded, so
+			// the texture is read alongside it on the asset loaders in case it does
+			model = Assets().Load<sModelAsset>(sModelFile);
+			sprTexture = Assets().Load<olcSprite>(sTextureFile);
+			model.Wait();
+			if (model.IsReady())
+				pModel = model.Get();
+		}
+		scopeLoad.End();
+
+		// A texture is only used when the model has coordinates to map it with
+		if (pModel->mesh.bHasTexCoords)
+		{
+			traceScope scope(Trace(), "Load texture");
+			if (!sprTexture.IsValid())
+				sprTexture = Assets().Load<olcSprite>(sTextureFile);
+			sprTexture.Wait();
+			if (sprTexture.IsReady())
+				texture.Create(sprTexture.Get());
+			bTexturing = texture.IsValid();
+		}
+
+		// Shadow maps cover the model from a sphere around its cluster boxes
+		if (!pModel->mesh.clusterList.empty())
+		{
+			point3D vMin = pModel->mesh.clusterList[0].vMin, vMax = pModel->mesh.clusterList[0].vMax;
+			for (auto& cluster : pModel->mesh.clusterList)
+			{
+				vMin.x = min(vMin.x, cluster.vMin.x); vMax.x = max(vMax.x, cluster.vMax.x);
+				vMin.y = min(vMin.y, cluster.vMin.y); vMax.y = max(vMax.y, cluster.vMax.y);
+				vMin.z = min(vMin.z, cluster.vMin.z); vMax.z = max(vMax.z, cluster.vMax.z);
+			}
+			vModelCentre = Vector_Add(vMin, vMax);
+			vModelCentre = Vector_Mul(vModelCentre, 0.5f);
+			point3D vExtent = Vector_Sub(vMax, vModelCentre);
+			fModelRadius = max(Vector_Length(vExtent), 0.001f);
+			SetupParticles(vMin, vMax);
+		}
+		BuildDebris();
+		for (auto& cascade : shadowCascades)
+			cascade.Create(nShadowMapSize);
+		vecWorldCache.resize(pModel->mesh.compact.TriangleCount());
+		if (!STREAM_MODE_STATUS)
+			BuildAnimation();
+		vecClusterWorldVersion.assign(pModel->mesh.clusterList.size(), 0);
+		vToLight = Vector_Normalise(vToLight);
+		bShadows = !STREAM_MODE_STATUS;
+
+		// Up to full screen size, so scaling never has to reallocate it
+		vecSceneBuffer.resize(ScreenWidth() * ScreenHeight());
+		resolution.SetTargetFrameTime(1.0f / 60.0f);
+		resolution.SetScaleRange(0.25f, 1.0f);
+
+		// Projection Matrix
+		matProj = Matrix_MakeProjection(90.0f, (float)ScreenHeight() / (float)ScreenWidth(), 0.1f, 1000.0f);
+		return true;
+	}
+
+	bool OnWindowUpdate(float fElapsedTime) override
+	{
+		if (GetKey(VK_ESCAPE).bPressed)
+			return false;
+
+		if (GetKey(VK_UP).bHeld)
+			vCamera.y += 8.0f * fElapsedTime;	// Travel Upwards
+
+		if (GetKey(VK_DOWN).bHeld)
+			vCamera.y -= 8.0f * fElapsedTime;	// Travel Downwards
+
+
+		// TODO change to move left and right as strafe instead of in world space
+		if (GetKey(VK_LEFT).bHeld)
+			vCamera.x -= 8.0f * fElapsedTime;
+
+		if (GetKey(VK_RIGHT).bHeld)
+			vCamera.x += 8.0f * fElapsedTime;
+
+
+		point3D vForward = Vector_Mul(vLookDir, 8.0f * fElapsedTime);
+
+		if (GetKey(L'W').bHeld)
+			vCamera = Vector_Add(vCamera, vForward);
+
+		if (GetKey(L'S').bHeld)
+			vCamera = Vector_Sub(vCamera, vForward);
+
+		if (GetKey(L'A').bHeld)
+			fYaw -= 2.0f * fElapsedTime;
+
+		if (GetKey(L'D').bHeld)
+			fYaw += 2.0f * fElapsedTime;
+
+		if (GetKey(L'O').bPressed)
+			bOcclusionCulling = !bOcclusionCulling && !STREAM_MODE_STATUS;
+
+		if (GetKey(L'C').bPressed)
+			bCameraCollision = !bCameraCollision && !STREAM_MODE_STATUS;
+
+		if (GetKey(L'T').bPressed)
+			bTexturing = !bTexturing && texture.IsValid();
+
+		// Record the screen to capture.cgef, captureToImages turns it into pictures
+		if (GetKey(L'R').bPressed)
+		{
+			if (IsCapturingFrames())
+				StopFrameCapture();
+			else
+				StartFrameCapture(L"capture.cgef");
+		}
+
+		if (GetKey(L'M').bPressed)
+			bShowMeshMemory = !bShowMeshMemory;
+
+		if (GetKey(L'H').bPressed)
+			bOverdraw = !bOverdraw;
+
+		if (GetKey(L'L').bPressed)
+			bShadows = !bShadows && !STREAM_MODE_STATUS;
+
+		if (GetKey(L'K').bPressed)
+			bAnimating = !bAnimating && !STREAM_MODE_STATUS;
+
+		if (GetKey(L'N').bPressed)
+			bDebris = !bDebris && !STREAM_MODE_STATUS;
+
+		if (GetKey(L'E').bPressed)
+		{
+			bParticles = !bParticles && !STREAM_MODE_STATUS;
+			particles.Clear();
+		}
+
+		if (GetKey(L'P').bPressed)
+			nViewportLayout = (nViewportLayout + 1) % 3;
+
+		if (GetKey(L'V').bPressed)
+		{
+			bDynamicResolution = !bDynamicResolution;
+			resolution.Reset();
+		}
+
+
+		if(GLOBAL_SPIN_MODE_STATUS)
+			fTheta += 1.0f * fElapsedTime; // Spin to debug without moving
+
+		if (bAnimating)
+			fAnimationTime += fElapsedTime;
+
+		// Each frame's camera comes straight from the path, so it doesn't matter which
+		// frame a batch worker started on
+		if (pCameraPath != nullptr)
+		{
+			float vPosition[3];
+			pCameraPath->Sample((float)nCameraPathFrame++, vPosition, fYaw);
+			vCamera = { vPosition[0], vPosition[1], vPosition[2] };
+		}
+
+		// Nothing that shows has changed, the screen from the last frame is still right
+		if (IsFrameUnchanged())
+		{
+			SetFrameUnchanged();
+			return true;
+		}
+
+		quadMatrix matRotZ, matRotX;
+		matRotZ = Matrix_MakeRotationZ(fTheta * 0.5f);
+		matRotX = Matrix_MakeRotationX(fTheta);
+
+		quadMatrix matTrans;
+		matTrans = Matrix_MakeTranslation(0.0f, 0.0f, 5.0f);
+
+		matWorld = Matrix_MakeIdentity();	// World Matrix
+		matWorld = Matrix_MultiplyMatrix(matRotZ, matRotX); // Transform by rotation
+		matWorld = Matrix_MultiplyMatrix(matWorld, matTrans); // Transform by translation
+
+		// Keep the camera out of the mesh before it is used to build the view
+		if (bCameraCollision)
+			ResolveCameraCollision();
+		else
+			bCameraLocalPrevValid = false;
+
+		// "Point At" Matrix for camera
+		point3D vUp = { 0,1,0 };
+		point3D vTarget = { 0,0,1 };
+		quadMatrix matCameraRot = Matrix_MakeRotationY(fYaw);
+		vLookDir = Matrix_MultiplyVector(matCameraRot, vTarget);
+		vTarget = Vector_Add(vCamera, vLookDir);
+		matCamera = Matrix_PointAt(vCamera, vTarget, vUp);
+
+		// view matrix from camera
+		matView = Matrix_QuickInverse(matCamera);
+
+		SetupViewports();
+
+		// Draw the scene smaller when frames run over budget, it's stretched back up to
+		// the screen after rasterizing. Everything up to then follows ScreenWidth() and
+		// ScreenHeight(), so projection, culling and clipping all work at the scaled size.
+		// Split views are each drawn this way into their own rectangle further down
+		int nSceneWidth = ScreenWidth(), nSceneHeight = ScreenHeight();
+		if (bDynamicResolution)
+		{
+			resolution.Update(fElapsedTime);
+			nSceneWidth = resolution.ScaledSize(nSceneWidth);
+			nSceneHeight = resolution.ScaledSize(nSceneHeight);
+			if (nViewports == 1)
+				BeginRenderTarget(vecSceneBuffer.data(), nSceneWidth, nSceneHeight);
+		}
+
+		// The frame's work up to drawing, as a graph so the parts that don't depend on
+		// each other run at once. Shadows, particles, entities and culling start
+		// together; the visible list needs the culling, and the shadows as they light
+		// the world space triangles; then the model's world transform runs alongside
+		// the animated instances and the entities' triangles. Drawing follows, one view
+		// at a time
+		bool bShadowsRedrawn = false;
+		auto shadowsNode = [&]
+			{
+				bShadowsRedrawn = bShadows && UpdateShadows();
+			};
+
+		auto particlesNode = [&]
+			{
+				if (bParticles)
+					UpdateParticles(fElapsedTime);
+			};
+
+		auto entitiesNode = [&]
+			{
+				if (bDebris != !vecDebris.empty())
+				{
+					if (bDebris)
+						SpawnDebris();
+					else
+						DestroyDebris();
+				}
+				UpdateEntities(fElapsedTime);
+			};
+
+		// Clusters hidden behind the nearest geometry are skipped entirely
+		frameVector<char> vecClusterVisible(pModel->mesh.clusterList.size(), 1, FrameAllocator<char>());
+		int nOcclusionCulledTris = 0;
+
+		// Streamed meshes draw whichever of the pages on screen are in memory
+		frameVector<int> vecPagesVisible(FrameAllocator<int>());
+		auto cullNode = [&]
+			{
+				if (STREAM_MODE_STATUS)
+				{
+					traceScope scope(Trace(), "Stream pages");
+					vecPagesVisible.reserve(pager.PageCount());
+					StreamPages(fElapsedTime, vecPagesVisible);
+					swprintf_s(m_sFrameStats, nFrameStatsLength, L"- Streaming %d/%d pages, %d loading, %d missing, %d KB", pager.ResidentPages(), pager.PageCount(),
+						pager.LoadingPages(), pager.MissingPages(), (int)(pager.CacheBytes() / 1024));
+				}
+				else if (bOcclusionCulling && nViewports == 1)
+				{
+					traceScope scope(Trace(), "Occlusion cull");
+					nOcclusionCulledTris = CullOccludedClusters(vecClusterVisible);
+					swprintf_s(m_sFrameStats, nFrameStatsLength, L"- Occlusion culled %d/%d tris", nOcclusionCulledTris, pModel->mesh.compact.TriangleCount());
+				}
+				else
+					swprintf_s(m_sFrameStats, nFrameStatsLength, L"- Occlusion culling off");
+			};
+
+		// Visible clusters come from the world space cache, any that are out of date
+		// are transformed again first. Streamed pages are transformed into the frame's
+		// own storage, and are only requested for the main camera, the other views
+		// draw what it has loaded
+		frameVector<sDrawRange> vecVisible(FrameAllocator<sDrawRange>());
+		frameVector<sDrawRange> vecToTransform(FrameAllocator<sDrawRange>());
+		frameVector<sWorldTri> vecPageWorld(FrameAllocator<sWorldTri>());
+		auto gatherNode = [&]
+			{
+				if (STREAM_MODE_STATUS)
+				{
+					int nPageTris = 0;
+					for (int p : vecPagesVisible)
+						if (compactMesh* pPage = pager.Resident(p))
+							nPageTris += pPage->TriangleCount();
+					vecPageWorld.resize(nPageTris);
+
+					vecVisible.reserve(vecPagesVisible.size());
+					nPageTris = 0;
+					for (int p : vecPagesVisible)
+						if (compactMesh* pPage = pager.Resident(p))
+						{
+							vecVisible.push_back({ pPage, 0, pPage->TriangleCount(), vecPageWorld.data() + nPageTris });
+							nPageTris += pPage->TriangleCount();
+						}
+					vecToTransform = vecVisible;
+				}
+				else
+				{
+					// Everything moves when the model does, and shading changes with the shadows
+					bool bWorldChanged = memcmp(&matWorld, &matCacheWorld, sizeof(quadMatrix)) != 0;
+					if (bWorldChanged || bShadowsRedrawn || bShadows != bCacheShadows)
+					{
+						matCacheWorld = matWorld;
+						bCacheShadows = bShadows;
+						nWorldVersion++;
+					}
+
+					vecVisible.reserve(pModel->mesh.clusterList.size());
+					vecToTransform.reserve(pModel->mesh.clusterList.size());
+					for (size_t c = 0; c < pModel->mesh.clusterList.size(); c++)
+					{
+						if (!vecClusterVisible[c])
+							continue;
+						triPolyCluster& cluster = pModel->mesh.clusterList[c];
+						vecVisible.push_back({ &pModel->mesh.compact, cluster.nStart, cluster.nCount, &vecWorldCache[cluster.nStart] });
+						if (vecClusterWorldVersion[c] != nWorldVersion)
+						{
+							vecClusterWorldVersion[c] = nWorldVersion;
+							vecToTransform.push_back(vecVisible.back());
+						}
+					}
+				}
+			};
+
+		frameVector<sWorldTri> vecAnimatedWorld(FrameAllocator<sWorldTri>());
+		frameVector<sWorldTri> vecEntityWorld(FrameAllocator<sWorldTri>());
+		auto instancesNode = [&]
+			{
+				if (bAnimating)
+					AnimateInstances(vecVisible, vecAnimatedWorld);
+				WorldEntities(vecVisible, vecEntityWorld);
+			};
+
+		// Ranges write to their own part of the output, so they can go in any order
+		auto transformNode = [&]
+			{
+				traceScope scope(Trace(), "World transform");
+				Jobs().ParallelFor(0, (int)vecToTransform.size(), 1, [&](int nFrom, int nTo)
+					{
+						for (int v = nFrom; v < nTo; v++)
+						{
+							sDrawRange& range = vecToTransform[v];
+							WorldTriangles(*range.pMesh, matWorld, range.nStart, range.nStart + range.nCount, range.pWorld);
+						}
+					});
+			};
+
+		frameGraph.Clear();
+		int nShadowsNode = frameGraph.AddNode(shadowsNode);
+		frameGraph.AddNode(particlesNode);
+		int nEntitiesNode = frameGraph.AddNode(entitiesNode);
+		int nCullNode = frameGraph.AddNode(cullNode);
+		int nGatherNode = frameGraph.AddNode(gatherNode);
+		int nInstancesNode = frameGraph.AddNode(instancesNode);
+		int nTransformNode = frameGraph.AddNode(transformNode);
+		frameGraph.AddDependency(nShadowsNode, nGatherNode);
+		frameGraph.AddDependency(nCullNode, nGatherNode);
+		frameGraph.AddDependency(nGatherNode, nInstancesNode);
+		frameGraph.AddDependency(nEntitiesNode, nInstancesNode);
+		frameGraph.AddDependency(nGatherNode, nTransformNode);
+		frameGraph.Run(Jobs());
+
+		if (bCameraCollision)
+		{
+			AppendFrameStats(L" - Collision tested %d tris", nCollisionTrisTested);
+		}
+
+		if (IsCapturingFrames())
+		{
+			AppendFrameStats(L" - Recording %u frames", CaptureFramesWritten());
+		}
+
+		if (bShowMeshMemory)
+		{
+			AppendFrameStats(L" - Mesh %d tris %d verts %d KB, %d KB with BVH and grid (%d KB as triPolys)", pModel->mesh.compact.TriangleCount(),
+				pModel->mesh.compact.VertexCount(), (int)(pModel->mesh.MemoryBytes() / 1024), (int)(pModel->MemoryBytes() / 1024), (int)(pModel->mesh.UncompressedBytes() / 1024));
+		}
+
+		if (bDynamicResolution)
+		{
+			AppendFrameStats(L" - Scale %.2f (%dx%d)", resolution.Scale(), nSceneWidth, nSceneHeight);
+		}
+
+		if (bShadows)
+		{
+			AppendFrameStats(L" - Shadow maps drawn %d times", nShadowMapsDrawn);
+		}
+
+		if (nViewports > 1)
+		{
+			AppendFrameStats(L" - %d views", nViewports);
+		}
+
+		if (bParticles)
+		{
+			AppendFrameStats(L" - %d particles", particles.AliveCount());
+		}
+
+		if (bDebris)
+		{
+			AppendFrameStats(L" - %d entities", entities.Count());
+		}
+
+		nOverdrawWrites = nOverdrawCovered = nOverdrawCells = nOverdrawMax = 0;
+		if (nViewports == 1)
+			RenderView(viewports[0], vecVisible);
+		else
+		{
+			for (int v = 0; v < nViewports; v++)
+			{
+				// Drawn to the side at the view's size, or smaller, then copied into its rectangle
+				sViewport& view = viewports[v];
+				int nViewWidth = bDynamicResolution ? resolution.ScaledSize(view.w) : view.w;
+				int nViewHeight = bDynamicResolution ? resolution.ScaledSize(view.h) : view.h;
+				BeginRenderTarget(vecSceneBuffer.data(), nViewWidth, nViewHeight);
+				RenderView(view, vecVisible);
+				EndRenderTarget();
+				resolutionScaler::Upscale(vecSceneBuffer.data(), nViewWidth, nViewHeight,
+					m_bufScreen + view.y * ScreenWidth() + view.x, view.w, view.h, ScreenWidth());
+
+				// Frame the views laid over the main one
+				if (nViewportLayout == 1 && v > 0)
+				{
+					DrawLine(view.x, view.y + view.h - 1, view.x + view.w - 1, view.y + view.h - 1, PIXEL_SOLID, FG_GREY);
+					DrawLine(view.x, view.y, view.x, view.y + view.h - 1, PIXEL_SOLID, FG_GREY);
+					DrawLine(view.x + view.w - 1, view.y, view.x + view.w - 1, view.y + view.h - 1, PIXEL_SOLID, FG_GREY);
+				}
+			}
+		}
+
+		// Lines between the quarters of the split
+		if (nViewportLayout == 2)
+		{
+			DrawLine(viewports[1].x, 0, viewports[1].x, ScreenHeight() - 1, PIXEL_SOLID, FG_GREY);
+			DrawLine(0, viewports[2].y, ScreenWidth() - 1, viewports[2].y, PIXEL_SOLID, FG_GREY);
+		}
+
+
+		if (bDynamicResolution && nViewports == 1)
+		{
+			traceScope scope(Trace(), "Upscale");
+			EndRenderTarget();
+			resolutionScaler::Upscale(vecSceneBuffer.data(), nSceneWidth, nSceneHeight, m_bufScreen, ScreenWidth(), ScreenHeight());
+		}
+
+		// Key to the heatmap colours along the top, and how much drawing went to waste:
+		// writes per covered cell, 1.00x would be every cell drawn exactly once
+		if (bOverdraw)
+		{
+			for (int n = 1; n <= 8; n++)
+				Draw(n * 2 - 1, 0, n < 8 ? L'0' + n : L'+', OverdrawColour(n));
+
+			AppendFrameStats(L" - Overdraw %.2fx, %d%% covered, max %d",
+				nOverdrawCovered > 0 ? (float)nOverdrawWrites / (float)nOverdrawCovered : 0.0f,
+				nOverdrawCells > 0 ? nOverdrawCovered * 100 / nOverdrawCells : 0, nOverdrawMax);
+		}
+
+		// Outline whatever triangle is under the mouse while the left button is held
+		if (GetMouse(0).bHeld && !STREAM_MODE_STATUS && nViewports == 1)
+		{
+			rayHit hit;
+			if (PickTriangle(GetMouseX(), GetMouseY(), hit))
+			{
+				point3D p[3];
+				pModel->mesh.compact.DecodePositions(hit.nTriangle, p);
+				bool bInFront = true;
+				for (int v = 0; v < 3; v++)
+				{
+					p[v] = Matrix_MultiplyVector(matWorld, p[v]);
+					p[v] = Matrix_MultiplyVector(matView, p[v]);
+					bInFront &= p[v].z >= 0.1f;
+					p[v] = ProjectToScreen(p[v]);
+				}
+				if (bInFront)
+					DrawTriangle(p[0].x, p[0].y, p[1].x, p[1].y, p[2].x, p[2].y, PIXEL_SOLID, FG_YELLOW);
+				AppendFrameStats(L" - Picked tri %d at %.2f", hit.nTriangle, hit.t);
+			}
+		}
+
+		return true;
+	}
+
+};
+
+
+
+
+// Frame time batch renders are recorded at
+const float BATCH_FRAME_TIME = 1.0f / 30.0f;
+
+// One worker's share of a batch render, started by RunBatch()
+//
+//		demo3DEngine --batch-worker <model> <camera path> <part file> <first frame> <last frame> <width> <height> <job workers>
+int RunBatchWorker(int argc, char* argv[])
+{
+	if (argc < 10)
+		return 1;
+
+	MODEL_NAME = argv[2];
+	string sPath = argv[3], sPart = argv[4];
+	int nFirst = atoi(argv[5]), nLast = atoi(argv[6]);
+
+	cameraPath path;
+	if (!path.Load(wstring(sPath.begin(), sPath.end())))
+		return 1;
+
+	consoleEngine3D worker(atoi(argv[9]));
+	worker.SetCameraPath(&path, nFirst);
+	return worker.RenderOffline(atoi(argv[7]), atoi(argv[8]), wstring(sPart.begin(), sPart.end()), nLast - nFirst + 1, BATCH_FRAME_TIME) ? 0 : 1;
+}
+
+// Renders frames of a camera path through a model to a capture file, without a
+// console window, on every core
+//
+//		demo3DEngine --batch <model> <camera path> <output> <first frame> <last frame> [workers] [width] [height]
+//
+// The frames are split into one run per worker, each rendered by a copy of this
+// program into a part file next to the output. Workers are separate processes so
+// they share nothing, and each has its fair share of the cores for its own job
+// system rather than all of them. Once every worker has finished the parts are
+// joined in frame order, see ConcatenateCaptures()
+int RunBatch(int argc, char* argv[])
+{
+	int nCores = max(1, (int)thread::hardware_concurrency());
+	int nFirst = argc > 6 ? atoi(argv[5]) : 0, nLast = argc > 6 ? atoi(argv[6]) : -1;
+	int nWorkers = argc > 7 ? atoi(argv[7]) : nCores;
+	int nWidth = argc > 8 ? atoi(argv[8]) : 640;
+	int nHeight = argc > 9 ? atoi(argv[9]) : 360;
+	int nFrames = nLast - nFirst + 1;
+	if (argc < 7 || nFrames < 1 || nWorkers < 1 || nWidth < 1 || nHeight < 1)
+	{
+		cout << "Usage: demo3DEngine --batch <model> <camera path> <output> <first frame> <last frame> [workers] [width] [height]" << endl;
+		return 1;
+	}
+
+	string sModel = argv[2], sPath = argv[3], sOut = argv[4];
+	cameraPath path;
+	if (!path.Load(wstring(sPath.begin(), sPath.end())))
+	{
+		cout << "Couldn't read a camera path from " << sPath << endl;
+		return 1;
+	}
+
+	nWorkers = min(nWorkers, nFrames);
+	int nJobWorkers = max(0, nCores / nWorkers - 1);
+	wchar_t sExe[MAX_PATH];
+	GetModuleFileNameW(NULL, sExe, MAX_PATH);
+
+	auto tStart = chrono::steady_clock::now();
+	bool bOk = true;
+	vector<wstring> vecParts;
+	vector<PROCESS_INFORMATION> vecWorkers;
+	for (int w = 0; w < nWorkers && bOk; w++)
+	{
+		int nFrom = nFirst + (int)((long long)nFrames * w / nWorkers);
+		int nTo = nFirst + (int)((long long)nFrames * (w + 1) / nWorkers) - 1;
+		wstring sPart = wstring(sOut.begin(), sOut.end()) + L".part" + to_wstring(w);
+		wstring sCommand = L"\"" + wstring(sExe) + L"\" --batch-worker \"" + wstring(sModel.begin(), sModel.end()) + L"\" \"" +
+			wstring(sPath.begin(), sPath.end()) + L"\" \"" + sPart + L"\" " + to_wstring(nFrom) + L" " + to_wstring(nTo) + L" " +
+			to_wstring(nWidth) + L" " + to_wstring(nHeight) + L" " + to_wstring(nJobWorkers);
+
+		STARTUPINFOW si;
+		ZeroMemory(&si, sizeof(si));
+		si.cb = sizeof(si);
+		PROCESS_INFORMATION pi;
+		ZeroMemory(&pi, sizeof(pi));
+		bOk = CreateProcessW(sExe, &sCommand[0], NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi) != 0;
+		if (bOk)
+		{
+			vecParts.push_back(sPart);
+			vecWorkers.push_back(pi);
+		}
+	}
+
+	for (auto& pi : vecWorkers)
+	{
+		DWORD nExitCode = 1;
+		WaitForSingleObject(pi.hProcess, INFINITE);
+		GetExitCodeProcess(pi.hProcess, &nExitCode);
+		bOk = bOk && nExitCode == 0;
+		CloseHandle(pi.hProcess);
+		CloseHandle(pi.hThread);
+	}
+
+	bOk = bOk && ConcatenateCaptures(vecParts, wstring(sOut.begin(), sOut.end()));
+	for (auto& sPart : vecParts)
+		DeleteFileW(sPart.c_str());
+
+	float fSeconds = chrono::duration<float>(chrono::steady_clock::now() - tStart).count();
+	if (!bOk)
+	{
+		cout << "Batch render failed" << endl;
+		return 1;
+	}
+	cout << "Rendered " << nFrames << " frames with " << nWorkers << " workers in " << fSeconds << "s, " << nFrames / fSeconds << " frames per second" << endl;
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1 && string(argv[1]) == "--batch")
+		return RunBatch(argc, argv);
+	if (argc > 1 && string(argv[1]) == "--batch-worker")
+		return RunBatchWorker(argc, argv);
+
+	int __consoleWidth = 140, __consoleHeight = 80, tmp;
+	char debugTmp = 'N';
+	cout << "Input Console Width (Min: 140 please): ";
+	cin >> tmp;
+	if (tmp >= 140)
+	{
+		__consoleWidth = tmp;
+	}
+	cout << "Input Console Height (Min: 80 please): ";
+	cin >> tmp;
+	if (tmp >= 80)
+	{
+		__consoleHeight = tmp;
+	}
+	cout << "Turn debug mode ON? (Y/N)" << endl;
+	cin >> debugTmp;
+	if (debugTmp == 'Y')
+	{
+		DEBUG_MODE_STATUS = true;
 	}
 	else
 	{
@@ -678,7 +2773,22 @@ int main()
 	{
 		GLOBAL_SPIN_MODE_STATUS = false;
 	}
+	cout << "Stream the model from disk? (Y/N)" << endl;
+	cin >> debugTmp;
+	if (debugTmp == 'Y')
+	{
+		STREAM_MODE_STATUS = true;
+	}
+	else
+	{
+		STREAM_MODE_STATUS = false;
+	}
 	consoleEngine3D gameDemo;
+
+	// Debug runs also record a timeline, open trace.json in ui.perfetto.dev or chrome://tracing
+	if (DEBUG_MODE_STATUS)
+		gameDemo.StartTrace(L"trace.json");
+
 	if (gameDemo.ConstructConsole(__consoleWidth, __consoleHeight, 1, 1))
 		gameDemo.Start();
 	return 0;
@@ -0,0 +1,380 @@
+#pragma once
+
+#include "jobSystem.h"
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <type_traits>
+
+// Entities made of plain data components, stored by archetype: every entity with
+// the same set of component types lives in the same table, one array per component
+// type, with a row per entity. A query walks the tables that have all the types it
+// asks for, so a system is a straight run down a few arrays of exactly the data it
+// uses, with no per entity lookups or virtual calls.
+//
+// Entities are handles, an index and a generation, so a handle to a destroyed
+// entity is recognised instead of finding whatever took its slot. Destroying an
+// entity moves the last row of its table into the gap, and adding or removing a
+// component moves the entity to the table for its new set of types, so tables never
+// have holes. Tables grow by doubling, Reserve() makes room up front so spawning
+// doesn't allocate part way through a frame.
+//
+// Components must be trivially copyable, they are moved about with memcpy, and
+// there can be up to nMaxComponentTypes types of them. Tables can't change while a
+// query is running over them. ParallelEach() splits the rows of each table across
+// the job system, so a system must only touch the components of the row it is given.
+class entityStore
+{
+public:
+	static const int nMaxComponentTypes = 64;
+
+	struct sEntity
+	{
+		uint32_t nIndex = 0;
+		uint32_t nGeneration = 0;	// 0 is never a live entity, a default sEntity is no entity
+	};
+
+	entityStore()
+	{
+
+	}
+
+	entityStore(const entityStore&) = delete;
+	entityStore& operator=(const entityStore&) = delete;
+
+	// New entity with exactly these components
+	template<typename... T>
+	sEntity Create(const T&... components)
+	{
+		sArchetype& arch = FindArchetype(MaskOf<T...>());
+		sEntity e = NewEntity();
+		int nRow = AddRow(arch, e.nIndex);
+		m_vecRecords[e.nIndex].pArchetype = &arch;
+		m_vecRecords[e.nIndex].nRow = nRow;
+		int unused[] = { 0, (Write(arch, nRow, components), 0)... };
+		(void)unused;
+		return e;
+	}
+
+	void Destroy(sEntity e)
+	{
+		if (!IsAlive(e))
+			return;
+		sRecord& rec = m_vecRecords[e.nIndex];
+		RemoveRow(*rec.pArchetype, rec.nRow);
+		rec.pArchetype = nullptr;
+		rec.nGeneration++;
+		if (rec.nGeneration == 0)
+			rec.nGeneration = 1;
+		m_vecFree.push_back(e.nIndex);
+		m_nEntities--;
+	}
+
+	// Everything goes, the tables keep their memory
+	void Clear()
+	{
+		for (auto& pArch : m_vecArchetypes)
+			pArch->nCount = 0;
+		for (uint32_t i = 0; i < (uint32_t)m_vecRecords.size(); i++)
+		{
+			sRecord& rec = m_vecRecords[i];
+			if (rec.pArchetype)
+			{
+				rec.pArchetype = nullptr;
+				rec.nGeneration = rec.nGeneration + 1 == 0 ? 1 : rec.nGeneration + 1;
+				m_vecFree.push_back(i);
+			}
+		}
+		m_nEntities = 0;
+	}
+
+	bool IsAlive(sEntity e)
+	{
+		return e.nIndex < m_vecRecords.size() && m_vecRecords[e.nIndex].nGeneration == e.nGeneration && m_vecRecords[e.nIndex].pArchetype;
+	}
+
+	int Count() { return m_nEntities; }
+	int ArchetypeCount() { return (int)m_vecArchetypes.size(); }
+
+	// Component of an entity, nullptr if it doesn't have one or is gone
+	template<typename T>
+	T* Get(sEntity e)
+	{
+		if (!IsAlive(e))
+			return nullptr;
+		sRecord& rec = m_vecRecords[e.nIndex];
+		int nColumn = rec.pArchetype->nColumnOf[ComponentType<T>()];
+		if (nColumn < 0)
+			return nullptr;
+		return (T*)rec.pArchetype->vecColumns[nColumn].data() + rec.nRow;
+	}
+
+	// Give an entity another component, or overwrite the one it has
+	template<typename T>
+	void Add(sEntity e, const T& component)
+	{
+		if (!IsAlive(e))
+			return;
+		if (T* p = Get<T>(e))
+		{
+			*p = component;
+			return;
+		}
+		sRecord& rec = m_vecRecords[e.nIndex];
+		int nRow = MoveToArchetype(e.nIndex, FindArchetype(rec.pArchetype->mask | MaskOf<T>()));
+		Write(*rec.pArchetype, nRow, component);
+	}
+
+	template<typename T>
+	void Remove(sEntity e)
+	{
+		if (!Get<T>(e))
+			return;
+		sRecord& rec = m_vecRecords[e.nIndex];
+		MoveToArchetype(e.nIndex, FindArchetype(rec.pArchetype->mask & ~MaskOf<T>()));
+	}
+
+	// Room for nCount more entities with exactly these components, and for destroying
+	// them again
+	template<typename... T>
+	void Reserve(int nCount)
+	{
+		sArchetype& arch = FindArchetype(MaskOf<T...>());
+		Grow(arch, arch.nCount + nCount);
+		m_vecRecords.reserve(m_vecRecords.size() + nCount);
+		m_vecFree.reserve(m_vecRecords.capacity());
+	}
+
+	// f(T&...) for every entity that has all of T, and maybe others
+	template<typename... T, typename F>
+	void Each(F f)
+	{
+		uint64_t mask = MaskOf<T...>();
+		for (auto& pArch : m_vecArchetypes)
+			if ((pArch->mask & mask) == mask && pArch->nCount > 0)
+				RunRows(f, 0, pArch->nCount, Column<T>(*pArch)...);
+	}
+
+	// f(nCount, T*...) once for each table with all of T, with its arrays of them, for
+	// systems that want whole runs at once
+	template<typename... T, typename F>
+	void EachRun(F f)
+	{
+		uint64_t mask = MaskOf<T...>();
+		for (auto& pArch : m_vecArchetypes)
+			if ((pArch->mask & mask) == mask && pArch->nCount > 0)
+				f(pArch->nCount, Column<T>(*pArch)...);
+	}
+
+	// Each() with the rows of every table split into pieces of nGrain across the job
+	// system. Returns once they have all been done
+	template<typename... T, typename F>
+	void ParallelEach(jobSystem& jobs, int nGrain, F f)
+	{
+		uint64_t mask = MaskOf<T...>();
+		for (auto& pArch : m_vecArchetypes)
+		{
+			if ((pArch->mask & mask) != mask || pArch->nCount == 0)
+				continue;
+			sArchetype& arch = *pArch;
+			jobs.ParallelFor(0, arch.nCount, nGrain, [&](int nFrom, int nTo)
+				{
+					RunRows(f, nFrom, nTo, Column<T>(arch)...);
+				});
+		}
+	}
+
+	// How many entities have all of T
+	template<typename... T>
+	int CountWith()
+	{
+		uint64_t mask = MaskOf<T...>();
+		int nCount = 0;
+		for (auto& pArch : m_vecArchetypes)
+			if ((pArch->mask & mask) == mask)
+				nCount += pArch->nCount;
+		return nCount;
+	}
+
+private:
+	struct sArchetype
+	{
+		uint64_t mask = 0;
+		int nCount = 0;
+		int nCapacity = 0;
+		int nColumnOf[nMaxComponentTypes];			// -1 where the table has no such type
+		std::vector<int> vecTypes;					// Component type of each column
+		std::vector<std::vector<uint8_t>> vecColumns;
+		std::vector<uint32_t> vecEntities;			// Entity index of each row
+	};
+
+	struct sRecord
+	{
+		sArchetype* pArchetype = nullptr;		// nullptr while the index is free
+		int nRow = 0;
+		uint32_t nGeneration = 1;
+	};
+
+	// Component types are numbered the first time each is used, for every store, from
+	// whichever thread uses them first
+	static std::atomic<int>& ComponentTypeCount()
+	{
+		static std::atomic<int> nCount(0);
+		return nCount;
+	}
+
+	static size_t* ComponentSizes()
+	{
+		static size_t nSizes[nMaxComponentTypes];
+		return nSizes;
+	}
+
+	static int RegisterComponentType(size_t nSize)
+	{
+		int nType = ComponentTypeCount()++;
+		if (nType >= nMaxComponentTypes)
+			throw std::length_error("entityStore: more than nMaxComponentTypes component types");
+		ComponentSizes()[nType] = nSize;
+		return nType;
+	}
+
+	template<typename T>
+	static int ComponentType()
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "Components are moved with memcpy");
+		static const int nType = RegisterComponentType(sizeof(T));
+		return nType;
+	}
+
+	template<typename... T>
+	static uint64_t MaskOf()
+	{
+		uint64_t mask = 0;
+		int unused[] = { 0, (mask |= (uint64_t)1 << ComponentType<T>(), 0)... };
+		(void)unused;
+		return mask;
+	}
+
+	template<typename T>
+	static T* Column(sArchetype& arch)
+	{
+		return (T*)arch.vecColumns[arch.nColumnOf[ComponentType<T>()]].data();
+	}
+
+	template<typename F, typename... P>
+	static void RunRows(F& f, int nFrom, int nTo, P*... pColumns)
+	{
+		for (int r = nFrom; r < nTo; r++)
+			f(pColumns[r]...);
+	}
+
+	template<typename T>
+	static void Write(sArchetype& arch, int nRow, const T& component)
+	{
+		Column<T>(arch)[nRow] = component;
+	}
+
+	sArchetype& FindArchetype(uint64_t mask)
+	{
+		for (auto& pArch : m_vecArchetypes)
+			if (pArch->mask == mask)
+				return *pArch;
+
+		m_vecArchetypes.push_back(std::make_unique<sArchetype>());
+		sArchetype& arch = *m_vecArchetypes.back();
+		arch.mask = mask;
+		for (int t = 0; t < nMaxComponentTypes; t++)
+		{
+			arch.nColumnOf[t] = -1;
+			if (mask & ((uint64_t)1 << t))
+			{
+				arch.nColumnOf[t] = (int)arch.vecTypes.size();
+				arch.vecTypes.push_back(t);
+			}
+		}
+		arch.vecColumns.resize(arch.vecTypes.size());
+		return arch;
+	}
+
+	void Grow(sArchetype& arch, int nCapacity)
+	{
+		if (nCapacity <= arch.nCapacity)
+			return;
+		arch.nCapacity = nCapacity;
+		for (size_t c = 0; c < arch.vecTypes.size(); c++)
+			arch.vecColumns[c].resize((size_t)nCapacity * ComponentSizes()[arch.vecTypes[c]]);
+		arch.vecEntities.resize(nCapacity);
+	}
+
+	int AddRow(sArchetype& arch, uint32_t nEntity)
+	{
+		if (arch.nCount == arch.nCapacity)
+			Grow(arch, (std::max)(16, arch.nCapacity * 2));
+		int nRow = arch.nCount++;
+		arch.vecEntities[nRow] = nEntity;
+		return nRow;
+	}
+
+	// The last row fills the gap, and its entity is told where it went
+	void RemoveRow(sArchetype& arch, int nRow)
+	{
+		int nLast = --arch.nCount;
+		if (nRow != nLast)
+		{
+			for (size_t c = 0; c < arch.vecTypes.size(); c++)
+			{
+				size_t nSize = ComponentSizes()[arch.vecTypes[c]];
+				memcpy(arch.vecColumns[c].data() + nRow * nSize, arch.vecColumns[c].data() + nLast * nSize, nSize);
+			}
+			arch.vecEntities[nRow] = arch.vecEntities[nLast];
+			m_vecRecords[arch.vecEntities[nRow]].nRow = nRow;
+		}
+	}
+
+	// Copies the components both tables have, returns the entity's new row
+	int MoveToArchetype(uint32_t nEntity, sArchetype& to)
+	{
+		sRecord& rec = m_vecRecords[nEntity];
+		sArchetype& from = *rec.pArchetype;
+		int nRow = AddRow(to, nEntity);
+		for (size_t c = 0; c < to.vecTypes.size(); c++)
+		{
+			int nFromColumn = from.nColumnOf[to.vecTypes[c]];
+			if (nFromColumn < 0)
+				continue;
+			size_t nSize = ComponentSizes()[to.vecTypes[c]];
+			memcpy(to.vecColumns[c].data() + nRow * nSize, from.vecColumns[nFromColumn].data() + rec.nRow * nSize, nSize);
+		}
+		RemoveRow(from, rec.nRow);
+		rec.pArchetype = &to;
+		rec.nRow = nRow;
+		return nRow;
+	}
+
+	sEntity NewEntity()
+	{
+		uint32_t nIndex;
+		if (!m_vecFree.empty())
+		{
+			nIndex = m_vecFree.back();
+			m_vecFree.pop_back();
+		}
+		else
+		{
+			nIndex = (uint32_t)m_vecRecords.size();
+			m_vecRecords.emplace_back();
+		}
+		m_nEntities++;
+		return { nIndex, m_vecRecords[nIndex].nGeneration };
+	}
+
+	std::vector<std::unique_ptr<sArchetype>> m_vecArchetypes;	// Pointers so records can hold on to them
+	std::vector<sRecord> m_vecRecords;		// By entity index
+	std::vector<uint32_t> m_vecFree;		// Entity indices to use again
+	int m_nEntities = 0;
+};
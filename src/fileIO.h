@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <cwchar>
+#include <string>
+
+// Opening files by their wide path on any platform. Windows takes the path as it
+// is; elsewhere it is converted to the multibyte encoding of the current locale
+// first, so names outside ASCII reach the file system intact.
+namespace fileIO
+{
+	// False if the path has characters the locale can't represent
+	inline bool NarrowPath(const std::wstring& sFile, std::string& sPath)
+	{
+		sPath.assign(sFile.size() * MB_CUR_MAX + 1, '\0');
+		size_t nLen = std::wcstombs(&sPath[0], sFile.c_str(), sPath.size());
+		if (nLen == (size_t)-1)
+			return false;
+		sPath.resize(nLen);
+		return true;
+	}
+
+	// As fopen(), nullptr if the file can't be opened
+	inline std::FILE* OpenFile(const std::wstring& sFile, const wchar_t* sMode)
+	{
+		std::FILE* f = nullptr;
+#if defined(_WIN32)
+		_wfopen_s(&f, sFile.c_str(), sMode);
+#else
+		std::string sPath;
+		if (!NarrowPath(sFile, sPath))
+			return nullptr;
+		std::string sModeA(sMode, sMode + std::wcslen(sMode));
+		f = std::fopen(sPath.c_str(), sModeA.c_str());
+#endif
+		return f;
+	}
+}
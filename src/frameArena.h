@@ -0,0 +1,232 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cassert>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Debug builds count every global heap allocation made by the threads doing a
+// frame's work, the game thread and the job workers, so the engine can assert that
+// a steady-state frame only ever touches the frame arena. Other threads, loaders,
+// audio or the capture writer, work to their own timing and aren't counted, nor
+// are asset loads on the job workers.
+// Define FRAME_ARENA_HEAP_CHECK to 0 to turn the check off in a debug build.
+//
+// The counting replaces the global operator new, which must only be defined once
+// in a program, so define FRAME_ARENA_HEAP_HOOKS before including this in exactly
+// one .cpp file. Without it nothing is counted and the check always passes.
+#if !defined(FRAME_ARENA_HEAP_CHECK)
+#if defined(_DEBUG)
+#define FRAME_ARENA_HEAP_CHECK 1
+#else
+#define FRAME_ARENA_HEAP_CHECK 0
+#endif
+#endif
+
+// Number of global operator new calls made so far by the counted threads
+inline std::atomic<size_t>& frameArenaHeapAllocCount()
+{
+	static std::atomic<size_t> nCount(0);
+	return nCount;
+}
+
+// Set on a thread to have its allocations counted
+inline bool& frameArenaHeapCheckThread()
+{
+	static thread_local bool bCounted = false;
+	return bCounted;
+}
+
+#if FRAME_ARENA_HEAP_CHECK && defined(FRAME_ARENA_HEAP_HOOKS)
+// Replacement global allocation functions, only the counter is added
+void* operator new(size_t nBytes)
+{
+	if (frameArenaHeapCheckThread())
+		frameArenaHeapAllocCount().fetch_add(1, std::memory_order_relaxed);
+	if (void* p = std::malloc(nBytes ? nBytes : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t nBytes)
+{
+	if (frameArenaHeapCheckThread())
+		frameArenaHeapAllocCount().fetch_add(1, std::memory_order_relaxed);
+	if (void* p = std::malloc(nBytes ? nBytes : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+#endif
+
+// Linear "bump" allocator for data that only lives for one frame. Allocation is
+// a pointer increment, under a lock so the frame's jobs can share the arena,
+// there is no per-allocation free, and Reset() at the start of the next frame
+// throws everything away at once. If a frame needs more than the current
+// capacity, overflow blocks are chained on and then merged into one block the
+// size of the high-water mark at the next Reset(), so after a few frames the arena
+// stops touching the heap altogether.
+class frameArena
+{
+public:
+	frameArena(size_t nInitialBytes = 1 << 20)
+	{
+		m_nCapacity = nInitialBytes;
+		m_pBlock = new char[m_nCapacity];
+		m_nHeapAllocs++;
+	}
+
+	~frameArena()
+	{
+		FreeOverflow();
+		delete[] m_pBlock;
+	}
+
+	frameArena(const frameArena&) = delete;
+	frameArena& operator=(const frameArena&) = delete;
+
+	// Any of the frame's jobs can allocate at once
+	void* Allocate(size_t nBytes, size_t nAlign = alignof(std::max_align_t))
+	{
+		std::lock_guard<std::mutex> lm(m_mux);
+
+		// Try the main block first
+		size_t nStart = (m_nOffset + nAlign - 1) & ~(nAlign - 1);
+		if (m_pOverflow == nullptr && nStart + nBytes <= m_nCapacity)
+		{
+			m_nOffset = nStart + nBytes;
+			m_nUsed = m_nOffset;
+			UpdateHighWater();
+			return m_pBlock + nStart;
+		}
+
+		while (true)
+		{
+			// Then whatever overflow block is current
+			if (m_pOverflow != nullptr)
+			{
+				uintptr_t pBase = (uintptr_t)(m_pOverflow + 1);
+				uintptr_t pAligned = (pBase + m_pOverflow->nOffset + nAlign - 1) & ~(uintptr_t)(nAlign - 1);
+				size_t nEnd = (size_t)(pAligned - pBase) + nBytes;
+				if (nEnd <= m_pOverflow->nSize)
+				{
+					m_nUsed += nEnd - m_pOverflow->nOffset;
+					m_pOverflow->nOffset = nEnd;
+					UpdateHighWater();
+					return (void*)pAligned;
+				}
+			}
+
+			// Out of room, chain on a new block that is at least as big as the main one
+			size_t nBlockSize = m_nCapacity > nBytes + nAlign ? m_nCapacity : nBytes + nAlign;
+			sOverflowBlock* pNew = (sOverflowBlock*)new char[sizeof(sOverflowBlock) + nBlockSize];
+			m_nHeapAllocs++;
+			m_nGrowths++;
+			pNew->nSize = nBlockSize;
+			pNew->nOffset = 0;
+			pNew->pNext = m_pOverflow;
+			m_pOverflow = pNew;
+		}
+	}
+
+	// Called once at the start of every frame
+	void Reset()
+	{
+		if (m_pOverflow != nullptr)
+		{
+			// Last frame did not fit, so grow the main block to cover the peak
+			FreeOverflow();
+			size_t nNewCapacity = m_nCapacity;
+			while (nNewCapacity < m_nHighWater)
+				nNewCapacity *= 2;
+			delete[] m_pBlock;
+			m_nCapacity = nNewCapacity;
+			m_pBlock = new char[m_nCapacity];
+			m_nHeapAllocs++;
+		}
+		m_nOffset = 0;
+		m_nUsed = 0;
+	}
+
+	size_t BytesUsed() { return m_nUsed; }
+	size_t Capacity() { return m_nCapacity; }
+	size_t HighWater() { return m_nHighWater; }
+	size_t GrowthCount() { return m_nGrowths; }
+
+	// Heap allocations the arena itself has made, used by the debug heap check
+	size_t HeapAllocCount() { return m_nHeapAllocs; }
+
+private:
+	struct sOverflowBlock
+	{
+		size_t nSize;
+		size_t nOffset;
+		sOverflowBlock* pNext;
+	};
+
+	void FreeOverflow()
+	{
+		while (m_pOverflow != nullptr)
+		{
+			sOverflowBlock* pNext = m_pOverflow->pNext;
+			delete[] (char*)m_pOverflow;
+			m_pOverflow = pNext;
+		}
+	}
+
+	void UpdateHighWater()
+	{
+		if (m_nUsed > m_nHighWater)
+			m_nHighWater = m_nUsed;
+	}
+
+	char* m_pBlock = nullptr;
+	size_t m_nCapacity = 0;
+	size_t m_nOffset = 0;
+	size_t m_nUsed = 0;
+	size_t m_nHighWater = 0;
+	size_t m_nGrowths = 0;
+	size_t m_nHeapAllocs = 0;
+	sOverflowBlock* m_pOverflow = nullptr;
+	std::mutex m_mux;
+};
+
+// Standard library allocator on top of a frameArena, so std containers can be
+// used for transient render data. deallocate() is a no-op, memory comes back
+// when the arena is Reset().
+template<typename T>
+struct frameArenaAllocator
+{
+	typedef T value_type;
+
+	frameArena* pArena;
+
+	frameArenaAllocator(frameArena* arena) : pArena(arena) {}
+
+	template<typename U>
+	frameArenaAllocator(const frameArenaAllocator<U>& other) : pArena(other.pArena) {}
+
+	T* allocate(size_t n)
+	{
+		return (T*)pArena->Allocate(n * sizeof(T), alignof(T));
+	}
+
+	void deallocate(T*, size_t) {}
+
+	template<typename U>
+	bool operator==(const frameArenaAllocator<U>& other) const { return pArena == other.pArena; }
+
+	template<typename U>
+	bool operator!=(const frameArenaAllocator<U>& other) const { return pArena != other.pArena; }
+};
+
+template<typename T>
+using frameVector = std::vector<T, frameArenaAllocator<T>>;
@@ -0,0 +1,503 @@
+#pragma once
+
+#include "fileIO.h"
+#include "traceRecorder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Compression used for captured frames. Each frame is XORed with the one before it,
+// which leaves zeros everywhere the screen didn't change, then packed with a small
+// LZ77 coder. A run of unchanged cells becomes a single match against the byte
+// before it, so a mostly static frame costs a few bytes.
+//
+// Packed stream: a control byte c then
+//		c < 0x80	c + 1 literal bytes follow
+//		c >= 0x80	a match of (c & 0x7f) + 4 bytes, uint16 distance back, and if
+//					(c & 0x7f) == 0x7f a uint16 of extra length
+namespace frameCaptureCodec
+{
+	const int nHashBits = 12;
+	const size_t nMinMatch = 4;
+	const size_t nMaxMatch = 4 + 0x7f + 0xffff;
+
+	// Worst case size of Compress() output for nIn bytes
+	inline size_t Bound(size_t nIn)
+	{
+		return nIn + nIn / 128 + 16;
+	}
+
+	// pHash must hold 1 << nHashBits ints
+	inline size_t Compress(const uint8_t* pIn, size_t nIn, uint8_t* pOut, int* pHash)
+	{
+		for (int h = 0; h < (1 << nHashBits); h++)
+			pHash[h] = -1;
+
+		size_t o = 0, i = 0, nLiteral = 0;
+		auto FlushLiterals = [&](size_t nEnd)
+		{
+			while (nLiteral < nEnd)
+			{
+				size_t n = (std::min)(nEnd - nLiteral, (size_t)128);
+				pOut[o++] = (uint8_t)(n - 1);
+				std::memcpy(pOut + o, pIn + nLiteral, n);
+				o += n;
+				nLiteral += n;
+			}
+		};
+
+		while (i + nMinMatch <= nIn)
+		{
+			uint32_t v;
+			std::memcpy(&v, pIn + i, 4);
+			uint32_t h = (v * 2654435761u) >> (32 - nHashBits);
+			int nCandidate = pHash[h];
+			pHash[h] = (int)i;
+
+			if (nCandidate < 0 || i - nCandidate > 0xffff || std::memcmp(pIn + nCandidate, pIn + i, nMinMatch) != 0)
+			{
+				i++;
+				continue;
+			}
+
+			size_t nLength = nMinMatch;
+			while (i + nLength < nIn && nLength < nMaxMatch && pIn[nCandidate + nLength] == pIn[i + nLength])
+				nLength++;
+
+			FlushLiterals(i);
+			size_t nCode = (std::min)(nLength - nMinMatch, (size_t)0x7f);
+			uint16_t nDistance = (uint16_t)(i - nCandidate);
+			pOut[o++] = (uint8_t)(0x80 | nCode);
+			std::memcpy(pOut + o, &nDistance, 2);
+			o += 2;
+			if (nCode == 0x7f)
+			{
+				uint16_t nExtra = (uint16_t)(nLength - nMinMatch - 0x7f);
+				std::memcpy(pOut + o, &nExtra, 2);
+				o += 2;
+			}
+
+			i += nLength;
+			nLiteral = i;
+		}
+
+		FlushLiterals(nIn);
+		return o;
+	}
+
+	// False if the data is corrupt or doesn't unpack to exactly nOut bytes
+	inline bool Decompress(const uint8_t* pIn, size_t nIn, uint8_t* pOut, size_t nOut)
+	{
+		size_t i = 0, o = 0;
+		while (i < nIn)
+		{
+			uint8_t c = pIn[i++];
+			if (c < 0x80)
+			{
+				size_t n = (size_t)c + 1;
+				if (i + n > nIn || o + n > nOut)
+					return false;
+				std::memcpy(pOut + o, pIn + i, n);
+				i += n;
+				o += n;
+				continue;
+			}
+
+			uint16_t nDistance = 0, nExtra = 0;
+			if (i + 2 > nIn)
+				return false;
+			std::memcpy(&nDistance, pIn + i, 2);
+			i += 2;
+			size_t nLength = (size_t)(c & 0x7f) + nMinMatch;
+			if ((c & 0x7f) == 0x7f)
+			{
+				if (i + 2 > nIn)
+					return false;
+				std::memcpy(&nExtra, pIn + i, 2);
+				i += 2;
+				nLength += nExtra;
+			}
+			if (nDistance == 0 || nDistance > o || o + nLength > nOut)
+				return false;
+
+			// Byte at a time, the source may overlap what is being written
+			for (size_t k = 0; k < nLength; k++, o++)
+				pOut[o] = pOut[o - nDistance];
+		}
+		return o == nOut;
+	}
+}
+
+// Records the screen buffer every frame to a capture file without holding up the
+// game loop. Submit() copies the frame into the next free buffer of a preallocated
+// ring and returns; a background thread compresses each frame against the one
+// before it and writes it out. If the writer falls behind and the ring is full the
+// frame is skipped rather than waited for, and counted in FramesDropped().
+//
+// Cells are 4 bytes, a 16-bit glyph then a 16-bit colour, the layout of CHAR_INFO.
+//
+// File layout: "CGEF", uint32 version, uint16 width, uint16 height, then per frame
+// a uint32 packed size, float elapsed time, uint8 flags and the packed cells. A
+// keyframe (flag 1) is packed on its own, every other frame as its XOR with the
+// previous frame. There is a keyframe every nKeyframeInterval frames, so a damaged
+// capture can be read again from the next one.
+class frameCaptureWriter
+{
+public:
+	static const int nKeyframeInterval = 300;
+
+	frameCaptureWriter()
+	{
+
+	}
+
+	~frameCaptureWriter()
+	{
+		Stop();
+	}
+
+	frameCaptureWriter(const frameCaptureWriter&) = delete;
+	frameCaptureWriter& operator=(const frameCaptureWriter&) = delete;
+
+	bool Start(const std::wstring& sFile, int nWidth, int nHeight, int nRingFrames = 8)
+	{
+		Stop();
+		m_pFile = fileIO::OpenFile(sFile, L"wb");
+		if (m_pFile == nullptr)
+			return false;
+
+		uint32_t nVersion = 1;
+		uint16_t nW = (uint16_t)nWidth, nH = (uint16_t)nHeight;
+		bool bOk = std::fwrite("CGEF", 1, 4, m_pFile) == 4;
+		bOk &= std::fwrite(&nVersion, sizeof(uint32_t), 1, m_pFile) == 1;
+		bOk &= std::fwrite(&nW, sizeof(uint16_t), 1, m_pFile) == 1;
+		bOk &= std::fwrite(&nH, sizeof(uint16_t), 1, m_pFile) == 1;
+		m_bWriteFailed = !bOk;
+		m_nBytesWritten = 4 + sizeof(nVersion) + sizeof(nW) + sizeof(nH);
+
+		// Everything the writer thread needs is allocated here
+		m_nCells = (size_t)nWidth * nHeight;
+		m_nRingFrames = nRingFrames;
+		m_vecRing.assign(m_nCells * nRingFrames, 0);
+		m_vecElapsed.assign(nRingFrames, 0.0f);
+		m_vecPrevious.assign(m_nCells, 0);
+		m_vecDelta.assign(m_nCells, 0);
+		m_vecPacked.assign(frameCaptureCodec::Bound(m_nCells * 4), 0);
+		m_vecHash.assign((size_t)1 << frameCaptureCodec::nHashBits, 0);
+
+		m_nSubmitted = 0;
+		m_nWritten = 0;
+		m_nDropped = 0;
+		m_bStop = false;
+		m_bRecording = true;
+		m_thread = std::thread(&frameCaptureWriter::WriterThread, this);
+		return true;
+	}
+
+	// Writes out whatever is still in the ring and closes the file
+	void Stop()
+	{
+		if (!m_bRecording)
+			return;
+
+		{
+			std::unique_lock<std::mutex> lm(m_mux);
+			m_bStop = true;
+		}
+		m_cvFrame.notify_one();
+		m_thread.join();
+		if (std::fclose(m_pFile) != 0)
+			m_bWriteFailed = true;
+		m_pFile = nullptr;
+		m_bRecording = false;
+	}
+
+	bool IsRecording() { return m_bRecording; }
+	unsigned int FramesWritten() { return m_nWritten; }
+	unsigned int FramesDropped() { return m_nDropped; }
+	size_t BytesWritten() { return m_nBytesWritten; }
+
+	// Something couldn't be written since Start(), such as a full disk. The capture
+	// is incomplete, though recording carries on until Stop()
+	bool WriteFailed() { return m_bWriteFailed; }
+
+	// Everything the writer thread does is recorded on this timeline while it is recording
+	void SetTrace(traceRecorder* pTrace)
+	{
+		m_pTrace = pTrace;
+	}
+
+	// Game thread only. False if the ring was full and the frame was skipped
+	bool Submit(const void* pCells, float fElapsedTime)
+	{
+		unsigned int nSubmitted = m_nSubmitted.load(std::memory_order_relaxed);
+		if (nSubmitted - m_nWritten.load(std::memory_order_acquire) == (unsigned int)m_nRingFrames)
+		{
+			m_nDropped++;
+			return false;
+		}
+
+		size_t nSlot = nSubmitted % m_nRingFrames;
+		std::memcpy(&m_vecRing[nSlot * m_nCells], pCells, m_nCells * 4);
+		m_vecElapsed[nSlot] = fElapsedTime;
+		m_nSubmitted.store(nSubmitted + 1, std::memory_order_release);
+		m_cvFrame.notify_one();
+		return true;
+	}
+
+	// Same, but when the ring is full waits for the writer to free a slot instead of
+	// dropping the frame, for offline rendering where every frame has to be kept
+	void SubmitWait(const void* pCells, float fElapsedTime)
+	{
+		while (m_nSubmitted.load(std::memory_order_relaxed) - m_nWritten.load(std::memory_order_acquire) == (unsigned int)m_nRingFrames)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		Submit(pCells, fElapsedTime);
+	}
+
+private:
+	void WriterThread()
+	{
+		traceRecorder::SetThreadName("Frame capture");
+
+		while (true)
+		{
+			unsigned int nWritten = m_nWritten.load(std::memory_order_relaxed);
+			if (nWritten == m_nSubmitted.load(std::memory_order_acquire))
+			{
+				// Nothing waiting. Submit() doesn't take the lock, so the wait
+				// times out now and then in case a wake up was missed
+				std::unique_lock<std::mutex> lm(m_mux);
+				if (m_bStop && nWritten == m_nSubmitted.load(std::memory_order_acquire))
+					return;
+				m_cvFrame.wait_for(lm, std::chrono::milliseconds(5));
+				continue;
+			}
+
+			traceRecorder* pTrace = m_pTrace;
+			int64_t nStart = pTrace != nullptr && pTrace->IsRecording() ? traceRecorder::Now() : 0;
+			WriteFrame(nWritten % m_nRingFrames, nWritten % nKeyframeInterval == 0);
+			if (nStart != 0)
+				pTrace->Record("Compress frame", nStart, traceRecorder::Now());
+
+			// Hands the slot back to Submit()
+			m_nWritten.store(nWritten + 1, std::memory_order_release);
+		}
+	}
+
+	void WriteFrame(size_t nSlot, bool bKeyframe)
+	{
+		const uint32_t* pFrame = &m_vecRing[nSlot * m_nCells];
+		const uint32_t* pSource = pFrame;
+		if (!bKeyframe)
+		{
+			for (size_t c = 0; c < m_nCells; c++)
+				m_vecDelta[c] = pFrame[c] ^ m_vecPrevious[c];
+			pSource = m_vecDelta.data();
+		}
+
+		uint32_t nPacked = (uint32_t)frameCaptureCodec::Compress((const uint8_t*)pSource, m_nCells * 4, m_vecPacked.data(), m_vecHash.data());
+		uint8_t nFlags = bKeyframe ? 1 : 0;
+		bool bOk = std::fwrite(&nPacked, sizeof(uint32_t), 1, m_pFile) == 1;
+		bOk &= std::fwrite(&m_vecElapsed[nSlot], sizeof(float), 1, m_pFile) == 1;
+		bOk &= std::fwrite(&nFlags, 1, 1, m_pFile) == 1;
+		bOk &= std::fwrite(m_vecPacked.data(), 1, nPacked, m_pFile) == nPacked;
+		if (!bOk)
+			m_bWriteFailed = true;
+		m_nBytesWritten += sizeof(nPacked) + sizeof(float) + sizeof(nFlags) + nPacked;
+
+		std::memcpy(m_vecPrevious.data(), pFrame, m_nCells * 4);
+	}
+
+	std::FILE* m_pFile = nullptr;
+	size_t m_nCells = 0;
+	int m_nRingFrames = 0;
+
+	std::vector<uint32_t> m_vecRing;		// m_nRingFrames whole frames, filled by Submit()
+	std::vector<float> m_vecElapsed;
+	std::vector<uint32_t> m_vecPrevious;	// Writer thread only from here down
+	std::vector<uint32_t> m_vecDelta;
+	std::vector<uint8_t> m_vecPacked;
+	std::vector<int> m_vecHash;
+
+	std::atomic<unsigned int> m_nSubmitted = 0;
+	std::atomic<unsigned int> m_nWritten = 0;
+	std::atomic<unsigned int> m_nDropped = 0;
+	std::atomic<size_t> m_nBytesWritten = 0;
+	std::atomic<bool> m_bWriteFailed = false;
+	bool m_bRecording = false;
+
+	std::thread m_thread;
+	std::mutex m_mux;
+	std::condition_variable m_cvFrame;
+	bool m_bStop = false;
+	std::atomic<traceRecorder*> m_pTrace = nullptr;
+};
+
+// Reads a capture back a frame at a time, in the same 4 byte cells it was written with
+class frameCaptureReader
+{
+public:
+	frameCaptureReader()
+	{
+
+	}
+
+	~frameCaptureReader()
+	{
+		Close();
+	}
+
+	frameCaptureReader(const frameCaptureReader&) = delete;
+	frameCaptureReader& operator=(const frameCaptureReader&) = delete;
+
+	bool Open(const std::wstring& sFile)
+	{
+		Close();
+		m_pFile = fileIO::OpenFile(sFile, L"rb");
+		if (m_pFile == nullptr)
+			return false;
+
+		char sMagic[4] = { 0 };
+		uint32_t nVersion = 0;
+		uint16_t nW = 0, nH = 0;
+		if (std::fread(sMagic, 1, 4, m_pFile) != 4 || std::memcmp(sMagic, "CGEF", 4) != 0 ||
+			std::fread(&nVersion, sizeof(uint32_t), 1, m_pFile) != 1 || nVersion != 1 ||
+			std::fread(&nW, sizeof(uint16_t), 1, m_pFile) != 1 ||
+			std::fread(&nH, sizeof(uint16_t), 1, m_pFile) != 1)
+		{
+			Close();
+			return false;
+		}
+
+		m_nWidth = nW;
+		m_nHeight = nH;
+		m_vecFrame.assign((size_t)nW * nH, 0);
+		m_vecPacked.clear();
+		m_bHaveKeyframe = false;
+		return true;
+	}
+
+	void Close()
+	{
+		if (m_pFile != nullptr)
+			std::fclose(m_pFile);
+		m_pFile = nullptr;
+	}
+
+	int Width() { return m_nWidth; }
+	int Height() { return m_nHeight; }
+
+	// Fills pCells with Width() * Height() cells. False at the end of the file, or
+	// if the capture is damaged and there is no later keyframe to pick up from
+	bool ReadFrame(void* pCells, float& fElapsedTime)
+	{
+		while (m_pFile != nullptr)
+		{
+			uint32_t nPacked = 0;
+			uint8_t nFlags = 0;
+			if (std::fread(&nPacked, sizeof(uint32_t), 1, m_pFile) != 1 ||
+				std::fread(&fElapsedTime, sizeof(float), 1, m_pFile) != 1 ||
+				std::fread(&nFlags, 1, 1, m_pFile) != 1 ||
+				nPacked > frameCaptureCodec::Bound(m_vecFrame.size() * 4))
+				return false;
+
+			m_vecPacked.resize(nPacked);
+			if (std::fread(m_vecPacked.data(), 1, nPacked, m_pFile) != nPacked)
+				return false;
+
+			bool bKeyframe = (nFlags & 1) != 0;
+			if (!bKeyframe && !m_bHaveKeyframe)
+				continue;
+
+			// Deltas unpack into scratch, keyframes straight over the last frame
+			uint32_t* pTarget = m_vecFrame.data();
+			if (!bKeyframe)
+			{
+				m_vecDelta.resize(m_vecFrame.size());
+				pTarget = m_vecDelta.data();
+			}
+
+			if (!frameCaptureCodec::Decompress(m_vecPacked.data(), nPacked, (uint8_t*)pTarget, m_vecFrame.size() * 4))
+			{
+				m_bHaveKeyframe = false;
+				continue;
+			}
+
+			if (!bKeyframe)
+				for (size_t c = 0; c < m_vecFrame.size(); c++)
+					m_vecFrame[c] ^= m_vecDelta[c];
+			m_bHaveKeyframe = true;
+
+			std::memcpy(pCells, m_vecFrame.data(), m_vecFrame.size() * 4);
+			return true;
+		}
+		return false;
+	}
+
+private:
+	std::FILE* m_pFile = nullptr;
+	int m_nWidth = 0;
+	int m_nHeight = 0;
+	std::vector<uint32_t> m_vecFrame;
+	std::vector<uint32_t> m_vecDelta;
+	std::vector<uint8_t> m_vecPacked;
+	bool m_bHaveKeyframe = false;
+};
+
+// Joins captures of the same size end to end into sOut, for a sequence recorded in
+// pieces, e.g. by separate processes each rendering a range of frames. Every part
+// must start on a keyframe, which any capture written by frameCaptureWriter does,
+// so the frames are copied across as they are without being unpacked
+inline bool ConcatenateCaptures(const std::vector<std::wstring>& vecParts, const std::wstring& sOut)
+{
+	std::FILE* pOut = fileIO::OpenFile(sOut, L"wb");
+	if (pOut == nullptr)
+		return false;
+
+	bool bOk = true;
+	uint8_t header[12], firstHeader[12];
+	std::vector<uint8_t> vecCopy(1 << 20);
+	for (size_t p = 0; p < vecParts.size() && bOk; p++)
+	{
+		std::FILE* pIn = fileIO::OpenFile(vecParts[p], L"rb");
+		if (pIn == nullptr)
+		{
+			bOk = false;
+			break;
+		}
+
+		// Magic, version and size have to match the first part's, its header is the one written
+		uint8_t frameStart[9];
+		bOk = std::fread(header, 1, sizeof(header), pIn) == sizeof(header) && std::memcmp(header, "CGEF", 4) == 0 &&
+			(p == 0 || std::memcmp(header, firstHeader, sizeof(header)) == 0);
+		if (bOk && p == 0)
+		{
+			std::memcpy(firstHeader, header, sizeof(header));
+			bOk = std::fwrite(header, 1, sizeof(header), pOut) == sizeof(header);
+		}
+
+		// An empty part adds nothing, anything else has to open with a keyframe
+		size_t nRead = bOk ? std::fread(frameStart, 1, sizeof(frameStart), pIn) : 0;
+		if (nRead == sizeof(frameStart))
+		{
+			bOk = (frameStart[8] & 1) != 0 && std::fwrite(frameStart, 1, nRead, pOut) == nRead;
+			while (bOk && (nRead = std::fread(vecCopy.data(), 1, vecCopy.size(), pIn)) > 0)
+				bOk = std::fwrite(vecCopy.data(), 1, nRead, pOut) == nRead;
+		}
+		else if (nRead != 0)
+			bOk = false;
+		std::fclose(pIn);
+	}
+
+	bOk = std::fclose(pOut) == 0 && bOk;
+	return bOk && !vecParts.empty();
+}
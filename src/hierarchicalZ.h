@@ -0,0 +1,180 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// Low resolution depth pyramid for software occlusion culling. Occluder triangles
+// are rasterized into level 0 (one texel covers nTexelSize x nTexelSize screen
+// cells) storing view space depth, and each level above holds the farthest depth
+// of the 2x2 texels beneath it. A screen rectangle whose nearest depth is behind
+// every texel it overlaps cannot be seen.
+//
+// Depths are view space z, larger is further away. Texels no occluder touched
+// hold FLT_MAX, so they never hide anything.
+class hierarchicalZBuffer
+{
+public:
+	hierarchicalZBuffer()
+	{
+
+	}
+
+	// Levels keep their memory when the screen shrinks, so only growing past the
+	// largest size seen so far allocates, which lets the render size change freely
+	void Resize(int nScreenWidth, int nScreenHeight, int nTexelSize = 4)
+	{
+		int w = (nScreenWidth + nTexelSize - 1) / nTexelSize;
+		int h = (nScreenHeight + nTexelSize - 1) / nTexelSize;
+		if (w == m_nWidth && h == m_nHeight && nTexelSize == m_nTexelSize)
+			return;
+
+		m_nTexelSize = nTexelSize;
+		m_nWidth = w;
+		m_nHeight = h;
+		m_nLevels = 0;
+
+		while (true)
+		{
+			if (m_nLevels == m_vecLevels.size())
+			{
+				m_vecLevels.emplace_back();
+				m_vecLevelWidth.push_back(0);
+				m_vecLevelHeight.push_back(0);
+			}
+			m_vecLevels[m_nLevels].assign(w * h, FLT_MAX);
+			m_vecLevelWidth[m_nLevels] = w;
+			m_vecLevelHeight[m_nLevels] = h;
+			m_nLevels++;
+			if (w == 1 && h == 1)
+				break;
+			w = (w + 1) / 2;
+			h = (h + 1) / 2;
+		}
+	}
+
+	void Clear()
+	{
+		std::vector<float>& base = m_vecLevels[0];
+		for (size_t i = 0; i < base.size(); i++)
+			base[i] = FLT_MAX;
+	}
+
+	// Screen space triangle (in console cells) at a single conservative depth,
+	// the caller passes the furthest view space z of the three vertices
+	void RasterizeOccluder(float x1, float y1, float x2, float y2, float x3, float y3, float fDepth)
+	{
+		float s = 1.0f / (float)m_nTexelSize;
+		x1 *= s; y1 *= s; x2 *= s; y2 *= s; x3 *= s; y3 *= s;
+
+		float fArea = (x2 - x1) * (y3 - y1) - (y2 - y1) * (x3 - x1);
+		if (fArea == 0.0f)
+			return;
+
+		// Make winding consistent so all edge functions are positive inside
+		if (fArea < 0.0f)
+		{
+			std::swap(x2, x3);
+			std::swap(y2, y3);
+		}
+
+		int minx = (std::max)(0, (int)floorf((std::min)(x1, (std::min)(x2, x3))));
+		int maxx = (std::min)(m_nWidth - 1, (int)ceilf((std::max)(x1, (std::max)(x2, x3))));
+		int miny = (std::max)(0, (int)floorf((std::min)(y1, (std::min)(y2, y3))));
+		int maxy = (std::min)(m_nHeight - 1, (int)ceilf((std::max)(y1, (std::max)(y2, y3))));
+
+		// Conservative: a texel is only covered when all of it is inside, so each edge
+		// function is tested at whichever corner of the texel gives it its lowest value
+		float c1 = (std::min)(x2 - x1, 0.0f) + (std::min)(y1 - y2, 0.0f);
+		float c2 = (std::min)(x3 - x2, 0.0f) + (std::min)(y2 - y3, 0.0f);
+		float c3 = (std::min)(x1 - x3, 0.0f) + (std::min)(y3 - y1, 0.0f);
+
+		std::vector<float>& base = m_vecLevels[0];
+		for (int y = miny; y <= maxy; y++)
+		{
+			float py = (float)y;
+			for (int x = minx; x <= maxx; x++)
+			{
+				float px = (float)x;
+				float e1 = (x2 - x1) * (py - y1) - (y2 - y1) * (px - x1) + c1;
+				float e2 = (x3 - x2) * (py - y2) - (y3 - y2) * (px - x2) + c2;
+				float e3 = (x1 - x3) * (py - y3) - (y1 - y3) * (px - x3) + c3;
+				if (e1 >= 0.0f && e2 >= 0.0f && e3 >= 0.0f)
+				{
+					float& d = base[y * m_nWidth + x];
+					if (fDepth < d)
+						d = fDepth;
+				}
+			}
+		}
+	}
+
+	// Call once all occluders are in, before any IsRectOccluded()
+	void BuildPyramid()
+	{
+		for (size_t l = 1; l < m_nLevels; l++)
+		{
+			std::vector<float>& src = m_vecLevels[l - 1];
+			std::vector<float>& dst = m_vecLevels[l];
+			int sw = m_vecLevelWidth[l - 1], sh = m_vecLevelHeight[l - 1];
+			int dw = m_vecLevelWidth[l], dh = m_vecLevelHeight[l];
+
+			for (int y = 0; y < dh; y++)
+			{
+				int y0 = y * 2, y1 = (std::min)(y * 2 + 1, sh - 1);
+				for (int x = 0; x < dw; x++)
+				{
+					int x0 = x * 2, x1 = (std::min)(x * 2 + 1, sw - 1);
+					dst[y * dw + x] = (std::max)((std::max)(src[y0 * sw + x0], src[y0 * sw + x1]),
+						(std::max)(src[y1 * sw + x0], src[y1 * sw + x1]));
+				}
+			}
+		}
+	}
+
+	// Screen space rectangle (in console cells) whose nearest point is at fNearestDepth
+	bool IsRectOccluded(float fMinX, float fMinY, float fMaxX, float fMaxY, float fNearestDepth)
+	{
+		float s = 1.0f / (float)m_nTexelSize;
+		int minx = (int)floorf(fMinX * s), maxx = (int)floorf(fMaxX * s);
+		int miny = (int)floorf(fMinY * s), maxy = (int)floorf(fMaxY * s);
+
+		// Off screen entirely, that's not our business
+		if (maxx < 0 || maxy < 0 || minx >= m_nWidth || miny >= m_nHeight)
+			return false;
+
+		minx = (std::max)(minx, 0); maxx = (std::min)(maxx, m_nWidth - 1);
+		miny = (std::max)(miny, 0); maxy = (std::min)(maxy, m_nHeight - 1);
+
+		// Pick the level where the rectangle spans no more than 4x4 texels
+		size_t l = 0;
+		while (l + 1 < m_nLevels && (maxx - minx > 3 || maxy - miny > 3))
+		{
+			minx >>= 1; maxx >>= 1;
+			miny >>= 1; maxy >>= 1;
+			l++;
+		}
+
+		std::vector<float>& level = m_vecLevels[l];
+		int w = m_vecLevelWidth[l];
+		for (int y = miny; y <= maxy; y++)
+			for (int x = minx; x <= maxx; x++)
+				if (level[y * w + x] >= fNearestDepth)
+					return false;
+
+		return true;
+	}
+
+	int Width() { return m_nWidth; }
+	int Height() { return m_nHeight; }
+
+private:
+	int m_nTexelSize = 0;
+	int m_nWidth = 0;
+	int m_nHeight = 0;
+	std::vector<std::vector<float>> m_vecLevels;	// Can hold more than m_nLevels, left from a larger size
+	size_t m_nLevels = 0;
+	std::vector<int> m_vecLevelWidth;
+	std::vector<int> m_vecLevelHeight;
+};
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "fileIO.h"
+#include "spscQueue.h"
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// One change in input state, as reported by the platform. Events arrive on the
+// input thread and are queued for the game thread, which applies them in order at
+// the start of the next frame.
+struct inputEvent
+{
+	enum : uint8_t { KEY_DOWN, KEY_UP, MOUSE_MOVE, MOUSE_BUTTONS, FOCUS };
+
+	uint8_t nType = KEY_DOWN;
+	uint8_t nCode = 0;	// Virtual key, mouse button mask, or 1/0 for focus gained/lost
+	int16_t x = 0;		// Mouse position for MOUSE_MOVE
+	int16_t y = 0;
+};
+
+// Queue between the input thread and the game thread
+typedef spscQueue<inputEvent, 1024> inputEventQueue;
+
+// Saves the events the game thread applied each frame, together with that frame's
+// elapsed time, so a session can be played back later and every frame sees exactly
+// the same input and the same time step as it did live.
+//
+// File layout: "CGEI", uint32 version, then per frame a float elapsed time, a
+// uint16 event count and that many inputEvents.
+class inputTimeline
+{
+public:
+	static const int nMaxEventsPerFrame = 256;
+
+	inputTimeline()
+	{
+
+	}
+
+	~inputTimeline()
+	{
+		Stop();
+	}
+
+	inputTimeline(const inputTimeline&) = delete;
+	inputTimeline& operator=(const inputTimeline&) = delete;
+
+	bool StartRecording(const std::wstring& sFile)
+	{
+		Stop();
+		if (!OpenFile(sFile, true))
+			return false;
+
+		uint32_t nVersion = 1;
+		std::fwrite("CGEI", 1, 4, m_pFile);
+		std::fwrite(&nVersion, sizeof(uint32_t), 1, m_pFile);
+		m_bRecording = true;
+		return true;
+	}
+
+	bool StartReplay(const std::wstring& sFile)
+	{
+		Stop();
+		if (!OpenFile(sFile, false))
+			return false;
+
+		char sMagic[4] = { 0 };
+		uint32_t nVersion = 0;
+		if (std::fread(sMagic, 1, 4, m_pFile) != 4 || memcmp(sMagic, "CGEI", 4) != 0 ||
+			std::fread(&nVersion, sizeof(uint32_t), 1, m_pFile) != 1 || nVersion != 1)
+		{
+			Stop();
+			return false;
+		}
+		m_bReplaying = true;
+		return true;
+	}
+
+	void Stop()
+	{
+		if (m_pFile != nullptr)
+			std::fclose(m_pFile);
+		m_pFile = nullptr;
+		m_bRecording = false;
+		m_bReplaying = false;
+	}
+
+	bool IsRecording() { return m_bRecording; }
+	bool IsReplaying() { return m_bReplaying; }
+	unsigned int FramesDone() { return m_nFrames; }
+
+	void WriteFrame(float fElapsedTime, const inputEvent* pEvents, int nEvents)
+	{
+		uint16_t nCount = (uint16_t)nEvents;
+		std::fwrite(&fElapsedTime, sizeof(float), 1, m_pFile);
+		std::fwrite(&nCount, sizeof(uint16_t), 1, m_pFile);
+		std::fwrite(pEvents, sizeof(inputEvent), nEvents, m_pFile);
+		m_nFrames++;
+	}
+
+	// False once the recording has run out, pEvents must hold nMaxEventsPerFrame
+	bool ReadFrame(float& fElapsedTime, inputEvent* pEvents, int& nEvents)
+	{
+		uint16_t nCount = 0;
+		if (std::fread(&fElapsedTime, sizeof(float), 1, m_pFile) != 1 ||
+			std::fread(&nCount, sizeof(uint16_t), 1, m_pFile) != 1 ||
+			nCount > nMaxEventsPerFrame ||
+			std::fread(pEvents, sizeof(inputEvent), nCount, m_pFile) != nCount)
+		{
+			Stop();
+			return false;
+		}
+		nEvents = nCount;
+		m_nFrames++;
+		return true;
+	}
+
+private:
+	bool OpenFile(const std::wstring& sFile, bool bWrite)
+	{
+		m_pFile = fileIO::OpenFile(sFile, bWrite ? L"wb" : L"rb");
+		if (m_pFile == nullptr)
+			return false;
+
+		// Our own buffer, so the C runtime doesn't allocate one in the middle of a frame
+		std::setvbuf(m_pFile, m_cBuffer, _IOFBF, sizeof(m_cBuffer));
+		m_nFrames = 0;
+		return true;
+	}
+
+	std::FILE* m_pFile = nullptr;
+	bool m_bRecording = false;
+	bool m_bReplaying = false;
+	unsigned int m_nFrames = 0;
+	char m_cBuffer[16384];
+};
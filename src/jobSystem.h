@@ -0,0 +1,404 @@
+#pragma once
+
+#include "traceRecorder.h"
+#include "frameArena.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+// Tracks a group of jobs, Wait() on it returns once every one has finished
+struct jobCounter
+{
+	std::atomic<int> nPending = 0;
+};
+
+// Work-stealing scheduler. There is one worker per core beyond the first, each with
+// its own queue of jobs; a worker runs its own queue newest first, and when that is
+// empty takes the oldest job from someone else's. Jobs submitted by threads that
+// aren't workers (the game, audio or a loader thread) go on a shared queue that
+// every worker steals from, and a thread waiting on a counter runs jobs itself
+// rather than sitting idle, so the game thread counts as one of the cores.
+//
+// A job is a function pointer, a context pointer and an index range, stored by
+// value in fixed size queues, so submitting work never touches the heap. Whatever
+// the context points at must stay alive until the job's counter reaches zero.
+class jobSystem
+{
+public:
+	typedef void (*jobFunction)(void* pContext, int nBegin, int nEnd);
+
+	jobSystem(int nWorkers = -1)
+	{
+		if (nWorkers < 0)
+			nWorkers = (std::max)(0, (int)std::thread::hardware_concurrency() - 1);
+
+		m_nQueues = nWorkers + 1;
+		m_queues.reset(new sQueue[m_nQueues]);
+		for (int i = 0; i < nWorkers; i++)
+			m_vecWorkers.push_back(std::thread(&jobSystem::WorkerThread, this, i + 1));
+	}
+
+	~jobSystem()
+	{
+		{
+			std::unique_lock<std::mutex> lm(m_muxSleep);
+			m_bQuit = true;
+		}
+		m_cvWork.notify_all();
+		for (auto& t : m_vecWorkers)
+			t.join();
+	}
+
+	jobSystem(const jobSystem&) = delete;
+	jobSystem& operator=(const jobSystem&) = delete;
+
+	// Threads that run jobs, including whichever thread is waiting
+	int ThreadCount() { return m_nQueues; }
+
+	// Every job run is recorded on this timeline while it is recording
+	void SetTrace(traceRecorder* pTrace)
+	{
+		m_pTrace = pTrace;
+	}
+
+	void Submit(jobFunction pfnRun, void* pContext, int nBegin, int nEnd, jobCounter& counter)
+	{
+		sJob job;
+		job.pfnRun = pfnRun;
+		job.pContext = pContext;
+		job.nBegin = nBegin;
+		job.nEnd = nEnd;
+		job.pCounter = &counter;
+		counter.nPending++;
+
+		// Workers keep their own jobs local, everyone else shares queue 0
+		const sWorkerSlot& worker = ThisWorker();
+		int q = worker.nQueue > 0 && worker.pOwner == this ? worker.nQueue : 0;
+		if (!m_queues[q].Push(job))
+		{
+			// Queue full, just do it now
+			Execute(job);
+			return;
+		}
+		m_nQueued++;
+		WakeWorkers();
+	}
+
+	// Runs other jobs until every job counted by counter has finished
+	void Wait(jobCounter& counter)
+	{
+		const sWorkerSlot& worker = ThisWorker();
+		int nSpins = 0;
+		while (counter.nPending.load(std::memory_order_acquire) > 0)
+		{
+			sJob job;
+			if (FindJob(worker.pOwner == this ? worker.nQueue : 0, job))
+			{
+				Execute(job);
+				nSpins = 0;
+			}
+			else if (++nSpins > 64)
+				std::this_thread::yield();
+		}
+	}
+
+	// Calls f(nFrom, nTo) over [nBegin, nEnd) in pieces of nGrain, on every core,
+	// and returns once all of them are done
+	template<typename F>
+	void ParallelFor(int nBegin, int nEnd, int nGrain, const F& f)
+	{
+		if (nEnd <= nBegin)
+			return;
+		nGrain = (std::max)(1, nGrain);
+
+		// Not worth waking anyone for a single piece
+		if (nEnd - nBegin <= nGrain || m_nQueues == 1)
+		{
+			f(nBegin, nEnd);
+			return;
+		}
+
+		jobCounter counter;
+		jobFunction pfnRun = [](void* pContext, int nFrom, int nTo) { (*(const F*)pContext)(nFrom, nTo); };
+		for (int i = nBegin; i < nEnd; i += nGrain)
+			Submit(pfnRun, (void*)&f, i, (std::min)(nEnd, i + nGrain), counter);
+		Wait(counter);
+	}
+
+private:
+	struct sJob
+	{
+		jobFunction pfnRun = nullptr;
+		void* pContext = nullptr;
+		int nBegin = 0;
+		int nEnd = 0;
+		jobCounter* pCounter = nullptr;
+	};
+
+	// Ring of jobs, the owner pushes and pops at the back, thieves take from the front
+	struct sQueue
+	{
+		static const int nCapacity = 4096;
+
+		bool Push(const sJob& job)
+		{
+			std::unique_lock<std::mutex> lm(mux);
+			if (nCount == nCapacity)
+				return false;
+			jobs[(nFront + nCount) % nCapacity] = job;
+			nCount++;
+			return true;
+		}
+
+		bool PopBack(sJob& job)
+		{
+			std::unique_lock<std::mutex> lm(mux);
+			if (nCount == 0)
+				return false;
+			nCount--;
+			job = jobs[(nFront + nCount) % nCapacity];
+			return true;
+		}
+
+		bool PopFront(sJob& job)
+		{
+			std::unique_lock<std::mutex> lm(mux);
+			if (nCount == 0)
+				return false;
+			job = jobs[nFront];
+			nFront = (nFront + 1) % nCapacity;
+			nCount--;
+			return true;
+		}
+
+		std::mutex mux;
+		sJob jobs[nCapacity];
+		int nFront = 0;
+		int nCount = 0;
+	};
+
+	void Execute(sJob& job)
+	{
+		traceRecorder* pTrace = m_pTrace;
+		int64_t nStart = pTrace != nullptr && pTrace->IsRecording() ? traceRecorder::Now() : 0;
+		job.pfnRun(job.pContext, job.nBegin, job.nEnd);
+		if (nStart != 0)
+			pTrace->Record("Job", nStart, traceRecorder::Now());
+		job.pCounter->nPending.fetch_sub(1, std::memory_order_release);
+	}
+
+	// Own queue first, then steal, starting somewhere different each time
+	bool FindJob(int nOwnQueue, sJob& job)
+	{
+		if (m_nQueued.load(std::memory_order_acquire) == 0)
+			return false;
+
+		if (nOwnQueue > 0 && m_queues[nOwnQueue].PopBack(job))
+		{
+			m_nQueued--;
+			return true;
+		}
+
+		// Anyone else takes from every queue, including the shared one they submit to
+		int nStart = (int)(m_nStealSeed.fetch_add(1, std::memory_order_relaxed) % (unsigned int)m_nQueues);
+		for (int i = 0; i < m_nQueues; i++)
+		{
+			int q = (nStart + i) % m_nQueues;
+			if ((q != nOwnQueue || nOwnQueue == 0) && m_queues[q].PopFront(job))
+			{
+				m_nQueued--;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void WakeWorkers()
+	{
+		// Sequentially consistent on both sides, so either the sleeper sees the new
+		// job or we see the sleeper
+		if (m_nSleeping.load() > 0)
+		{
+			std::unique_lock<std::mutex> lm(m_muxSleep);
+			m_cvWork.notify_all();
+		}
+	}
+
+	void WorkerThread(int nQueue)
+	{
+		ThisWorker() = { nQueue, this };
+		traceRecorder::SetThreadName("Worker");
+		frameArenaHeapCheckThread() = true;	// Workers run the frame's jobs
+
+		while (true)
+		{
+			sJob job;
+			if (FindJob(nQueue, job))
+			{
+				Execute(job);
+				continue;
+			}
+
+			// Nothing anywhere, sleep until something is submitted
+			std::unique_lock<std::mutex> lm(m_muxSleep);
+			m_nSleeping++;
+			m_cvWork.wait(lm, [&] { return m_bQuit || m_nQueued.load() > 0; });
+			m_nSleeping--;
+			if (m_bQuit)
+				return;
+		}
+	}
+
+	int m_nQueues = 1;
+	std::unique_ptr<sQueue[]> m_queues;	// 0 is shared, 1..n belong to the workers
+	std::vector<std::thread> m_vecWorkers;
+
+	std::atomic<int> m_nQueued = 0;		// Jobs sitting in any queue
+	std::atomic<unsigned int> m_nStealSeed = 0;
+	std::atomic<int> m_nSleeping = 0;
+	std::mutex m_muxSleep;
+	std::condition_variable m_cvWork;
+	bool m_bQuit = false;
+
+	std::atomic<traceRecorder*> m_pTrace = nullptr;
+
+	// Which queue the calling thread owns, kept in a function so every translation
+	// unit that includes this shares the one thread_local
+	struct sWorkerSlot
+	{
+		int nQueue;
+		jobSystem* pOwner;
+	};
+
+	static sWorkerSlot& ThisWorker()
+	{
+		static thread_local sWorkerSlot worker = { 0, nullptr };
+		return worker;
+	}
+};
+
+// A set of jobs with dependencies between them, e.g. one frame's work. Build it by
+// adding nodes and the order they must run in, then hand it to Run(), which starts
+// every node whose dependencies are done as soon as they are, and returns when the
+// whole graph has finished. Nodes and edges live in fixed arrays inside the graph,
+// so a graph can be rebuilt every frame without allocating.
+class jobGraph
+{
+public:
+	static const int nMaxNodes = 128;
+	static const int nMaxEdges = 512;
+
+	jobGraph()
+	{
+
+	}
+
+	void Clear()
+	{
+		m_nNodes = 0;
+		m_nEdges = 0;
+	}
+
+	// f() must stay alive until Run() returns. Returns the node's index, or -1 if the graph is full
+	template<typename F>
+	int AddNode(const F& f)
+	{
+		if (m_nNodes == nMaxNodes)
+			return -1;
+
+		sNode& node = m_nodes[m_nNodes];
+		node.pfnRun = [](void* pContext) { (*(const F*)pContext)(); };
+		node.pContext = (void*)&f;
+		return m_nNodes++;
+	}
+
+	// nAfter won't start until nBefore has finished
+	bool AddDependency(int nBefore, int nAfter)
+	{
+		if (m_nEdges == nMaxEdges || nBefore < 0 || nAfter < 0)
+			return false;
+		m_edges[m_nEdges].nBefore = nBefore;
+		m_edges[m_nEdges].nAfter = nAfter;
+		m_nEdges++;
+		return true;
+	}
+
+	void Run(jobSystem& jobs)
+	{
+		// Group each node's successors together, counting sort on nBefore
+		for (int n = 0; n <= m_nNodes; n++)
+			m_nFirstSuccessor[n] = 0;
+		for (int n = 0; n < m_nNodes; n++)
+			m_nodes[n].nDependencies = 0;
+		for (int e = 0; e < m_nEdges; e++)
+		{
+			m_nFirstSuccessor[m_edges[e].nBefore + 1]++;
+			m_nodes[m_edges[e].nAfter].nDependencies++;
+		}
+		for (int n = 0; n < m_nNodes; n++)
+			m_nFirstSuccessor[n + 1] += m_nFirstSuccessor[n];
+
+		int nCursor[nMaxNodes];
+		for (int n = 0; n < m_nNodes; n++)
+			nCursor[n] = m_nFirstSuccessor[n];
+		for (int e = 0; e < m_nEdges; e++)
+			m_nSuccessors[nCursor[m_edges[e].nBefore]++] = m_edges[e].nAfter;
+
+		for (int n = 0; n < m_nNodes; n++)
+			m_nodes[n].nRemaining = m_nodes[n].nDependencies;
+
+		m_pJobs = &jobs;
+		for (int n = 0; n < m_nNodes; n++)
+			if (m_nodes[n].nDependencies == 0)
+				jobs.Submit(&jobGraph::RunNode, this, n, n + 1, m_counter);
+		jobs.Wait(m_counter);
+		m_pJobs = nullptr;
+	}
+
+private:
+	struct sNode
+	{
+		void (*pfnRun)(void* pContext) = nullptr;
+		void* pContext = nullptr;
+		int nDependencies = 0;
+		std::atomic<int> nRemaining = 0;
+	};
+
+	struct sEdge
+	{
+		int nBefore = 0;
+		int nAfter = 0;
+	};
+
+	static void RunNode(void* pContext, int nNode, int)
+	{
+		jobGraph* pGraph = (jobGraph*)pContext;
+		sNode& node = pGraph->m_nodes[nNode];
+		node.pfnRun(node.pContext);
+
+		// Release anything that was only waiting on this node. Submitting before this
+		// job's own count comes off keeps the graph's counter above zero until the end
+		for (int s = pGraph->m_nFirstSuccessor[nNode]; s < pGraph->m_nFirstSuccessor[nNode + 1]; s++)
+		{
+			int nNext = pGraph->m_nSuccessors[s];
+			if (pGraph->m_nodes[nNext].nRemaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				pGraph->m_pJobs->Submit(&jobGraph::RunNode, pGraph, nNext, nNext + 1, pGraph->m_counter);
+		}
+	}
+
+	sNode m_nodes[nMaxNodes];
+	sEdge m_edges[nMaxEdges];
+	int m_nNodes = 0;
+	int m_nEdges = 0;
+
+	int m_nFirstSuccessor[nMaxNodes + 1];
+	int m_nSuccessors[nMaxEdges];
+
+	jobSystem* m_pJobs = nullptr;
+	jobCounter m_counter;
+};
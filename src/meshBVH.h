@@ -0,0 +1,425 @@
+#pragma once
+
+#include "compactMesh.h"
+
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// A ray in the space the BVH was built in. Direction does not have to be
+// normalised, hit distances are then in units of the direction's length.
+struct rayQuery
+{
+	float ox, oy, oz;
+	float dx, dy, dz;
+	float tMax = FLT_MAX;
+};
+
+struct rayHit
+{
+	float t = FLT_MAX;		// Distance along the ray
+	float u = 0.0f;			// Barycentrics of the hit inside the triangle
+	float v = 0.0f;
+	int nTriangle = -1;		// Triangle of the mesh the BVH was built over, -1 if nothing hit
+};
+
+// Bounding volume hierarchy over a compactMesh for ray casting. Built once with a
+// binned surface area heuristic, then queried without any allocation. Nodes are 32
+// bytes and siblings sit next to each other, so a query only walks a few cache lines
+// per level. The tree is never deeper than nMaxDepth, which is what sizes the
+// traversal stack; anything still to split at that depth is left as a bigger leaf.
+//
+// Triangles aren't copied. Leaves list triangle numbers in the mesh, decoded as
+// they are tested, so the tree costs about 16 bytes a triangle on top of the mesh,
+// which must stay where it is for as long as the BVH is used.
+class meshBVH
+{
+public:
+	meshBVH()
+	{
+
+	}
+
+	// Nodes are split until they hold nMaxLeafSize triangles or fewer. Bigger leaves
+	// mean fewer nodes, so less memory, for a few more triangles decoded per ray
+	void Build(const compactMesh& mesh, int nMaxLeafSize = 8)
+	{
+		int nTris = mesh.TriangleCount();
+		m_pMesh = &mesh;
+		m_nMaxLeafSize = nMaxLeafSize;
+		m_vecNodes.clear();
+		m_vecTriIndex.resize(nTris);
+		m_vecCentroids.resize(nTris * 3);
+		m_vecTriBounds.resize(nTris * 6);
+		if (nTris == 0)
+			return;
+
+		for (int i = 0; i < nTris; i++)
+		{
+			m_vecTriIndex[i] = i;
+			sPoint p[3];
+			mesh.DecodePositions(i, p);
+			for (int a = 0; a < 3; a++)
+			{
+				float p0 = (&p[0].x)[a];
+				float p1 = (&p[1].x)[a];
+				float p2 = (&p[2].x)[a];
+				m_vecTriBounds[i * 6 + a] = fminf(p0, fminf(p1, p2));
+				m_vecTriBounds[i * 6 + 3 + a] = fmaxf(p0, fmaxf(p1, p2));
+				m_vecCentroids[i * 3 + a] = (p0 + p1 + p2) / 3.0f;
+			}
+		}
+
+		m_vecNodes.reserve(nTris * 2);
+		m_vecNodes.push_back(sNode());
+		m_vecNodes[0].nLeftOrFirst = 0;
+		m_vecNodes[0].nCount = nTris;
+		UpdateNodeBounds(0);
+		Subdivide(0, 0);
+		m_vecNodes.shrink_to_fit();
+
+		m_vecCentroids.clear();
+		m_vecCentroids.shrink_to_fit();
+		m_vecTriBounds.clear();
+		m_vecTriBounds.shrink_to_fit();
+	}
+
+	// Closest hit along the ray, returns false if nothing was hit before ray.tMax
+	bool Intersect(const rayQuery& ray, rayHit& hit) const
+	{
+		hit = rayHit();
+		hit.t = ray.tMax;
+		Traverse(ray, hit, false);
+		return hit.nTriangle >= 0;
+	}
+
+	// Any hit along the ray, cheaper than Intersect() as it stops at the first one
+	bool Occluded(const rayQuery& ray) const
+	{
+		rayHit hit;
+		hit.t = ray.tMax;
+		Traverse(ray, hit, true);
+		return hit.nTriangle >= 0;
+	}
+
+	void IntersectBatch(const rayQuery* pRays, rayHit* pHits, int nRays) const
+	{
+		for (int i = 0; i < nRays; i++)
+			Intersect(pRays[i], pHits[i]);
+	}
+
+	void OccludedBatch(const rayQuery* pRays, bool* pOccluded, int nRays) const
+	{
+		for (int i = 0; i < nRays; i++)
+			pOccluded[i] = Occluded(pRays[i]);
+	}
+
+	bool IsEmpty() const { return m_vecNodes.empty(); }
+	int NodeCount() const { return (int)m_vecNodes.size(); }
+	int TriangleCount() const { return (int)m_vecTriIndex.size(); }
+
+	size_t MemoryBytes() const
+	{
+		return m_vecNodes.capacity() * sizeof(sNode) + m_vecTriIndex.capacity() * sizeof(int)
+			+ (m_vecCentroids.capacity() + m_vecTriBounds.capacity()) * sizeof(float);
+	}
+
+private:
+	static const int nMaxDepth = 64;
+
+	struct sNode
+	{
+		float vMin[3];
+		int nLeftOrFirst;	// First triangle for leaves, left child for interior nodes
+		float vMax[3];
+		int nCount;			// Triangles in a leaf, 0 for interior nodes
+	};
+
+	struct sPoint
+	{
+		float x, y, z;
+	};
+
+	// Origin and two edges, as the intersection test wants a triangle
+	struct sTri
+	{
+		float v0[3];
+		float e1[3];
+		float e2[3];
+	};
+
+	sTri DecodeTri(int nTriangle) const
+	{
+		sPoint p[3];
+		m_pMesh->DecodePositions(nTriangle, p);
+		sTri t;
+		t.v0[0] = p[0].x; t.v0[1] = p[0].y; t.v0[2] = p[0].z;
+		t.e1[0] = p[1].x - p[0].x; t.e1[1] = p[1].y - p[0].y; t.e1[2] = p[1].z - p[0].z;
+		t.e2[0] = p[2].x - p[0].x; t.e2[1] = p[2].y - p[0].y; t.e2[2] = p[2].z - p[0].z;
+		return t;
+	}
+
+	void UpdateNodeBounds(int nNode)
+	{
+		sNode& node = m_vecNodes[nNode];
+		for (int a = 0; a < 3; a++)
+		{
+			node.vMin[a] = FLT_MAX;
+			node.vMax[a] = -FLT_MAX;
+		}
+		for (int i = node.nLeftOrFirst; i < node.nLeftOrFirst + node.nCount; i++)
+		{
+			const float* b = &m_vecTriBounds[m_vecTriIndex[i] * 6];
+			for (int a = 0; a < 3; a++)
+			{
+				node.vMin[a] = fminf(node.vMin[a], b[a]);
+				node.vMax[a] = fmaxf(node.vMax[a], b[3 + a]);
+			}
+		}
+	}
+
+	static float HalfArea(const float* vMin, const float* vMax)
+	{
+		float ex = vMax[0] - vMin[0], ey = vMax[1] - vMin[1], ez = vMax[2] - vMin[2];
+		return ex * ey + ey * ez + ez * ex;
+	}
+
+	void Subdivide(int nNode, int nDepth)
+	{
+		int nFirst = m_vecNodes[nNode].nLeftOrFirst;
+		int nCount = m_vecNodes[nNode].nCount;
+		if (nCount <= m_nMaxLeafSize || nDepth >= nMaxDepth)
+			return;
+
+		// Centroid bounds decide where the bins go
+		float cMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+		float cMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (int i = nFirst; i < nFirst + nCount; i++)
+		{
+			const float* c = &m_vecCentroids[m_vecTriIndex[i] * 3];
+			for (int a = 0; a < 3; a++)
+			{
+				cMin[a] = fminf(cMin[a], c[a]);
+				cMax[a] = fmaxf(cMax[a], c[a]);
+			}
+		}
+
+		// Binned SAH, evaluate every bin boundary on every axis
+		const int nBins = 12;
+		float fBestCost = FLT_MAX;
+		int nBestAxis = -1;
+		float fBestSplit = 0.0f;
+
+		for (int a = 0; a < 3; a++)
+		{
+			float fExtent = cMax[a] - cMin[a];
+			if (fExtent <= 0.0f)
+				continue;
+
+			struct sBin { float vMin[3], vMax[3]; int nCount; } bins[nBins];
+			for (int b = 0; b < nBins; b++)
+			{
+				bins[b].nCount = 0;
+				for (int k = 0; k < 3; k++)
+				{
+					bins[b].vMin[k] = FLT_MAX;
+					bins[b].vMax[k] = -FLT_MAX;
+				}
+			}
+
+			float fScale = (float)nBins / fExtent;
+			for (int i = nFirst; i < nFirst + nCount; i++)
+			{
+				int t = m_vecTriIndex[i];
+				// Written so a scale that overflowed on a tiny extent still lands in a bin
+				float fBin = (m_vecCentroids[t * 3 + a] - cMin[a]) * fScale;
+				int b = fBin > 0.0f ? (int)(std::min)(fBin, (float)(nBins - 1)) : 0;
+				bins[b].nCount++;
+				for (int k = 0; k < 3; k++)
+				{
+					bins[b].vMin[k] = fminf(bins[b].vMin[k], m_vecTriBounds[t * 6 + k]);
+					bins[b].vMax[k] = fmaxf(bins[b].vMax[k], m_vecTriBounds[t * 6 + 3 + k]);
+				}
+			}
+
+			// Sweep from both ends to get area and count either side of each boundary
+			float fLeftArea[nBins - 1], fRightArea[nBins - 1];
+			int nLeftCount[nBins - 1], nRightCount[nBins - 1];
+			float lMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, lMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+			float rMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, rMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+			int nLeftSum = 0, nRightSum = 0;
+			for (int b = 0; b < nBins - 1; b++)
+			{
+				nLeftSum += bins[b].nCount;
+				nRightSum += bins[nBins - 1 - b].nCount;
+				for (int k = 0; k < 3; k++)
+				{
+					lMin[k] = fminf(lMin[k], bins[b].vMin[k]); lMax[k] = fmaxf(lMax[k], bins[b].vMax[k]);
+					rMin[k] = fminf(rMin[k], bins[nBins - 1 - b].vMin[k]); rMax[k] = fmaxf(rMax[k], bins[nBins - 1 - b].vMax[k]);
+				}
+				nLeftCount[b] = nLeftSum;
+				fLeftArea[b] = nLeftSum > 0 ? HalfArea(lMin, lMax) : 0.0f;
+				nRightCount[nBins - 2 - b] = nRightSum;
+				fRightArea[nBins - 2 - b] = nRightSum > 0 ? HalfArea(rMin, rMax) : 0.0f;
+			}
+
+			for (int b = 0; b < nBins - 1; b++)
+			{
+				float fCost = nLeftCount[b] * fLeftArea[b] + nRightCount[b] * fRightArea[b];
+				if (nLeftCount[b] > 0 && nRightCount[b] > 0 && fCost < fBestCost)
+				{
+					fBestCost = fCost;
+					nBestAxis = a;
+					fBestSplit = cMin[a] + fExtent * (float)(b + 1) / (float)nBins;
+				}
+			}
+		}
+
+		// Every centroid in the same place, nothing to split them by
+		if (nBestAxis < 0)
+			return;
+
+		// Partition triangle indices about the split plane
+		int i = nFirst;
+		int j = nFirst + nCount - 1;
+		while (i <= j)
+		{
+			if (m_vecCentroids[m_vecTriIndex[i] * 3 + nBestAxis] < fBestSplit)
+				i++;
+			else
+				std::swap(m_vecTriIndex[i], m_vecTriIndex[j--]);
+		}
+
+		int nLeftCount = i - nFirst;
+		if (nLeftCount == 0 || nLeftCount == nCount)
+			return;
+
+		int nLeft = (int)m_vecNodes.size();
+		m_vecNodes.push_back(sNode());
+		m_vecNodes.push_back(sNode());
+		m_vecNodes[nLeft].nLeftOrFirst = nFirst;
+		m_vecNodes[nLeft].nCount = nLeftCount;
+		m_vecNodes[nLeft + 1].nLeftOrFirst = i;
+		m_vecNodes[nLeft + 1].nCount = nCount - nLeftCount;
+		m_vecNodes[nNode].nLeftOrFirst = nLeft;
+		m_vecNodes[nNode].nCount = 0;
+
+		UpdateNodeBounds(nLeft);
+		UpdateNodeBounds(nLeft + 1);
+		Subdivide(nLeft, nDepth + 1);
+		Subdivide(nLeft + 1, nDepth + 1);
+	}
+
+	// Slab test, returns entry distance or FLT_MAX on a miss
+	static float IntersectNode(const sNode& node, const float* o, const float* invD, float tMax)
+	{
+		float tx1 = (node.vMin[0] - o[0]) * invD[0], tx2 = (node.vMax[0] - o[0]) * invD[0];
+		float tmin = fminf(tx1, tx2), tmax = fmaxf(tx1, tx2);
+		float ty1 = (node.vMin[1] - o[1]) * invD[1], ty2 = (node.vMax[1] - o[1]) * invD[1];
+		tmin = fmaxf(tmin, fminf(ty1, ty2)); tmax = fminf(tmax, fmaxf(ty1, ty2));
+		float tz1 = (node.vMin[2] - o[2]) * invD[2], tz2 = (node.vMax[2] - o[2]) * invD[2];
+		tmin = fmaxf(tmin, fminf(tz1, tz2)); tmax = fminf(tmax, fmaxf(tz1, tz2));
+		if (tmax >= tmin && tmin < tMax && tmax > 0.0f)
+			return tmin;
+		return FLT_MAX;
+	}
+
+	// Moller-Trumbore, both faces count as a hit
+	static bool IntersectTri(const sTri& tri, const float* o, const float* d, float& t, float& u, float& v)
+	{
+		float h[3] = { d[1] * tri.e2[2] - d[2] * tri.e2[1], d[2] * tri.e2[0] - d[0] * tri.e2[2], d[0] * tri.e2[1] - d[1] * tri.e2[0] };
+		float a = tri.e1[0] * h[0] + tri.e1[1] * h[1] + tri.e1[2] * h[2];
+		if (a > -1e-9f && a < 1e-9f)
+			return false;
+
+		float f = 1.0f / a;
+		float s[3] = { o[0] - tri.v0[0], o[1] - tri.v0[1], o[2] - tri.v0[2] };
+		u = f * (s[0] * h[0] + s[1] * h[1] + s[2] * h[2]);
+		if (u < 0.0f || u > 1.0f)
+			return false;
+
+		float q[3] = { s[1] * tri.e1[2] - s[2] * tri.e1[1], s[2] * tri.e1[0] - s[0] * tri.e1[2], s[0] * tri.e1[1] - s[1] * tri.e1[0] };
+		v = f * (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]);
+		if (v < 0.0f || u + v > 1.0f)
+			return false;
+
+		t = f * (tri.e2[0] * q[0] + tri.e2[1] * q[1] + tri.e2[2] * q[2]);
+		return t > 1e-6f;
+	}
+
+	void Traverse(const rayQuery& ray, rayHit& hit, bool bAnyHit) const
+	{
+		if (m_vecNodes.empty())
+			return;
+
+		float o[3] = { ray.ox, ray.oy, ray.oz };
+		float d[3] = { ray.dx, ray.dy, ray.dz };
+		float invD[3] = { 1.0f / ray.dx, 1.0f / ray.dy, 1.0f / ray.dz };
+
+		if (IntersectNode(m_vecNodes[0], o, invD, hit.t) == FLT_MAX)
+			return;
+
+		// At most one far child is pending per level above the current node
+		int stack[nMaxDepth];
+		int nStack = 0;
+		int nNode = 0;
+
+		while (true)
+		{
+			const sNode& node = m_vecNodes[nNode];
+			if (node.nCount > 0)
+			{
+				for (int i = node.nLeftOrFirst; i < node.nLeftOrFirst + node.nCount; i++)
+				{
+					float t, u, v;
+					if (IntersectTri(DecodeTri(m_vecTriIndex[i]), o, d, t, u, v) && t < hit.t)
+					{
+						hit.t = t;
+						hit.u = u;
+						hit.v = v;
+						hit.nTriangle = m_vecTriIndex[i];
+						if (bAnyHit)
+							return;
+					}
+				}
+				if (nStack == 0)
+					return;
+				nNode = stack[--nStack];
+				continue;
+			}
+
+			// Visit the nearer child first, the other one only if it's still in range
+			int nNear = node.nLeftOrFirst, nFar = node.nLeftOrFirst + 1;
+			float tNear = IntersectNode(m_vecNodes[nNear], o, invD, hit.t);
+			float tFar = IntersectNode(m_vecNodes[nFar], o, invD, hit.t);
+			if (tFar < tNear)
+			{
+				std::swap(nNear, nFar);
+				std::swap(tNear, tFar);
+			}
+
+			if (tNear == FLT_MAX)
+			{
+				if (nStack == 0)
+					return;
+				nNode = stack[--nStack];
+			}
+			else
+			{
+				nNode = nNear;
+				if (tFar != FLT_MAX)
+					stack[nStack++] = nFar;
+			}
+		}
+	}
+
+	const compactMesh* m_pMesh = nullptr;
+	int m_nMaxLeafSize = 8;
+	std::vector<sNode> m_vecNodes;
+	std::vector<int> m_vecTriIndex;	// Leaf order --> triangle of the mesh
+
+	// Only needed while building
+	std::vector<float> m_vecCentroids;
+	std::vector<float> m_vecTriBounds;
+};
@@ -0,0 +1,711 @@
+#pragma once
+
+#include "compactMesh.h"
+#include "fileIO.h"
+#include "traceRecorder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+// A mesh split into spatially compact pages on disk, each page a compactMesh of up
+// to a few thousand triangles with its bounding box in a table at the end of the
+// file. meshPager streams pages in from it, so a mesh of any size can be drawn in a
+// fixed amount of memory.
+//
+// File layout, all little endian:
+//	"CGEM", uint32 version, uint32 page count, uint32 has texture coordinates,
+//	uint32 most triangles in a page, uint32 most vertices in a page,
+//	uint64 offset of the page table, float[3] min, float[3] max of the whole mesh,
+//	uint64 size and int64 modification time of the .obj it was built from,
+//	then the pages as written by compactMesh::Write(), then the page table.
+namespace meshPageFile
+{
+	const uint32_t nVersion = 2;
+
+	struct sPage
+	{
+		uint64_t nOffset = 0;
+		uint32_t nTriangles = 0;
+		uint32_t nReserved = 0;
+		float vMin[3] = { 0 };
+		float vMax[3] = { 0 };
+	};
+
+	struct sHeader
+	{
+		char sMagic[4] = { 'C', 'G', 'E', 'M' };
+		uint32_t nVersion = meshPageFile::nVersion;
+		uint32_t nPages = 0;
+		uint32_t nHasTexCoords = 0;
+		uint32_t nMaxTriangles = 0;
+		uint32_t nMaxVertices = 0;
+		uint64_t nTableOffset = 0;
+		float vMin[3] = { 0 };
+		float vMax[3] = { 0 };
+		uint64_t nSourceSize = 0;
+		int64_t nSourceTime = 0;
+	};
+
+	// Size and modification time of the .obj a page file is built from, so a page
+	// file left over from an older version of the model can be told apart
+	inline bool SourceStamp(const std::string& sObjFile, uint64_t& nSize, int64_t& nTime)
+	{
+#if defined(_WIN32)
+		struct _stat64 st;
+		if (_stat64(sObjFile.c_str(), &st) != 0)
+			return false;
+#else
+		struct stat st;
+		if (stat(sObjFile.c_str(), &st) != 0)
+			return false;
+#endif
+		nSize = (uint64_t)st.st_size;
+		nTime = (int64_t)st.st_mtime;
+		return true;
+	}
+
+	// 64 bit file positions, page files can be larger than 2GB
+	inline int64_t Tell(std::FILE* f)
+	{
+#if defined(_WIN32)
+		return _ftelli64(f);
+#else
+		return (int64_t)ftello(f);
+#endif
+	}
+
+	inline bool Seek(std::FILE* f, int64_t nOffset, int nOrigin = SEEK_SET)
+	{
+#if defined(_WIN32)
+		return _fseeki64(f, nOffset, nOrigin) == 0;
+#else
+		return fseeko(f, (off_t)nOffset, nOrigin) == 0;
+#endif
+	}
+
+	// Triangle as compactMesh::Build() wants it
+	struct sCorner { float x, y, z; };
+	struct sTexCoord { float u, v; };
+	struct sTriangle
+	{
+		sCorner _point[3];
+		sTexCoord _tex[3];
+	};
+
+	// Calls fn(sTriangle&, bool bTextured) for every face of an .obj, read the same
+	// way triPolyMeshCollection::LoadFromObjectFile() reads them
+	template<typename FN>
+	bool ForEachFace(const std::string& sObjFile, const std::vector<float>& vecVerts, const std::vector<float>& vecTex, FN fn)
+	{
+		std::ifstream f(sObjFile);
+		if (!f.is_open())
+			return false;
+
+		std::string sLine;
+		sTriangle tri;
+		while (std::getline(f, sLine))
+		{
+			if (sLine.size() < 2 || sLine[0] != 'f' || sLine[1] != ' ')
+				continue;
+
+			const char* p = sLine.c_str() + 1;
+			bool bTextured = true;
+			bool bValid = true;
+			for (int k = 0; k < 3 && bValid; k++)
+			{
+				char* pEnd = nullptr;
+				long nVert = std::strtol(p, &pEnd, 10);
+				long nTex = 0;
+				if (*pEnd == '/')
+					nTex = std::strtol(pEnd + 1, &pEnd, 10);
+				while (*pEnd != 0 && *pEnd != ' ' && *pEnd != '\t')
+					pEnd++;
+				p = pEnd;
+
+				bValid = nVert > 0 && (size_t)nVert * 3 <= vecVerts.size();
+				if (!bValid)
+					break;
+				tri._point[k] = { vecVerts[(nVert - 1) * 3], vecVerts[(nVert - 1) * 3 + 1], vecVerts[(nVert - 1) * 3 + 2] };
+				if (nTex > 0 && (size_t)nTex * 2 <= vecTex.size())
+					tri._tex[k] = { vecTex[(nTex - 1) * 2], vecTex[(nTex - 1) * 2 + 1] };
+				else
+				{
+					tri._tex[k] = { 0.0f, 0.0f };
+					bTextured = false;
+				}
+			}
+			if (bValid)
+				fn(tri, bTextured);
+		}
+		return true;
+	}
+
+	// Turns an .obj into a page file. Faces are bucketed into a grid of cells of about
+	// nTrisPerPage triangles each by centroid, and every cell becomes one or more
+	// pages. Only the vertex positions and texture coordinates are held for the whole
+	// file. Cells are grouped into bands of about nBandTris faces, and one read of the
+	// faces hands each face to its band; when there is more than one band, a band's
+	// faces are written out to a temporary file in runs as they arrive and read back
+	// when the band's pages are written, so meshes with far more triangles than
+	// memory can still be converted.
+	inline bool Build(const std::string& sObjFile, const std::wstring& sPageFile, int nTrisPerPage = 2048, int nBandTris = 1 << 20)
+	{
+		// Vertices, texture coordinates and bounds
+		std::vector<float> vecVerts, vecTex;
+		{
+			std::ifstream f(sObjFile);
+			if (!f.is_open())
+				return false;
+			std::string sLine;
+			while (std::getline(f, sLine))
+			{
+				if (sLine.size() > 2 && sLine[0] == 'v' && sLine[1] == ' ')
+				{
+					float x = 0, y = 0, z = 0;
+					std::sscanf(sLine.c_str() + 2, "%f %f %f", &x, &y, &z);
+					vecVerts.insert(vecVerts.end(), { x, y, z });
+				}
+				else if (sLine.size() > 3 && sLine[0] == 'v' && sLine[1] == 't')
+				{
+					float u = 0, v = 0;
+					std::sscanf(sLine.c_str() + 3, "%f %f", &u, &v);
+					vecTex.insert(vecTex.end(), { u, 1.0f - v });	// Sprites have y going down
+				}
+			}
+		}
+
+		sHeader header;
+		if (!SourceStamp(sObjFile, header.nSourceSize, header.nSourceTime))
+			return false;
+		for (int a = 0; a < 3; a++)
+		{
+			header.vMin[a] = FLT_MAX;
+			header.vMax[a] = -FLT_MAX;
+		}
+		for (size_t i = 0; i < vecVerts.size(); i++)
+		{
+			header.vMin[i % 3] = (std::min)(header.vMin[i % 3], vecVerts[i]);
+			header.vMax[i % 3] = (std::max)(header.vMax[i % 3], vecVerts[i]);
+		}
+
+		// Count faces to size the grid
+		size_t nFaces = 0;
+		bool bAllTextured = true;
+		ForEachFace(sObjFile, vecVerts, vecTex, [&](sTriangle&, bool bTextured) { nFaces++; bAllTextured &= bTextured; });
+		if (nFaces == 0)
+			return false;
+		header.nHasTexCoords = bAllTextured ? 1 : 0;
+
+		// Cells over the axes that have some extent, as triPolyMeshCollection::BuildClusters() does
+		int nCells = (int)(std::max)((size_t)1, nFaces / (size_t)nTrisPerPage);
+		float fVolume = 1.0f;
+		int nAxes = 0;
+		for (int a = 0; a < 3; a++)
+		{
+			if (header.vMax[a] - header.vMin[a] > 1e-4f)
+			{
+				fVolume *= header.vMax[a] - header.vMin[a];
+				nAxes++;
+			}
+		}
+		int nDiv[3] = { 1, 1, 1 };
+		if (nAxes > 0)
+		{
+			float fCellSize = powf(fVolume / (float)nCells, 1.0f / (float)nAxes);
+			for (int a = 0; a < 3; a++)
+				if (header.vMax[a] - header.vMin[a] > 1e-4f)
+					nDiv[a] = (std::min)(256, (std::max)(1, (int)ceilf((header.vMax[a] - header.vMin[a]) / fCellSize)));
+		}
+
+		auto cellOf = [&](sTriangle& t)
+		{
+			int idx[3];
+			for (int a = 0; a < 3; a++)
+			{
+				float fCentroid = ((&t._point[0].x)[a] + (&t._point[1].x)[a] + (&t._point[2].x)[a]) / 3.0f;
+				float fExtent = header.vMax[a] - header.vMin[a];
+				int i = fExtent > 1e-4f ? (int)((fCentroid - header.vMin[a]) / fExtent * (float)nDiv[a]) : 0;
+				idx[a] = (std::min)(nDiv[a] - 1, (std::max)(0, i));
+			}
+			return (idx[2] * nDiv[1] + idx[1]) * nDiv[0] + idx[0];
+		};
+
+		int nTotalCells = nDiv[0] * nDiv[1] * nDiv[2];
+		std::vector<size_t> vecCellCount(nTotalCells, 0);
+		ForEachFace(sObjFile, vecVerts, vecTex, [&](sTriangle& t, bool) { vecCellCount[cellOf(t)]++; });
+
+		std::FILE* f = fileIO::OpenFile(sPageFile, L"wb");
+		if (f == nullptr)
+			return false;
+		bool bOk = std::fwrite(&header, sizeof(header), 1, f) == 1;
+
+		// Bands of whole cells, each small enough to hold
+		std::vector<int> vecBandFirstCell = { 0 };
+		std::vector<int> vecCellBand(nTotalCells);
+		size_t nBandFaces = 0;
+		for (int c = 0; c < nTotalCells; c++)
+		{
+			if (c > vecBandFirstCell.back() && nBandFaces + vecCellCount[c] > (size_t)nBandTris)
+			{
+				vecBandFirstCell.push_back(c);
+				nBandFaces = 0;
+			}
+			nBandFaces += vecCellCount[c];
+			vecCellBand[c] = (int)vecBandFirstCell.size() - 1;
+		}
+		int nBands = (int)vecBandFirstCell.size();
+		vecBandFirstCell.push_back(nTotalCells);
+
+		// One read of the faces sorts them into bands. With more than one band, each
+		// band's buffer is written out as a run when full, and the buffers together
+		// hold about one band
+		struct sRun
+		{
+			int64_t nOffset;
+			size_t nCount;
+		};
+		std::vector<std::vector<sTriangle>> vecBandBuffer(nBands);
+		std::vector<std::vector<sRun>> vecBandRuns(nBands);
+		size_t nBufferTris = (std::max)((size_t)1024, (size_t)nBandTris / (size_t)nBands);
+		std::FILE* fSpill = nullptr;
+		int64_t nSpillOffset = 0;
+
+		ForEachFace(sObjFile, vecVerts, vecTex, [&](sTriangle& t, bool)
+			{
+				int b = vecCellBand[cellOf(t)];
+				std::vector<sTriangle>& vecBuffer = vecBandBuffer[b];
+				vecBuffer.push_back(t);
+				if (nBands == 1 || vecBuffer.size() < nBufferTris || !bOk)
+					return;
+
+				if (fSpill == nullptr)
+					fSpill = std::tmpfile();
+				bOk = fSpill != nullptr && std::fwrite(vecBuffer.data(), sizeof(sTriangle), vecBuffer.size(), fSpill) == vecBuffer.size();
+				vecBandRuns[b].push_back({ nSpillOffset, vecBuffer.size() });
+				nSpillOffset += (int64_t)(vecBuffer.size() * sizeof(sTriangle));
+				vecBuffer.clear();
+			});
+
+		std::vector<sPage> vecPages;
+		std::vector<sTriangle> vecBand, vecSorted, vecPageTris;
+		std::vector<int> vecBandCell;
+		compactMesh page;
+
+		for (int b = 0; b < nBands && bOk; b++)
+		{
+			int nFirstCell = vecBandFirstCell[b], nEndCell = vecBandFirstCell[b + 1];
+
+			// The band's runs from the temporary file, in the order they were read, then
+			// what is still in its buffer
+			vecBand.clear();
+			for (const sRun& run : vecBandRuns[b])
+			{
+				size_t nAt = vecBand.size();
+				vecBand.resize(nAt + run.nCount);
+				bOk = bOk && Seek(fSpill, run.nOffset) && std::fread(&vecBand[nAt], sizeof(sTriangle), run.nCount, fSpill) == run.nCount;
+			}
+			vecBand.insert(vecBand.end(), vecBandBuffer[b].begin(), vecBandBuffer[b].end());
+			std::vector<sTriangle>().swap(vecBandBuffer[b]);
+
+			vecBandCell.clear();
+			for (auto& t : vecBand)
+				vecBandCell.push_back(cellOf(t));
+
+			// Counting sort of the band by cell
+			std::vector<size_t> vecStart(nEndCell - nFirstCell + 1, 0);
+			for (int c : vecBandCell)
+				vecStart[c - nFirstCell + 1]++;
+			for (size_t c = 1; c < vecStart.size(); c++)
+				vecStart[c] += vecStart[c - 1];
+			vecSorted.resize(vecBand.size());
+			std::vector<size_t> vecCursor(vecStart.begin(), vecStart.end() - 1);
+			for (size_t i = 0; i < vecBand.size(); i++)
+				vecSorted[vecCursor[vecBandCell[i] - nFirstCell]++] = vecBand[i];
+
+			// Every cell is cut into pages of at most nTrisPerPage
+			for (int c = 0; c < nEndCell - nFirstCell && bOk; c++)
+			{
+				for (size_t nStart = vecStart[c]; nStart < vecStart[c + 1]; nStart += nTrisPerPage)
+				{
+					size_t nEnd = (std::min)(vecStart[c + 1], nStart + (size_t)nTrisPerPage);
+					vecPageTris.assign(vecSorted.begin() + nStart, vecSorted.begin() + nEnd);
+
+					sPage entry;
+					entry.nOffset = (uint64_t)Tell(f);
+					entry.nTriangles = (uint32_t)vecPageTris.size();
+					for (int a = 0; a < 3; a++)
+					{
+						entry.vMin[a] = FLT_MAX;
+						entry.vMax[a] = -FLT_MAX;
+					}
+					for (auto& t : vecPageTris)
+					{
+						for (int k = 0; k < 3; k++)
+						{
+							for (int a = 0; a < 3; a++)
+							{
+								entry.vMin[a] = (std::min)(entry.vMin[a], (&t._point[k].x)[a]);
+								entry.vMax[a] = (std::max)(entry.vMax[a], (&t._point[k].x)[a]);
+							}
+						}
+					}
+
+					page.Build(vecPageTris, bAllTextured);
+					bOk &= page.Write(f);
+					header.nMaxTriangles = (std::max)(header.nMaxTriangles, (uint32_t)page.TriangleCount());
+					header.nMaxVertices = (std::max)(header.nMaxVertices, (uint32_t)page.VertexCount());
+					vecPages.push_back(entry);
+				}
+			}
+		}
+		if (fSpill != nullptr)
+			std::fclose(fSpill);
+
+		header.nPages = (uint32_t)vecPages.size();
+		header.nTableOffset = (uint64_t)Tell(f);
+		bOk &= std::fwrite(vecPages.data(), sizeof(sPage), vecPages.size(), f) == vecPages.size();
+		bOk &= Seek(f, 0);
+		bOk &= std::fwrite(&header, sizeof(header), 1, f) == 1;
+		bOk &= std::fclose(f) == 0;
+		return bOk;
+	}
+}
+
+// Keeps the pages of a page file that are wanted right now in a fixed number of
+// cache slots. Each frame the game thread Request()s the pages it can see, and the
+// pages it expects to see soon as prefetches, then calls Update(). Pages already
+// in a slot are kept; missing ones, nearest first, are read in by a loader thread
+// into slots whose pages weren't wanted this frame, least recently wanted first.
+// When every slot is wanted, a page only replaces one wanted less, a prefetch or a
+// page further away, so the cache holds the nearest pages rather than churning.
+// Nothing is allocated after Open(), so memory is the page table plus the slots
+// however large the file is. A page only becomes Resident() once it is fully read.
+class meshPager
+{
+public:
+	meshPager()
+	{
+
+	}
+
+	~meshPager()
+	{
+		Close();
+	}
+
+	meshPager(const meshPager&) = delete;
+	meshPager& operator=(const meshPager&) = delete;
+
+	bool Open(const std::wstring& sFile, int nCacheSlots = 64)
+	{
+		Close();
+		m_pFile = fileIO::OpenFile(sFile, L"rb");
+		if (m_pFile == nullptr)
+			return false;
+
+		// The page table has to be where the header says, and fit in the file
+		int64_t nFileSize = meshPageFile::Seek(m_pFile, 0, SEEK_END) ? meshPageFile::Tell(m_pFile) : -1;
+		if (!meshPageFile::Seek(m_pFile, 0) || std::fread(&m_header, sizeof(m_header), 1, m_pFile) != 1 ||
+			std::memcmp(m_header.sMagic, "CGEM", 4) != 0 || m_header.nVersion != meshPageFile::nVersion ||
+			nFileSize < 0 || m_header.nTableOffset < sizeof(m_header) || m_header.nTableOffset > (uint64_t)nFileSize ||
+			(uint64_t)nFileSize - m_header.nTableOffset < (uint64_t)m_header.nPages * sizeof(meshPageFile::sPage) ||
+			!meshPageFile::Seek(m_pFile, (int64_t)m_header.nTableOffset))
+		{
+			Close();
+			return false;
+		}
+		m_vecPages.resize(m_header.nPages);
+		if (std::fread(m_vecPages.data(), sizeof(meshPageFile::sPage), m_vecPages.size(), m_pFile) != m_vecPages.size())
+		{
+			Close();
+			return false;
+		}
+
+		// Every page lies between the header and the table, Read() checks it fits there
+		for (const auto& page : m_vecPages)
+		{
+			if (page.nOffset < sizeof(m_header) || page.nOffset >= m_header.nTableOffset)
+			{
+				Close();
+				return false;
+			}
+		}
+
+		// Everything a frame needs is allocated here
+		m_vecSlots = std::vector<sSlot>(nCacheSlots);
+		for (auto& slot : m_vecSlots)
+			slot.mesh.Reserve(m_header.nMaxTriangles, m_header.nMaxVertices, m_header.nHasTexCoords != 0);
+		m_vecPageSlot.assign(m_vecPages.size(), -1);
+		m_vecPageRequest.assign(m_vecPages.size(), -1);
+		m_vecRequests.clear();
+		m_vecRequests.reserve(m_vecPages.size());
+		m_vecLoadQueue.assign(nCacheSlots, 0);
+		m_nQueueHead = m_nQueueTail = 0;
+		m_nFrame = 1;
+		m_nPagesLoaded = 0;
+		m_bStop = false;
+		m_thread = std::thread(&meshPager::LoaderThread, this);
+		return true;
+	}
+
+	void Close()
+	{
+		if (m_thread.joinable())
+		{
+			{
+				std::unique_lock<std::mutex> lm(m_mux);
+				m_bStop = true;
+			}
+			m_cvLoad.notify_one();
+			m_thread.join();
+		}
+		if (m_pFile != nullptr)
+			std::fclose(m_pFile);
+		m_pFile = nullptr;
+		m_vecPages.clear();
+		m_vecSlots.clear();
+	}
+
+	// Everything the loader thread does is recorded on this timeline while it is recording
+	void SetTrace(traceRecorder* pTrace)
+	{
+		m_pTrace = pTrace;
+	}
+
+	// Loads that can be waiting at once. Fewer means less time spent reading pages
+	// the camera has already turned away from
+	void SetMaxLoadsInFlight(int nLoads)
+	{
+		m_nMaxInFlight = nLoads;
+	}
+
+	int PageCount() { return (int)m_vecPages.size(); }
+	const meshPageFile::sPage& Page(int nPage) { return m_vecPages[nPage]; }
+	bool HasTexCoords() { return m_header.nHasTexCoords != 0; }
+
+	// Whether the open page file was built from sObjFile as it is now
+	bool IsBuiltFrom(const std::string& sObjFile)
+	{
+		uint64_t nSize = 0;
+		int64_t nTime = 0;
+		return meshPageFile::SourceStamp(sObjFile, nSize, nTime) && nSize == m_header.nSourceSize && nTime == m_header.nSourceTime;
+	}
+
+	// Game thread. Lower priorities load first; prefetches only load once every page
+	// that is actually wanted this frame is in or on its way
+	void Request(int nPage, float fPriority, bool bPrefetch = false)
+	{
+		int nRequest = m_vecPageRequest[nPage];
+		if (nRequest >= 0 && nRequest < (int)m_vecRequests.size() && m_vecRequests[nRequest].nPage == nPage)
+		{
+			sRequest& r = m_vecRequests[nRequest];
+			r.fPriority = (std::min)(r.fPriority, fPriority);
+			r.bPrefetch &= bPrefetch;
+			return;
+		}
+		m_vecPageRequest[nPage] = (int)m_vecRequests.size();
+		m_vecRequests.push_back({ nPage, fPriority, bPrefetch });
+	}
+
+	// Game thread, after this frame's requests. Hands the most wanted missing pages to the loader
+	void Update()
+	{
+		std::sort(m_vecRequests.begin(), m_vecRequests.end(), [](const sRequest& a, const sRequest& b)
+			{
+				return a.bPrefetch != b.bPrefetch ? b.bPrefetch : a.fPriority < b.fPriority;
+			});
+
+		// Pages already in are kept, unless something wanted more needs the slot
+		for (auto& r : m_vecRequests)
+		{
+			int nSlot = m_vecPageSlot[r.nPage];
+			if (nSlot >= 0)
+			{
+				m_vecSlots[nSlot].nLastWanted = m_nFrame;
+				m_vecSlots[nSlot].fPriority = r.bPrefetch ? FLT_MAX : r.fPriority;
+			}
+		}
+
+		int nInFlight = 0;
+		for (auto& slot : m_vecSlots)
+			nInFlight += slot.nState.load(std::memory_order_acquire) == SLOT_LOADING ? 1 : 0;
+
+		m_nMissing = 0;
+		for (auto& r : m_vecRequests)
+		{
+			if (m_vecPageSlot[r.nPage] >= 0)
+				continue;
+			if (!r.bPrefetch)
+				m_nMissing++;
+			if (nInFlight >= m_nMaxInFlight)
+				continue;
+
+			int nVictim = FindVictim(r.bPrefetch ? FLT_MAX : r.fPriority);
+			if (nVictim < 0)
+				continue;
+
+			sSlot& slot = m_vecSlots[nVictim];
+			if (slot.nPage >= 0)
+				m_vecPageSlot[slot.nPage] = -1;
+			slot.nPage = r.nPage;
+			slot.nLastWanted = m_nFrame;
+			slot.fPriority = r.bPrefetch ? FLT_MAX : r.fPriority;
+			slot.nState.store(SLOT_LOADING, std::memory_order_relaxed);
+			m_vecPageSlot[r.nPage] = nVictim;
+			nInFlight++;
+			{
+				std::unique_lock<std::mutex> lm(m_mux);
+				m_vecLoadQueue[m_nQueueTail++ % m_vecLoadQueue.size()] = nVictim;
+			}
+			m_cvLoad.notify_one();
+		}
+
+		m_vecRequests.clear();
+		m_nFrame++;
+	}
+
+	// Game thread. The page's triangles, or nullptr if it isn't in memory yet
+	compactMesh* Resident(int nPage)
+	{
+		int nSlot = m_vecPageSlot[nPage];
+		if (nSlot < 0 || m_vecSlots[nSlot].nState.load(std::memory_order_acquire) != SLOT_READY)
+			return nullptr;
+		return &m_vecSlots[nSlot].mesh;
+	}
+
+	int ResidentPages()
+	{
+		int n = 0;
+		for (auto& slot : m_vecSlots)
+			n += slot.nState.load(std::memory_order_acquire) == SLOT_READY ? 1 : 0;
+		return n;
+	}
+
+	int LoadingPages()
+	{
+		int n = 0;
+		for (auto& slot : m_vecSlots)
+			n += slot.nState.load(std::memory_order_acquire) == SLOT_LOADING ? 1 : 0;
+		return n;
+	}
+
+	// Pages requested (not prefetched) in the last Update() that weren't in memory
+	int MissingPages() { return m_nMissing; }
+	unsigned int PagesLoaded() { return m_nPagesLoaded; }
+
+	// Bytes held by the cache slots, fixed at Open()
+	size_t CacheBytes()
+	{
+		size_t n = 0;
+		for (auto& slot : m_vecSlots)
+			n += slot.mesh.MemoryBytes();
+		return n;
+	}
+
+private:
+	enum { SLOT_FREE, SLOT_LOADING, SLOT_READY };
+
+	struct sSlot
+	{
+		compactMesh mesh;
+		std::atomic<int> nState = SLOT_FREE;
+		int nPage = -1;
+		unsigned int nLastWanted = 0;
+		float fPriority = 0.0f;		// Of this frame's request for the page, prefetches are FLT_MAX
+	};
+
+	struct sRequest
+	{
+		int nPage;
+		float fPriority;
+		bool bPrefetch;
+	};
+
+	// A free slot, or the least recently wanted one not wanted this frame, or failing
+	// that the one wanted least this frame if that's less than fPriority
+	int FindVictim(float fPriority)
+	{
+		int nUnwanted = -1, nLeastWanted = -1;
+		for (int s = 0; s < (int)m_vecSlots.size(); s++)
+		{
+			sSlot& slot = m_vecSlots[s];
+			int nState = slot.nState.load(std::memory_order_acquire);
+			if (nState == SLOT_FREE)
+				return s;
+			if (nState != SLOT_READY)
+				continue;
+			if (slot.nLastWanted != m_nFrame)
+			{
+				if (nUnwanted < 0 || slot.nLastWanted < m_vecSlots[nUnwanted].nLastWanted)
+					nUnwanted = s;
+			}
+			else if (slot.fPriority > fPriority && (nLeastWanted < 0 || slot.fPriority > m_vecSlots[nLeastWanted].fPriority))
+				nLeastWanted = s;
+		}
+		return nUnwanted >= 0 ? nUnwanted : nLeastWanted;
+	}
+
+	void LoaderThread()
+	{
+		traceRecorder::SetThreadName("Mesh pager");
+		while (true)
+		{
+			int nSlot;
+			{
+				std::unique_lock<std::mutex> lm(m_mux);
+				m_cvLoad.wait(lm, [&] { return m_bStop || m_nQueueHead != m_nQueueTail; });
+				if (m_bStop)
+					return;
+				nSlot = m_vecLoadQueue[m_nQueueHead++ % m_vecLoadQueue.size()];
+			}
+
+			// The slot is this thread's until it is marked ready
+			sSlot& slot = m_vecSlots[nSlot];
+			traceRecorder* pTrace = m_pTrace;
+			int64_t nStart = pTrace != nullptr && pTrace->IsRecording() ? traceRecorder::Now() : 0;
+			const meshPageFile::sPage& page = m_vecPages[slot.nPage];
+
+			// A page that can't be read is left empty rather than asked for again every frame
+			if (!meshPageFile::Seek(m_pFile, (int64_t)page.nOffset) || !slot.mesh.Read(m_pFile, m_header.nTableOffset - page.nOffset))
+				slot.mesh.Clear();
+
+			if (nStart != 0)
+				pTrace->Record("Load page", nStart, traceRecorder::Now());
+			m_nPagesLoaded++;
+			slot.nState.store(SLOT_READY, std::memory_order_release);
+		}
+	}
+
+	std::FILE* m_pFile = nullptr;
+	meshPageFile::sHeader m_header;
+	std::vector<meshPageFile::sPage> m_vecPages;
+	std::vector<sSlot> m_vecSlots;
+	std::vector<int> m_vecPageSlot;		// Slot each page is in, or -1
+	std::vector<int> m_vecPageRequest;	// Where each page was last put in m_vecRequests
+	std::vector<sRequest> m_vecRequests;
+	unsigned int m_nFrame = 1;
+	int m_nMissing = 0;
+	int m_nMaxInFlight = 8;
+
+	std::vector<int> m_vecLoadQueue;	// Slots waiting for the loader, never more than there are slots
+	size_t m_nQueueHead = 0;
+	size_t m_nQueueTail = 0;
+	std::atomic<unsigned int> m_nPagesLoaded = 0;
+	std::thread m_thread;
+	std::mutex m_mux;
+	std::condition_variable m_cvLoad;
+	bool m_bStop = false;
+	std::atomic<traceRecorder*> m_pTrace = nullptr;
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "consoleWindowEngine.h"
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+
+// Texture for the 3D pipeline, built from an olcSprite at load time. Every level of
+// the mip chain is stored in 4x4 tiles (16 cells, one 64 byte cache line) with the
+// cells inside a tile in Morton order, so neighbouring texels in both u and v tend to
+// share a line. Cells are packed glyph | colour << 16, the same as the console.
+//
+// Console colours can't be blended, so a coarser level takes the most common cell of
+// the 2x2 below it rather than an average.
+class mipTexture
+{
+public:
+	mipTexture()
+	{
+
+	}
+
+	bool Create(olcSprite* sprite)
+	{
+		m_vecLevels.clear();
+		if (sprite == nullptr || sprite->nWidth <= 0 || sprite->nHeight <= 0)
+			return false;
+
+		sLevel base;
+		Allocate(base, sprite->nWidth, sprite->nHeight);
+		for (int y = 0; y < base.nHeight; y++)
+			for (int x = 0; x < base.nWidth; x++)
+				At(base, x, y) = (uint16_t)sprite->GetGlyph(x, y) | ((uint32_t)(uint16_t)sprite->GetColour(x, y) << 16);
+		m_vecLevels.push_back(base);
+
+		while (m_vecLevels.back().nWidth > 1 || m_vecLevels.back().nHeight > 1)
+		{
+			sLevel& src = m_vecLevels.back();
+			sLevel dst;
+			Allocate(dst, (std::max)(1, (src.nWidth + 1) / 2), (std::max)(1, (src.nHeight + 1) / 2));
+			for (int y = 0; y < dst.nHeight; y++)
+			{
+				for (int x = 0; x < dst.nWidth; x++)
+				{
+					int x0 = (std::min)(x * 2, src.nWidth - 1), x1 = (std::min)(x * 2 + 1, src.nWidth - 1);
+					int y0 = (std::min)(y * 2, src.nHeight - 1), y1 = (std::min)(y * 2 + 1, src.nHeight - 1);
+					uint32_t c[4] = { At(src, x0, y0), At(src, x1, y0), At(src, x0, y1), At(src, x1, y1) };
+
+					// Most common of the four, first one on a tie
+					int nBest = 0, nBestCount = 0;
+					for (int i = 0; i < 4; i++)
+					{
+						int nCount = 0;
+						for (int j = 0; j < 4; j++)
+							nCount += c[i] == c[j];
+						if (nCount > nBestCount)
+						{
+							nBest = i;
+							nBestCount = nCount;
+						}
+					}
+					At(dst, x, y) = c[nBest];
+				}
+			}
+			m_vecLevels.push_back(dst);
+		}
+		return true;
+	}
+
+	bool IsValid() { return !m_vecLevels.empty(); }
+	int Levels() { return (int)m_vecLevels.size(); }
+	int Width() { return m_vecLevels[0].nWidth; }
+	int Height() { return m_vecLevels[0].nHeight; }
+
+	// Nearest texel, u and v repeat outside 0..1
+	uint32_t Sample(float u, float v, int nLevel)
+	{
+		sLevel& l = m_vecLevels[nLevel];
+		int x = (int)floorf(u * (float)l.nWidth) % l.nWidth;
+		int y = (int)floorf(v * (float)l.nHeight) % l.nHeight;
+		if (x < 0) x += l.nWidth;
+		if (y < 0) y += l.nHeight;
+		return At(l, x, y);
+	}
+
+	// Level whose texels are about the size of a screen cell, given the texture
+	// space area (0..1 units) and screen area (cells) of the same triangle
+	int SelectLevel(float fUVArea, float fScreenArea)
+	{
+		if (fScreenArea <= 0.0f || fUVArea <= 0.0f)
+			return 0;
+		float fTexels = fUVArea * (float)Width() * (float)Height();
+		int nLevel = (int)(0.5f * log2f(fTexels / fScreenArea));
+		return (std::max)(0, (std::min)(nLevel, Levels() - 1));
+	}
+
+private:
+	struct sLevel
+	{
+		int nWidth = 0;
+		int nHeight = 0;
+		int nTilesX = 0;
+		std::vector<uint32_t> vecCells;
+	};
+
+	static void Allocate(sLevel& l, int w, int h)
+	{
+		l.nWidth = w;
+		l.nHeight = h;
+		l.nTilesX = (w + 3) / 4;
+		l.vecCells.assign(l.nTilesX * ((h + 3) / 4) * 16, (uint32_t)L' ');
+	}
+
+	static uint32_t& At(sLevel& l, int x, int y)
+	{
+		// Interleave the low two bits of x and y inside the tile
+		int nInTile = (x & 1) | ((y & 1) << 1) | ((x & 2) << 1) | ((y & 2) << 2);
+		return l.vecCells[((y >> 2) * l.nTilesX + (x >> 2)) * 16 + nInTile];
+	}
+
+	std::vector<sLevel> m_vecLevels;
+};
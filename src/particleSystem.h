@@ -0,0 +1,323 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+
+#if defined(CGE_SSE2)
+#include <emmintrin.h>
+#endif
+
+// A fixed size pool of small, short lived world space points, such as sparks, engine
+// exhaust or dust, drawn as one console cell each or a small square when close.
+//
+// Every particle property is its own array, all the x positions, then all the y and
+// so on, so Update() is the same few multiply-adds down straight runs of memory,
+// four particles at a time where SSE2 is available. The live particles are always
+// the first AliveCount() entries: new ones go on the end, and a dead one is replaced
+// by the last live one, so the pool never has holes and nothing is allocated after
+// Create(). When the pool is full new particles are dropped, see Dropped().
+//
+// Drawing is in two steps, Project() works out every particle's screen position and
+// 1/w, then Draw() puts them into a band of rows of the screen, keeping only those
+// nearer than the depth already in each cell. Both work on ranges, so they can be
+// split across threads.
+class particleSystem
+{
+public:
+	static const int nRampSteps = 4;
+	static const int nMaxSplatRadius = 2;
+
+	// Where new particles come from and how they start out. Positions are spread over
+	// a sphere of fRadius, directions over a cone about vDirection that widens with
+	// fSpread, 0 is straight along it and 1 is about 45 degrees either side
+	struct sEmitter
+	{
+		float vPosition[3] = { 0.0f, 0.0f, 0.0f };
+		float vDirection[3] = { 0.0f, 1.0f, 0.0f };
+		float fRadius = 0.0f;
+		float fSpread = 0.0f;
+		float fSpeedMin = 1.0f, fSpeedMax = 1.0f;
+		float fLifeMin = 1.0f, fLifeMax = 1.0f;
+		float fRate = 100.0f;		// Particles per second
+		float fCarry = 0.0f;		// Part of a particle left over from the last Emit()
+	};
+
+	particleSystem()
+	{
+
+	}
+
+	// Room for nCapacity particles, the only allocation the pool makes
+	void Create(int nCapacity)
+	{
+		// Whole groups of four, so the SIMD loops never need a tail
+		m_nCapacity = (nCapacity + 3) & ~3;
+		for (auto* pVec : { &m_vecPX, &m_vecPY, &m_vecPZ, &m_vecVX, &m_vecVY, &m_vecVZ, &m_vecLife, &m_vecInvLifetime,
+			&m_vecScreenX, &m_vecScreenY, &m_vecInvW })
+			pVec->assign(m_nCapacity, 0.0f);
+		m_nAlive = 0;
+		m_nDropped = 0;
+	}
+
+	// Acceleration in world units per second squared, and how much of its speed a
+	// particle loses per second to drag
+	void SetForces(float fGravityX, float fGravityY, float fGravityZ, float fDrag)
+	{
+		m_vGravity[0] = fGravityX; m_vGravity[1] = fGravityY; m_vGravity[2] = fGravityZ;
+		m_fDrag = fDrag;
+	}
+
+	// Particles falling below y bounce back up with fBounce of their speed
+	void SetFloor(float fY, float fBounce)
+	{
+		m_fFloorY = fY;
+		m_fBounce = fBounce;
+	}
+
+	// Glyph and colour from birth to death, nRampSteps of each. fSize is the world
+	// space width of a particle, for how big it is drawn close up
+	void SetAppearance(const uint16_t* pGlyphs, const uint16_t* pColours, float fSize)
+	{
+		for (int i = 0; i < nRampSteps; i++)
+		{
+			m_nGlyph[i] = pGlyphs[i];
+			m_nColour[i] = pColours[i];
+		}
+		m_fSize = fSize;
+	}
+
+	void Clear() { m_nAlive = 0; }
+
+	int AliveCount() { return m_nAlive; }
+	int Capacity() { return m_nCapacity; }
+	int Dropped() { return m_nDropped; }
+
+	// Add the particles emitter makes in fElapsedTime seconds
+	void Emit(sEmitter& emitter, float fElapsedTime)
+	{
+		emitter.fCarry += emitter.fRate * fElapsedTime;
+		int nNew = (int)emitter.fCarry;
+		emitter.fCarry -= (float)nNew;
+
+		int nRoom = m_nCapacity - m_nAlive;
+		if (nNew > nRoom)
+		{
+			m_nDropped += nNew - nRoom;
+			nNew = nRoom;
+		}
+
+		for (int n = 0; n < nNew; n++)
+		{
+			int i = m_nAlive++;
+			float vOffset[3], vDir[3];
+			RandomInSphere(vOffset);
+			RandomInSphere(vDir);
+			for (int a = 0; a < 3; a++)
+				vDir[a] = emitter.vDirection[a] + vDir[a] * emitter.fSpread;
+			float fLength = sqrtf(vDir[0] * vDir[0] + vDir[1] * vDir[1] + vDir[2] * vDir[2]);
+			float fSpeed = (emitter.fSpeedMin + (emitter.fSpeedMax - emitter.fSpeedMin) * Random()) / (std::max)(fLength, 1e-6f);
+			float fLife = emitter.fLifeMin + (emitter.fLifeMax - emitter.fLifeMin) * Random();
+
+			m_vecPX[i] = emitter.vPosition[0] + vOffset[0] * emitter.fRadius;
+			m_vecPY[i] = emitter.vPosition[1] + vOffset[1] * emitter.fRadius;
+			m_vecPZ[i] = emitter.vPosition[2] + vOffset[2] * emitter.fRadius;
+			m_vecVX[i] = vDir[0] * fSpeed;
+			m_vecVY[i] = vDir[1] * fSpeed;
+			m_vecVZ[i] = vDir[2] * fSpeed;
+			m_vecLife[i] = fLife;
+			m_vecInvLifetime[i] = 1.0f / (std::max)(fLife, 1e-6f);
+		}
+	}
+
+	// Move every particle on by fElapsedTime and remove the ones that have run out
+	void Update(float fElapsedTime)
+	{
+		float fDamp = 1.0f / (1.0f + m_fDrag * fElapsedTime);
+		int nGroups = (m_nAlive + 3) & ~3;
+		int i = 0;
+#if defined(CGE_SSE2)
+		const __m128 vDt = _mm_set1_ps(fElapsedTime), vDamp = _mm_set1_ps(fDamp);
+		const __m128 vGX = _mm_set1_ps(m_vGravity[0] * fElapsedTime);
+		const __m128 vGY = _mm_set1_ps(m_vGravity[1] * fElapsedTime);
+		const __m128 vGZ = _mm_set1_ps(m_vGravity[2] * fElapsedTime);
+		const __m128 vFloor = _mm_set1_ps(m_fFloorY), vBounce = _mm_set1_ps(-m_fBounce);
+		for (; i < nGroups; i += 4)
+		{
+			__m128 vx = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&m_vecVX[i]), vDamp), vGX);
+			__m128 vy = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&m_vecVY[i]), vDamp), vGY);
+			__m128 vz = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&m_vecVZ[i]), vDamp), vGZ);
+			__m128 px = _mm_add_ps(_mm_loadu_ps(&m_vecPX[i]), _mm_mul_ps(vx, vDt));
+			__m128 py = _mm_add_ps(_mm_loadu_ps(&m_vecPY[i]), _mm_mul_ps(vy, vDt));
+			__m128 pz = _mm_add_ps(_mm_loadu_ps(&m_vecPZ[i]), _mm_mul_ps(vz, vDt));
+
+			// Those under the floor go back onto it, heading up
+			__m128 vBelow = _mm_cmplt_ps(py, vFloor);
+			py = _mm_or_ps(_mm_and_ps(vBelow, vFloor), _mm_andnot_ps(vBelow, py));
+			vy = _mm_or_ps(_mm_and_ps(vBelow, _mm_mul_ps(vy, vBounce)), _mm_andnot_ps(vBelow, vy));
+
+			_mm_storeu_ps(&m_vecVX[i], vx);
+			_mm_storeu_ps(&m_vecVY[i], vy);
+			_mm_storeu_ps(&m_vecVZ[i], vz);
+			_mm_storeu_ps(&m_vecPX[i], px);
+			_mm_storeu_ps(&m_vecPY[i], py);
+			_mm_storeu_ps(&m_vecPZ[i], pz);
+			_mm_storeu_ps(&m_vecLife[i], _mm_sub_ps(_mm_loadu_ps(&m_vecLife[i]), vDt));
+		}
+#endif
+		for (; i < nGroups; i++)
+		{
+			m_vecVX[i] = m_vecVX[i] * fDamp + m_vGravity[0] * fElapsedTime;
+			m_vecVY[i] = m_vecVY[i] * fDamp + m_vGravity[1] * fElapsedTime;
+			m_vecVZ[i] = m_vecVZ[i] * fDamp + m_vGravity[2] * fElapsedTime;
+			m_vecPX[i] += m_vecVX[i] * fElapsedTime;
+			m_vecPY[i] += m_vecVY[i] * fElapsedTime;
+			m_vecPZ[i] += m_vecVZ[i] * fElapsedTime;
+			if (m_vecPY[i] < m_fFloorY)
+			{
+				m_vecPY[i] = m_fFloorY;
+				m_vecVY[i] *= -m_fBounce;
+			}
+			m_vecLife[i] -= fElapsedTime;
+		}
+
+		// The last live particle takes the place of each dead one
+		for (int n = 0; n < m_nAlive;)
+		{
+			if (m_vecLife[n] > 0.0f)
+			{
+				n++;
+				continue;
+			}
+			int nLast = --m_nAlive;
+			m_vecPX[n] = m_vecPX[nLast]; m_vecPY[n] = m_vecPY[nLast]; m_vecPZ[n] = m_vecPZ[nLast];
+			m_vecVX[n] = m_vecVX[nLast]; m_vecVY[n] = m_vecVY[nLast]; m_vecVZ[n] = m_vecVZ[nLast];
+			m_vecLife[n] = m_vecLife[nLast];
+			m_vecInvLifetime[n] = m_vecInvLifetime[nLast];
+		}
+	}
+
+	// Screen position and 1/w of particles nFrom..nTo-1. matViewProj is 4x4 row major
+	// for row vectors, world space to clip space, and the screen is nWidth x nHeight
+	// cells. Particles closer than fNear get a 1/w of 0 and aren't drawn
+	void Project(const float* m, int nWidth, int nHeight, float fNear, int nFrom, int nTo)
+	{
+		float fHalfWidth = 0.5f * (float)nWidth, fHalfHeight = 0.5f * (float)nHeight;
+		int i = nFrom;
+#if defined(CGE_SSE2)
+		const __m128 m0 = _mm_set1_ps(m[0]), m1 = _mm_set1_ps(m[1]), m3 = _mm_set1_ps(m[3]);
+		const __m128 m4 = _mm_set1_ps(m[4]), m5 = _mm_set1_ps(m[5]), m7 = _mm_set1_ps(m[7]);
+		const __m128 m8 = _mm_set1_ps(m[8]), m9 = _mm_set1_ps(m[9]), m11 = _mm_set1_ps(m[11]);
+		const __m128 m12 = _mm_set1_ps(m[12]), m13 = _mm_set1_ps(m[13]), m15 = _mm_set1_ps(m[15]);
+		const __m128 vOne = _mm_set1_ps(1.0f), vNear = _mm_set1_ps(fNear);
+		const __m128 vHalfWidth = _mm_set1_ps(fHalfWidth), vHalfHeight = _mm_set1_ps(fHalfHeight);
+		for (; i + 4 <= nTo; i += 4)
+		{
+			__m128 px = _mm_loadu_ps(&m_vecPX[i]), py = _mm_loadu_ps(&m_vecPY[i]), pz = _mm_loadu_ps(&m_vecPZ[i]);
+			__m128 cx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, m0), _mm_mul_ps(py, m4)), _mm_add_ps(_mm_mul_ps(pz, m8), m12));
+			__m128 cy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, m1), _mm_mul_ps(py, m5)), _mm_add_ps(_mm_mul_ps(pz, m9), m13));
+			__m128 cw = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, m3), _mm_mul_ps(py, m7)), _mm_add_ps(_mm_mul_ps(pz, m11), m15));
+			__m128 vInFront = _mm_cmpge_ps(cw, vNear);
+			__m128 vInvW = _mm_and_ps(vInFront, _mm_div_ps(vOne, _mm_or_ps(_mm_and_ps(vInFront, cw), _mm_andnot_ps(vInFront, vOne))));
+			_mm_storeu_ps(&m_vecScreenX[i], _mm_mul_ps(_mm_sub_ps(vOne, _mm_mul_ps(cx, vInvW)), vHalfWidth));
+			_mm_storeu_ps(&m_vecScreenY[i], _mm_mul_ps(_mm_sub_ps(vOne, _mm_mul_ps(cy, vInvW)), vHalfHeight));
+			_mm_storeu_ps(&m_vecInvW[i], vInvW);
+		}
+#endif
+		for (; i < nTo; i++)
+		{
+			float cx = m_vecPX[i] * m[0] + m_vecPY[i] * m[4] + m_vecPZ[i] * m[8] + m[12];
+			float cy = m_vecPX[i] * m[1] + m_vecPY[i] * m[5] + m_vecPZ[i] * m[9] + m[13];
+			float cw = m_vecPX[i] * m[3] + m_vecPY[i] * m[7] + m_vecPZ[i] * m[11] + m[15];
+			float fInvW = cw >= fNear ? 1.0f / cw : 0.0f;
+			m_vecScreenX[i] = (1.0f - cx * fInvW) * fHalfWidth;
+			m_vecScreenY[i] = (1.0f - cy * fInvW) * fHalfHeight;
+			m_vecInvW[i] = fInvW;
+		}
+	}
+
+	// Draw every projected particle into rows nRowMin..nRowMax-1 of an nWidth x nHeight
+	// screen. Cells are 4 bytes, a 16-bit glyph then a 16-bit colour, the layout of
+	// CHAR_INFO, nPitch cells apart from one row to the next. pDepth holds 1/w of
+	// whatever is already in each cell, 0 for nothing, nWidth apart. A particle only
+	// covers a cell it is nearer than, and leaves its own 1/w there. fCellsPerUnit is
+	// how many cells wide one world unit at a distance of 1 is drawn
+	void Draw(uint16_t* pCells, int nWidth, int nHeight, int nPitch, float* pDepth, float fCellsPerUnit, int nRowMin, int nRowMax)
+	{
+		nRowMin = (std::max)(nRowMin, 0);
+		nRowMax = (std::min)(nRowMax, nHeight);
+		float fSplat = 0.5f * m_fSize * fCellsPerUnit;
+		for (int i = 0; i < m_nAlive; i++)
+		{
+			float fInvW = m_vecInvW[i];
+			if (fInvW <= 0.0f)
+				continue;
+			float fx = m_vecScreenX[i], fy = m_vecScreenY[i];
+			int r = (int)(fSplat * fInvW);
+			if (r > nMaxSplatRadius)
+				r = nMaxSplatRadius;
+			if (fy + (float)r < (float)nRowMin || fy - (float)r >= (float)nRowMax || fx + (float)r < 0.0f || fx - (float)r >= (float)nWidth)
+				continue;
+
+			int nStep = (int)((1.0f - m_vecLife[i] * m_vecInvLifetime[i]) * (float)nRampSteps);
+			nStep = (std::min)((std::max)(nStep, 0), nRampSteps - 1);
+			int x = (int)floorf(fx), y = (int)floorf(fy);
+			int nX0 = (std::max)(x - r, 0), nX1 = (std::min)(x + r, nWidth - 1);
+			int nY0 = (std::max)(y - r, nRowMin), nY1 = (std::min)(y + r, nRowMax - 1);
+			for (int cy = nY0; cy <= nY1; cy++)
+				for (int cx = nX0; cx <= nX1; cx++)
+				{
+					float& fDepth = pDepth[cy * nWidth + cx];
+					if (fInvW <= fDepth)
+						continue;
+					fDepth = fInvW;
+					uint16_t* pCell = pCells + 2 * ((size_t)cy * nPitch + cx);
+					pCell[0] = m_nGlyph[nStep];
+					pCell[1] = m_nColour[nStep];
+				}
+		}
+	}
+
+private:
+	// xorshift, quick and the same sequence every run
+	float Random()
+	{
+		m_nSeed ^= m_nSeed << 13;
+		m_nSeed ^= m_nSeed >> 17;
+		m_nSeed ^= m_nSeed << 5;
+		return (float)(m_nSeed >> 8) * (1.0f / 16777216.0f);
+	}
+
+	void RandomInSphere(float* v)
+	{
+		do
+		{
+			v[0] = Random() * 2.0f - 1.0f;
+			v[1] = Random() * 2.0f - 1.0f;
+			v[2] = Random() * 2.0f - 1.0f;
+		} while (v[0] * v[0] + v[1] * v[1] + v[2] * v[2] > 1.0f);
+	}
+
+	int m_nCapacity = 0;
+	int m_nAlive = 0;
+	int m_nDropped = 0;
+
+	std::vector<float> m_vecPX, m_vecPY, m_vecPZ;	// World space position
+	std::vector<float> m_vecVX, m_vecVY, m_vecVZ;	// World units per second
+	std::vector<float> m_vecLife;					// Seconds left
+	std::vector<float> m_vecInvLifetime;			// 1 / seconds it started with
+	std::vector<float> m_vecScreenX, m_vecScreenY, m_vecInvW;	// From the last Project()
+
+	float m_vGravity[3] = { 0.0f, 0.0f, 0.0f };
+	float m_fDrag = 0.0f;
+	float m_fFloorY = -FLT_MAX;
+	float m_fBounce = 0.0f;
+
+	uint16_t m_nGlyph[nRampSteps] = { '*', '*', '*', '*' };
+	uint16_t m_nColour[nRampSteps] = { 15, 15, 15, 15 };
+	float m_fSize = 0.1f;
+
+	uint32_t m_nSeed = 0x9E3779B9u;
+};
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// Chooses the resolution to render at so that frames come in on a target time.
+// Each frame it is told how long the last one took, and compares a smoothed frame
+// time against the target. Rendering cost is taken to grow with the number of
+// cells, the square of the scale, so the scale expected to hit the target is the
+// current one times the square root of target / measured. Small misses inside a
+// dead band are ignored, the scale moves in whole steps, and after each change it
+// waits a few frames for the average to catch up, so it settles on a size rather
+// than hunting between two.
+class resolutionScaler
+{
+public:
+	resolutionScaler()
+	{
+
+	}
+
+	// Seconds per frame to aim for
+	void SetTargetFrameTime(float fSeconds) { m_fTarget = fSeconds; }
+
+	// Scale is a fraction of the full size in each direction
+	void SetScaleRange(float fMin, float fMax)
+	{
+		m_fMinScale = fMin;
+		m_fMaxScale = fMax;
+		m_fScale = (std::max)(fMin, (std::min)(m_fScale, fMax));
+	}
+
+	// How much of each new frame time goes into the average, 0 to 1
+	void SetSmoothing(float fWeight) { m_fSmoothing = fWeight; }
+
+	// Misses smaller than this fraction of the target are left alone
+	void SetDeadBand(float fFraction) { m_fDeadBand = fFraction; }
+
+	// The scale only ever moves in multiples of this
+	void SetStep(float fStep) { m_fStep = fStep; }
+
+	// Frames to wait after a change before the next one
+	void SetSettleFrames(int nFrames) { m_nSettleFrames = nFrames; }
+
+	void Reset(float fScale = 1.0f)
+	{
+		m_fScale = (std::max)(m_fMinScale, (std::min)(fScale, m_fMaxScale));
+		m_fSmoothed = 0.0f;
+		m_nSettle = m_nSettleFrames;
+	}
+
+	// Call once per frame with the time the last frame took, returns the scale to use
+	float Update(float fFrameTime)
+	{
+		m_fSmoothed = m_fSmoothed == 0.0f ? fFrameTime : m_fSmoothed + (fFrameTime - m_fSmoothed) * m_fSmoothing;
+		if (m_nSettle > 0)
+		{
+			m_nSettle--;
+			return m_fScale;
+		}
+
+		float fRatio = m_fTarget / (std::max)(m_fSmoothed, 1e-6f);
+		if (fabsf(1.0f - fRatio) < m_fDeadBand)
+			return m_fScale;
+
+		float fWanted = m_fScale * sqrtf(fRatio);
+		float fNew = roundf(fWanted / m_fStep) * m_fStep;
+		fNew = (std::max)(m_fMinScale, (std::min)(fNew, m_fMaxScale));
+		if (fNew != m_fScale)
+		{
+			m_fScale = fNew;
+			m_nSettle = m_nSettleFrames;
+		}
+		return m_fScale;
+	}
+
+	float Scale() { return m_fScale; }
+	float SmoothedFrameTime() { return m_fSmoothed; }
+
+	// A full size dimension at the current scale
+	int ScaledSize(int nFull)
+	{
+		return (std::max)(1, (std::min)(nFull, (int)((float)nFull * m_fScale + 0.5f)));
+	}
+
+	// Nearest neighbour stretch of a w*h grid of cells to a larger (or equal) one.
+	// nDstPitch is the distance between destination rows, for drawing into part of a
+	// wider grid, 0 means the rows are packed
+	template<typename T>
+	static void Upscale(const T* pSrc, int nSrcWidth, int nSrcHeight, T* pDst, int nDstWidth, int nDstHeight, int nDstPitch = 0)
+	{
+		if (nDstPitch == 0)
+			nDstPitch = nDstWidth;
+
+		if (nSrcWidth == nDstWidth && nSrcHeight == nDstHeight)
+		{
+			if (nDstPitch == nDstWidth)
+				std::memcpy(pDst, pSrc, sizeof(T) * nDstWidth * nDstHeight);
+			else
+				for (int y = 0; y < nDstHeight; y++)
+					std::memcpy(pDst + (size_t)y * nDstPitch, pSrc + (size_t)y * nSrcWidth, sizeof(T) * nDstWidth);
+			return;
+		}
+
+		// 16.16 fixed point steps through the source
+		uint32_t nStepX = ((uint32_t)nSrcWidth << 16) / (uint32_t)nDstWidth;
+		int nLastRow = -1;
+		for (int y = 0; y < nDstHeight; y++)
+		{
+			T* pRow = pDst + (size_t)y * nDstPitch;
+			int sy = (int)(((int64_t)y * nSrcHeight) / nDstHeight);
+
+			// Consecutive rows from the same source row are straight copies
+			if (sy == nLastRow)
+			{
+				std::memcpy(pRow, pRow - nDstPitch, sizeof(T) * nDstWidth);
+				continue;
+			}
+			nLastRow = sy;
+
+			const T* pSrcRow = pSrc + (size_t)sy * nSrcWidth;
+			uint32_t sx = 0;
+			for (int x = 0; x < nDstWidth; x++, sx += nStepX)
+				pRow[x] = pSrcRow[sx >> 16];
+		}
+	}
+
+private:
+	float m_fTarget = 1.0f / 60.0f;
+	float m_fMinScale = 0.25f;
+	float m_fMaxScale = 1.0f;
+	float m_fSmoothing = 0.1f;
+	float m_fDeadBand = 0.1f;
+	float m_fStep = 0.05f;
+	int m_nSettleFrames = 10;
+
+	float m_fScale = 1.0f;
+	float m_fSmoothed = 0.0f;
+	int m_nSettle = 10;
+};
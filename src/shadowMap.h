@@ -0,0 +1,203 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// Depth of the scene as seen from a directional light, for telling which surfaces
+// have something between them and the light. The map is an orthographic window
+// across the light's beam: Fit() says which part of the world it has to cover, and
+// triangles are rasterized into it storing their distance along the light, nearest
+// kept. A point is in shadow when the map holds something nearer the light than it.
+//
+// Drawing the map is the expensive part, so it is kept from frame to frame and only
+// drawn again when the light turns, when the geometry moves (the caller says so with
+// Invalidate()) or when Fit() moves the window. Fit() covers more than it is asked
+// to and snaps the window to a coarse grid, so a camera wandering around inside it
+// doesn't start a redraw every frame, and a frame that reuses the map only pays for
+// the lookups.
+class shadowMap
+{
+public:
+	shadowMap()
+	{
+
+	}
+
+	// nSize x nSize texels, the only allocation the map makes
+	void Create(int nSize)
+	{
+		m_nSize = nSize;
+		m_vecDepth.assign((size_t)nSize * nSize, FLT_MAX);
+		m_bValid = false;
+	}
+
+	// Unit vector pointing towards the light
+	void SetLightDirection(float x, float y, float z)
+	{
+		if (x == m_vToLight[0] && y == m_vToLight[1] && z == m_vToLight[2])
+			return;
+		m_vToLight[0] = x; m_vToLight[1] = y; m_vToLight[2] = z;
+
+		// Light travels along forward, any right and up across it will do
+		m_vForward[0] = -x; m_vForward[1] = -y; m_vForward[2] = -z;
+		float vRef[3] = { 0.0f, 1.0f, 0.0f };
+		if (fabsf(y) > 0.99f)
+		{
+			vRef[1] = 0.0f;
+			vRef[2] = 1.0f;
+		}
+		Cross(vRef, m_vForward, m_vRight);
+		Normalise(m_vRight);
+		Cross(m_vForward, m_vRight, m_vUp);
+
+		// The window's centre was in the old light space
+		m_fFitRadius = 0.0f;
+		m_bValid = false;
+	}
+
+	// World space sphere the map must cover. The window is half as big again and its
+	// centre sits on a grid of a quarter of the radius, so it only moves once the
+	// sphere has travelled that far
+	void Fit(float x, float y, float z, float fRadius)
+	{
+		float p[3] = { x, y, z };
+		float fStep = fRadius * 0.25f;
+		float fCentreX = roundf(Dot(p, m_vRight) / fStep) * fStep;
+		float fCentreY = roundf(Dot(p, m_vUp) / fStep) * fStep;
+		if (fRadius == m_fFitRadius && fCentreX == m_fCentreX && fCentreY == m_fCentreY)
+			return;
+
+		m_fFitRadius = fRadius;
+		m_fCentreX = fCentreX;
+		m_fCentreY = fCentreY;
+		m_fHalfSize = fRadius * 1.5f;
+		m_bValid = false;
+	}
+
+	// Whatever was drawn into the map has moved
+	void Invalidate() { m_bValid = false; }
+
+	bool NeedsRender() { return !m_bValid; }
+
+	// Start of a redraw, every texel back to nothing in the way
+	void BeginRender()
+	{
+		std::fill(m_vecDepth.begin(), m_vecDepth.end(), FLT_MAX);
+	}
+
+	// World space point to texel x, texel y and distance along the light
+	void ToLightSpace(const float* p, float* pOut)
+	{
+		float fTexelsPerUnit = (float)m_nSize / (2.0f * m_fHalfSize);
+		pOut[0] = (Dot(p, m_vRight) - m_fCentreX + m_fHalfSize) * fTexelsPerUnit;
+		pOut[1] = (m_fCentreY + m_fHalfSize - Dot(p, m_vUp)) * fTexelsPerUnit;
+		pOut[2] = Dot(p, m_vForward);
+	}
+
+	// Triangle already through ToLightSpace(), both windings are drawn. Only rows
+	// nRowMin..nRowMax-1 are touched, so bands of the map can be drawn on separate
+	// threads from the same triangles
+	void RasterizeTriangle(const float* a, const float* b, const float* c, int nRowMin, int nRowMax)
+	{
+		float fArea = (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+		if (fArea == 0.0f)
+			return;
+
+		// Make winding consistent so all edge functions are positive inside
+		if (fArea < 0.0f)
+		{
+			std::swap(b, c);
+			fArea = -fArea;
+		}
+		float fInvArea = 1.0f / fArea;
+
+		int minx = (std::max)(0, (int)floorf((std::min)(a[0], (std::min)(b[0], c[0]))));
+		int maxx = (std::min)(m_nSize - 1, (int)ceilf((std::max)(a[0], (std::max)(b[0], c[0]))));
+		int miny = (std::max)(nRowMin, (int)floorf((std::min)(a[1], (std::min)(b[1], c[1]))));
+		int maxy = (std::min)(nRowMax - 1, (int)ceilf((std::max)(a[1], (std::max)(b[1], c[1]))));
+
+		for (int y = miny; y <= maxy; y++)
+		{
+			float py = (float)y + 0.5f;
+			float* pRow = &m_vecDepth[(size_t)y * m_nSize];
+			for (int x = minx; x <= maxx; x++)
+			{
+				float px = (float)x + 0.5f;
+				float e1 = (c[0] - b[0]) * (py - b[1]) - (c[1] - b[1]) * (px - b[0]);
+				float e2 = (a[0] - c[0]) * (py - c[1]) - (a[1] - c[1]) * (px - c[0]);
+				float e3 = (b[0] - a[0]) * (py - a[1]) - (b[1] - a[1]) * (px - a[0]);
+				if (e1 >= 0.0f && e2 >= 0.0f && e3 >= 0.0f)
+				{
+					// Edge functions are the weights of the opposite corners
+					float fDepth = (e1 * a[2] + e2 * b[2] + e3 * c[2]) * fInvArea;
+					if (fDepth < pRow[x])
+						pRow[x] = fDepth;
+				}
+			}
+		}
+	}
+
+	// Redraw finished, the map stands until something invalidates it
+	void EndRender() { m_bValid = true; }
+
+	// How much light reaches a world space point on a surface facing n, from 0 in
+	// shadow to 1, blended over the 2x2 texels around it. The point is pushed off the
+	// surface by a texel or so first, so the surface doesn't shadow itself. -1 if the
+	// point is outside the window, so a wider map can be asked instead
+	float Lookup(float x, float y, float z, float nx, float ny, float nz)
+	{
+		float fTexel = 2.0f * m_fHalfSize / (float)m_nSize;
+		float p[3] = { x + nx * fTexel * 1.5f, y + ny * fTexel * 1.5f, z + nz * fTexel * 1.5f };
+		float l[3];
+		ToLightSpace(p, l);
+
+		float fx = l[0] - 0.5f, fy = l[1] - 0.5f;
+		int x0 = (int)floorf(fx), y0 = (int)floorf(fy);
+		if (x0 < 0 || y0 < 0 || x0 + 1 >= m_nSize || y0 + 1 >= m_nSize)
+			return -1.0f;
+
+		float fBiasedDepth = l[2] - fTexel;
+		const float* pRow0 = &m_vecDepth[(size_t)y0 * m_nSize + x0];
+		const float* pRow1 = pRow0 + m_nSize;
+		float wx = fx - (float)x0, wy = fy - (float)y0;
+		float fTop = (pRow0[0] >= fBiasedDepth ? 1.0f - wx : 0.0f) + (pRow0[1] >= fBiasedDepth ? wx : 0.0f);
+		float fBottom = (pRow1[0] >= fBiasedDepth ? 1.0f - wx : 0.0f) + (pRow1[1] >= fBiasedDepth ? wx : 0.0f);
+		return fTop + (fBottom - fTop) * wy;
+	}
+
+	int Size() { return m_nSize; }
+
+private:
+	static float Dot(const float* a, const float* b) { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]; }
+
+	static void Cross(const float* a, const float* b, float* pOut)
+	{
+		pOut[0] = a[1] * b[2] - a[2] * b[1];
+		pOut[1] = a[2] * b[0] - a[0] * b[2];
+		pOut[2] = a[0] * b[1] - a[1] * b[0];
+	}
+
+	static void Normalise(float* v)
+	{
+		float l = sqrtf(Dot(v, v));
+		v[0] /= l; v[1] /= l; v[2] /= l;
+	}
+
+	int m_nSize = 0;
+	std::vector<float> m_vecDepth;	// Distance along the light of the nearest thing in each texel
+	bool m_bValid = false;
+
+	// Light space, forward is the way the light travels
+	float m_vToLight[3] = { 0.0f, 0.0f, 0.0f };
+	float m_vForward[3] = { 0.0f, 0.0f, 1.0f };
+	float m_vRight[3] = { 1.0f, 0.0f, 0.0f };
+	float m_vUp[3] = { 0.0f, 1.0f, 0.0f };
+
+	// Window in light space right/up
+	float m_fFitRadius = 0.0f;
+	float m_fCentreX = 0.0f;
+	float m_fCentreY = 0.0f;
+	float m_fHalfSize = 1.0f;
+};
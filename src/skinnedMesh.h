@@ -0,0 +1,333 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+
+// Animated vertex positions for a mesh. Two kinds of animation are combined, in
+// this order:
+//
+//  - Vertex keyframes, whole copies of the vertex positions. A pose is a blend of
+//    two of them, keyframe 0 is the rest pose.
+//  - Linear blend skinning. Every vertex follows up to 4 bones, and ends up at the
+//    weighted sum of where each bone's matrix would put it.
+//
+// Everything per vertex is kept structure-of-arrays, all the x, then all the y and
+// so on, with the bone indices and weights split the same way by influence, so the
+// kernel in Skin() is the same few multiply-adds down straight runs of memory.
+// Ranges of vertices are independent, so a big mesh or many instances of one can
+// be split across threads.
+//
+// Bones make a hierarchy, parents before children, each turning about an axis
+// through a pivot. Bone matrices are 3x4, row major, and take a rest pose position
+// straight to its animated one, so the rest pose is every bone at identity and
+// there are no inverse bind matrices to keep. A clip of keyframes, looped, gives
+// the angle of every bone and the vertex keyframe blend at any time.
+class skinnedMesh
+{
+public:
+	static const int nMaxInfluences = 4;
+
+	// Which two vertex keyframes to blend, and how far from the first to the second
+	struct sVertexBlend
+	{
+		int nKeyA = 0;
+		int nKeyB = 0;
+		float fBlend = 0.0f;
+	};
+
+	skinnedMesh()
+	{
+
+	}
+
+	// Rest pose of nVertices, all at the origin, no bones and an empty clip
+	void Create(int nVertices)
+	{
+		m_nVertices = nVertices;
+		m_nVertexKeyframes = 1;
+		m_vecX.assign(nVertices, 0.0f);
+		m_vecY.assign(nVertices, 0.0f);
+		m_vecZ.assign(nVertices, 0.0f);
+		for (int i = 0; i < nMaxInfluences; i++)
+		{
+			m_vecBone[i].assign(nVertices, 0);
+			m_vecWeight[i].assign(nVertices, i == 0 ? 1.0f : 0.0f);
+		}
+		m_vecBones.clear();
+		m_vecBoneKeys.clear();
+		m_vecVertexKeys.clear();
+		m_fDuration = 0.0f;
+	}
+
+	int VertexCount() { return m_nVertices; }
+	int BoneCount() { return (int)m_vecBones.size(); }
+	int VertexKeyframeCount() { return m_nVertexKeyframes; }
+	float Duration() { return m_fDuration; }
+
+	// Positions of vertex keyframe k, nVertices of each
+	float* KeyframeX(int k) { return &m_vecX[(size_t)k * m_nVertices]; }
+	float* KeyframeY(int k) { return &m_vecY[(size_t)k * m_nVertices]; }
+	float* KeyframeZ(int k) { return &m_vecZ[(size_t)k * m_nVertices]; }
+
+	// New vertex keyframe, starting as a copy of the rest pose, returns its number
+	int AddVertexKeyframe()
+	{
+		for (std::vector<float>* p : { &m_vecX, &m_vecY, &m_vecZ })
+		{
+			p->resize((size_t)(m_nVertexKeyframes + 1) * m_nVertices);
+			std::copy(p->begin(), p->begin() + m_nVertices, p->end() - m_nVertices);
+		}
+		return m_nVertexKeyframes++;
+	}
+
+	// Returns the new bone's number, nParent is -1 for a root and must already exist
+	int AddBone(int nParent, float fPivotX, float fPivotY, float fPivotZ, float fAxisX, float fAxisY, float fAxisZ)
+	{
+		float l = sqrtf(fAxisX * fAxisX + fAxisY * fAxisY + fAxisZ * fAxisZ);
+		m_vecBones.push_back({ nParent, { fPivotX, fPivotY, fPivotZ }, { fAxisX / l, fAxisY / l, fAxisZ / l } });
+		return (int)m_vecBones.size() - 1;
+	}
+
+	// Influence i (0 to 3) of vertex v
+	void SetInfluence(int v, int i, int nBone, float fWeight)
+	{
+		m_vecBone[i][v] = (uint16_t)nBone;
+		m_vecWeight[i][v] = fWeight;
+	}
+
+	// Scales every vertex's weights to add up to 1
+	void NormaliseWeights()
+	{
+		for (int v = 0; v < m_nVertices; v++)
+		{
+			float fTotal = 0.0f;
+			for (int i = 0; i < nMaxInfluences; i++)
+				fTotal += m_vecWeight[i][v];
+			if (fTotal <= 0.0f)
+			{
+				m_vecWeight[0][v] = 1.0f;
+				continue;
+			}
+			for (int i = 0; i < nMaxInfluences; i++)
+				m_vecWeight[i][v] /= fTotal;
+		}
+	}
+
+	// Chain of nBones along the longest axis of the rest pose, each bending about the
+	// axis after it. Every vertex is weighted by a cubic B-spline over the bones
+	// around it, which is where the 4 influences come from and keeps the bend smooth
+	void RigAsChain(int nBones)
+	{
+		float fMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, fMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		const float* pAxis[3] = { KeyframeX(0), KeyframeY(0), KeyframeZ(0) };
+		for (int a = 0; a < 3; a++)
+			for (int v = 0; v < m_nVertices; v++)
+			{
+				fMin[a] = (std::min)(fMin[a], pAxis[a][v]);
+				fMax[a] = (std::max)(fMax[a], pAxis[a][v]);
+			}
+
+		int nLong = 0;
+		for (int a = 1; a < 3; a++)
+			if (fMax[a] - fMin[a] > fMax[nLong] - fMin[nLong])
+				nLong = a;
+		int nBend = (nLong + 1) % 3;
+		float fLength = (std::max)(fMax[nLong] - fMin[nLong], 1e-6f);
+
+		m_vecBones.clear();
+		for (int b = 0; b < nBones; b++)
+		{
+			float vPivot[3] = { (fMin[0] + fMax[0]) * 0.5f, (fMin[1] + fMax[1]) * 0.5f, (fMin[2] + fMax[2]) * 0.5f };
+			vPivot[nLong] = fMin[nLong] + fLength * (float)b / (float)nBones;
+			float vAxis[3] = { 0.0f, 0.0f, 0.0f };
+			vAxis[nBend] = 1.0f;
+			AddBone(b - 1, vPivot[0], vPivot[1], vPivot[2], vAxis[0], vAxis[1], vAxis[2]);
+		}
+
+		for (int v = 0; v < m_nVertices; v++)
+		{
+			float u = (pAxis[nLong][v] - fMin[nLong]) / fLength * (float)nBones - 0.5f;
+			float fCell = floorf(u), f = u - fCell;
+			float w[4] =
+			{
+				(1.0f - f) * (1.0f - f) * (1.0f - f) / 6.0f,
+				(3.0f * f * f * f - 6.0f * f * f + 4.0f) / 6.0f,
+				(-3.0f * f * f * f + 3.0f * f * f + 3.0f * f + 1.0f) / 6.0f,
+				f * f * f / 6.0f,
+			};
+			for (int i = 0; i < nMaxInfluences; i++)
+				SetInfluence(v, i, (std::max)(0, (std::min)((int)fCell - 1 + i, nBones - 1)), w[i]);
+		}
+		NormaliseWeights();
+	}
+
+	// Clip keyframes, added in time order. Bone keys hold an angle in radians for
+	// every bone, vertex keys say which vertex keyframe is the pose at that time
+	void AddBoneKey(float fTime, const float* pAngles)
+	{
+		m_vecBoneKeys.push_back({ fTime, std::vector<float>(pAngles, pAngles + m_vecBones.size()) });
+		m_fDuration = (std::max)(m_fDuration, fTime);
+	}
+
+	void AddVertexKey(float fTime, int nKeyframe)
+	{
+		m_vecVertexKeys.push_back({ fTime, nKeyframe });
+		m_fDuration = (std::max)(m_fDuration, fTime);
+	}
+
+	// Bone matrices, 12 floats for each bone, and the vertex keyframe blend at fTime,
+	// which wraps around the clip. Keys are blended linearly
+	void Evaluate(float fTime, float* pBoneMatrices, sVertexBlend& blend)
+	{
+		float t = m_fDuration > 0.0f ? fTime - floorf(fTime / m_fDuration) * m_fDuration : 0.0f;
+
+		int nBoneKey = 0;
+		float fBoneBlend = 0.0f;
+		FindKeys(m_vecBoneKeys, t, nBoneKey, fBoneBlend);
+
+		for (size_t b = 0; b < m_vecBones.size(); b++)
+		{
+			float fAngle = 0.0f;
+			if (!m_vecBoneKeys.empty())
+			{
+				const std::vector<float>& a = m_vecBoneKeys[nBoneKey].vecAngles;
+				const std::vector<float>& c = m_vecBoneKeys[(std::min)(nBoneKey + 1, (int)m_vecBoneKeys.size() - 1)].vecAngles;
+				fAngle = a[b] + (c[b] - a[b]) * fBoneBlend;
+			}
+
+			// Turn about the pivot, then follow the parent
+			float mLocal[12];
+			const sBone& bone = m_vecBones[b];
+			RotationAbout(bone.vPivot, bone.vAxis, fAngle, mLocal);
+			float* m = pBoneMatrices + b * 12;
+			if (bone.nParent < 0)
+				std::copy(mLocal, mLocal + 12, m);
+			else
+				Multiply(pBoneMatrices + bone.nParent * 12, mLocal, m);
+		}
+
+		int nVertexKey = 0;
+		float fVertexBlend = 0.0f;
+		FindKeys(m_vecVertexKeys, t, nVertexKey, fVertexBlend);
+		if (m_vecVertexKeys.empty())
+			blend = sVertexBlend();
+		else
+		{
+			blend.nKeyA = m_vecVertexKeys[nVertexKey].nKeyframe;
+			blend.nKeyB = m_vecVertexKeys[(std::min)(nVertexKey + 1, (int)m_vecVertexKeys.size() - 1)].nKeyframe;
+			blend.fBlend = fVertexBlend;
+		}
+	}
+
+	// The kernel. Vertices nFrom..nTo-1 posed by the blend and bone matrices from
+	// Evaluate(), written to pOutX/Y/Z at the same positions
+	void Skin(const float* pBoneMatrices, const sVertexBlend& blend, int nFrom, int nTo, float* pOutX, float* pOutY, float* pOutZ)
+	{
+		const float* pAX = KeyframeX(blend.nKeyA);
+		const float* pAY = KeyframeY(blend.nKeyA);
+		const float* pAZ = KeyframeZ(blend.nKeyA);
+		const float* pBX = KeyframeX(blend.nKeyB);
+		const float* pBY = KeyframeY(blend.nKeyB);
+		const float* pBZ = KeyframeZ(blend.nKeyB);
+		float t = blend.fBlend;
+
+		for (int v = nFrom; v < nTo; v++)
+		{
+			float x = pAX[v] + (pBX[v] - pAX[v]) * t;
+			float y = pAY[v] + (pBY[v] - pAY[v]) * t;
+			float z = pAZ[v] + (pBZ[v] - pAZ[v]) * t;
+
+			float ox = 0.0f, oy = 0.0f, oz = 0.0f;
+			for (int i = 0; i < nMaxInfluences; i++)
+			{
+				const float* m = pBoneMatrices + (size_t)m_vecBone[i][v] * 12;
+				float w = m_vecWeight[i][v];
+				ox += w * (m[0] * x + m[1] * y + m[2] * z + m[3]);
+				oy += w * (m[4] * x + m[5] * y + m[6] * z + m[7]);
+				oz += w * (m[8] * x + m[9] * y + m[10] * z + m[11]);
+			}
+			pOutX[v] = ox;
+			pOutY[v] = oy;
+			pOutZ[v] = oz;
+		}
+	}
+
+private:
+	struct sBone
+	{
+		int nParent;
+		float vPivot[3];
+		float vAxis[3];
+	};
+
+	struct sBoneKey
+	{
+		float fTime;
+		std::vector<float> vecAngles;
+	};
+
+	struct sVertexKey
+	{
+		float fTime;
+		int nKeyframe;
+	};
+
+	// Last key at or before t, and how far t is towards the one after it
+	template<typename KEY>
+	static void FindKeys(const std::vector<KEY>& vecKeys, float t, int& nKey, float& fBlend)
+	{
+		nKey = 0;
+		fBlend = 0.0f;
+		while (nKey + 1 < (int)vecKeys.size() && vecKeys[nKey + 1].fTime <= t)
+			nKey++;
+		if (nKey + 1 < (int)vecKeys.size())
+		{
+			float fSpan = vecKeys[nKey + 1].fTime - vecKeys[nKey].fTime;
+			fBlend = fSpan > 0.0f ? (std::max)(0.0f, (t - vecKeys[nKey].fTime) / fSpan) : 0.0f;
+		}
+	}
+
+	// Rotation by fAngle about a unit axis through a pivot, as a 3x4 matrix
+	static void RotationAbout(const float* p, const float* a, float fAngle, float* m)
+	{
+		float c = cosf(fAngle), s = sinf(fAngle), k = 1.0f - c;
+		float r[9] =
+		{
+			c + a[0] * a[0] * k,		a[0] * a[1] * k - a[2] * s,	a[0] * a[2] * k + a[1] * s,
+			a[1] * a[0] * k + a[2] * s,	c + a[1] * a[1] * k,		a[1] * a[2] * k - a[0] * s,
+			a[2] * a[0] * k - a[1] * s,	a[2] * a[1] * k + a[0] * s,	c + a[2] * a[2] * k,
+		};
+		for (int row = 0; row < 3; row++)
+		{
+			m[row * 4 + 0] = r[row * 3 + 0];
+			m[row * 4 + 1] = r[row * 3 + 1];
+			m[row * 4 + 2] = r[row * 3 + 2];
+			m[row * 4 + 3] = p[row] - (r[row * 3 + 0] * p[0] + r[row * 3 + 1] * p[1] + r[row * 3 + 2] * p[2]);
+		}
+	}
+
+	// a * b, both 3x4 with an implied 0 0 0 1 bottom row
+	static void Multiply(const float* a, const float* b, float* m)
+	{
+		for (int row = 0; row < 3; row++)
+		{
+			for (int col = 0; col < 4; col++)
+				m[row * 4 + col] = a[row * 4 + 0] * b[col] + a[row * 4 + 1] * b[4 + col] + a[row * 4 + 2] * b[8 + col];
+			m[row * 4 + 3] += a[row * 4 + 3];
+		}
+	}
+
+	int m_nVertices = 0;
+	int m_nVertexKeyframes = 0;
+	std::vector<float> m_vecX, m_vecY, m_vecZ;		// m_nVertices per vertex keyframe, one after another
+	std::vector<uint16_t> m_vecBone[nMaxInfluences];
+	std::vector<float> m_vecWeight[nMaxInfluences];
+
+	std::vector<sBone> m_vecBones;
+	std::vector<sBoneKey> m_vecBoneKeys;
+	std::vector<sVertexKey> m_vecVertexKeys;
+	float m_fDuration = 0.0f;
+};
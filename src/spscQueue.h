@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Fixed capacity, lock-free queue for exactly one producer thread and one consumer
+// thread. Each side only ever writes its own index, so a push and a pop can run at
+// the same time without a mutex. Nothing is allocated after construction, which
+// makes it safe to drain from the audio thread.
+//
+// nCapacity must be a power of two, one slot is always left empty to tell a full
+// queue from an empty one.
+template<typename T, size_t nCapacity>
+class spscQueue
+{
+	static_assert((nCapacity & (nCapacity - 1)) == 0, "spscQueue capacity must be a power of two");
+
+public:
+	spscQueue()
+	{
+
+	}
+
+	spscQueue(const spscQueue&) = delete;
+	spscQueue& operator=(const spscQueue&) = delete;
+
+	// Producer side, false if the queue is full
+	bool Push(const T& item)
+	{
+		size_t nHead = m_nHead.load(std::memory_order_relaxed);
+		size_t nNext = (nHead + 1) & (nCapacity - 1);
+		if (nNext == m_nTail.load(std::memory_order_acquire))
+			return false;
+
+		m_items[nHead] = item;
+		m_nHead.store(nNext, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side, false if the queue is empty
+	bool Pop(T& item)
+	{
+		size_t nTail = m_nTail.load(std::memory_order_relaxed);
+		if (nTail == m_nHead.load(std::memory_order_acquire))
+			return false;
+
+		item = m_items[nTail];
+		m_nTail.store((nTail + 1) & (nCapacity - 1), std::memory_order_release);
+		return true;
+	}
+
+	bool Empty()
+	{
+		return m_nTail.load(std::memory_order_acquire) == m_nHead.load(std::memory_order_acquire);
+	}
+
+private:
+	T m_items[nCapacity];
+
+	// Kept on separate cache lines so the two threads don't fight over one
+	alignas(64) std::atomic<size_t> m_nHead = 0;
+	alignas(64) std::atomic<size_t> m_nTail = 0;
+};
@@ -0,0 +1,250 @@
+#pragma once
+
+#include "fileIO.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Records when each thread was busy with what, and writes it out as Chrome trace
+// JSON, which chrome://tracing and ui.perfetto.dev both open as a timeline. Where
+// the frame time counters only say a frame was slow, the timeline shows which
+// thread was waiting on which.
+//
+// Every thread that records gets its own slice of one buffer allocated by Start(),
+// and only that thread ever writes to it, so recording an event is a couple of
+// stores and no locks. A thread whose slice is full drops further events rather
+// than stalling; DroppedEvents() says how many.
+//
+// Event names are not copied, they must be string literals or otherwise outlive
+// the recorder.
+class traceRecorder
+{
+public:
+	static const int nMaxThreads = 32;
+
+	traceRecorder()
+	{
+
+	}
+
+	traceRecorder(const traceRecorder&) = delete;
+	traceRecorder& operator=(const traceRecorder&) = delete;
+
+	// Don't call while another thread might still be inside Record()
+	void Start(int nEventsPerThread = 16384)
+	{
+		m_bRecording = false;
+		if (nEventsPerThread != m_nEventsPerThread)
+		{
+			m_events.reset(new sEvent[(size_t)nEventsPerThread * nMaxThreads]);
+			m_nEventsPerThread = nEventsPerThread;
+		}
+
+		for (int t = 0; t < nMaxThreads; t++)
+		{
+			m_threads[t].nCount.store(0, std::memory_order_relaxed);
+			m_threads[t].sName = nullptr;
+		}
+		m_nThreads = 0;
+		m_nDropped = 0;
+		m_nGeneration.store(m_nGeneration.load() + 1);
+		m_nOrigin = Now();
+		m_bRecording.store(true, std::memory_order_release);
+	}
+
+	void Stop()
+	{
+		m_bRecording.store(false, std::memory_order_release);
+	}
+
+	bool IsRecording()
+	{
+		return m_bRecording.load(std::memory_order_acquire);
+	}
+
+	unsigned int DroppedEvents() { return m_nDropped; }
+
+	// Names the calling thread in the timeline, can be called before Start()
+	static void SetThreadName(const char* sName)
+	{
+		ThisThreadSlot().sName = sName;
+	}
+
+	static int64_t Now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// Something the calling thread spent from nStart to nEnd doing, times from Now()
+	void Record(const char* sName, int64_t nStart, int64_t nEnd)
+	{
+		if (!IsRecording())
+			return;
+
+		sThread* pThread = ThisThread();
+		if (pThread == nullptr)
+		{
+			m_nDropped++;
+			return;
+		}
+
+		// Only this thread writes its slice, the count is published last so
+		// Write() never sees a half written event
+		int n = pThread->nCount.load(std::memory_order_relaxed);
+		if (n == m_nEventsPerThread)
+		{
+			m_nDropped++;
+			return;
+		}
+		sEvent& e = pThread->pEvents[n];
+		e.sName = sName;
+		e.nStart = nStart;
+		e.nEnd = nEnd;
+		pThread->nCount.store(n + 1, std::memory_order_release);
+	}
+
+	// Writes everything recorded so far, the recorder should be stopped first
+	bool Write(const std::wstring& sFile)
+	{
+		std::FILE* f = fileIO::OpenFile(sFile, L"w");
+		if (f == nullptr)
+			return false;
+
+		std::fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+		bool bFirst = true;
+		int nThreads = (std::min)(m_nThreads.load(), (int)nMaxThreads);
+		for (int t = 0; t < nThreads; t++)
+		{
+			sThread& thread = m_threads[t];
+			std::fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"", bFirst ? "" : ",\n", t);
+			WriteString(f, thread.sName != nullptr ? thread.sName : "Thread");
+			std::fprintf(f, "\"}}");
+			bFirst = false;
+
+			int nCount = thread.nCount.load(std::memory_order_acquire);
+			for (int i = 0; i < nCount; i++)
+			{
+				sEvent& e = thread.pEvents[i];
+				std::fprintf(f, ",\n{\"name\":\"");
+				WriteString(f, e.sName);
+				std::fprintf(f, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+					t, (double)(e.nStart - m_nOrigin) / 1000.0, (double)(e.nEnd - e.nStart) / 1000.0);
+			}
+		}
+		std::fprintf(f, "\n]}\n");
+		return std::fclose(f) == 0;
+	}
+
+private:
+	struct sEvent
+	{
+		const char* sName = nullptr;
+		int64_t nStart = 0;
+		int64_t nEnd = 0;
+	};
+
+	struct sThread
+	{
+		std::atomic<int> nCount = 0;
+		sEvent* pEvents = nullptr;
+		const char* sName = nullptr;
+	};
+
+	// The calling thread's slice, claimed the first time it records after Start()
+	sThread* ThisThread()
+	{
+		sThreadSlot& slot = ThisThreadSlot();
+		unsigned int nGeneration = m_nGeneration.load(std::memory_order_relaxed);
+		if (slot.pOwner == this && slot.nGeneration == nGeneration)
+			return slot.pThread;
+
+		int t = m_nThreads.fetch_add(1);
+		sThread* pThread = nullptr;
+		if (t < nMaxThreads)
+		{
+			pThread = &m_threads[t];
+			pThread->pEvents = &m_events[(size_t)t * m_nEventsPerThread];
+			pThread->sName = slot.sName;
+		}
+
+		slot.pOwner = this;
+		slot.nGeneration = nGeneration;
+		slot.pThread = pThread;
+		return pThread;
+	}
+
+	static void WriteString(std::FILE* f, const char* s)
+	{
+		for (; *s != 0; s++)
+		{
+			if (*s == '"' || *s == '\\')
+				std::fputc('\\', f);
+			if ((unsigned char)*s >= 0x20)
+				std::fputc(*s, f);
+		}
+	}
+
+	std::atomic<bool> m_bRecording = false;
+	std::unique_ptr<sEvent[]> m_events;
+	int m_nEventsPerThread = 0;
+	sThread m_threads[nMaxThreads];
+	std::atomic<int> m_nThreads = 0;
+	std::atomic<unsigned int> m_nDropped = 0;
+	std::atomic<unsigned int> m_nGeneration = 0;	// Bumped by Start() so threads claim a fresh slice
+	int64_t m_nOrigin = 0;
+
+	// The calling thread's name and the slice it last claimed, kept in a function so
+	// every translation unit that includes this shares the one thread_local
+	struct sThreadSlot
+	{
+		traceRecorder* pOwner;
+		unsigned int nGeneration;
+		sThread* pThread;
+		const char* sName;
+	};
+
+	static sThreadSlot& ThisThreadSlot()
+	{
+		static thread_local sThreadSlot slot = { nullptr, 0, nullptr, nullptr };
+		return slot;
+	}
+};
+
+// Records the time between its construction and destruction as one event
+//
+//		{ traceScope scope(Trace(), "Sort"); ... }
+class traceScope
+{
+public:
+	traceScope(traceRecorder& trace, const char* sName)
+		: m_trace(trace), m_sName(sName)
+	{
+		m_nStart = trace.IsRecording() ? traceRecorder::Now() : 0;
+	}
+
+	~traceScope()
+	{
+		End();
+	}
+
+	// Ends the event early, for stages that don't have a block of their own
+	void End()
+	{
+		if (m_nStart != 0)
+			m_trace.Record(m_sName, m_nStart, traceRecorder::Now());
+		m_nStart = 0;
+	}
+
+	traceScope(const traceScope&) = delete;
+	traceScope& operator=(const traceScope&) = delete;
+
+private:
+	traceRecorder& m_trace;
+	const char* m_sName;
+	int64_t m_nStart;
+};
@@ -0,0 +1,303 @@
+#pragma once
+
+#include "compactMesh.h"
+
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// Uniform grid over the x/z footprint of a compactMesh for collision queries.
+// Every triangle is listed in each cell its x/z bounds overlap, stored as one flat
+// index array with a start offset per cell, so a query reads a couple of short
+// contiguous runs. Columns suit terrain well: a height lookup is one cell and a
+// small sphere a few, whatever the size of the mesh. Triangles are decoded from the
+// mesh as they are tested rather than copied, so the mesh must stay where it is for
+// as long as the grid is used.
+class triSpatialHash
+{
+public:
+	triSpatialHash()
+	{
+
+	}
+
+	// fTrisPerCell sets the cell size from the average triangle density
+	void Build(const compactMesh& mesh, float fTrisPerCell = 4.0f)
+	{
+		int nTris = mesh.TriangleCount();
+		m_pMesh = &mesh;
+		m_vecCellStart.clear();
+		m_vecCellTris.clear();
+		if (nTris == 0)
+			return;
+
+		m_fMinX = m_fMinZ = FLT_MAX;
+		float fMaxX = -FLT_MAX, fMaxZ = -FLT_MAX;
+		for (int i = 0; i < nTris; i++)
+		{
+			sTri t = DecodeTri(i);
+			for (int v = 0; v < 3; v++)
+			{
+				m_fMinX = (std::min)(m_fMinX, t.p[v][0]); fMaxX = (std::max)(fMaxX, t.p[v][0]);
+				m_fMinZ = (std::min)(m_fMinZ, t.p[v][2]); fMaxZ = (std::max)(fMaxZ, t.p[v][2]);
+			}
+		}
+
+		float fArea = (std::max)(fMaxX - m_fMinX, 1e-3f) * (std::max)(fMaxZ - m_fMinZ, 1e-3f);
+		m_fCellSize = sqrtf(fArea * fTrisPerCell / (float)nTris);
+		m_nCellsX = (std::min)(1024, (int)((fMaxX - m_fMinX) / m_fCellSize) + 1);
+		m_nCellsZ = (std::min)(1024, (int)((fMaxZ - m_fMinZ) / m_fCellSize) + 1);
+		m_fCellSize = (std::max)((fMaxX - m_fMinX) / (float)m_nCellsX, (fMaxZ - m_fMinZ) / (float)m_nCellsZ) * 1.0001f;
+		if (m_fCellSize <= 0.0f)
+			m_fCellSize = 1.0f;
+
+		// Two passes, count then fill, so cells end up packed in one array
+		m_vecCellStart.assign(m_nCellsX * m_nCellsZ + 1, 0);
+		for (int pass = 0; pass < 2; pass++)
+		{
+			std::vector<int> vecCursor;
+			if (pass == 1)
+			{
+				for (int c = 0; c < m_nCellsX * m_nCellsZ; c++)
+					m_vecCellStart[c + 1] += m_vecCellStart[c];
+				m_vecCellTris.resize(m_vecCellStart.back());
+				vecCursor.assign(m_vecCellStart.begin(), m_vecCellStart.end() - 1);
+			}
+
+			for (int i = 0; i < nTris; i++)
+			{
+				sTri t = DecodeTri(i);
+				int x0, z0, x1, z1;
+				CellRange((std::min)(t.p[0][0], (std::min)(t.p[1][0], t.p[2][0])), (std::min)(t.p[0][2], (std::min)(t.p[1][2], t.p[2][2])),
+					(std::max)(t.p[0][0], (std::max)(t.p[1][0], t.p[2][0])), (std::max)(t.p[0][2], (std::max)(t.p[1][2], t.p[2][2])), x0, z0, x1, z1);
+				for (int z = z0; z <= z1; z++)
+					for (int x = x0; x <= x1; x++)
+					{
+						if (pass == 0)
+							m_vecCellStart[z * m_nCellsX + x + 1]++;
+						else
+							m_vecCellTris[vecCursor[z * m_nCellsX + x]++] = i;
+					}
+			}
+		}
+	}
+
+	// Height of the highest surface at (x, z) that is no higher than fMaxY.
+	// Returns false if there's nothing underneath
+	bool GroundHeight(float x, float z, float& fHeight, float fMaxY = FLT_MAX)
+	{
+		m_nLastTrisTested = 0;
+		if (m_vecCellStart.empty())
+			return false;
+
+		int cx, cz, cx1, cz1;
+		CellRange(x, z, x, z, cx, cz, cx1, cz1);
+		if (cx1 < cx || cz1 < cz)
+			return false;
+
+		bool bFound = false;
+		int nCell = cz * m_nCellsX + cx;
+		for (int i = m_vecCellStart[nCell]; i < m_vecCellStart[nCell + 1]; i++)
+		{
+			sTri t = DecodeTri(m_vecCellTris[i]);
+			m_nLastTrisTested++;
+
+			// Barycentrics of (x, z) in the triangle's x/z projection
+			float d = (t.p[1][2] - t.p[2][2]) * (t.p[0][0] - t.p[2][0]) + (t.p[2][0] - t.p[1][0]) * (t.p[0][2] - t.p[2][2]);
+			if (fabsf(d) < 1e-12f)
+				continue;
+			float a = ((t.p[1][2] - t.p[2][2]) * (x - t.p[2][0]) + (t.p[2][0] - t.p[1][0]) * (z - t.p[2][2])) / d;
+			float b = ((t.p[2][2] - t.p[0][2]) * (x - t.p[2][0]) + (t.p[0][0] - t.p[2][0]) * (z - t.p[2][2])) / d;
+			float c = 1.0f - a - b;
+			if (a < 0.0f || b < 0.0f || c < 0.0f)
+				continue;
+
+			float y = a * t.p[0][1] + b * t.p[1][1] + c * t.p[2][1];
+			if (y <= fMaxY && (!bFound || y > fHeight))
+			{
+				fHeight = y;
+				bFound = true;
+			}
+		}
+		return bFound;
+	}
+
+	// Pushes a sphere out of any triangles it overlaps. Centre is updated in place,
+	// returns true if there was a collision
+	bool ResolveSphere(float* vCentre, float fRadius, int nIterations = 4)
+	{
+		m_nLastTrisTested = 0;
+		if (m_vecCellStart.empty())
+			return false;
+
+		bool bCollided = false;
+		for (int it = 0; it < nIterations; it++)
+		{
+			int x0, z0, x1, z1;
+			CellRange(vCentre[0] - fRadius, vCentre[2] - fRadius, vCentre[0] + fRadius, vCentre[2] + fRadius, x0, z0, x1, z1);
+
+			// Deepest contact wins each iteration, then the sphere is moved and tested again
+			float fDeepest = 0.0f;
+			float vPush[3] = { 0.0f, 0.0f, 0.0f };
+			for (int z = z0; z <= z1; z++)
+			{
+				for (int x = x0; x <= x1; x++)
+				{
+					int nCell = z * m_nCellsX + x;
+					for (int i = m_vecCellStart[nCell]; i < m_vecCellStart[nCell + 1]; i++)
+					{
+						sTri t = DecodeTri(m_vecCellTris[i]);
+						m_nLastTrisTested++;
+
+						float q[3];
+						ClosestPointOnTriangle(vCentre, t, q);
+						float d[3] = { vCentre[0] - q[0], vCentre[1] - q[1], vCentre[2] - q[2] };
+						float fDist2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+						if (fDist2 >= fRadius * fRadius)
+							continue;
+
+						float fDist = sqrtf(fDist2);
+						float fDepth = fRadius - fDist;
+						if (fDepth <= fDeepest)
+							continue;
+
+						if (fDist > 1e-6f)
+						{
+							vPush[0] = d[0] / fDist; vPush[1] = d[1] / fDist; vPush[2] = d[2] / fDist;
+						}
+						else
+						{
+							// Centre is on the surface, use the face normal
+							float e1[3] = { t.p[1][0] - t.p[0][0], t.p[1][1] - t.p[0][1], t.p[1][2] - t.p[0][2] };
+							float e2[3] = { t.p[2][0] - t.p[0][0], t.p[2][1] - t.p[0][1], t.p[2][2] - t.p[0][2] };
+							float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+							float l = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+							if (l < 1e-12f)
+								continue;
+							vPush[0] = n[0] / l; vPush[1] = n[1] / l; vPush[2] = n[2] / l;
+						}
+						fDeepest = fDepth;
+					}
+				}
+			}
+
+			if (fDeepest <= 0.0f)
+				break;
+
+			vCentre[0] += vPush[0] * fDeepest;
+			vCentre[1] += vPush[1] * fDeepest;
+			vCentre[2] += vPush[2] * fDeepest;
+			bCollided = true;
+		}
+		return bCollided;
+	}
+
+	// How many triangles the most recent query looked at
+	int LastTrianglesTested() { return m_nLastTrisTested; }
+	int CellCount() { return m_nCellsX * m_nCellsZ; }
+
+	size_t MemoryBytes() const
+	{
+		return (m_vecCellStart.capacity() + m_vecCellTris.capacity()) * sizeof(int);
+	}
+
+private:
+	struct sPoint
+	{
+		float x, y, z;
+	};
+
+	struct sTri
+	{
+		float p[3][3];
+	};
+
+	sTri DecodeTri(int nTriangle) const
+	{
+		sPoint q[3];
+		m_pMesh->DecodePositions(nTriangle, q);
+		sTri t;
+		for (int v = 0; v < 3; v++)
+		{
+			t.p[v][0] = q[v].x;
+			t.p[v][1] = q[v].y;
+			t.p[v][2] = q[v].z;
+		}
+		return t;
+	}
+
+	void CellRange(float fMinX, float fMinZ, float fMaxX, float fMaxZ, int& x0, int& z0, int& x1, int& z1)
+	{
+		x0 = (std::max)(0, (int)floorf((fMinX - m_fMinX) / m_fCellSize));
+		z0 = (std::max)(0, (int)floorf((fMinZ - m_fMinZ) / m_fCellSize));
+		x1 = (std::min)(m_nCellsX - 1, (int)floorf((fMaxX - m_fMinX) / m_fCellSize));
+		z1 = (std::min)(m_nCellsZ - 1, (int)floorf((fMaxZ - m_fMinZ) / m_fCellSize));
+	}
+
+	// Real-Time Collision Detection, Ericson, 5.1.5
+	static void ClosestPointOnTriangle(const float* p, const sTri& t, float* out)
+	{
+		const float* a = t.p[0];
+		const float* b = t.p[1];
+		const float* c = t.p[2];
+		auto dot = [](const float* u, const float* v) { return u[0] * v[0] + u[1] * v[1] + u[2] * v[2]; };
+		auto set = [&](float wa, float wb, float wc)
+		{
+			for (int k = 0; k < 3; k++)
+				out[k] = a[k] * wa + b[k] * wb + c[k] * wc;
+		};
+
+		float ab[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+		float ac[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+		float ap[3] = { p[0] - a[0], p[1] - a[1], p[2] - a[2] };
+		float d1 = dot(ab, ap), d2 = dot(ac, ap);
+		if (d1 <= 0.0f && d2 <= 0.0f) { set(1, 0, 0); return; }
+
+		float bp[3] = { p[0] - b[0], p[1] - b[1], p[2] - b[2] };
+		float d3 = dot(ab, bp), d4 = dot(ac, bp);
+		if (d3 >= 0.0f && d4 <= d3) { set(0, 1, 0); return; }
+
+		float vc = d1 * d4 - d3 * d2;
+		if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+		{
+			float v = d1 / (d1 - d3);
+			set(1 - v, v, 0);
+			return;
+		}
+
+		float cp[3] = { p[0] - c[0], p[1] - c[1], p[2] - c[2] };
+		float d5 = dot(ab, cp), d6 = dot(ac, cp);
+		if (d6 >= 0.0f && d5 <= d6) { set(0, 0, 1); return; }
+
+		float vb = d5 * d2 - d1 * d6;
+		if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+		{
+			float w = d2 / (d2 - d6);
+			set(1 - w, 0, w);
+			return;
+		}
+
+		float va = d3 * d6 - d5 * d4;
+		if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+		{
+			float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+			set(0, 1 - w, w);
+			return;
+		}
+
+		float denom = 1.0f / (va + vb + vc);
+		float v = vb * denom, w = vc * denom;
+		set(1 - v - w, v, w);
+	}
+
+	const compactMesh* m_pMesh = nullptr;
+	std::vector<int> m_vecCellStart;	// Offset of each cell's run in m_vecCellTris, plus one past the end
+	std::vector<int> m_vecCellTris;
+	float m_fMinX = 0.0f;
+	float m_fMinZ = 0.0f;
+	float m_fCellSize = 1.0f;
+	int m_nCellsX = 0;
+	int m_nCellsZ = 0;
+	int m_nLastTrisTested = 0;
+};
@@ -0,0 +1,274 @@
+#pragma once
+
+#include "fileIO.h"
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstdlib>
+#endif
+
+// Read only view of a RIFF WAVE file. The file is memory mapped rather than read,
+// so opening a long track costs nothing up front and Decode() converts just the
+// frames asked for straight out of the mapping. Chunks are found by walking the
+// RIFF headers, so files with extra chunks before "fmt " or "data" are fine.
+//
+// Handles 8, 16, 24 and 32 bit integer PCM, and 32 bit float, at any sample rate
+// and channel count. Decoded samples are floats in -1..1, channels interleaved.
+class wavFile
+{
+public:
+	wavFile()
+	{
+
+	}
+
+	~wavFile()
+	{
+		Close();
+	}
+
+	wavFile(const wavFile&) = delete;
+	wavFile& operator=(const wavFile&) = delete;
+
+	bool Open(const std::wstring& sFile)
+	{
+		Close();
+		if (!Map(sFile))
+			return false;
+
+		if (m_nFileSize < 12 || memcmp(m_pFile, "RIFF", 4) != 0 || memcmp(m_pFile + 8, "WAVE", 4) != 0)
+		{
+			Close();
+			return false;
+		}
+
+		// Walk the chunks, each is a 4 byte id, a 4 byte size, then the data padded to even length
+		const uint8_t* pFormat = nullptr;
+		uint32_t nFormatSize = 0;
+		size_t nOffset = 12;
+		while (nOffset + 8 <= m_nFileSize)
+		{
+			const uint8_t* pChunk = m_pFile + nOffset;
+			uint32_t nChunkSize = ReadU32(pChunk + 4);
+			size_t nAvailable = m_nFileSize - nOffset - 8;
+			if (nChunkSize > nAvailable)
+				nChunkSize = (uint32_t)nAvailable; // Truncated file, use what is there
+
+			if (memcmp(pChunk, "fmt ", 4) == 0 && nChunkSize >= 16)
+			{
+				pFormat = pChunk + 8;
+				nFormatSize = nChunkSize;
+			}
+			else if (memcmp(pChunk, "data", 4) == 0)
+			{
+				m_pData = pChunk + 8;
+				m_nDataSize = nChunkSize;
+			}
+
+			nOffset += 8 + nChunkSize + (nChunkSize & 1);
+		}
+
+		if (pFormat == nullptr || m_pData == nullptr)
+		{
+			Close();
+			return false;
+		}
+
+		uint16_t nFormatTag = ReadU16(pFormat);
+		m_nChannels = ReadU16(pFormat + 2);
+		m_nSampleRate = ReadU32(pFormat + 4);
+		m_nBitsPerSample = ReadU16(pFormat + 14);
+
+		// WAVE_FORMAT_EXTENSIBLE keeps the real format tag at the start of its sub format GUID,
+		// a chunk too short to hold the whole 40 byte extension leaves the tag unsupported
+		if (nFormatTag == 0xFFFE && nFormatSize >= 40 && ReadU16(pFormat + 16) >= 22)
+			nFormatTag = ReadU16(pFormat + 24);
+
+		m_bFloat = nFormatTag == 3;
+		bool bSupported = (nFormatTag == 1 && (m_nBitsPerSample == 8 || m_nBitsPerSample == 16 || m_nBitsPerSample == 24 || m_nBitsPerSample == 32))
+			|| (m_bFloat && m_nBitsPerSample == 32);
+		if (!bSupported || m_nChannels == 0 || m_nSampleRate == 0)
+		{
+			Close();
+			return false;
+		}
+
+		m_nFrameBytes = m_nChannels * (m_nBitsPerSample / 8);
+		m_nFrames = (long)(m_nDataSize / m_nFrameBytes);
+		return true;
+	}
+
+	void Close()
+	{
+		Unmap();
+		m_pData = nullptr;
+		m_nDataSize = 0;
+		m_nFrames = 0;
+		m_nChannels = 0;
+		m_nSampleRate = 0;
+	}
+
+	bool IsOpen() { return m_pData != nullptr; }
+	int Channels() { return m_nChannels; }
+	unsigned int SampleRate() { return m_nSampleRate; }
+	int BitsPerSample() { return m_nBitsPerSample; }
+	long Frames() { return m_nFrames; }
+
+	// Converts up to nFrames frames starting at nFrame into pOut, returns how many there were
+	long Decode(long nFrame, long nFrames, float* pOut)
+	{
+		if (nFrame < 0 || nFrame >= m_nFrames)
+			return 0;
+		if (nFrames > m_nFrames - nFrame)
+			nFrames = m_nFrames - nFrame;
+
+		const uint8_t* p = m_pData + (size_t)nFrame * m_nFrameBytes;
+		long nSamples = nFrames * m_nChannels;
+		switch (m_nBitsPerSample)
+		{
+		case 8:
+			for (long i = 0; i < nSamples; i++)
+				pOut[i] = ((float)p[i] - 128.0f) * (1.0f / 128.0f);
+			break;
+
+		case 16:
+			for (long i = 0; i < nSamples; i++)
+				pOut[i] = (float)(int16_t)ReadU16(p + i * 2) * (1.0f / 32768.0f);
+			break;
+
+		case 24:
+			for (long i = 0; i < nSamples; i++)
+			{
+				const uint8_t* s = p + i * 3;
+				int32_t n = (int32_t)(((uint32_t)s[0] << 8) | ((uint32_t)s[1] << 16) | ((uint32_t)s[2] << 24)) >> 8;
+				pOut[i] = (float)n * (1.0f / 8388608.0f);
+			}
+			break;
+
+		case 32:
+			if (m_bFloat)
+				memcpy(pOut, p, sizeof(float) * nSamples);
+			else
+				for (long i = 0; i < nSamples; i++)
+					pOut[i] = (float)(int32_t)ReadU32(p + i * 4) * (1.0f / 2147483648.0f);
+			break;
+		}
+		return nFrames;
+	}
+
+private:
+	// WAVE files are little endian, and so is everything this engine runs on
+	static uint16_t ReadU16(const uint8_t* p) { uint16_t n; memcpy(&n, p, 2); return n; }
+	static uint32_t ReadU32(const uint8_t* p) { uint32_t n; memcpy(&n, p, 4); return n; }
+
+#if defined(_WIN32)
+	bool Map(const std::wstring& sFile)
+	{
+		m_hFile = CreateFileW(sFile.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (m_hFile == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER nSize;
+		if (!GetFileSizeEx(m_hFile, &nSize) || nSize.QuadPart == 0)
+		{
+			Unmap();
+			return false;
+		}
+		m_nFileSize = (size_t)nSize.QuadPart;
+
+		m_hMapping = CreateFileMappingW(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (m_hMapping == NULL)
+		{
+			Unmap();
+			return false;
+		}
+
+		m_pFile = (const uint8_t*)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+		if (m_pFile == nullptr)
+		{
+			Unmap();
+			return false;
+		}
+		return true;
+	}
+
+	void Unmap()
+	{
+		if (m_pFile != nullptr)
+			UnmapViewOfFile(m_pFile);
+		if (m_hMapping != NULL)
+			CloseHandle(m_hMapping);
+		if (m_hFile != INVALID_HANDLE_VALUE)
+			CloseHandle(m_hFile);
+		m_pFile = nullptr;
+		m_hMapping = NULL;
+		m_hFile = INVALID_HANDLE_VALUE;
+		m_nFileSize = 0;
+	}
+
+	HANDLE m_hFile = INVALID_HANDLE_VALUE;
+	HANDLE m_hMapping = NULL;
+#else
+	bool Map(const std::wstring& sFile)
+	{
+		std::string sPath;
+		if (!fileIO::NarrowPath(sFile, sPath))
+			return false;
+
+		m_nFd = open(sPath.c_str(), O_RDONLY);
+		if (m_nFd < 0)
+			return false;
+
+		struct stat st;
+		if (fstat(m_nFd, &st) != 0 || st.st_size == 0)
+		{
+			Unmap();
+			return false;
+		}
+		m_nFileSize = (size_t)st.st_size;
+
+		void* p = mmap(nullptr, m_nFileSize, PROT_READ, MAP_PRIVATE, m_nFd, 0);
+		if (p == MAP_FAILED)
+		{
+			Unmap();
+			return false;
+		}
+		m_pFile = (const uint8_t*)p;
+		return true;
+	}
+
+	void Unmap()
+	{
+		if (m_pFile != nullptr)
+			munmap((void*)m_pFile, m_nFileSize);
+		if (m_nFd >= 0)
+			close(m_nFd);
+		m_pFile = nullptr;
+		m_nFd = -1;
+		m_nFileSize = 0;
+	}
+
+	int m_nFd = -1;
+#endif
+
+	const uint8_t* m_pFile = nullptr;
+	size_t m_nFileSize = 0;
+
+	const uint8_t* m_pData = nullptr;
+	size_t m_nDataSize = 0;
+	size_t m_nFrameBytes = 0;
+	long m_nFrames = 0;
+	int m_nChannels = 0;
+	unsigned int m_nSampleRate = 0;
+	int m_nBitsPerSample = 0;
+	bool m_bFloat = false;
+};
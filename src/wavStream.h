@@ -0,0 +1,53 @@
+#pragma once
+
+#include "wavFile.h"
+#include "audioResampler.h"
+#include "audioMixer.h"
+
+// A .wav file played straight from its memory mapping, decoded and converted to
+// the output sample rate a block at a time on the audio thread. Only the decode
+// chunk and the resampler's window are ever in memory, however long the track.
+class wavStream : public audioStreamSource
+{
+public:
+	wavStream()
+	{
+
+	}
+
+	bool Open(const std::wstring& sFile, unsigned int nOutputRate)
+	{
+		if (!m_file.Open(sFile))
+			return false;
+
+		m_resampler.Setup(m_file.SampleRate(), nOutputRate, m_file.Channels());
+		m_nCursor = 0;
+		return true;
+	}
+
+	int Channels() override
+	{
+		return m_file.Channels();
+	}
+
+	void Rewind() override
+	{
+		m_nCursor = 0;
+		m_resampler.Reset();
+	}
+
+	int Read(float* pFrames, int nFrames) override
+	{
+		return m_resampler.Process(pFrames, nFrames, [&](float* pDecoded, int nWanted)
+			{
+				long n = m_file.Decode(m_nCursor, nWanted, pDecoded);
+				m_nCursor += n;
+				return (int)n;
+			});
+	}
+
+private:
+	wavFile m_file;
+	audioResampler m_resampler;
+	long m_nCursor = 0;	// Next frame of the file to decode
+};